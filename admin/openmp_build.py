@@ -0,0 +1,77 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+The OpenMP build support shared by the setup.py files of the UM library
+extensions (um_packing, um_sstpert, um_wafccb and um_spiral_search).
+
+"""
+import os
+import shutil
+import tempfile
+from setuptools.command.build_ext import build_ext
+from setuptools.errors import CompileError, LinkError
+
+
+def openmp_flags(compiler):
+    """
+    Return the compile and link arguments which enable OpenMP for the given
+    compiler, or empty lists if it doesn't support OpenMP (the extension is
+    then built without it).  Setting the environment variable MULE_OPENMP
+    to "0" always builds without OpenMP.
+    """
+    if os.environ.get("MULE_OPENMP", "1") == "0":
+        return [], []
+    if compiler.compiler_type == "msvc":
+        return ["/openmp"], []
+    # Other compilers (e.g. Apple's clang) may not accept the usual flag,
+    # so check that a small program can be built with it
+    flags = ["-fopenmp"]
+    tempdir = tempfile.mkdtemp()
+    try:
+        source = os.path.join(tempdir, "openmp_test.c")
+        with open(source, "w") as test_file:
+            test_file.write("#include <omp.h>\n"
+                            "int main(void) {return omp_get_max_threads();}\n")
+        objects = compiler.compile([source], output_dir=tempdir,
+                                   extra_postargs=flags)
+        compiler.link_executable(objects,
+                                 os.path.join(tempdir, "openmp_test"),
+                                 extra_postargs=flags)
+    except (CompileError, LinkError):
+        print("OpenMP is not supported by the compiler; building without it")
+        return [], []
+    finally:
+        shutil.rmtree(tempdir)
+    return flags, flags
+
+
+class BuildExtCommand(build_ext):
+    """
+    Custom build_ext which enables OpenMP where the compiler supports it
+    """
+
+    def build_extensions(self):
+        compile_args, link_args = openmp_flags(self.compiler)
+        for extension in self.extensions:
+            extension.extra_compile_args = (
+                list(extension.extra_compile_args or []) + compile_args)
+            extension.extra_link_args = (
+                list(extension.extra_link_args or []) + link_args)
+        build_ext.build_extensions(self)
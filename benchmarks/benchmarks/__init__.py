@@ -0,0 +1,24 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Performance benchmarks for Mule and its extension modules, in the format
+used by airspeed velocity (asv).
+
+"""
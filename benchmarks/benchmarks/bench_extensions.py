@@ -0,0 +1,110 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Benchmarks for the optional extension modules (um_spiral_search and
+um_wafccb).
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import inspect
+import numpy as np
+
+from . import generate
+
+
+class SpiralSearch(object):
+    """
+    Resolving the coastal points of a land field which are land in a fine
+    mask but not in a coarser one (as when reconfiguring an ancillary).
+
+    """
+    params = (generate.resolutions(), ["spiral", "tree"])
+    param_names = ["resolution", "method"]
+    number = 1
+    timeout = 1200
+
+    def setup(self, resolution, method):
+        module = generate.require_module("um_spiral_search")
+        self.spiral_search = module.spiral_search
+        self.kwargs = {}
+        if method == "tree":
+            try:
+                arguments = inspect.signature(self.spiral_search)
+                supported = "use_tree" in arguments.parameters
+            except ValueError:
+                # Older versions of the extension give no signature
+                supported = "use_tree" in (self.spiral_search.__doc__ or "")
+            if not supported:
+                raise NotImplementedError("spiral_search has no use_tree")
+            self.kwargs["use_tree"] = True
+
+        self.lats, self.lons = generate.coordinates(resolution)
+        self.lsm = generate.land_sea_mask(resolution).ravel()
+        resolved = generate.land_sea_mask(resolution, threshold=0.5).ravel()
+        self.unres_mask = ~resolved
+        self.index_unres = np.where(self.lsm & self.unres_mask)[0]
+
+    def time_spiral_search(self, resolution, method):
+        self.spiral_search(
+            self.lsm, self.index_unres, self.unres_mask, self.lats,
+            self.lons, generate.PLANET_RADIUS, True, True, False,
+            200000.0, 3, **self.kwargs)
+
+    def track_unresolved_points(self, resolution, method):
+        return len(self.index_unres)
+    track_unresolved_points.unit = "points"
+
+
+class WAFCCB(object):
+    """Calculating the WAFC CB diagnostics for a full set of levels."""
+    params = generate.resolutions()
+    param_names = ["resolution"]
+    number = 1
+    timeout = 1200
+    RMDI = -1073741824.0
+
+    def setup(self, resolution):
+        module = generate.require_module("um_wafccb")
+        self.wafccb = module.wafccb
+        if "level_major" not in (self.wafccb.__doc__ or ""):
+            raise NotImplementedError("wafccb has no level_major layout")
+
+        rows, cols = generate.GRIDS[resolution]
+        levels = generate.num_levels()
+        base = generate.field_data(resolution)
+        anomaly = (base - base.mean())/base.std()
+
+        # Convective precipitation where the anomaly is large, with cloud
+        # fractions peaking in the mid troposphere beneath it
+        self.cpnrt = np.where(anomaly > 1.0, 1.0e-3*anomaly, 0.0)
+        profile = np.sin(np.linspace(0.0, np.pi, levels))
+        cloud = np.clip(0.5 + 0.5*anomaly, 0.0, 1.0)
+        self.blkcld = profile[:, None, None]*cloud[None, :, :]
+        self.concld = 0.5*self.blkcld
+        heights = np.linspace(20.0, 40000.0, levels)
+        pressures = 100000.0*np.exp(-heights/7000.0)
+        self.ptheta = np.repeat(
+            pressures, rows*cols).reshape(levels, rows, cols)
+
+    def time_wafccb(self, resolution):
+        self.wafccb(self.cpnrt, self.blkcld, self.concld, self.ptheta,
+                    self.RMDI, False, level_major=True)
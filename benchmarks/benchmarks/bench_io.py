@@ -0,0 +1,132 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Benchmarks for reading and writing UM files and pp files.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import os
+import inspect
+
+import mule
+import mule.pp
+
+from . import generate
+
+_PACKINGS = {"unpacked": 0, "wgdos": 1}
+
+
+def _packing_setup(packing):
+    # Return the lbpack for the named packing, skipping if it can't be used
+    if packing == "wgdos":
+        generate.require_wgdos()
+    return _PACKINGS[packing]
+
+
+class FromFile(object):
+    """Opening a FieldsFile and reading its data."""
+    params = (generate.resolutions(), ["eager", "lazy", "index"])
+    param_names = ["resolution", "mode"]
+    number = 1
+    timeout = 1200
+
+    def setup(self, resolution, mode):
+        generate.require_wgdos()
+        self.path = generate.fieldsfile_path(resolution)
+        self.kwargs = {"stashmaster": generate.empty_stashmaster()}
+        if mode != "eager":
+            arguments = inspect.signature(mule.FieldsFile.from_file)
+            if mode not in arguments.parameters:
+                msg = "from_file has no {0} argument"
+                raise NotImplementedError(msg.format(mode))
+            self.kwargs[mode] = True
+        if mode == "index":
+            # Make sure the index has been written before timing
+            mule.FieldsFile.from_file(self.path, **self.kwargs)
+
+    def time_open(self, resolution, mode):
+        mule.FieldsFile.from_file(self.path, **self.kwargs)
+
+    def time_read_one_field(self, resolution, mode):
+        ff = mule.FieldsFile.from_file(self.path, **self.kwargs)
+        ff.fields[len(ff.fields)//2].get_data()
+
+    def time_read_all_fields(self, resolution, mode):
+        ff = mule.FieldsFile.from_file(self.path, **self.kwargs)
+        for field in ff.fields:
+            field.get_data()
+
+    def peakmem_read_all_fields(self, resolution, mode):
+        self.time_read_all_fields(resolution, mode)
+
+
+class ToFile(object):
+    """Writing a FieldsFile (including packing its data)."""
+    params = (generate.resolutions(), list(_PACKINGS))
+    param_names = ["resolution", "packing"]
+    number = 1
+    timeout = 1200
+
+    def setup(self, resolution, packing):
+        lbpack = _packing_setup(packing)
+        self.ff = generate.new_fieldsfile(resolution, lbpack=lbpack)
+        self.path = "output_{0}_{1}.ff".format(resolution, packing)
+
+    def teardown(self, resolution, packing):
+        if os.path.exists(self.path):
+            os.remove(self.path)
+
+    def time_to_file(self, resolution, packing):
+        self.ff.to_file(self.path)
+
+    def track_file_size(self, resolution, packing):
+        self.ff.to_file(self.path)
+        return os.path.getsize(self.path)/2.0**20
+    track_file_size.unit = "MiB"
+
+
+class PP(object):
+    """Reading and writing pp files."""
+    params = (generate.resolutions(), list(_PACKINGS))
+    param_names = ["resolution", "packing"]
+    number = 1
+    timeout = 1200
+
+    def setup(self, resolution, packing):
+        lbpack = _packing_setup(packing)
+        self.path = generate.pp_path(resolution, lbpack)
+        self.output_path = "output_{0}_{1}.pp".format(resolution, packing)
+        self.fields = mule.pp.fields_from_pp_file(self.path)
+
+    def teardown(self, resolution, packing):
+        if os.path.exists(self.output_path):
+            os.remove(self.output_path)
+
+    def time_read_headers(self, resolution, packing):
+        mule.pp.fields_from_pp_file(self.path)
+
+    def time_read_all_fields(self, resolution, packing):
+        for field in mule.pp.fields_from_pp_file(self.path):
+            field.get_data()
+
+    def time_write(self, resolution, packing):
+        mule.pp.fields_to_pp_file(self.output_path, self.fields)
@@ -0,0 +1,137 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Benchmarks for the packing and unpacking of field data (see
+:mod:`mule.packing`).
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import mule
+import mule.packing
+
+from . import generate
+
+
+class WGDOS(object):
+    """Packing and unpacking a single WGDOS packed field."""
+    params = generate.resolutions()
+    param_names = ["resolution"]
+    timeout = 600
+
+    def setup(self, resolution):
+        generate.require_wgdos()
+        self.rows, self.cols = generate.GRIDS[resolution]
+        self.data = generate.field_data(resolution)
+        self.packed = mule.packing.wgdos_pack_field(
+            self.data, mule._REAL_MDI, generate.ACCURACY)
+
+    def time_pack(self, resolution):
+        mule.packing.wgdos_pack_field(
+            self.data, mule._REAL_MDI, generate.ACCURACY)
+
+    def time_unpack(self, resolution):
+        mule.packing.wgdos_unpack_field(
+            self.packed, mule._REAL_MDI, self.rows, self.cols)
+
+    def time_unpack_rows(self, resolution):
+        # A band of a tenth of the rows, as needed by a cutout
+        start = self.rows//2
+        mule.packing.wgdos_unpack_field(
+            self.packed, mule._REAL_MDI, self.rows, self.cols,
+            row_range=(start, start + max(1, self.rows//10)))
+
+    def track_packed_ratio(self, resolution):
+        return len(self.packed)/float(self.data.nbytes)
+    track_packed_ratio.unit = "ratio"
+
+
+class WGDOSLevels(object):
+    """Packing all of the levels of a variable together."""
+    params = generate.resolutions()
+    param_names = ["resolution"]
+    timeout = 600
+
+    def setup(self, resolution):
+        generate.require_wgdos()
+        if not hasattr(mule.packing, "wgdos_pack_fields"):
+            raise NotImplementedError("wgdos_pack_fields is not available")
+        data = generate.field_data(resolution)
+        levels = generate.num_levels()
+        self.data = [data]*levels
+        self.mdis = [mule._REAL_MDI]*levels
+        self.accs = [generate.ACCURACY]*levels
+
+    def time_pack_fields(self, resolution):
+        mule.packing.wgdos_pack_fields(self.data, self.mdis, self.accs)
+
+
+class LandSea(object):
+    """Expanding and compressing land packed fields."""
+    params = generate.resolutions()
+    param_names = ["resolution"]
+
+    def setup(self, resolution):
+        if not hasattr(mule.packing, "landsea_expand"):
+            raise NotImplementedError("landsea_expand is not available")
+        self.mask = generate.land_sea_mask(resolution)
+        self.data = generate.field_data(resolution)
+        self.packed = self.data[self.mask]
+
+    def time_expand(self, resolution):
+        mule.packing.landsea_expand(self.packed, self.mask, mule._REAL_MDI)
+
+    def time_compress(self, resolution):
+        mule.packing.landsea_compress(self.data, self.mask)
+
+
+class Cray32(object):
+    """Reading and writing 32-bit (lbpack=2) field data."""
+    params = generate.resolutions()
+    param_names = ["resolution"]
+
+    def setup(self, resolution):
+        if not hasattr(mule.packing, "cray32_pack"):
+            raise NotImplementedError("cray32_pack is not available")
+        self.data = generate.field_data(resolution)
+        self.packed = mule.packing.cray32_pack(self.data)
+
+    def time_pack(self, resolution):
+        mule.packing.cray32_pack(self.data)
+
+    def time_unpack(self, resolution):
+        mule.packing.cray32_unpack(self.packed, self.data.size)
+
+
+class Compare(object):
+    """Comparing the data of two fields (as done by cumf)."""
+    params = generate.resolutions()
+    param_names = ["resolution"]
+
+    def setup(self, resolution):
+        if not hasattr(mule.packing, "compare_arrays"):
+            raise NotImplementedError("compare_arrays is not available")
+        self.data_1 = generate.field_data(resolution)
+        self.data_2 = self.data_1.copy()
+        self.data_2[-1, -1] += 1.0
+
+    def time_compare(self, resolution):
+        mule.packing.compare_arrays(self.data_1, self.data_2)
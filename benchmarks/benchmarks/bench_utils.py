@@ -0,0 +1,54 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Benchmarks for the UM utilities (see :mod:`um_utils`).
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import mule
+
+from . import generate
+
+
+class Cumf(object):
+    """Comparing two FieldsFiles with cumf."""
+    params = generate.resolutions()
+    param_names = ["resolution"]
+    number = 1
+    timeout = 1200
+
+    def setup(self, resolution):
+        generate.require_wgdos()
+        from um_utils import cumf
+        self.cumf = cumf
+        stashmaster = generate.empty_stashmaster()
+        self.ff_1 = mule.FieldsFile.from_file(
+            generate.fieldsfile_path(resolution), stashmaster=stashmaster)
+        self.ff_2 = mule.FieldsFile.from_file(
+            generate.perturbed_fieldsfile_path(resolution),
+            stashmaster=stashmaster)
+
+    def time_identical(self, resolution):
+        self.cumf.UMFileComparison(self.ff_1, self.ff_1)
+
+    def time_different(self, resolution):
+        self.cumf.UMFileComparison(self.ff_1, self.ff_2)
@@ -0,0 +1,323 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Generators for the synthetic reference dataset used by the benchmarks.
+
+Everything here is deterministic; the same resolution and number of levels
+always give the same data, so results from different versions of Mule can
+be compared directly.  The files are written into a data directory (see
+:func:`data_dir`) the first time they are needed and then re-used, so a
+directory which is kept between runs means every version is timed against
+exactly the same bytes.
+
+The resolutions and number of levels can be chosen with the environment
+variables:
+
+* MULE_BENCH_RESOLUTIONS:
+    A comma separated list of the names in :data:`GRIDS`
+    (default "N96,N320").
+* MULE_BENCH_LEVELS:
+    The number of model levels (default 70).
+* MULE_BENCH_DATA:
+    The directory the reference files are kept in (default a
+    "mule_benchmarks" directory in the system's temporary directory).
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import os
+import tempfile
+import numpy as np
+
+import mule
+import mule.pp
+import mule.packing
+from mule.stashmaster import STASHmaster
+
+GRIDS = {
+    "N96": (144, 192),
+    "N320": (480, 640),
+    "N1280": (1920, 2560),
+    "N2560": (3840, 5120),
+    }
+"""The (rows, columns) of the global ENDGame grid at each resolution."""
+
+STASH_CODES = (16004, 10)
+"""The STASH codes of the fields written for each level of the files."""
+
+ACCURACY = -10
+"""The WGDOS packing accuracy (as a power of 2) used for packed fields."""
+
+PLANET_RADIUS = 6371229.0
+
+
+def resolutions():
+    """Return the names of the resolutions to be benchmarked."""
+    names = os.environ.get("MULE_BENCH_RESOLUTIONS", "N96,N320")
+    names = [name.strip() for name in names.split(",") if name.strip()]
+    for name in names:
+        if name not in GRIDS:
+            msg = "Unknown benchmark resolution {0}; choose from {1}"
+            raise ValueError(msg.format(name, ", ".join(sorted(GRIDS))))
+    return names
+
+
+def num_levels():
+    """Return the number of model levels to be benchmarked."""
+    return int(os.environ.get("MULE_BENCH_LEVELS", 70))
+
+
+def data_dir():
+    """Return the directory the reference files are kept in."""
+    path = os.environ.get(
+        "MULE_BENCH_DATA",
+        os.path.join(tempfile.gettempdir(), "mule_benchmarks"))
+    if not os.path.isdir(path):
+        os.makedirs(path)
+    return path
+
+
+def empty_stashmaster():
+    """
+    Return an empty STASHmaster, so that opening a file doesn't search for
+    (or warn about) the UM's STASHmaster and only the file itself is timed.
+
+    """
+    return STASHmaster()
+
+
+def coordinates(resolution):
+    """
+    Return the latitudes and longitudes (in degrees) of the points of the
+    grid at the given resolution.
+
+    """
+    rows, cols = GRIDS[resolution]
+    lats = -90.0 + (np.arange(rows) + 0.5)*(180.0/rows)
+    lons = (np.arange(cols) + 0.5)*(360.0/cols)
+    return lats, lons
+
+
+def field_data(resolution, seed=0):
+    """
+    Return a smooth, temperature-like field with small scale noise; this
+    packs to roughly the same size as real model data.
+
+    Args:
+        * resolution:
+            The name of the grid.
+
+    Kwargs:
+        * seed:
+            Selects one of a set of different (but similar) fields.
+
+    """
+    lats, lons = np.radians(coordinates(resolution))
+    lat, lon = np.meshgrid(lats, lons, indexing="ij")
+    data = (250.0 + 40.0*np.cos(lat) +
+            8.0*np.sin(3*lon + seed)*np.cos(2*lat) +
+            3.0*np.cos(7*lon - 2*seed)*np.sin(5*lat))
+    rng = np.random.RandomState(seed)
+    data += rng.normal(0.0, 0.2, size=data.shape)
+    return data
+
+
+def land_sea_mask(resolution, threshold=0.35):
+    """
+    Return a boolean land-sea mask (True for land) with a few "continents"
+    covering roughly a third of the globe.
+
+    Kwargs:
+        * threshold:
+            Raising this shrinks the land, which gives (for example) the mask
+            of the same coastline as resolved by a coarser model.
+
+    """
+    lats, lons = np.radians(coordinates(resolution))
+    lat, lon = np.meshgrid(lats, lons, indexing="ij")
+    pattern = (np.sin(3*lon)*np.cos(2*lat) +
+               0.4*np.sin(7*lon + lat)*np.cos(5*lat))
+    return pattern > threshold
+
+
+def new_fieldsfile(resolution, levels=None, stash_codes=STASH_CODES,
+                   lbpack=1):
+    """
+    Return a new :class:`mule.FieldsFile` on the given grid, with a field
+    for each level of each STASH code.  The fields share a data array for
+    each STASH code, so even the largest files use little memory before
+    they are written.
+
+    Kwargs:
+        * levels:
+            The number of levels (if not given, see :func:`num_levels`).
+        * stash_codes:
+            The STASH codes of the fields.
+        * lbpack:
+            The packing code of the fields (1 for WGDOS packed, 0 for
+            unpacked).
+
+    """
+    if levels is None:
+        levels = num_levels()
+    rows, cols = GRIDS[resolution]
+    col_spacing, row_spacing = 360.0/cols, 180.0/rows
+
+    ff = mule.FieldsFile()
+    ff.fixed_length_header.dataset_type = 3
+    ff.fixed_length_header.grid_staggering = 6
+
+    ff.integer_constants = mule.ff.FF_IntegerConstants.empty()
+    ff.integer_constants.num_cols = cols
+    ff.integer_constants.num_rows = rows
+    ff.integer_constants.num_p_levels = levels
+
+    ff.real_constants = mule.ff.FF_RealConstants.empty()
+    ff.real_constants.start_lon = 0.5*col_spacing
+    ff.real_constants.start_lat = -90.0 + 0.5*row_spacing
+    ff.real_constants.col_spacing = col_spacing
+    ff.real_constants.row_spacing = row_spacing
+
+    ff.level_dependent_constants = (
+        mule.ff.FF_LevelDependentConstants.empty(levels + 1))
+    ldc_range = np.arange(levels + 1)
+    for idim in range(1, ff.level_dependent_constants.shape[1] + 1):
+        ff.level_dependent_constants.raw[:, idim] = ldc_range*idim
+
+    for iseed, stash_code in enumerate(stash_codes):
+        provider = mule.ArrayDataProvider(field_data(resolution, iseed))
+        for level in range(1, levels + 1):
+            field = mule.Field3.empty()
+            field.lbrel = 3
+            field.raw[1] = 2025
+            field.lbext = 0
+            field.lbproc = 0
+            field.lbcode = 1
+            field.lblev = level
+            field.blev = float(level)
+            field.lbuser1 = 1
+            field.lbuser4 = stash_code
+            field.lbuser7 = 1
+            field.lbpack = lbpack
+            field.bacc = ACCURACY
+            field.bmdi = mule._REAL_MDI
+            field.lbnpt, field.lbrow = cols, rows
+            field.bdx, field.bdy = col_spacing, row_spacing
+            field.bzx = ff.real_constants.start_lon - field.bdx
+            field.bzy = ff.real_constants.start_lat - field.bdy
+            field.set_data_provider(provider)
+            ff.fields.append(field)
+
+    return ff
+
+
+def _write_once(path, write):
+    # Write a reference file (via a temporary file, so that a run which
+    # is interrupted never leaves a partial file behind) unless it exists
+    if not os.path.exists(path):
+        handle, temp_path = tempfile.mkstemp(
+            dir=os.path.dirname(path), prefix=os.path.basename(path))
+        os.close(handle)
+        try:
+            write(temp_path)
+            os.replace(temp_path, path)
+        except BaseException:
+            os.remove(temp_path)
+            raise
+    return path
+
+
+def fieldsfile_path(resolution, lbpack=1, levels=None):
+    """
+    Return the path to a reference FieldsFile (as given by
+    :func:`new_fieldsfile`), writing it first if it doesn't exist.
+
+    """
+    if levels is None:
+        levels = num_levels()
+    path = os.path.join(
+        data_dir(), "{0}_L{1}_lbpack{2}.ff".format(resolution, levels, lbpack))
+
+    def write(temp_path):
+        new_fieldsfile(resolution, levels, lbpack=lbpack).to_file(temp_path)
+
+    return _write_once(path, write)
+
+
+def perturbed_fieldsfile_path(resolution, levels=None):
+    """
+    Return the path to a copy of the WGDOS packed reference FieldsFile in
+    which every other field has been slightly changed, for comparisons.
+
+    """
+    if levels is None:
+        levels = num_levels()
+    path = os.path.join(
+        data_dir(), "{0}_L{1}_perturbed.ff".format(resolution, levels))
+
+    def write(temp_path):
+        ff = new_fieldsfile(resolution, levels)
+        perturbed = mule.ArrayDataProvider(field_data(resolution) + 0.5)
+        for field in ff.fields[::2]:
+            field.set_data_provider(perturbed)
+        ff.to_file(temp_path)
+
+    return _write_once(path, write)
+
+
+def pp_path(resolution, lbpack=1, levels=None):
+    """
+    Return the path to a reference pp file holding the same fields as
+    :func:`fieldsfile_path`, writing it first if it doesn't exist.
+
+    """
+    if levels is None:
+        levels = num_levels()
+    path = os.path.join(
+        data_dir(), "{0}_L{1}_lbpack{2}.pp".format(resolution, levels, lbpack))
+
+    def write(temp_path):
+        ff = new_fieldsfile(resolution, levels, lbpack=lbpack)
+        mule.pp.fields_to_pp_file(temp_path, ff.fields)
+
+    return _write_once(path, write)
+
+
+def require_wgdos():
+    """
+    Raise NotImplementedError (which asv reports as a skipped benchmark)
+    if no WGDOS packing library is available.
+
+    """
+    mule.packing.wgdos_pack_field(np.zeros((2, 2)), mule._REAL_MDI, ACCURACY)
+
+
+def require_module(name):
+    """
+    Import and return an extension module, raising NotImplementedError
+    (which asv reports as a skipped benchmark) if it isn't installed.
+
+    """
+    try:
+        return __import__(name)
+    except ImportError:
+        msg = "{0} is not installed"
+        raise NotImplementedError(msg.format(name))
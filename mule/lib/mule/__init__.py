@@ -50,12 +50,20 @@ are invalid because of unexpected or inconsistent header information.
 from __future__ import (absolute_import, division, print_function)
 
 import os
+import mmap as _mmap
+import threading
 import numpy as np
 import numpy.ma
 import weakref
 import six
+from collections import deque
+from six.moves.collections_abc import MutableSequence
 from contextlib import contextmanager
 from mule.stashmaster import STASHmaster
+from mule import index as _index
+from mule import cache as _cache
+from mule import instrument as _instrument
+from mule import packing as _packing
 
 __version__ = "2025.10.1"
 
@@ -723,11 +731,46 @@ class Field(six.with_metaclass(_HeaderMetaclass, object)):
         """Return the number of values defined by this header."""
         return len(self._values) - 1
 
-    def get_data(self):
-        """Return the data for this field as an array."""
+    def get_data(self, rows=None):
+        """
+        Return the data for this field as an array.
+
+        Kwargs:
+            * rows (slice):
+                If given, only return these rows of the data.  Some types of
+                field (unpacked, Cray32 and WGDOS packed fields read from a
+                file) can then read or decode just the requested rows, which
+                is much faster when they are a small part of the field.
+
+        .. Note::
+            If the field is read from a file which is using a
+            :class:`mule.cache.DataCache`, the array may be shared with
+            other callers and is then read-only.
+
+        """
         data = None
-        if hasattr(self._data_provider, '_data_array'):
-            data = self._data_provider._data_array()
+        provider = self._data_provider
+        if rows is not None and hasattr(provider, '_data_rows'):
+            # Decode just the requested rows, unless the data is being kept
+            # in a cache (in which case the whole field is decoded so that
+            # it can be shared with later requests)
+            cache = provider.cache
+            if cache is None:
+                cache = _cache.get_default_cache()
+            start, stop, step = rows.indices(self.lbrow)
+            if cache is None and step == 1:
+                if _instrument.enabled:
+                    return _instrument.timed(
+                        provider._decode_phase(), provider._data_rows,
+                        start, max(start, stop))
+                return provider._data_rows(start, max(start, stop))
+        if hasattr(provider, '_data_array'):
+            if isinstance(provider, RawReadProvider):
+                data = provider._cached_data_array()
+            else:
+                data = provider._data_array()
+        if rows is not None and data is not None:
+            data = data[rows]
         return data
 
     def _get_raw_payload_bytes(self):
@@ -868,6 +911,10 @@ class _OperatorDataProvider(object):
 
     def _data_array(self):
         """Return the data using the provided operator."""
+        if _instrument.enabled:
+            phase = "operator " + type(self.operator).__name__
+            return _instrument.timed(phase, self.operator.transform,
+                                     self.source, self.result_field)
         return self.operator.transform(self.source, self.result_field)
 
 
@@ -1016,6 +1063,11 @@ class DataOperator(object):
         raise NotImplementedError(msg)
 
 
+# Lock used to serialise the seek and read of data payloads from file objects,
+# so that providers sharing a file can safely be read from multiple threads
+_READ_LOCK = threading.Lock()
+
+
 class RawReadProvider(object):
     """
     A generic 'data provider' object, which deals with the most basic/common
@@ -1030,6 +1082,10 @@ class RawReadProvider(object):
     """
     DISK_RECORD_SIZE = _DEFAULT_WORD_SIZE
 
+    # The :class:`mule.cache.DataCache` to keep the decoded data in; if not
+    # set the default cache is used (if there is one)
+    cache = None
+
     def __init__(self, source, sourcefile, offset):
         """
         Initialise the read provider.
@@ -1066,13 +1122,136 @@ class RawReadProvider(object):
     def _read_bytes(self):
         # Return the raw data payload, as an array of bytes.
         # This is independent of the content type.
+        if _instrument.enabled:
+            return _instrument.timed("read", self._read_payload)
+        return self._read_payload()
+
+    def _read_payload(self):
+        # Read the raw data payload (see _read_bytes)
         field = self.source
-        with self._with_source():
-            self.sourcefile.seek(self.offset)
-            data_size = field.lbnrec * self.DISK_RECORD_SIZE
-            data_bytes = self.sourcefile.read(data_size)
+        return self._read_range(0, field.lbnrec * self.DISK_RECORD_SIZE)
+
+    def _read_part(self, start, size):
+        # Return part of the raw data payload (size bytes, from start bytes
+        # into it), as for _read_bytes
+        if _instrument.enabled:
+            return _instrument.timed("read", self._read_range, start, size)
+        return self._read_range(start, size)
+
+    def _read_range(self, start, size):
+        # Read part of the raw data payload (see _read_part)
+        if isinstance(self.sourcefile, _MappedSourceFile):
+            # A mapped source can return a view directly onto the mapping
+            # (this avoids both the read and a copy of the payload)
+            return self.sourcefile.view(self.offset + start, size)
+        with self._with_source(), _READ_LOCK:
+            self.sourcefile.seek(self.offset + start)
+            data_bytes = self.sourcefile.read(size)
         return data_bytes
 
+    def _cached_data_array(self):
+        # Return the decoded data, taking it from the cache if possible
+        cache = self.cache
+        if cache is None:
+            cache = _cache.get_default_cache()
+        if cache is None:
+            return self._decode()
+        return cache.get(self._cache_key(), self._decode)
+
+    def _decode(self):
+        # Return the decoded data, counting the work if instrumentation is
+        # enabled (see mule.instrument)
+        if _instrument.enabled:
+            return _instrument.timed(self._decode_phase(), self._data_array)
+        return self._data_array()
+
+    def _data_points(self):
+        # The number of points the decoded data will have, as given by the
+        # headers (or None if this can't be known without decoding it); for
+        # most fields this is the size of the grid
+        field = self.source
+        rows = getattr(field, "lbrow", 0)
+        cols = getattr(field, "lbnpt", 0)
+        if rows > 0 and cols > 0:
+            return rows*cols
+        return None
+
+    def _decode_phase(self):
+        # The name of the instrumentation phase for decoding this data
+        return "decode lbpack={0}".format(self.source.lbpack)
+
+    def _cache_key(self):
+        # The key identifying the decoded data in a cache; the same data may
+        # be decoded differently by different providers (or to a different
+        # data type), so these are included along with its location.  The
+        # identity of the file is included too, so that a file which has
+        # been re-written at the same path isn't given the cached data of
+        # the old version of it
+        return (os.path.abspath(self.sourcefile.name),
+                _file_identity(self.sourcefile), self.offset,
+                type(self), str(getattr(self, "unpack_dtype", None)))
+
+
+def _file_identity(source):
+    """
+    Return a tuple identifying the version of an open file (or mapping, see
+    :class:`_MappedSourceFile`); its device, inode, size and modification
+    time.  Returns None for objects which aren't open files.
+
+    """
+    stat = getattr(source, "_stat", None)
+    if stat is None:
+        try:
+            stat = os.fstat(source.fileno())
+        except (AttributeError, OSError, ValueError):
+            return None
+    return (stat.st_dev, stat.st_ino, stat.st_size, stat.st_mtime_ns)
+
+
+class _MappedSourceFile(object):
+    """
+    A read-only memory-map of a file, which can be passed to a
+    :class:`RawReadProvider` in place of an open file object.
+
+    The mapping is independent of the file object it was created from, and
+    remains valid after that file is closed.  Since the pages of the mapping
+    come from the operating system's page cache they are shared between all
+    processes mapping the same file.
+
+    """
+    def __init__(self, source):
+        """
+        Initialise the mapping.
+
+        Args:
+            * source:
+                An open file object (which must have a valid "fileno").
+
+        """
+        self.name = source.name
+        # The state of the file when it was mapped (see _file_identity)
+        self._stat = os.fstat(source.fileno())
+        self._map = _mmap.mmap(source.fileno(), 0, access=_mmap.ACCESS_READ)
+        self._view = memoryview(self._map)
+
+    @property
+    def closed(self):
+        return self._map.closed
+
+    def view(self, offset, size):
+        """
+        Return a read-only memoryview of part of the mapped file.
+
+        Args:
+            * offset:
+                Starting position of the view in the file (in bytes).
+            * size:
+                Length of the view (in bytes); this will be truncated if it
+                extends beyond the end of the file.
+
+        """
+        return self._view[offset:offset + size]
+
 
 class _NullReadProvider(RawReadProvider):
     """
@@ -1080,12 +1259,214 @@ class _NullReadProvider(RawReadProvider):
     - to be able to represent unknown-type data in a :class:`Field`.
 
     """
+    def _data_points(self):
+        # The data can't be decoded, so has no known size
+        return None
+
     def _data_array(self):
         lbpack = self.source.raw[21]
         msg = "Packing code {0} unsupported".format(lbpack)
         raise NotImplementedError(msg)
 
 
+class _LazyFieldList(MutableSequence):
+    """
+    A list of fields which keeps the raw lookup table of a file and only
+    creates each :class:`Field` object the first time it is accessed.
+
+    Apart from the delayed creation this behaves like a normal list; fields
+    may be added, replaced or removed and the rows of the lookup table which
+    the remaining fields came from are tracked so that they can still be
+    queried in bulk (see :meth:`matches`).
+
+    """
+    def __init__(self, lookup, make_field, field_classes):
+        """
+        Initialise the list.
+
+        Args:
+            * lookup:
+                2-dimensional array of the raw lookup table, with one row
+                for each field.
+            * make_field:
+                A function which, given the index of a row in the lookup
+                table, returns the :class:`Field` object for that row.
+            * field_classes:
+                The FIELD_CLASSES mapping of the file the lookup is from
+                (used to find the positions of named lookup entries).
+
+        """
+        self.lookup = lookup
+        self._make_field = make_field
+        self._field_classes = field_classes
+        self._rows = list(range(len(lookup)))
+        self._fields = [None]*len(lookup)
+        self._functions = []
+
+    def _field(self, index):
+        # Return the field, creating it (and applying any functions which
+        # are waiting for it) if this is the first time it has been accessed
+        field = self._fields[index]
+        if field is None:
+            field = self._make_field(self._rows[index])
+            for function in self._functions:
+                function(field)
+            self._fields[index] = field
+        return field
+
+    def peek(self, index):
+        """
+        Return the field at the given index, without keeping a reference to
+        it in the list if it hasn't been created yet (so that it can be
+        released as soon as the caller has finished with it).
+
+        Args:
+            * index:
+                The index of the field.
+
+        """
+        field = self._fields[index]
+        if field is None:
+            field = self._make_field(self._rows[index])
+            for function in self._functions:
+                function(field)
+        return field
+
+    def __len__(self):
+        return len(self._fields)
+
+    def __getitem__(self, index):
+        if isinstance(index, slice):
+            return [self._field(ind)
+                    for ind in range(*index.indices(len(self)))]
+        return self._field(index)
+
+    def __iter__(self):
+        for index in range(len(self)):
+            yield self._field(index)
+
+    def __setitem__(self, index, value):
+        if isinstance(index, slice):
+            value = list(value)
+            self._fields[index] = value
+            self._rows[index] = [None]*len(value)
+        else:
+            self._fields[index] = value
+            self._rows[index] = None
+
+    def __delitem__(self, index):
+        del self._fields[index]
+        del self._rows[index]
+
+    def insert(self, index, value):
+        self._fields.insert(index, value)
+        self._rows.insert(index, None)
+
+    def __repr__(self):
+        return "<{0}: fields={1}>".format(type(self).__name__, len(self))
+
+    def apply(self, function):
+        """
+        Apply a function to every field; this is done immediately for any
+        fields which already exist, and to the rest once they are created.
+
+        Args:
+            * function:
+                A function accepting a single :class:`Field` argument.
+
+        """
+        for field in self._fields:
+            if field is not None:
+                function(field)
+        self._functions.append(function)
+
+    def created(self):
+        """
+        Return a list of (index, field) pairs for the fields which have
+        been created so far.
+
+        """
+        return [(index, field) for index, field in enumerate(self._fields)
+                if field is not None]
+
+    def subset(self, indices):
+        """
+        Return a new list containing the fields at the given indices, which
+        shares the lookup table (and any fields already created) with this
+        list.
+
+        Args:
+            * indices:
+                A sequence of indices of the fields to include.
+
+        """
+        new_list = type(self)(self.lookup, self._make_field,
+                              self._field_classes)
+        new_list._rows = [self._rows[index] for index in indices]
+        new_list._fields = [self._fields[index] for index in indices]
+        new_list._functions = list(self._functions)
+        return new_list
+
+    def matches(self, name, values):
+        """
+        Return a boolean array which is True for each field whose named
+        lookup entry is one of the given values.  Fields which haven't been
+        created are checked directly in the raw lookup table, without
+        creating them.
+
+        Args:
+            * name:
+                The name of the lookup entry (e.g. "lbuser4"), or its
+                (1-based) position in the lookup.
+            * values:
+                A sequence of values to match (or a single value).
+
+        """
+        if not isinstance(values, (list, tuple, set, np.ndarray)):
+            values = [values]
+        values = list(values)
+
+        default_mapping = dict(self._field_classes[-99].HEADER_MAPPING)
+        lbrel_index = default_mapping["lbrel"] - 1
+
+        rows = np.array([-1 if row is None or field is not None else row
+                         for row, field in zip(self._rows, self._fields)],
+                        dtype=np.int64)
+        in_lookup = rows >= 0
+        rows = rows[in_lookup]
+
+        # The positions of the named entries can differ between header
+        # releases, so each release used in the lookup is checked in turn
+        found = np.zeros(len(rows), dtype=bool)
+        lbrel = self.lookup[rows, lbrel_index]
+        for release in np.unique(lbrel):
+            field_class = self._field_classes.get(release,
+                                                  self._field_classes[-99])
+            if isinstance(name, six.integer_types):
+                position = name
+            else:
+                position = dict(field_class.HEADER_MAPPING).get(name)
+            if position is None:
+                continue
+            in_release = lbrel == release
+            raw = self.lookup[rows[in_release], position - 1]
+            if position > field_class.NUM_LOOKUP_INTS:
+                raw = raw.view(field_class.DTYPE_REAL)
+            found[in_release] = np.isin(raw, values)
+
+        # Any fields which aren't (or are no longer) described by the raw
+        # lookup are checked through the field objects themselves
+        result = np.zeros(len(self), dtype=bool)
+        result[in_lookup] = found
+        for index in np.flatnonzero(~in_lookup):
+            field = self._fields[index]
+            if isinstance(name, six.integer_types):
+                result[index] = field.raw[name] in values
+            else:
+                result[index] = getattr(field, name, None) in values
+        return result
+
+
 class UMFile(object):
     """Represents the structure of a single UM file."""
 
@@ -1225,7 +1606,8 @@ class UMFile(object):
 
     @classmethod
     def from_file(cls, file_or_filepath, remove_empty_lookups=False,
-                  stashmaster=None):
+                  stashmaster=None, mmap=False, unpack_dtype=None,
+                  lazy=False, index=False, cache=None):
         """
         Initialise a UMFile, populated using the contents of a file.
 
@@ -1242,16 +1624,51 @@ class UMFile(object):
                 the details of the STASHmaster to associate with the fields
                 in the file (if not provided will attempt to load a central
                 STASHmaster based on the version in the fixed length header).
+            * mmap:
+                If set to True, the field data will be accessed through a
+                read-only memory-map of the file, rather than read in from
+                the file object each time it is needed.  Unpacked fields
+                will then return arrays which are views onto the mapping,
+                and packed fields are unpacked directly from it.
+            * unpack_dtype:
+                The data type to unpack packed fields to, for read providers
+                which support it (currently WGDOS and Cray32 packed real
+                fields, which may be unpacked to either numpy.float64 or
+                numpy.float32).  If not set the data is returned in double
+                precision.
+            * lazy:
+                If set to True, the lookup table is kept as a single array
+                and each :class:`Field` object is only created when it is
+                first accessed from the field list.  This makes opening
+                files with very many fields much faster, particularly when
+                combined with :meth:`field_indices` to find the fields of
+                interest without creating the others.
+            * index:
+                If set to True (and a file path is given), the lookup, and
+                the positions, classes and packing codes of the fields
+                derived from it, will be loaded from the file's sidecar
+                index if it has a valid one (see :mod:`mule.index`).
+                Otherwise the lookup is read from the file as usual, and an
+                index is written for next time (if possible).
+            * cache:
+                A :class:`mule.cache.DataCache` to keep the decoded data of
+                the fields in, so that fields which are accessed repeatedly
+                are only read and unpacked once.  If not set the default
+                cache is used (see :func:`mule.cache.set_default_cache`).
 
         .. Note::
             As part of this the "validate" method will be called. For the
             base :class:`UMFile` class this does nothing, but sub-classes
-            may override it to provide specific validation checks.
+            may override it to provide specific validation checks (when
+            the lookup is read lazily, only the fields which have been
+            created at the time are checked).
 
         """
         # First create the class and then populate it from the file.
         new_umf = cls()
-        new_umf._read_file(file_or_filepath)
+        new_umf._read_file(file_or_filepath, mmap=mmap,
+                           unpack_dtype=unpack_dtype, lazy=lazy, index=index,
+                           cache=cache)
 
         if remove_empty_lookups:
             new_umf.remove_empty_lookups()
@@ -1328,12 +1745,64 @@ class UMFile(object):
 
         """
         self.stashmaster = stashmaster
-        for field in self.fields:
+
+        def attach_stash(field):
             if hasattr(field, "lbuser4") and field.lbuser4 in stashmaster:
                 field.stash = stashmaster[field.lbuser4]
             else:
                 field.stash = None
 
+        self._apply_to_fields(attach_stash)
+
+    def field_indices(self, **criteria):
+        """
+        Return the indices of the fields in the field list whose lookup
+        headers match all of the given criteria.
+
+        When the lookup has been read lazily (see :meth:`from_file`) the
+        search is made directly in the raw lookup table, so none of the
+        fields need to be created to find the ones of interest.
+
+        Kwargs:
+            Each keyword should be the name of a lookup header entry (as
+            defined by Mule, e.g. "lbuser4"), and its value either a single
+            value or a sequence of values to match.
+
+        Returns:
+            A 1-dimensional array of the (0-based) indices of the
+            matching fields.
+
+        For example:
+
+        >>> indices = umf.field_indices(lbuser4=16004, lblev=[1, 2])
+        >>> fields = [umf.fields[index] for index in indices]
+
+        """
+        fields = self.fields
+        selected = np.ones(len(fields), dtype=bool)
+        for name, values in criteria.items():
+            if isinstance(fields, _LazyFieldList):
+                selected &= fields.matches(name, values)
+            else:
+                if not isinstance(values, (list, tuple, set, np.ndarray)):
+                    values = [values]
+                selected &= np.array(
+                    [getattr(field, name, None) in values
+                     for field in fields], dtype=bool)
+        return np.flatnonzero(selected)
+
+    def _apply_to_fields(self, function):
+        """
+        Apply a function to each field in the field list (when the lookup
+        has been read lazily, this happens to each field as it is created).
+
+        """
+        if isinstance(self.fields, _LazyFieldList):
+            self.fields.apply(function)
+        else:
+            for field in self.fields:
+                function(field)
+
     def copy(self, include_fields=False):
         """
         Make a copy of a UMFile object including all of its headers,
@@ -1381,10 +1850,14 @@ class UMFile(object):
         which are empty.
 
         """
-        self.fields = [field for field in self.fields
-                       if field.raw[1] != -99]
+        if isinstance(self.fields, _LazyFieldList):
+            empty = self.fields.matches(1, -99)
+            self.fields = self.fields.subset(np.flatnonzero(~empty))
+        else:
+            self.fields = [field for field in self.fields
+                           if field.raw[1] != -99]
 
-    def to_file(self, output_file_or_path):
+    def to_file(self, output_file_or_path, workers=None):
         """
         Write to an output file or path.
 
@@ -1393,6 +1866,14 @@ class UMFile(object):
                 An open file or filepath. If a path, it is opened and
                 closed again afterwards.
 
+        Kwargs:
+            * workers (int):
+                If set to more than 1, the data payloads of upcoming fields
+                (reading, applying any operators and packing) are prepared
+                by a pool of this many threads, while the fields already
+                prepared are written out in order.  The output is identical
+                to that produced without this option.
+
         .. Note::
             As part of this the "validate" method will be called. For the
             base :class:`UMFile` class this does nothing, but sub-classes
@@ -1409,12 +1890,18 @@ class UMFile(object):
 
         if isinstance(output_file_or_path, six.string_types):
             with open(output_file_or_path, 'wb') as output_file:
-                self._write_to_file(output_file)
+                self._write_to_file(output_file, workers=workers)
         else:
-            self._write_to_file(output_file_or_path)
+            self._write_to_file(output_file_or_path, workers=workers)
 
-    def _read_file(self, file_or_filepath):
+    def _read_file(self, file_or_filepath, mmap=False, unpack_dtype=None,
+                   lazy=False, index=False, cache=None):
         """Populate the class from an existing file object or file"""
+        # The sidecar index can only be used when given the path to a file
+        index_file = None
+        if index and isinstance(file_or_filepath, six.string_types):
+            index_file = file_or_filepath
+
         if isinstance(file_or_filepath, six.string_types):
             self._source_path = file_or_filepath
             # If a filename is provided, open the file and populate the
@@ -1448,109 +1935,195 @@ class UMFile(object):
             setattr(self, name, header)
 
         # Now move onto reading in the lookup headers.
+        layout = None
         lookup_start = self.fixed_length_header.lookup_start
         if lookup_start > 0:
-            source.seek((lookup_start - 1) * self.WORD_SIZE)
-
             shape = (self.fixed_length_header.lookup_dim1,
                      self.fixed_length_header.lookup_dim2)
 
-            lookup = np.fromfile(source,
-                                 dtype='>i{0}'.format(self.WORD_SIZE),
-                                 count=np.prod(shape))
-            # Catch if the file has no lookups/data to read
-            if len(lookup) > 0:
-                lookup = lookup.reshape(shape, order="F")
-            else:
-                lookup = None
+            # Try to take the lookup and the layout of the fields (see
+            # _field_layout) from the sidecar index first; the layout
+            # depends on the field classes, so is only used by the same
+            # class of file which wrote it
+            lookup = None
+            if index_file is not None:
+                arrays = _index.read_index(index_file, "um")
+                if (arrays is not None and
+                        arrays["lookup"].shape == shape and
+                        str(arrays["file_class"]) == type(self).__name__):
+                    lookup = arrays["lookup"]
+                    layout = dict((name, arrays[name])
+                                  for name in self._LAYOUT_ARRAYS)
+
+            if lookup is None:
+                if index_file is not None:
+                    stamp = _index.file_stamp(index_file)
+                source.seek((lookup_start - 1) * self.WORD_SIZE)
+                lookup = np.fromfile(source,
+                                     dtype='>i{0}'.format(self.WORD_SIZE),
+                                     count=np.prod(shape))
+                # Catch if the file has no lookups/data to read
+                if len(lookup) > 0:
+                    lookup = lookup.reshape(shape, order="F")
+                    if index_file is not None:
+                        layout = self._field_layout(lookup.T)
+                        _index.try_write_index(
+                            index_file, "um", stamp, lookup=lookup,
+                            file_class=type(self).__name__, **layout)
+                else:
+                    lookup = None
         else:
             lookup = None
 
+        # If requested, the data providers will read from a memory-map of
+        # the file instead of the file object itself
+        data_source = source
+        if mmap and lookup is not None:
+            data_source = _MappedSourceFile(source)
+
         # Read and add all the fields.
         self.fields = []
         if lookup is not None:
-            # A quick helper function to create the default field class
-            # from a part of the raw array
-            default_field_class = self.FIELD_CLASSES[-99]
-
-            def default_from_raw(values):
-                ints = values[:default_field_class.NUM_LOOKUP_INTS]
-                reals = (values[default_field_class.NUM_LOOKUP_INTS:]
-                         .view(default_field_class.DTYPE_REAL))
-                return default_field_class(ints, reals, None)
-
-            # Setup the first field, and check if it is using well-formed
-            # records (i.e. the header defines the position of the field).
-            first_field = default_from_raw(lookup.T[0])
-            is_well_formed = (first_field.lbnrec != 0 and
-                              first_field.lbegin != 0)
-            if not is_well_formed:
-                # If the file is not well formed, keep a running offset.
-                running_offset = ((self.fixed_length_header.data_start - 1) *
-                                  self.WORD_SIZE)
-
-            for raw_headers in lookup.T:
-                # Populate the default field class first - for now we only
-                # need the minimum information about the field.
-                default_field = default_from_raw(raw_headers)
-
-                # Lookup what the final class for the field should be
-                # (based on its release version).
-                field_class = self.FIELD_CLASSES.get(
-                    default_field.lbrel, self.FIELD_CLASSES[-99])
-
-                # Update the field to the correct Field subclass.
-                field = field_class(default_field._lookup_ints,
-                                    default_field._lookup_reals,
-                                    None)
-
-                # Attach an appropriate data provider (unless the field is
-                # empty - in which case it doesn't need a provider).
-                if raw_headers[0] == -99:
-                    provider = None
-                else:
-                    # Update the running offset if needed.
-                    if not is_well_formed:
-                        offset = running_offset
-                    else:
-                        offset = field.lbegin*self.WORD_SIZE
-
-                    # Now select which type of basic reading and unpacking
-                    # provider is suitable for the type of file and data,
-                    # starting by checking the number format (N4 position)
-                    num_format = (field.lbpack//1000) % 10
-                    # Check number format is valid
-                    if num_format not in (0, 2, 3):
-                        msg = 'Unsupported number format (lbpack N4): {0}'
-                        raise ValueError(msg.format(num_format))
-
-                    # With that check out of the way remove the N4 digit and
-                    # proceed with the N1 - N3 digits
-                    lbpack321 = field.lbpack - num_format*1000
-
-                    # Select an appropriate read provider for this packing
-                    # code if one is available, otherwise use the default
-                    # provider (which cannot actually decode the data)
-                    read_provider = (
-                        self.READ_PROVIDERS.get(
-                            "{0:03d}".format(lbpack321),
-                            _NullReadProvider))
-
-                    # Create the provider, passing a reference to the field,
-                    # the file object and the start position to read the data
-                    # (Note that we pass a copy of the field, not the original
-                    # - this is because we *do not* want that reference to be
-                    # modified; since it will be needed to read the data).
-                    provider = read_provider(field.copy(), source, offset)
-
-                # Now attach the selected provider to the field object and
-                # add it to the field-list
-                field.set_data_provider(provider)
-                self.fields.append(field)
-
-                # Update the running offset if required
-                if not is_well_formed:
-                    running_offset += field.lblrec*self.WORD_SIZE
+            # Each row of the transposed lookup holds the headers of one field
+            lookup = lookup.T
+            make_field = self._field_factory(lookup, data_source,
+                                             unpack_dtype, cache, layout)
+            if lazy:
+                self.fields = _LazyFieldList(lookup, make_field,
+                                             self.FIELD_CLASSES)
+            else:
+                self.fields = [make_field(index)
+                               for index in range(len(lookup))]
+
+    # The names of the arrays returned by _field_layout
+    _LAYOUT_ARRAYS = ("offsets", "classes", "number_formats", "packings")
+
+    def _field_layout(self, lookup):
+        """
+        Return a dictionary of arrays giving the layout of the fields
+        described by the rows of the lookup: the offset of each field's data
+        in the file ("offsets"), the key of each field's class in
+        FIELD_CLASSES ("classes") and the number format (N4 digit) and the
+        rest of the packing code (N3 - N1 digits) of each field's lbpack
+        ("number_formats" and "packings").
+
+        """
+        default_field_class = self.FIELD_CLASSES[-99]
+        positions = dict(default_field_class.HEADER_MAPPING)
+
+        def column(name):
+            return lookup[:, positions[name] - 1].astype(np.int64)
+
+        # Check if the file is using well-formed records (i.e. the header
+        # defines the position of the field) using the first field.
+        is_well_formed = (lookup[0, positions["lbnrec"] - 1] != 0 and
+                          lookup[0, positions["lbegin"] - 1] != 0)
+        if is_well_formed:
+            offsets = column("lbegin")*self.WORD_SIZE
+        else:
+            # If the file is not well formed, take a running offset from
+            # the start of the data
+            lblrec = column("lblrec")
+            offsets = ((self.fixed_length_header.data_start - 1) *
+                       self.WORD_SIZE +
+                       np.concatenate(([0], np.cumsum(lblrec[:-1]))) *
+                       self.WORD_SIZE)
+
+        # The class of each field is chosen by its release version
+        lbrel = column("lbrel")
+        classes = np.where(np.isin(lbrel, list(self.FIELD_CLASSES)),
+                           lbrel, -99)
+
+        lbpack = column("lbpack")
+        number_formats = (lbpack//1000) % 10
+        return {"offsets": offsets.astype(np.int64),
+                "classes": classes,
+                "number_formats": number_formats,
+                "packings": lbpack - number_formats*1000}
+
+    def _field_factory(self, lookup, data_source, unpack_dtype=None,
+                       cache=None, layout=None):
+        """
+        Return a function which creates the :class:`Field` object (complete
+        with a suitable read provider) for a given row of the lookup.  The
+        layout of the fields is as given by :meth:`_field_layout` (which is
+        called if it isn't given).
+
+        """
+        if layout is None:
+            layout = self._field_layout(lookup)
+        offsets = layout["offsets"]
+        classes = layout["classes"]
+        number_formats = layout["number_formats"]
+        packings = layout["packings"]
+
+        # The lookup of each field is split into its integer and real parts
+        # in the same way for every class of field
+        default_field_class = self.FIELD_CLASSES[-99]
+        num_ints = default_field_class.NUM_LOOKUP_INTS
+        dtype_real = default_field_class.DTYPE_REAL
+
+        field_classes = self.FIELD_CLASSES
+        read_providers = self.READ_PROVIDERS
+
+        def make_field(index):
+            # Create the field as the class for its release version
+            raw_headers = lookup[index]
+            field_class = field_classes[int(classes[index])]
+            field = field_class(raw_headers[:num_ints],
+                                raw_headers[num_ints:].view(dtype_real),
+                                None)
+
+            # Attach an appropriate data provider (unless the field is
+            # empty - in which case it doesn't need a provider).
+            if raw_headers[0] == -99:
+                provider = None
+            else:
+                offset = int(offsets[index])
+
+                # Now select which type of basic reading and unpacking
+                # provider is suitable for the type of file and data,
+                # starting by checking the number format (N4 position)
+                num_format = int(number_formats[index])
+                # Check number format is valid
+                if num_format not in (0, 2, 3):
+                    msg = 'Unsupported number format (lbpack N4): {0}'
+                    raise ValueError(msg.format(num_format))
+
+                # With that check out of the way remove the N4 digit and
+                # proceed with the N1 - N3 digits
+                lbpack321 = int(packings[index])
+
+                # Select an appropriate read provider for this packing
+                # code if one is available, otherwise use the default
+                # provider (which cannot actually decode the data)
+                read_provider = (
+                    read_providers.get(
+                        "{0:03d}".format(lbpack321),
+                        _NullReadProvider))
+
+                # Create the provider, passing a reference to the field,
+                # the file object and the start position to read the data
+                # (Note that we pass a copy of the field, not the original
+                # - this is because we *do not* want that reference to be
+                # modified; since it will be needed to read the data).
+                provider = read_provider(field.copy(), data_source, offset)
+
+                # Pass on the requested unpacking data type to any
+                # providers which are able to use it
+                if (unpack_dtype is not None and
+                        hasattr(provider, "unpack_dtype")):
+                    provider.unpack_dtype = unpack_dtype
+
+                # Decoded data will be kept in the requested cache
+                if cache is not None:
+                    provider.cache = cache
+
+            # Now attach the selected provider to the field object
+            field.set_data_provider(provider)
+            return field
+
+        return make_field
 
     def _apply_template(self, template):
         """Apply the assignments specified in a template."""
@@ -1590,24 +2163,34 @@ class UMFile(object):
 
     def _calc_lookup_and_data_positions(self, lookup_start):
         """Sets the lookup and data positional information in the header"""
-        header = self.fixed_length_header
         if self.fields:
-            header.lookup_start = lookup_start
             lookup_lengths = set([field.num_values() for field in self.fields])
             if len(lookup_lengths) != 1:
                 msg = 'Inconsistent lookup header lengths - {0}'
                 raise ValueError(msg.format(lookup_lengths))
             lookup_length = lookup_lengths.pop()
             n_fields = len(self.fields)
-            header.lookup_dim1 = lookup_length
-            header.lookup_dim2 = n_fields
+            self._set_lookup_and_data_positions(lookup_start, lookup_length,
+                                                n_fields)
+
+    def _set_lookup_and_data_positions(self, lookup_start, lookup_length,
+                                       n_fields):
+        """
+        Sets the lookup and data positional information in the header, for
+        a lookup of the given size.
 
-            # make space for the lookup
-            word_number = lookup_start + lookup_length * n_fields
-            # Round up to the nearest whole number of "sectors".
-            offset = word_number - 1
-            offset -= offset % -self._DATA_START_ALIGNMENT
-            header.data_start = offset + 1
+        """
+        header = self.fixed_length_header
+        header.lookup_start = lookup_start
+        header.lookup_dim1 = lookup_length
+        header.lookup_dim2 = n_fields
+
+        # make space for the lookup
+        word_number = lookup_start + lookup_length * n_fields
+        # Round up to the nearest whole number of "sectors".
+        offset = word_number - 1
+        offset -= offset % -self._DATA_START_ALIGNMENT
+        header.data_start = offset + 1
 
     def _write_singular_headers(self, output_file):
         """
@@ -1654,7 +2237,88 @@ class UMFile(object):
             if component:
                 component.to_file(output_file)
 
-    def _write_to_file(self, output_file):
+    def _field_payload(self, field):
+        """
+        Return the bytes to be written for a field's data payload, along with
+        the values its "lblrec" and "lbnrec" headers should take when written.
+
+        .. Note::
+            This does not modify the field, and may be called for different
+            fields from several threads at once.
+
+        """
+        if field._can_copy_deferred_data(
+                field.lbpack, field.bacc, self.WORD_SIZE):
+            # The original, unread file data is encoded as wanted,
+            # so extract the raw bytes and write them back out
+            # again unchanged; however first trim off any existing
+            # padding to allow the code below to re-pad the output
+            data_bytes = field._get_raw_payload_bytes()
+            data_bytes = data_bytes[
+                :field.lblrec * field._data_provider.DISK_RECORD_SIZE]
+
+            # Calculate lblrec and lbnrec based on what will be
+            # written (just in case they are wrong or have come
+            # from a pp file)
+            lblrec = (field._data_provider.DISK_RECORD_SIZE *
+                      field.lblrec // self.WORD_SIZE)
+            lbnrec = lblrec - (lblrec % -self._WORDS_PER_SECTOR)
+        else:
+
+            # Strip just the n1-n3 digits from the lbpack value
+            # since the later digits are not relevant
+            lbpack321 = "{0:03d}".format(
+                field.lbpack - ((field.lbpack//1000) % 10)*1000)
+
+            # Select an appropriate operator for writing the data
+            # (if one is available for the given packing code)
+            if lbpack321 in self.WRITE_OPERATORS:
+                write_operator = self._write_operators[lbpack321]
+            else:
+                msg = ('Cannot save data with lbpack={0} : '
+                       'packing not supported.')
+                raise ValueError(msg.format(field.lbpack))
+
+            # Use the write operator to prepare the field data for
+            # writing to disk; the bytes returned by the operator are in
+            # the exact format to be written
+            if _instrument.enabled:
+                data_bytes, data_size = _instrument.timed(
+                    "encode lbpack={0}".format(field.lbpack),
+                    write_operator.to_bytes, field)
+            else:
+                data_bytes, data_size = write_operator.to_bytes(field)
+
+            # The operator also returns the exact number of words/records
+            # taken up by the data; this is exactly what needs to go in the
+            # Field's lblrec
+            lblrec = data_size
+
+            # The other record header, lbnrec, is the number of
+            # words/records used to store the data; this may be
+            # different to the above in the case of packed data;
+            # if the packing method has a different word size.
+            # Calculate the actual on-disk word size here
+            size_on_disk = ((write_operator.WORD_SIZE*data_size) //
+                            self.WORD_SIZE)
+
+            # Padding will also be applied to ensure that the next
+            # block of data is aligned with a sector boundary
+            lbnrec = size_on_disk - (size_on_disk % -self._WORDS_PER_SECTOR)
+
+        return data_bytes, lblrec, lbnrec
+
+    def _field_payloads(self, fields, workers=None):
+        """
+        Generate the data payload (see :meth:`_field_payload`) for each of
+        the given fields, in order.  If more than one worker is requested,
+        the payloads of upcoming fields are prepared in a thread pool while
+        earlier ones are being consumed.
+
+        """
+        return _packing.pipelined_map(self._field_payload, fields, workers)
+
+    def _write_to_file(self, output_file, workers=None):
         """Write out to an open output file."""
         # A reference to the header
         flh = self.fixed_length_header
@@ -1683,88 +2347,32 @@ class UMFile(object):
             output_file.seek((flh.data_start - 1) * self.WORD_SIZE)
             sector_size = self._WORDS_PER_SECTOR * self.WORD_SIZE
 
+            # Output 'recognised' lookup types (not blank entries).
+            data_fields = [field for field in self.fields
+                           if field.lbrel != -99.0]
+
+            for field in data_fields:
+                # WGDOS packed fields can be tagged with an accuracy of
+                # -99.0; this indicates that they should not be packed,
+                # so reset the packing code here accordingly
+                if field.lbpack % 10 == 1 and int(field.bacc) == -99:
+                    field.lbpack = 10*(field.lbpack//10)
+
             # Write out all the field data payloads.
-            for field in self.fields:
-                if field.lbrel != -99.0:
-
-                    # Output 'recognised' lookup types (not blank entries).
-                    field.lbegin = output_file.tell() // self.WORD_SIZE
-
-                    # WGDOS packed fields can be tagged with an accuracy of
-                    # -99.0; this indicates that they should not be packed,
-                    # so reset the packing code here accordingly
-                    if field.lbpack % 10 == 1 and int(field.bacc) == -99:
-                        field.lbpack = 10*(field.lbpack//10)
-
-                    if field._can_copy_deferred_data(
-                            field.lbpack, field.bacc, self.WORD_SIZE):
-                        # The original, unread file data is encoded as wanted,
-                        # so extract the raw bytes and write them back out
-                        # again unchanged; however first trim off any existing
-                        # padding to allow the code below to re-pad the output
-                        data_bytes = field._get_raw_payload_bytes()
-                        data_bytes = data_bytes[
-                            :field.lblrec *
-                            field._data_provider.DISK_RECORD_SIZE]
-                        output_file.write(data_bytes)
-
-                        # Calculate lblrec and lbnrec based on what will be
-                        # written (just in case they are wrong or have come
-                        # from a pp file)
-                        field.lblrec = (
-                            field._data_provider.DISK_RECORD_SIZE *
-                            field.lblrec // self.WORD_SIZE)
-                        field.lbnrec = (
-                            field.lblrec -
-                            (field.lblrec % -self._WORDS_PER_SECTOR))
-                    else:
-
-                        # Strip just the n1-n3 digits from the lbpack value
-                        # since the later digits are not relevant
-                        lbpack321 = "{0:03d}".format(
-                            field.lbpack - ((field.lbpack//1000) % 10)*1000)
-
-                        # Select an appropriate operator for writing the data
-                        # (if one is available for the given packing code)
-                        if lbpack321 in self.WRITE_OPERATORS:
-                            write_operator = self._write_operators[lbpack321]
-                        else:
-                            msg = ('Cannot save data with lbpack={0} : '
-                                   'packing not supported.')
-                            raise ValueError(msg.format(field.lbpack))
-
-                        # Use the write operator to prepare the field data for
-                        # writing to disk
-                        data_bytes, data_size = write_operator.to_bytes(field)
-
-                        # The bytes returned by the operator are in the exact
-                        # format to be written
-                        output_file.write(data_bytes)
-
-                        # and the operator also returns the exact number of
-                        # words/records taken up by the data; this is exactly
-                        # what needs to go in the Field's lblrec
-                        field.lblrec = data_size
-
-                        # The other record header, lbnrec, is the number of
-                        # words/records used to store the data; this may be
-                        # different to the above in the case of packed data;
-                        # if the packing method has a different word size.
-                        # Calculate the actual on-disk word size here
-                        size_on_disk = ((write_operator.WORD_SIZE*data_size) //
-                                        self.WORD_SIZE)
-
-                        # Padding will also be applied to ensure that the next
-                        # block of data is aligned with a sector boundary
-                        field.lbnrec = (
-                            size_on_disk -
-                            (size_on_disk % -self._WORDS_PER_SECTOR))
-
-                    # Pad out the data section to a whole number of sectors.
-                    overrun = output_file.tell() % sector_size
-                    if overrun != 0:
-                        padding = np.zeros(sector_size - overrun, 'i1')
-                        output_file.write(padding)
+            payloads = self._field_payloads(data_fields, workers=workers)
+            for field, payload in zip(data_fields, payloads):
+                data_bytes, lblrec, lbnrec = payload
+
+                field.lbegin = output_file.tell() // self.WORD_SIZE
+                _instrument.write(output_file, data_bytes)
+                field.lblrec = lblrec
+                field.lbnrec = lbnrec
+
+                # Pad out the data section to a whole number of sectors.
+                overrun = output_file.tell() % sector_size
+                if overrun != 0:
+                    padding = np.zeros(sector_size - overrun, 'i1')
+                    output_file.write(padding)
 
             # Update the fixed length header to reflect the extent
             # of the DATA component.
@@ -1783,6 +2391,223 @@ class UMFile(object):
         output_file.seek(0)
         self.fixed_length_header.to_file(output_file)
 
+    def _stream_to_file(self, output_file, fields, max_fields, workers=None):
+        """
+        Write out to an open output file, taking the fields from an iterable
+        rather than the field list (see :func:`stream_to_file`).
+
+        """
+        # A reference to the header
+        flh = self.fixed_length_header
+
+        # Write out the singular headers, the same as for a normal write,
+        # but reserve space in the lookup for the maximum number of fields
+        # since it isn't known how many there will be
+        output_file.seek(flh._NUM_WORDS * self.WORD_SIZE)
+        self._write_singular_headers(output_file)
+        single_headers_end = output_file.tell() // self.WORD_SIZE
+        empty_field = self.FIELD_CLASSES[-99].empty()
+        lookup_length = empty_field.num_values()
+        self._set_lookup_and_data_positions(single_headers_end + 1,
+                                            lookup_length, max_fields)
+
+        # Only the raw lookup of each field is kept once its data has been
+        # written; the rest of the lookup remains as empty entries
+        lookup = np.empty((max_fields, lookup_length), dtype=">i8")
+        lookup[:, :empty_field.NUM_LOOKUP_INTS] = empty_field._lookup_ints
+        lookup[:, empty_field.NUM_LOOKUP_INTS:] = (
+            np.asarray(empty_field._lookup_reals, dtype=">f8").view(">i8"))
+
+        in_flight = deque()
+
+        def data_fields(fields):
+            # Select the 'recognised' lookup types (not blank entries), and
+            # keep track of them until their payloads have been written
+            for field in fields:
+                if field.lbrel == -99.0:
+                    continue
+                if field.num_values() != lookup_length:
+                    msg = 'Inconsistent lookup header lengths - {0}'
+                    raise ValueError(msg.format(
+                        set([field.num_values(), lookup_length])))
+                # WGDOS packed fields can be tagged with an accuracy of
+                # -99.0; this indicates that they should not be packed,
+                # so reset the packing code here accordingly
+                if field.lbpack % 10 == 1 and int(field.bacc) == -99:
+                    field.lbpack = 10*(field.lbpack//10)
+                in_flight.append(field)
+                yield field
+
+        output_file.seek((flh.data_start - 1) * self.WORD_SIZE)
+        sector_size = self._WORDS_PER_SECTOR * self.WORD_SIZE
+
+        n_fields = 0
+        payloads = self._field_payloads(data_fields(fields), workers=workers)
+        for data_bytes, lblrec, lbnrec in payloads:
+            field = in_flight.popleft()
+            if n_fields == max_fields:
+                msg = 'Too many fields to write; at most {0} were expected'
+                raise ValueError(msg.format(max_fields))
+
+            field.lbegin = output_file.tell() // self.WORD_SIZE
+            _instrument.write(output_file, data_bytes)
+            field.lblrec = lblrec
+            field.lbnrec = lbnrec
+
+            # Pad out the data section to a whole number of sectors.
+            overrun = output_file.tell() % sector_size
+            if overrun != 0:
+                padding = np.zeros(sector_size - overrun, 'i1')
+                output_file.write(padding)
+
+            lookup[n_fields, :field.NUM_LOOKUP_INTS] = field._lookup_ints
+            lookup[n_fields, field.NUM_LOOKUP_INTS:] = (
+                np.asarray(field._lookup_reals, dtype=">f8").view(">i8"))
+            n_fields += 1
+
+        # Update the fixed length header to reflect the extent
+        # of the DATA component.
+        flh.data_dim1 = ((output_file.tell() // self.WORD_SIZE) -
+                         flh.data_start + 1)
+
+        # Go back and write the LOOKUP component, then the fixed length
+        # header now that we know how big the DATA component was.
+        output_file.seek((flh.lookup_start - 1) * self.WORD_SIZE)
+        output_file.write(lookup)
+        output_file.seek(0)
+        self.fixed_length_header.to_file(output_file)
+        return n_fields
+
+
+def stats():
+    """
+    Return the work counted by Mule's optional instrumentation; see
+    :mod:`mule.instrument` for details (including how to turn it on).
+
+    Returns:
+        A dictionary with an entry for each phase of the work (such as
+        "read" or "decode lbpack=1"), which is a dictionary giving the
+        "calls", "seconds" and "bytes" of the work.
+
+    """
+    return _instrument.stats()
+
+
+def iter_fields(umfile_or_path, filter=None, **kwargs):
+    """
+    Iterate over the (non-empty) fields of a UM file.
+
+    Unlike the field list of a :class:`UMFile`, the fields are created
+    one at a time as the iteration proceeds, and no reference to them is
+    kept; so when combined with :func:`stream_to_file` a file can be read,
+    transformed and written while only a few fields are held in memory.
+
+    Args:
+        * umfile_or_path:
+            Either a :class:`UMFile` object, or the path to a UM file
+            (which will be loaded with its lookup read lazily).
+
+    Kwargs:
+        * filter:
+            Either a dictionary of lookup header names and values to match,
+            in which case only the fields matching all of them are returned
+            (see :meth:`UMFile.field_indices`), or a function accepting a
+            :class:`Field` and returning True for the fields to be returned.
+
+    Other Kwargs:
+        Any other keywords are passed to :func:`load_umfile` when given
+        a path.
+
+    For example:
+
+    >>> umf = mule.FieldsFile.from_file(path, lazy=True)
+    >>> fields = mule.iter_fields(umf, filter={"lbuser4": [2, 3]})
+    >>> mule.stream_to_file((operator(field) for field in fields),
+    ...                     umf, output_path)
+
+    """
+    if isinstance(umfile_or_path, six.string_types):
+        umf = load_umfile(umfile_or_path, lazy=True, **kwargs)
+    else:
+        umf = umfile_or_path
+
+    # Use the lookup as a whole to find the fields if possible, otherwise
+    # go through them all
+    if isinstance(filter, dict):
+        indices = umf.field_indices(**filter)
+        filter = None
+    else:
+        indices = range(len(umf.fields))
+
+    fields = umf.fields
+    for index in indices:
+        if isinstance(fields, _LazyFieldList):
+            field = fields.peek(index)
+        else:
+            field = fields[index]
+        if field.raw[1] == -99:
+            continue
+        if filter is None or filter(field):
+            yield field
+
+
+def stream_to_file(fields, template, output_file_or_path, max_fields=None,
+                   workers=None):
+    """
+    Write a UM file whose fields are taken one at a time from an iterable
+    (such as :func:`iter_fields` or a generator applying operators to it),
+    so that each field can be released as soon as it has been written.
+
+    Args:
+        * fields:
+            An iterable of :class:`Field` objects to write.  Any empty
+            fields are skipped.
+        * template:
+            A :class:`UMFile` object providing the type of file and the
+            headers to be written (its own fields are ignored, and it is
+            not modified).
+        * output_file_or_path (string or file-like):
+            An open file or filepath. If a path, it is opened and
+            closed again afterwards.
+
+    Kwargs:
+        * max_fields (int):
+            The number of lookup entries to reserve in the output; any
+            which aren't used are left as empty entries.  If not given the
+            number of lookup entries in the template's header is used.
+        * workers (int):
+            If set to more than 1, the data payloads of upcoming fields are
+            prepared by a pool of this many threads (see
+            :meth:`UMFile.to_file`).
+
+    Returns:
+        The number of fields written.
+
+    .. Note::
+        Only the headers of the file (not the fields) can be validated
+        before the write, since the fields aren't known in advance.
+
+    """
+    if max_fields is None:
+        max_fields = template.fixed_length_header.lookup_dim2
+    if max_fields <= 0:
+        msg = "The number of lookup entries to reserve must be given"
+        raise ValueError(msg)
+
+    # Work on a copy of the template, so that the positional information
+    # set in its headers during the write doesn't change the original
+    umf = template.copy()
+
+    if isinstance(output_file_or_path, six.string_types):
+        umf.validate(filename=output_file_or_path)
+        with open(output_file_or_path, 'wb') as output_file:
+            return umf._stream_to_file(output_file, fields, max_fields,
+                                       workers=workers)
+    else:
+        umf.validate(filename=output_file_or_path.name)
+        return umf._stream_to_file(output_file_or_path, fields, max_fields,
+                                   workers=workers)
+
 
 # Import the derived UM File formats
 from mule.ff import FieldsFile  # noqa: E402
@@ -1802,7 +2627,8 @@ DATASET_TYPE_MAPPING = {
 }
 
 
-def load_umfile(unknown_umfile, stashmaster=None):
+def load_umfile(unknown_umfile, stashmaster=None, mmap=False,
+                unpack_dtype=None, lazy=False, index=False, cache=None):
     """
     Load a UM file of undetermined type, by checking its dataset type and
     attempting to load it as the correct class.
@@ -1818,6 +2644,21 @@ def load_umfile(unknown_umfile, stashmaster=None):
             the details of the STASHmaster to associate with the fields
             in the file (if not provided will attempt to load a central
             STASHmaster based on the version in the fixed length header).
+        * mmap:
+            If set to True, access the field data through a memory-map of
+            the file (see :meth:`UMFile.from_file`).
+        * unpack_dtype:
+            The data type to unpack packed fields to, where supported (see
+            :meth:`UMFile.from_file`).
+        * lazy:
+            If set to True, only create each field object when it is first
+            accessed (see :meth:`UMFile.from_file`).
+        * index:
+            If set to True, use (or create) the file's sidecar index
+            (see :meth:`UMFile.from_file`).
+        * cache:
+            A :class:`mule.cache.DataCache` to keep the decoded field data
+            in (see :meth:`UMFile.from_file`).
 
     """
     def _load_umfile(file_path, open_file):
@@ -1834,7 +2675,10 @@ def load_umfile(unknown_umfile, stashmaster=None):
             msg = ("Unknown dataset_type {0}, supported types are {1}"
                    .format(flh.dataset_type, str(DATASET_TYPE_MAPPING.keys())))
             raise ValueError(msg)
-        umf_new = file_class.from_file(file_path, stashmaster=stashmaster)
+        umf_new = file_class.from_file(file_path, stashmaster=stashmaster,
+                                       mmap=mmap, unpack_dtype=unpack_dtype,
+                                       lazy=lazy, index=index,
+                                       cache=cache)
         return umf_new
 
     # Handle the case of the file being either the path to a file to be opened
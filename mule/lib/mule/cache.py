@@ -0,0 +1,425 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+
+"""
+This module provides a cache for the decoded data of fields read from files.
+
+Normally the data of a field is read (and unpacked) from its file every time
+:meth:`mule.Field.get_data` is called.  A :class:`DataCache` can be attached
+to a file when it is loaded (see the "cache" argument of
+:meth:`mule.UMFile.from_file`), or set as the default for all files with
+:func:`set_default_cache`; the data of each field is then kept after it is
+first read, up to a given total size, with the least recently used fields
+being discarded first.
+
+For example:
+
+    >>> cache = mule.cache.DataCache(max_bytes=512*1024**2)
+    >>> ff = mule.FieldsFile.from_file(path, cache=cache)
+    >>> orog = ff.fields[0].get_data()  # read from the file
+    >>> orog = ff.fields[0].get_data()  # returned from the cache
+    >>> print(cache.hits, cache.misses)
+    1 1
+
+.. Note::
+    The arrays held by the cache are shared between all callers, so they
+    are made read-only; take a copy of the array if it needs to be modified.
+
+When the same fields are needed by several processes (for example to take
+many different cutouts from one global file) a :class:`SharedFieldPool` can
+be used instead.  This decodes the data of the fields once, into shared
+memory, and other processes attach to it and take views of the data:
+
+    >>> umf = mule.load_umfile(path, lazy=True)
+    >>> with mule.cache.SharedFieldPool.from_fields(
+    ...         mule.iter_fields(umf), workers=4) as pool:
+    ...     # ... pass pool.handle to the other processes, which call
+    ...     # mule.cache.set_default_cache(SharedFieldPool.attach(handle))
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import threading
+from collections import OrderedDict
+from multiprocessing import shared_memory
+import numpy as np
+from mule import packing as _packing
+
+# The cache used by any read providers which haven't been given their own
+_DEFAULT_CACHE = None
+
+
+class DataCache(object):
+    """
+    A least-recently-used cache of field data arrays, with a limit on the
+    total size of the arrays it holds.
+
+    """
+    def __init__(self, max_bytes, max_field_bytes=None):
+        """
+        Initialise the cache.
+
+        Args:
+            * max_bytes:
+                The maximum total size (in bytes) of the arrays which may be
+                held by the cache.
+
+        Kwargs:
+            * max_field_bytes:
+                The maximum size (in bytes) of a single array which will be
+                added to the cache; larger fields are read from their file
+                each time their data is needed.  If not set this is a
+                quarter of max_bytes.
+
+        """
+        if max_bytes < 0:
+            msg = "Cache size must be non-negative; got {0}"
+            raise ValueError(msg.format(max_bytes))
+        self.max_bytes = max_bytes
+        if max_field_bytes is None:
+            max_field_bytes = max_bytes // 4
+        self.max_field_bytes = min(max_field_bytes, max_bytes)
+
+        self._arrays = OrderedDict()
+        self._lock = threading.Lock()
+        self.nbytes = 0
+        self.hits = 0
+        self.misses = 0
+        self.evictions = 0
+
+    def __len__(self):
+        return len(self._arrays)
+
+    def __repr__(self):
+        fmt = ("<DataCache: {0} arrays, {1}/{2} bytes, hits={3}, misses={4}, "
+               "evictions={5}>")
+        return fmt.format(len(self), self.nbytes, self.max_bytes,
+                          self.hits, self.misses, self.evictions)
+
+    def get(self, key, load):
+        """
+        Return the array stored in the cache under a given key, or if there
+        isn't one call a function to create it (and store the result).
+
+        Args:
+            * key:
+                A hashable key identifying the array.
+            * load:
+                A function (taking no arguments) which returns the array.
+
+        """
+        with self._lock:
+            data = self._arrays.get(key)
+            if data is not None:
+                self._arrays.move_to_end(key)
+                self.hits += 1
+                return data
+            self.misses += 1
+
+        # The lock isn't held while the array is loaded, so that other
+        # threads aren't held up; if two threads load the same array at once
+        # it is simply stored twice
+        data = load()
+        if data is not None and data.nbytes <= self.max_field_bytes:
+            data.flags.writeable = False
+            with self._lock:
+                previous = self._arrays.pop(key, None)
+                if previous is not None:
+                    self.nbytes -= previous.nbytes
+                self._arrays[key] = data
+                self.nbytes += data.nbytes
+                while self.nbytes > self.max_bytes:
+                    _, evicted = self._arrays.popitem(last=False)
+                    self.nbytes -= evicted.nbytes
+                    self.evictions += 1
+        return data
+
+    def clear(self):
+        """Discard all arrays held in the cache (the counters are kept)."""
+        with self._lock:
+            self._arrays.clear()
+            self.nbytes = 0
+
+    def stats(self):
+        """
+        Return a dictionary of the cache's counters ("hits", "misses" and
+        "evictions") along with the number of arrays and bytes it holds.
+
+        """
+        with self._lock:
+            return {"hits": self.hits,
+                    "misses": self.misses,
+                    "evictions": self.evictions,
+                    "arrays": len(self._arrays),
+                    "nbytes": self.nbytes}
+
+
+class SharedFieldPool(object):
+    """
+    The decoded data of a set of fields, held in a single block of shared
+    memory which other processes can attach to.
+
+    A pool is created (and its fields decoded) once by :meth:`from_fields`;
+    its :attr:`handle` may then be passed to other processes, which attach
+    to the same memory with :meth:`attach`.  A pool provides the same
+    "get" method as a :class:`DataCache` and can be used in place of one,
+    so that fields read from the same file return read-only views of the
+    pooled data instead of reading and decoding it again.
+
+    .. Note::
+        The process which created the pool should call :meth:`unlink`
+        (or use the pool as a context manager) once all of the other
+        processes are finished with it.
+
+    """
+    # The alignment (in bytes) of each array within the shared memory
+    _ALIGN = 64
+
+    def __init__(self, shm, layout, owner=False):
+        """
+        Initialise the pool; use :meth:`from_fields` or :meth:`attach`
+        rather than calling this directly.
+
+        Args:
+            * shm:
+                The :class:`multiprocessing.shared_memory.SharedMemory`
+                holding the data.
+            * layout:
+                A dictionary mapping the cache key of each field's data to
+                its offset (in bytes), data type and shape.
+
+        Kwargs:
+            * owner:
+                Whether this pool created the shared memory.
+
+        """
+        self._shm = shm
+        self._layout = layout
+        self._owner = owner
+        self._closed = False
+        self._lock = threading.Lock()
+        self.nbytes = 0
+        for offset, dtype, shape in layout.values():
+            self.nbytes += int(np.prod(shape))*np.dtype(dtype).itemsize
+        self.hits = 0
+        self.misses = 0
+
+    @classmethod
+    def from_fields(cls, fields, workers=None):
+        """
+        Create a pool holding the decoded data of some fields.
+
+        Args:
+            * fields:
+                An iterable of :class:`mule.Field` objects.  Only fields
+                whose data is read from a file are added to the pool; any
+                others are ignored.
+
+        Kwargs:
+            * workers (int):
+                If greater than 1, the number of threads used to decode
+                the fields.
+
+        """
+        # Find the distinct fields to decode (a copied field shares its
+        # provider with the original, so would otherwise be stored twice)
+        providers = OrderedDict()
+        for field in fields:
+            provider = field._data_provider
+            if hasattr(provider, "_cache_key"):
+                providers.setdefault(provider._cache_key(), provider)
+
+        # The decoded data can't be added to the shared memory once it has
+        # been created, so allow for the largest size each field could
+        # decode to (pages of the memory which aren't used are never
+        # touched, so don't take up any space)
+        capacity = sum(_decoded_nbytes_limit(provider) + cls._ALIGN
+                       for provider in providers.values())
+        shm = shared_memory.SharedMemory(create=True, size=max(capacity, 1))
+
+        layout = {}
+        offset = 0
+        try:
+            decoded = _decoded_arrays(providers.values(), workers)
+            for key, data in zip(providers.keys(), decoded):
+                # Skip any field which decodes to more than was allowed for
+                # (it will just be read from its file as normal)
+                if data is None or offset + data.nbytes > capacity:
+                    continue
+                view = np.ndarray(data.shape, dtype=data.dtype,
+                                  buffer=shm.buf, offset=offset)
+                view[...] = data
+                del view
+                layout[key] = (offset, data.dtype.str, data.shape)
+                offset += data.nbytes - (data.nbytes % -cls._ALIGN)
+        except BaseException:
+            shm.close()
+            shm.unlink()
+            raise
+        return cls(shm, layout, owner=True)
+
+    @classmethod
+    def attach(cls, handle):
+        """
+        Attach to a pool created by another process.
+
+        Args:
+            * handle:
+                The :attr:`handle` of the pool.
+
+        """
+        name, layout = handle
+        try:
+            # Only the process which created the memory should remove it
+            shm = shared_memory.SharedMemory(name=name, track=False)
+        except TypeError:
+            # (older versions of Python don't support disabling this)
+            shm = shared_memory.SharedMemory(name=name)
+        return cls(shm, layout)
+
+    @property
+    def handle(self):
+        """
+        The information needed for another process to attach to the pool
+        (this may be pickled, and passed to :meth:`attach`).
+
+        """
+        return (self._shm.name, self._layout)
+
+    def __len__(self):
+        return len(self._layout)
+
+    def __repr__(self):
+        fmt = "<SharedFieldPool: {0} arrays, {1} bytes, hits={2}, misses={3}>"
+        return fmt.format(len(self), self.nbytes, self.hits, self.misses)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        if self._owner:
+            self.unlink()
+        try:
+            self.close()
+        except BufferError:
+            # Some arrays taken from the pool are still in use; the memory
+            # will instead be released once they have all been discarded
+            pass
+
+    def get(self, key, load):
+        """
+        Return a read-only view of the data stored in the pool under a
+        given key, or if there isn't any call a function to create it
+        (the result of which is not added to the pool).
+
+        Args:
+            * key:
+                A hashable key identifying the array.
+            * load:
+                A function (taking no arguments) which returns the array.
+
+        """
+        entry = self._layout.get(key)
+        with self._lock:
+            if entry is None or self._closed:
+                self.misses += 1
+                entry = None
+            else:
+                self.hits += 1
+        if entry is None:
+            return load()
+        offset, dtype, shape = entry
+        data = np.ndarray(shape, dtype=dtype, buffer=self._shm.buf,
+                          offset=offset)
+        data.flags.writeable = False
+        return data
+
+    def stats(self):
+        """
+        Return a dictionary of the pool's counters ("hits" and "misses")
+        along with the number of arrays and bytes it holds.
+
+        """
+        with self._lock:
+            return {"hits": self.hits,
+                    "misses": self.misses,
+                    "arrays": len(self._layout),
+                    "nbytes": self.nbytes}
+
+    def close(self):
+        """
+        Release this process's access to the pool; any arrays taken from
+        the pool must no longer be in use.
+
+        """
+        if not self._closed:
+            self._closed = True
+            self._shm.close()
+
+    def unlink(self):
+        """
+        Remove the shared memory, once all processes have closed it (this
+        should only be called by the process which created the pool).
+
+        """
+        if self._owner:
+            self._owner = False
+            self._shm.unlink()
+
+
+def _decoded_nbytes_limit(provider):
+    # The largest size the decoded data of a field could be, in bytes; no
+    # packing type decodes to more than 8 bytes per point of the field (or of
+    # the grid, for land/sea packed fields)
+    field = provider.source
+    points = max(getattr(field, "lbrow", 0)*getattr(field, "lbnpt", 0),
+                 field.lblrec)
+    lsm = getattr(provider, "_lsm_source", None)
+    if lsm is not None:
+        points = max(points, lsm.shape[0]*lsm.shape[1])
+    return 8*points
+
+
+def _decoded_arrays(providers, workers=None):
+    # Generate the decoded data of each of the given read providers, in
+    # order.  If more than one worker is requested the upcoming fields are
+    # decoded in a thread pool (see :func:`mule.packing.pipelined_map`)
+    return _packing.pipelined_map(lambda provider: provider._decode(),
+                                  providers, workers)
+
+
+def set_default_cache(cache):
+    """
+    Set the cache used by fields which weren't given one when their file was
+    loaded.
+
+    Args:
+        * cache:
+            A :class:`DataCache`, or None to disable the default cache.
+
+    """
+    global _DEFAULT_CACHE
+    _DEFAULT_CACHE = cache
+
+
+def get_default_cache():
+    """Return the default :class:`DataCache` (or None if there isn't one)."""
+    return _DEFAULT_CACHE
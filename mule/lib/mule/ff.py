@@ -26,7 +26,9 @@ from __future__ import (absolute_import, division, print_function)
 
 import mule
 import mule.validators as validators
-from mule.packing import wgdos_pack_field, wgdos_unpack_field
+from mule.packing import (wgdos_pack_field, wgdos_unpack_field,
+                          landsea_expand, landsea_compress,
+                          cray32_unpack, cray32_pack)
 import numpy as np
 
 # UM FieldsFile integer constant names
@@ -143,6 +145,38 @@ _CRAY32_SIZE = 4
 _WGDOS_SIZE = 4
 
 
+def _words_to_array(data_bytes, count, word_size, lbuser1, unpack_dtype=None):
+    """
+    Return the first count words of the data of an unpacked (or Cray32
+    packed) field as a 1-dimensional array.  64-bit words are returned as a
+    view of the data, but Cray32 words are converted to native 64-bit values
+    (or to unpack_dtype, for real fields) in a single pass.
+
+    """
+    dtype = np.dtype(_DATA_DTYPES[word_size][lbuser1])
+    if word_size != _CRAY32_SIZE:
+        return np.frombuffer(data_bytes, dtype, count=count)
+    if dtype.kind == "f":
+        native_dtype = np.float64 if unpack_dtype is None else unpack_dtype
+    else:
+        native_dtype = np.int64
+    return cray32_unpack(data_bytes, count, dtype=native_dtype)
+
+
+def _array_to_words(data, word_size, lbuser1):
+    """
+    Return the bytes of the data of an unpacked (or Cray32 packed) field,
+    along with the number of words they contain.
+
+    """
+    dtype = np.dtype(_DATA_DTYPES[word_size][lbuser1])
+    if word_size == _CRAY32_SIZE:
+        data = np.asarray(data)
+        return cray32_pack(data, integer=(dtype.kind == "i")), data.size
+    data = data.astype(dtype)
+    return data.tobytes(), data.size
+
+
 # Overidden versions of the relevant header elements for a FieldsFile
 class FF_IntegerConstants(mule.IntegerConstants):
     """The integer constants component of a UM FieldsFile."""
@@ -178,11 +212,19 @@ class FF_ColumnDependentConstants(mule.ColumnDependentConstants):
 class _ReadFFProviderUnpacked(mule.RawReadProvider):
     """A :class:`mule.RawReadProvider` which reads an unpacked field."""
     WORD_SIZE = mule._DEFAULT_WORD_SIZE
+    # Only used by the Cray32 subclass (see below)
+    unpack_dtype = None
+
+    def _data_points(self):
+        # (as for the data itself, see below)
+        field = self.source
+        if hasattr(field, "lbrow") and hasattr(field, "lbnpt"):
+            return field.lbrow*field.lbnpt
+        return field.lblrec
 
     def _data_array(self):
         field = self.source
         data_bytes = self._read_bytes()
-        dtype = _DATA_DTYPES[self.WORD_SIZE][field.lbuser1]
         # If the number of rows and columns aren't available read the
         # data as a simple array instead
         size_present = hasattr(field, "lbrow") and hasattr(field, "lbnpt")
@@ -190,30 +232,109 @@ class _ReadFFProviderUnpacked(mule.RawReadProvider):
             count = field.lbrow*field.lbnpt
         else:
             count = field.lblrec
-        data = np.frombuffer(data_bytes, dtype, count=count)
+        data = _words_to_array(data_bytes, count, self.WORD_SIZE,
+                               field.lbuser1, self.unpack_dtype)
         if size_present:
             data = data.reshape(field.lbrow, field.lbnpt)
         return data
 
+    def _data_rows(self, row_start, row_end):
+        # Return only the given range of rows of the data; just the words of
+        # those rows are read
+        field = self.source
+        if not (hasattr(field, "lbrow") and hasattr(field, "lbnpt")):
+            return self._data_array()[row_start:row_end]
+        count = (row_end - row_start)*field.lbnpt
+        data_bytes = self._read_part(row_start*field.lbnpt*self.WORD_SIZE,
+                                     count*self.WORD_SIZE)
+        data = _words_to_array(data_bytes, count, self.WORD_SIZE,
+                               field.lbuser1, self.unpack_dtype)
+        return data.reshape(row_end - row_start, field.lbnpt)
+
 
 class _ReadFFProviderCray32Packed(_ReadFFProviderUnpacked):
     """
     A :class:`mule.RawReadProvider` which reads a Cray32-bit packed field.
 
+    The 32-bit words are converted to native 64-bit values (or for real
+    fields to the data type given by unpack_dtype, if that is set).
+
     """
     WORD_SIZE = _CRAY32_SIZE
 
 
 class _ReadFFProviderWGDOSPacked(mule.RawReadProvider):
     """A :class:`mule.RawReadProvider` which reads a WGDOS packed field."""
+    # The data type to unpack the field to (if not set the default of the
+    # packing library is used, which is double precision)
+    unpack_dtype = None
+
     def _data_array(self):
         field = self.source
         data_bytes = self._read_bytes()
         data = wgdos_unpack_field(data_bytes, field.bmdi,
-                                  field.lbrow, field.lbnpt)
+                                  field.lbrow, field.lbnpt,
+                                  dtype=self.unpack_dtype)
+        return data
+
+    def _data_rows(self, row_start, row_end):
+        # Return only the given range of rows of the data (the packed field is
+        # still read in full, but only these rows are unpacked)
+        field = self.source
+        data_bytes = self._read_bytes()
+        data = wgdos_unpack_field(data_bytes, field.bmdi,
+                                  field.lbrow, field.lbnpt,
+                                  dtype=self.unpack_dtype,
+                                  row_range=(row_start, row_end))
         return data
 
 
+class _LandSeaMask(object):
+    """
+    The land and sea points of a land-sea mask.  These are found once (when
+    first required) and then shared by all of the land/sea packed providers
+    and operators referencing the same land-sea mask.
+
+    """
+    def __init__(self, lsm):
+        """
+        Initialise the mask.
+
+        Args:
+            * lsm:
+                2-dimensional array containing the land-sea mask data
+                (1.0 at land points and 0.0 at sea points).
+
+        """
+        self.lsm = np.asarray(lsm)
+        self.shape = self.lsm.shape
+        self._masks = {}
+
+    def mask(self, land):
+        """
+        Return a flattened boolean array selecting either the land or the
+        sea points, along with the number of points selected.
+
+        Args:
+            * land:
+                True to select the land points, False to select the sea points.
+
+        """
+        if land not in self._masks:
+            value = 1.0 if land else 0.0
+            mask = np.ascontiguousarray(self.lsm.ravel() == value)
+            self._masks[land] = (mask, int(np.count_nonzero(mask)))
+        return self._masks[land]
+
+
+def _land_sea_mask(lsm_source):
+    # Return a shared land-sea mask object for the given source, which may
+    # either be an existing one or a land-sea mask data array
+    if isinstance(lsm_source, _LandSeaMask):
+        return lsm_source
+    return _LandSeaMask(lsm_source)
+
+
 class _ReadFFProviderLandPacked(mule.RawReadProvider):
     """
     A :class:`mule.RawReadProvider` which reads an unpacked field defined
@@ -225,6 +346,8 @@ class _ReadFFProviderLandPacked(mule.RawReadProvider):
 
     """
     WORD_SIZE = mule._DEFAULT_WORD_SIZE
+    # Only used by the Cray32 subclasses (as for the unpacked fields above)
+    unpack_dtype = None
     _LAND = True
 
     def __init__(self, *args, **kwargs):
@@ -232,7 +355,7 @@ class _ReadFFProviderLandPacked(mule.RawReadProvider):
         self._lsm_source = None
 
     def set_lsm_source(self, lsm_source):
-        self._lsm_source = lsm_source
+        self._lsm_source = _land_sea_mask(lsm_source)
 
     def _data_array(self):
         field = self.source
@@ -241,21 +364,16 @@ class _ReadFFProviderLandPacked(mule.RawReadProvider):
             msg = ("Land Packed Field cannot be unpacked as it "
                    "has no associated Land-Sea mask")
             raise ValueError(msg)
-        dtype = _DATA_DTYPES[self.WORD_SIZE][field.lbuser1]
-        data_p = np.frombuffer(data_bytes, dtype, count=field.lblrec)
-        if self._LAND:
-            mask = np.where(self._lsm_source.ravel() == 1.0)[0]
-        else:
-            mask = np.where(self._lsm_source.ravel() == 0.0)[0]
-        if len(mask) != len(data_p):
+        data_p = _words_to_array(data_bytes, field.lblrec, self.WORD_SIZE,
+                                 field.lbuser1, self.unpack_dtype)
+        mask, n_points = self._lsm_source.mask(self._LAND)
+        if n_points != len(data_p):
             msg = "Number of points in mask is incompatible; {0} != {1}"
-            raise ValueError(msg.format(len(mask), len(data_p)))
+            raise ValueError(msg.format(n_points, len(data_p)))
 
         rows, cols = self._lsm_source.shape
 
-        data = np.empty((rows*cols), dtype)
-        data[:] = field.bmdi
-        data[mask] = data_p
+        data = landsea_expand(data_p, mask, field.bmdi)
         data = data.reshape(rows, cols)
         return data
 
@@ -310,9 +428,7 @@ class _WriteFFOperatorUnpacked(object):
 
     def to_bytes(self, field):
         data = field.get_data()
-        dtype = _DATA_DTYPES[self.WORD_SIZE][field.lbuser1]
-        data = data.astype(dtype)
-        return data.tobytes(), data.size
+        return _array_to_words(data, self.WORD_SIZE, field.lbuser1)
 
 
 class _WriteFFOperatorWGDOSPacked(_WriteFFOperatorUnpacked):
@@ -325,12 +441,12 @@ class _WriteFFOperatorWGDOSPacked(_WriteFFOperatorUnpacked):
 
     def to_bytes(self, field):
         data = field.get_data()
-        # The packing library will expect the data in native byte-ordering
-        # and in the appropriate format, so ensure that is the case here
+        # The packing library will expect the data in native byte-ordering,
+        # in the appropriate format and contiguous, so ensure that is the case
+        # here (this only copies the data if it isn't already suitable)
         dtype = np.dtype(_DATA_DTYPES[self.WORD_SIZE][field.lbuser1])
         native_dtype = dtype.newbyteorder("=")
-        if data.dtype is not native_dtype:
-            data = data.astype(native_dtype)
+        data = np.ascontiguousarray(data, dtype=native_dtype)
 
         data_bytes = wgdos_pack_field(data, field.bmdi, int(field.bacc))
         # Note: the returned data size here is a little odd; WGDOS data is
@@ -368,10 +484,7 @@ class _WriteFFOperatorLandPacked(_WriteFFOperatorUnpacked):
         self._lsm_source = None
 
     def set_lsm_source(self, lsm_source):
-        self._lsm_source = lsm_source
-
-    def set_lsm_source(self, lsm_source):
-        self._lsm_source = lsm_source
+        self._lsm_source = _land_sea_mask(lsm_source)
 
     def to_bytes(self, field):
         data = field.get_data()
@@ -380,15 +493,9 @@ class _WriteFFOperatorLandPacked(_WriteFFOperatorUnpacked):
                    "land-sea-mask")
             raise ValueError(msg)
 
-        if self._LAND:
-            mask = np.where(self._lsm_source.ravel() == 1.0)[0]
-        else:
-            mask = np.where(self._lsm_source.ravel() == 0.0)[0]
-
-        data = data.ravel()[mask]
-        dtype = _DATA_DTYPES[self.WORD_SIZE][field.lbuser1]
-        data = data.astype(dtype)
-        return data.tobytes(), data.size
+        mask, n_points = self._lsm_source.mask(self._LAND)
+        data = landsea_compress(data, mask, n_points)
+        return _array_to_words(data, self.WORD_SIZE, field.lbuser1)
 
 
 class _WriteFFOperatorSeaPacked(_WriteFFOperatorLandPacked):
@@ -476,15 +583,16 @@ class FieldsFile(mule.UMFile):
     # Attach to the standard validation function
     validate = validators.validate_umf
 
-    def _write_to_file(self, output_file):
+    def _write_to_file(self, output_file, workers=None):
         """Write out to an open output file."""
         # We want to extend the UMFile version of this routine to extract the
         # land-sea mask info for the relevant operators
         lsm = None
-        for field in self.fields:
-            if hasattr(field, "lbuser4") and field.lbuser4 == 30:
-                lsm = field.get_data()
-                break
+        lsm_indices = self.field_indices(lbuser4=30)
+        if len(lsm_indices) > 0:
+            lsm = self.fields[lsm_indices[0]].get_data()
+            if lsm is not None:
+                lsm = _LandSeaMask(lsm)
 
         # Assuming a valid mask was found above; attach it to the operators
         if lsm is not None:
@@ -493,23 +601,68 @@ class FieldsFile(mule.UMFile):
                     operator.set_lsm_source(lsm)
 
         # Now call the usual method
-        super(FieldsFile, self)._write_to_file(output_file)
-
-    def _read_file(self, file_or_filepath):
+        super(FieldsFile, self)._write_to_file(output_file, workers=workers)
+
+    def _stream_to_file(self, output_file, fields, max_fields, workers=None):
+        """Write out to an open output file, from an iterable of fields."""
+        # As above; but since the fields aren't known in advance the
+        # land-sea mask is attached to the operators when it is reached.  Any
+        # fields from the first land/sea packed field up to the mask are held
+        # back until then (only the field objects, not their data)
+        def find_lsm(fields):
+            pending = []
+            lsm_found = False
+            for field in fields:
+                if not lsm_found:
+                    if getattr(field, "lbuser4", None) == 30:
+                        lsm = field.get_data()
+                        if lsm is not None:
+                            lsm = _LandSeaMask(lsm)
+                            for _, operator in (
+                                    self._write_operators.items()):
+                                if hasattr(operator, "_LAND"):
+                                    operator.set_lsm_source(lsm)
+                        lsm_found = True
+                    elif pending or (field.lbpack % 100)//10 == 2:
+                        pending.append(field)
+                        continue
+                for pending_field in pending:
+                    yield pending_field
+                pending = []
+                yield field
+
+            # If there was no mask the remaining fields are still written
+            # (the land/sea packed fields will fail when packed)
+            for pending_field in pending:
+                yield pending_field
+
+        return super(FieldsFile, self)._stream_to_file(
+            output_file, find_lsm(fields), max_fields, workers=workers)
+
+    def _read_file(self, file_or_filepath, mmap=False, unpack_dtype=None,
+                   lazy=False, index=False, cache=None):
         """Populate the class from an existing file object or file"""
         # Similarly we want to append some land-sea mask logic to this routine
         # Start by calling the usual routine
-        super(FieldsFile, self)._read_file(file_or_filepath)
+        super(FieldsFile, self)._read_file(file_or_filepath, mmap=mmap,
+                                           unpack_dtype=unpack_dtype,
+                                           lazy=lazy, index=index,
+                                           cache=cache)
 
         # Look for the land-sea mask
         lsm = None
-        for field in self.fields:
-            if hasattr(field, "lbuser4") and field.lbuser4 == 30:
-                lsm = field.get_data()
-                break
+        lsm_indices = self.field_indices(lbuser4=30)
+        if len(lsm_indices) > 0:
+            lsm = self.fields[lsm_indices[0]].get_data()
+            if lsm is not None:
+                lsm = _LandSeaMask(lsm)
 
         # If a land-sea mask was found, attach it to the relevant fields
+        # (these all share the same mask object, so the land and sea points
+        # only need to be found once)
         if lsm is not None:
-            for field in self.fields:
+            def attach_lsm(field):
                 if hasattr(field._data_provider, "_LAND"):
                     field._data_provider.set_lsm_source(lsm)
+
+            self._apply_to_fields(attach_lsm)
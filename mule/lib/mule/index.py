@@ -0,0 +1,159 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+
+"""
+This module provides sidecar index files, which record the parts of a UM or
+pp file needed to locate its fields (the raw lookup, and for pp files the
+position of each data record).  When the same file is opened repeatedly the
+index can be loaded instead of scanning the file again.
+
+An index is saved next to the file it describes (with the suffix given by
+:data:`INDEX_SUFFIX`) and records the size and modification time of that
+file; if either has changed since the index was written it is ignored.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import os
+import uuid
+import numpy as np
+
+INDEX_SUFFIX = ".mule_index"
+"""The suffix added to the path of a file to give the path of its index."""
+
+# Version of the index layout; indices written with a different version are
+# ignored (and will be re-written)
+_INDEX_VERSION = 2
+
+def index_path(file_path):
+    """
+    Return the path of the sidecar index for a given file.
+
+    Args:
+        * file_path:
+            Path to the UM or pp file.
+
+    """
+    return file_path + INDEX_SUFFIX
+
+
+def file_stamp(file_path):
+    """
+    Return the values used to detect if a file has changed since it was
+    indexed (its size and modification time).  This should be taken before
+    the file is scanned and passed to :func:`write_index`, so that a file
+    which changes while it is being scanned is not given a valid index.
+
+    Args:
+        * file_path:
+            Path to the UM or pp file.
+
+    """
+    stat = os.stat(file_path)
+    return np.array([stat.st_size, stat.st_mtime_ns], dtype=np.int64)
+
+
+def read_index(file_path, kind):
+    """
+    Read the sidecar index of a file, if it has one which is still valid.
+
+    Args:
+        * file_path:
+            Path to the UM or pp file.
+        * kind:
+            The type of index expected ("um" or "pp").
+
+    Returns:
+        A dictionary of the arrays saved in the index, or None if the file
+        has no index, or the index is out of date, of the wrong kind or
+        can't be read.
+
+    """
+    path = index_path(file_path)
+    if not os.path.exists(path):
+        return None
+    try:
+        with np.load(path, allow_pickle=False) as index:
+            arrays = dict(index.items())
+        valid = (int(arrays.pop("version")) == _INDEX_VERSION and
+                 str(arrays.pop("kind")) == kind and
+                 np.array_equal(arrays.pop("stamp"), file_stamp(file_path)))
+    except Exception:
+        # An index which can't be read is treated the same as a missing one,
+        # since the file itself can always be scanned instead
+        return None
+    if not valid:
+        return None
+    return arrays
+
+
+def write_index(file_path, kind, stamp, **arrays):
+    """
+    Write the sidecar index of a file.
+
+    The index is written to a temporary file which then replaces any
+    existing index, so that other processes never see a partial index.
+
+    Args:
+        * file_path:
+            Path to the UM or pp file.
+        * kind:
+            The type of index being written ("um" or "pp").
+        * stamp:
+            The stamp of the file (see :func:`file_stamp`) taken before
+            it was scanned to produce the arrays.
+
+    Kwargs:
+        The arrays to save in the index.
+
+    Returns:
+        The path to the index.
+
+    """
+    path = index_path(file_path)
+    # The temporary file is given a unique name next to the index, and is
+    # created exclusively (so an existing file is never written to); its
+    # permissions are those of any new file (subject to the umask)
+    temp_path = "{0}.{1}".format(path, uuid.uuid4().hex)
+    flags = os.O_CREAT | os.O_EXCL | os.O_WRONLY | getattr(os, "O_BINARY", 0)
+    handle = os.open(temp_path, flags, 0o666)
+    try:
+        with os.fdopen(handle, "wb") as temp_file:
+            np.savez(temp_file, version=_INDEX_VERSION, kind=kind,
+                     stamp=stamp, **arrays)
+        os.replace(temp_path, path)
+    except BaseException:
+        os.remove(temp_path)
+        raise
+    return path
+
+
+def try_write_index(file_path, kind, stamp, **arrays):
+    """
+    As :func:`write_index`, but return None instead of raising an error if
+    the index can't be written (for example if the directory containing the
+    file is read-only).
+
+    """
+    try:
+        return write_index(file_path, kind, stamp, **arrays)
+    except (IOError, OSError):
+        return None
@@ -0,0 +1,261 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+
+"""
+This module provides optional counters of the work Mule does when reading,
+decoding and writing field data, to show where the time in a slow job goes.
+
+Each phase of the work adds to a counter of the number of times it was done,
+the time it took and the number of bytes involved.  The phases are:
+
+* "read":
+    Reading the raw data payload of a field from its file (for a memory
+    mapped file this is only the creation of a view onto the mapping).
+* "decode lbpack=N":
+    Getting the data of a field read from a file with packing code N,
+    including reading it; the bytes are those of the decoded array, which
+    is also the memory allocated for it.
+* "operator NAME":
+    Getting the data of a field from the :class:`mule.DataOperator` NAME,
+    including getting the data of its source.
+* "encode lbpack=N":
+    Preparing the data of a field to be written with packing code N,
+    including getting the data; the bytes are those of the encoded data.
+* "write":
+    Writing the data payloads of fields to a file.
+
+If the "um_packing" extension is installed its own counters are included,
+as "um_packing.FUNCTION"; these give the time spent in the packing library
+itself (separately from reading, byte-swapping and so on).
+
+The counting is off by default.  It can be turned on with :func:`enable`,
+or by setting the environment variable MULE_STATS before Mule is imported;
+either to "1" to print a summary (see :func:`summary`) to the standard
+error when Python exits, or to the path of a file to append it to.  While
+the counting is off each phase costs only a test of a flag, and while it is
+on only a pair of timer calls, so it can safely be left on in production.
+
+For example:
+
+    >>> mule.instrument.enable()
+    >>> ff = mule.FieldsFile.from_file(path)
+    >>> ff.to_file(out_path)
+    >>> print(mule.stats()["decode lbpack=1"])
+    {'calls': 70, 'seconds': 0.512, 'bytes': 172032000}
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import os
+import sys
+import time
+import atexit
+import threading
+
+ENV_VAR = "MULE_STATS"
+"""The environment variable which turns the counting on at import."""
+
+enabled = False
+"""True while the work is being counted (see :func:`enable`)."""
+
+clock = time.perf_counter
+"""The timer used to measure each phase."""
+
+_LOCK = threading.Lock()
+_COUNTERS = {}
+
+
+def _packing_module():
+    # The "um_packing" extension, if it has been imported (by mule.packing,
+    # which also turns its counting on to match) and can count its work
+    module = sys.modules.get("um_packing")
+    if module is not None and hasattr(module, "get_stats"):
+        return module
+    return None
+
+
+def enable():
+    """Turn on the counting of work."""
+    global enabled
+    enabled = True
+    packing_module = _packing_module()
+    if packing_module is not None:
+        packing_module.set_stats(True)
+
+
+def disable():
+    """Turn off the counting of work (the counters keep their values)."""
+    global enabled
+    enabled = False
+    packing_module = _packing_module()
+    if packing_module is not None:
+        packing_module.set_stats(False)
+
+
+def reset():
+    """Reset all of the counters to zero."""
+    with _LOCK:
+        _COUNTERS.clear()
+    packing_module = _packing_module()
+    if packing_module is not None:
+        packing_module.reset_stats()
+
+
+def _nbytes(value):
+    # The size of an array, buffer or string of bytes (or of the first of a
+    # tuple of them, as returned by the write operators)
+    if isinstance(value, tuple):
+        value = value[0] if value else None
+    if hasattr(value, "nbytes"):
+        return int(value.nbytes)
+    try:
+        return len(value)
+    except TypeError:
+        return 0
+
+
+def record(phase, seconds, nbytes=0):
+    """
+    Add some work to the counter of a phase.
+
+    Args:
+        * phase:
+            The name of the phase.
+        * seconds:
+            The time taken.
+
+    Kwargs:
+        * nbytes:
+            The number of bytes involved.
+
+    """
+    with _LOCK:
+        counter = _COUNTERS.get(phase)
+        if counter is None:
+            counter = _COUNTERS[phase] = [0, 0.0, 0]
+        counter[0] += 1
+        counter[1] += seconds
+        counter[2] += nbytes
+
+
+def timed(phase, function, *args):
+    """
+    Call a function, counting it as work in a phase (the number of bytes is
+    the size of the returned value, or of its first element if it returns a
+    tuple).
+
+    Args:
+        * phase:
+            The name of the phase.
+        * function:
+            The function to call with the remaining arguments.
+
+    Returns:
+        The value returned by the function.
+
+    """
+    start = clock()
+    result = function(*args)
+    record(phase, clock() - start, _nbytes(result))
+    return result
+
+
+def write(output_file, data_bytes):
+    """
+    Write bytes to a file, counting it as work in the "write" phase if the
+    counting is on.
+
+    Args:
+        * output_file:
+            The (open) file object to write to.
+        * data_bytes:
+            The bytes (or array) to write.
+
+    """
+    if not enabled:
+        output_file.write(data_bytes)
+        return
+    start = clock()
+    output_file.write(data_bytes)
+    record("write", clock() - start, _nbytes(data_bytes))
+
+
+def stats():
+    """
+    Return the work counted since the counters were last reset.
+
+    Returns:
+        A dictionary with an entry for each phase, which is a dictionary
+        giving the "calls", "seconds" and "bytes" of the work.
+
+    """
+    with _LOCK:
+        result = dict((phase, {"calls": calls, "seconds": seconds,
+                               "bytes": nbytes})
+                      for phase, (calls, seconds, nbytes)
+                      in _COUNTERS.items())
+    packing_module = _packing_module()
+    if packing_module is not None:
+        for name, (calls, seconds, nbytes) in (
+                packing_module.get_stats().items()):
+            if calls > 0:
+                result["um_packing." + name] = {
+                    "calls": calls, "seconds": seconds, "bytes": nbytes}
+    return result
+
+
+def summary(stdout=None):
+    """
+    Print a table of the work counted, with the phases which took the most
+    time first.
+
+    Kwargs:
+        * stdout:
+            The (open) file object to print to (default sys.stdout).
+
+    """
+    if stdout is None:
+        stdout = sys.stdout
+    line = "{0:<32s} {1:>10} {2:>10} {3:>12} {4:>10}\n"
+    stdout.write(line.format("Phase", "Calls", "Seconds", "MiB", "MiB/s"))
+    counters = sorted(stats().items(), key=lambda item: -item[1]["seconds"])
+    for phase, counter in counters:
+        mib = counter["bytes"]/2.0**20
+        rate = "-"
+        if counter["seconds"] > 0 and counter["bytes"] > 0:
+            rate = "{0:.1f}".format(mib/counter["seconds"])
+        stdout.write(line.format(
+            phase, counter["calls"], "{0:.3f}".format(counter["seconds"]),
+            "{0:.1f}".format(mib), rate))
+
+
+def _summary_at_exit(target):
+    # Print the summary at exit, to stderr or appended to the given file
+    if target == "1":
+        summary(sys.stderr)
+    else:
+        with open(target, "a") as output_file:
+            summary(output_file)
+
+
+if os.environ.get(ENV_VAR, "") not in ("", "0"):
+    enable()
+    atexit.register(_summary_at_exit, os.environ[ENV_VAR])
@@ -87,12 +87,19 @@ class LBC_ColumnDependentConstants(mule.ColumnDependentConstants):
 class _ReadLBCProviderUnpacked(mule.RawReadProvider):
     """A :class:`mule.RawReadProvider` which reads an unpacked field."""
     WORD_SIZE = mule._DEFAULT_WORD_SIZE
+    # Only used by the Cray32 subclass (see :mod:`mule.ff`)
+    unpack_dtype = None
+
+    def _data_points(self):
+        # The data is the boundary points of each level, not the full grid
+        return self.source.lblrec
 
     def _data_array(self):
         field = self.source
         data_bytes = self._read_bytes()
-        dtype = mule.ff._DATA_DTYPES[self.WORD_SIZE][field.lbuser1]
-        data = np.frombuffer(data_bytes, dtype, count=field.lblrec)
+        data = mule.ff._words_to_array(data_bytes, field.lblrec,
+                                       self.WORD_SIZE, field.lbuser1,
+                                       self.unpack_dtype)
         data = data.reshape(field.lbhem - 100, -1)
         return data
 
@@ -116,9 +123,7 @@ class _WriteLBCOperatorUnpacked(object):
 
     def to_bytes(self, field):
         data = field.get_data()
-        dtype = mule.ff._DATA_DTYPES[self.WORD_SIZE][field.lbuser1]
-        data = data.astype(dtype)
-        return data.tobytes(), data.size
+        return mule.ff._array_to_words(data, self.WORD_SIZE, field.lbuser1)
 
 
 class _WriteLBCOperatorCray32Packed(_WriteLBCOperatorUnpacked):
@@ -396,12 +401,21 @@ class LBCFile(mule.UMFile):
     validate = validators.validate_umf
 
     # The only other difference is that LBC files do not set the data shape
-    def _write_to_file(self, output_file):
+    def _write_to_file(self, output_file, workers=None):
         # Do exactly what the FieldsFile class does
-        super(LBCFile, self)._write_to_file(output_file)
+        super(LBCFile, self)._write_to_file(output_file, workers=workers)
 
         # But clear out the data shape property (it should be set to zero for
         # LBC files) and write the fixed length header again to update this
         self.fixed_length_header.data_shape = 0
         output_file.seek(0)
         self.fixed_length_header.to_file(output_file)
+
+    def _stream_to_file(self, output_file, fields, max_fields, workers=None):
+        # As above, but for a streamed write
+        n_fields = super(LBCFile, self)._stream_to_file(
+            output_file, fields, max_fields, workers=workers)
+        self.fixed_length_header.data_shape = 0
+        output_file.seek(0)
+        self.fixed_length_header.to_file(output_file)
+        return n_fields
@@ -32,11 +32,151 @@ from __future__ import division
 
 import mule
 import numpy as np
+from mule import instrument as _instrument
 
 
 # Operators which act on a single field only
 # ==========================================
-class AddScalarOperator(mule.DataOperator):
+class _PointwiseDataProvider(mule._OperatorDataProvider):
+    """
+    A data provider which evaluates a chain of :class:`_PointwiseOperator`
+    operations together, in a single pass over the data of the field at the
+    start of the chain.
+
+    The chain is fixed when each operator is applied; if the data provider
+    of one of the intermediate fields in the chain is replaced afterwards,
+    the chain no longer describes how that field's data is produced, so the
+    operator is then applied to its source field as normal instead.
+
+    """
+    def __init__(self, operator, source, new_field, stages, base, links):
+        """
+        Create the provider.
+
+        Args:
+            * operator, source, new_field:
+                As for :class:`mule._OperatorDataProvider`.
+            * stages:
+                A list of (operator, field) pairs giving each operator in the
+                chain and the field it was applied to, in order.
+            * base:
+                The field at the start of the chain.
+            * links:
+                A list of (field, provider) pairs giving each intermediate
+                field in the chain and the data provider it had when the
+                chain was formed.
+
+        """
+        super(_PointwiseDataProvider, self).__init__(
+            operator, source, new_field)
+        self.stages = stages
+        self.base = base
+        self.links = links
+
+    def _data_array(self):
+        """Return the data after applying every operator in the chain."""
+        # Timed in the same way as the data of other operators (as the
+        # phase of the last operator in the chain)
+        if _instrument.enabled:
+            phase = "operator " + type(self.operator).__name__
+            return _instrument.timed(phase, self._chain_data)
+        return self._chain_data()
+
+    def _chain_data(self):
+        for field, provider in self.links:
+            if getattr(field, "_data_provider", None) is not provider:
+                return self.operator.transform(self.source,
+                                               self.result_field)
+        data = self.base.get_data()
+        owned = False
+        for operator, field in self.stages:
+            data, owned = operator._apply(data, field, owned)
+        return data
+
+
+class _PointwiseOperator(mule.DataOperator):
+    """
+    Base class for the operators which act on each point of a single field
+    independently.
+
+    When one of these operators is applied to a field which is itself the
+    result of one (or more) of them, the operations are combined; the data is
+    then fetched from the original field and each operation applied to it in
+    turn, in place on a single copy of the data, rather than each operation
+    creating a new array.  The result is the same as if each operation had
+    been applied separately.
+
+    """
+    def __call__(self, source_field, *args, **kwargs):
+        new_field = self.new_field(source_field, *args, **kwargs)
+        # Operators which override the transform can't take part in a chain
+        # (since it won't be called)
+        if type(self).transform in _POINTWISE_TRANSFORMS:
+            stages = [(self, source_field)]
+            base = source_field
+            links = []
+            source_provider = getattr(source_field, "_data_provider", None)
+            if isinstance(source_provider, _PointwiseDataProvider):
+                stages = source_provider.stages + stages
+                base = source_provider.base
+                links = source_provider.links + [(source_field,
+                                                  source_provider)]
+            provider = _PointwiseDataProvider(
+                self, source_field, new_field, stages, base, links)
+        else:
+            provider = mule._OperatorDataProvider(
+                self, source_field, new_field)
+        new_field.set_data_provider(provider)
+        return new_field
+
+    def _apply(self, data, field, owned):
+        """
+        Apply the operation to an array.
+
+        Args:
+            * data:
+                The array to operate on.
+            * field:
+                The field the operator was applied to (which provides the
+                MDI value, if it defines one).
+            * owned:
+                Whether the array was created by an earlier stage of the
+                chain (and so can be modified in place).
+
+        Returns:
+            * data, owned:
+                The resulting array, and whether it can be modified in
+                place by later stages.
+
+        """
+        raise NotImplementedError()
+
+
+def _apply_scalar(ufunc, data, value, field, owned):
+    # Apply a binary ufunc to the data and a scalar value, skipping any
+    # points set to MDI; the result is written in place when it has the
+    # same type as the data and the data is owned by the chain
+    if hasattr(field, "bmdi"):
+        mdi = field.bmdi
+        mask = (data != mdi)
+        # Where MDI is defined the result is always double precision
+        if (data.dtype == np.float64 and
+                np.result_type(data, value) == np.float64):
+            if not owned:
+                data = data.copy()
+            ufunc(data, value, out=data, where=mask)
+        else:
+            data_out = np.zeros(data.shape) + mdi
+            data_out[mask] = ufunc(data[mask], value)
+            data = data_out
+    elif owned and np.result_type(data, value) == data.dtype:
+        ufunc(data, value, out=data)
+    else:
+        data = ufunc(data, value)
+    return data, True
+
+
+class AddScalarOperator(_PointwiseOperator):
     """Operator which adds a scalar value to all points in a single field."""
     def __init__(self, value):
         """
@@ -89,18 +229,14 @@ class AddScalarOperator(mule.DataOperator):
             by the new field's :meth:`get_data` method.
 
         """
-        data = source_field.get_data()
-        if hasattr(source_field, "bmdi"):
-            mdi = source_field.bmdi
-            mask = (data != mdi)
-            data_out = np.zeros(data.shape) + mdi
-            data_out[mask] = data[mask] + self.value
-        else:
-            data_out = data + self.value
-        return data_out
+        data, _ = self._apply(source_field.get_data(), source_field, False)
+        return data
 
+    def _apply(self, data, field, owned):
+        return _apply_scalar(np.add, data, self.value, field, owned)
 
-class ScaleFactorOperator(mule.DataOperator):
+
+class ScaleFactorOperator(_PointwiseOperator):
     """Operator which multiplies points in a single field by a factor."""
     def __init__(self, factor):
         """
@@ -153,18 +289,14 @@ class ScaleFactorOperator(mule.DataOperator):
             by the new field's :meth:`get_data` method.
 
         """
-        data = source_field.get_data()
-        if hasattr(source_field, "bmdi"):
-            mdi = source_field.bmdi
-            mask = (data != mdi)
-            data_out = np.zeros(data.shape) + mdi
-            data_out[mask] = data[mask]*self.factor
-        else:
-            data_out = data*self.factor
-        return data_out
+        data, _ = self._apply(source_field.get_data(), source_field, False)
+        return data
 
+    def _apply(self, data, field, owned):
+        return _apply_scalar(np.multiply, data, self.factor, field, owned)
 
-class HardLimitOperator(mule.DataOperator):
+
+class HardLimitOperator(_PointwiseOperator):
     """Operator which restricts the range of the values in a single field."""
     def __init__(self, lower_limit=None, upper_limit=None,
                  lower_fill=None, upper_fill=None):
@@ -249,20 +381,28 @@ class HardLimitOperator(mule.DataOperator):
             by the new field's :meth:`get_data` method.
 
         """
-        data = source_field.get_data()
-        data_out = data.copy()
+        data, _ = self._apply(source_field.get_data(), source_field, False)
+        return data
+
+    def _apply(self, data, field, owned):
+        # All of the points to change are found before any are changed,
+        # so that each test is made against the original values
+        changes = []
         if self.lower_limit is not None:
-            data_out[(data < self.lower_limit)] = self.lower_fill
+            changes.append(((data < self.lower_limit), self.lower_fill))
         if self.upper_limit is not None:
-            data_out[(data > self.upper_limit)] = self.upper_fill
-        if hasattr(source_field, "bmdi"):
-            mdi = source_field.bmdi
-            mask = (data == mdi)
-            data_out[mask] = mdi
-        return data_out
-
-
-class ValueExchangeOperator(mule.DataOperator):
+            changes.append(((data > self.upper_limit), self.upper_fill))
+        if hasattr(field, "bmdi"):
+            mdi = field.bmdi
+            changes.append(((data == mdi), mdi))
+        if not owned:
+            data = data.copy()
+        for mask, value in changes:
+            data[mask] = value
+        return data, True
+
+
+class ValueExchangeOperator(_PointwiseOperator):
     """Operator which sets points with a particular value to a new value."""
     def __init__(self, target_value, new_value):
         """
@@ -317,10 +457,26 @@ class ValueExchangeOperator(mule.DataOperator):
             by the new field's :meth:`get_data` method.
 
         """
-        data = source_field.get_data()
-        data[(data == self.target_value)] = self.new_value
+        data, _ = self._apply(source_field.get_data(), source_field, False)
         return data
 
+    def _apply(self, data, field, owned):
+        # The source data may be read-only (e.g. if it is cached or
+        # memory-mapped) in which case it can't be modified in place
+        if not owned and not data.flags.writeable:
+            data = data.copy()
+            owned = True
+        data[(data == self.target_value)] = self.new_value
+        return data, owned
+
+
+# The transforms of the operators above; these may be chained together
+# (see :class:`_PointwiseOperator`)
+_POINTWISE_TRANSFORMS = (AddScalarOperator.transform,
+                         ScaleFactorOperator.transform,
+                         HardLimitOperator.transform,
+                         ValueExchangeOperator.transform)
+
 
 # Operators which act on multiple fields
 # ======================================
@@ -37,44 +37,91 @@ This module will use *either* the SHUMlib packing library wrapper module
         accuracy.
 
 """
-import os
 import importlib
+import itertools
+import threading
+import contextlib
+import numpy as np
+from collections import deque
+from concurrent.futures import ThreadPoolExecutor
+from mule import instrument as _instrument
 
 # First establish whether the SHUMlib packing library is available
 if importlib.util.find_spec("um_packing") is not None:
     try:
         import um_packing
-        # Since the SHUMlib packing employs OpenMP for speed, make sure the
-        # environment variable which controls the number of threads is set
-        # (on some platforms the default will be a high number of threads
-        # which can cause issues - we set it to be single threaded by default)
-        _omp_threads = "OMP_NUM_THREADS"
-        if (_omp_threads not in os.environ or
-                not os.environ[_omp_threads].isdigit()):
-            os.environ[_omp_threads] = "1"
-
-        def _wgdos_unpack_field(data_bytes, mdi, rows, cols):
+
+        # Older builds of the library lack some of the functions and
+        # keyword arguments used below; where one is missing Mule works
+        # without it (more slowly) rather than failing to import.  Versions
+        # which take the number of threads for each call will be given the
+        # setting from set_threads or threads (below)
+        _threads_module = None
+        if hasattr(um_packing, "set_threads"):
+            _threads_module = um_packing
+
+        # The optional keyword arguments of wgdos_unpack (versions which
+        # don't list them take none of the ones used here)
+        _unpack_keywords = frozenset(
+            getattr(um_packing, "wgdos_unpack_keywords", ()))
+
+        # Until set_threads or threads are used the library takes the OpenMP
+        # default number of threads (from the "OMP_NUM_THREADS" environment
+        # variable, or otherwise the number of cores); only fields large
+        # enough to gain from it are shared between the threads, so small
+        # fields don't pay for starting them
+
+        def _wgdos_unpack_field(data_bytes, mdi, rows, cols, dtype=None):
             """
             Unpack a WGDOS-packed field using the SHUMlib packing library.
 
             Args:
-                * data_bytes (string):
+                * data_bytes (bytes-like):
                     the raw byte data in the file.  This should be exactly as
                     read in from the file (so without any byte-swapping or
-                    other processing).
+                    other processing); any object supporting the buffer
+                    protocol may be given and will not be modified.
                 * mdi (float):
                     the value used as missing data in the field.
                 * rows, cols (int):
                     not used by this implementation.
 
+            Kwargs:
+                * dtype:
+                    the data type of the unpacked field; either float64 (the
+                    default) or float32, which the library will unpack to
+                    directly.
+
             Returns:
                 data (array):
                     the unpacked 2-dimensional data payload.
 
             """
-            data = um_packing.wgdos_unpack(data_bytes, mdi)
+            if "dtype" in _unpack_keywords:
+                return um_packing.wgdos_unpack(data_bytes, mdi, dtype=dtype,
+                                               **_thread_kwargs())
+            data = um_packing.wgdos_unpack(data_bytes, mdi,
+                                           **_thread_kwargs())
+            if dtype is not None:
+                data = data.astype(dtype, copy=False)
             return data
 
+        # Versions of the library which can unpack a range of rows of a field
+        # (without unpacking the rest of it) will be used to do so
+        _wgdos_unpack_rows = None
+        if "row_start" in _unpack_keywords:
+            def _wgdos_unpack_rows(data_bytes, mdi, row_start, row_end,
+                                   dtype=None):
+                """
+                Unpack some of the rows of a WGDOS-packed field using the
+                SHUMlib packing library (see :func:`_wgdos_unpack_field`).
+
+                """
+                return um_packing.wgdos_unpack(data_bytes, mdi, dtype=dtype,
+                                               row_start=row_start,
+                                               row_end=row_end,
+                                               **_thread_kwargs())
+
         def _wgdos_pack_field(data, mdi, acc):
             """
             WGDOS-pack a field using the SHUMlib packing library.
@@ -99,19 +146,71 @@ if importlib.util.find_spec("um_packing") is not None:
                     packed byte data.
 
             """
-            data_bytes = um_packing.wgdos_pack(data, mdi, acc)
+            data_bytes = um_packing.wgdos_pack(data, mdi, acc,
+                                               **_thread_kwargs())
             return data_bytes
 
+        def _wgdos_pack_fields(data_list, mdis, accs):
+            """
+            WGDOS-pack a list of fields using the SHUMlib packing library;
+            the fields are packed in parallel (the number of threads is
+            controlled by :func:`set_threads` and :func:`threads`).
+
+            Args:
+                * data_list (list of arrays):
+                    the 2-dimensional arrays containing the field data.
+                * mdis (list of floats):
+                    the values representing missing data in each field.
+                * accs (list of ints):
+                   the accuracy to pack each field to.
+
+            Returns:
+                data_bytes_list (list of strings):
+                    packed byte data for each field.
+
+            """
+            if not hasattr(um_packing, "wgdos_pack_many"):
+                return [_wgdos_pack_field(data, mdi, acc)
+                        for data, mdi, acc in zip(data_list, mdis, accs)]
+            return um_packing.wgdos_pack_many(data_list, mdis, accs,
+                                              **_thread_kwargs())
+
+        # Versions of the library with the land/sea packing kernels will be
+        # used to expand and compress land/sea packed fields
+        _landsea_module = None
+        if hasattr(um_packing, "landsea_expand"):
+            _landsea_module = um_packing
+
+        # Similarly for the kernel which compares the values of two fields
+        _compare_module = None
+        if hasattr(um_packing, "compare_arrays"):
+            _compare_module = um_packing
+
+        # And for the kernels which convert 32-bit (Cray32 packed) data
+        _cray32_module = None
+        if hasattr(um_packing, "cray32_unpack"):
+            _cray32_module = um_packing
+
+        # The library's own counters of its work follow Mule's (see
+        # mule.instrument)
+        if hasattr(um_packing, "set_stats"):
+            um_packing.set_stats(_instrument.enabled)
+
     except ImportError as err:
         msg = "SHUMlib Packing library found, but failed to import"
         raise ImportError(err.args + (msg,))
 
 elif importlib.util.find_spec("mo_pack") is not None:
     # If the UM library wasn't found, try the MO packing library instead
+    _landsea_module = None
+    _compare_module = None
+    _cray32_module = None
+    _threads_module = None
+    _wgdos_unpack_rows = None
     try:
         import mo_pack
 
-        def _wgdos_unpack_field(data_bytes, mdi, rows, cols):
+        def _wgdos_unpack_field(data_bytes, mdi, rows, cols, dtype=None):
             """
             Unpack a WGDOS-packed field using the MO packing library 'mo_pack'.
 
@@ -126,12 +225,22 @@ elif importlib.util.find_spec("mo_pack") is not None:
                     the number of expected rows and columns in the unpacked
                     field.
 
+            Kwargs:
+                * dtype:
+                    the data type of the unpacked field (the result from
+                    'mo_pack' is converted to this type if needed).
+
             Returns:
                 data (array):
                     the unpacked 2-dimensional data payload.
 
             """
-            data = mo_pack.decompress_wgdos(data_bytes, rows, cols, mdi)
+            # mo_pack requires a bytes object (rather than, for instance,
+            # a view onto a memory-mapped file)
+            data = mo_pack.decompress_wgdos(bytes(data_bytes),
+                                            rows, cols, mdi)
+            if dtype is not None:
+                data = data.astype(dtype, copy=False)
             return data
 
         def _wgdos_pack_field(data, mdi, acc):
@@ -160,6 +269,15 @@ elif importlib.util.find_spec("mo_pack") is not None:
             data_bytes = data_buffer.tobytes()
             return data_bytes
 
+        def _wgdos_pack_fields(data_list, mdis, accs):
+            """
+            WGDOS-pack a list of fields using the MO packing library
+            'mo_pack' (which packs each field in turn).
+
+            """
+            return [_wgdos_pack_field(data, mdi, acc)
+                    for data, mdi, acc in zip(data_list, mdis, accs)]
+
     except ImportError as err:
         msg = "MO Packing library found, but failed to import"
         raise ImportError(err.args + (msg,))
@@ -168,7 +286,13 @@ else:
     # If neither the UM nor MO libraries were found, fall-back to placeholders
     # which will allow the API to function, but will not be able to perform
     # any actual unpacking
-    def _wgdos_unpack_field(data_bytes, mdi, rows, cols):
+    _landsea_module = None
+    _compare_module = None
+    _cray32_module = None
+    _threads_module = None
+    _wgdos_unpack_rows = None
+
+    def _wgdos_unpack_field(data_bytes, mdi, rows, cols, dtype=None):
         """
         Unpack WGDOS packed field placeholder - this will be used when
         no other suitable packing library has been loaded, it cannot
@@ -190,8 +314,176 @@ else:
         msg = "No WGDOS packing library available, unable to pack field"
         raise NotImplementedError(msg)
 
+    def _wgdos_pack_fields(data_list, mdis, accs):
+        """
+        WGDOS pack fields placeholder - see :func:`_wgdos_pack_field`.
+
+        """
+        msg = "No WGDOS packing library available, unable to pack field"
+        raise NotImplementedError(msg)
+
+
+# The number of threads set by :func:`threads` for the calling thread (if
+# any) is kept here
+_thread_state = threading.local()
+
+
+def _thread_kwargs():
+    # The keyword arguments giving the packing library the number of threads
+    # set for the calling thread (if any)
+    count = getattr(_thread_state, "threads", None)
+    if count is None or _threads_module is None:
+        return {}
+    return {"threads": count}
+
+
+def set_threads(count):
+    """
+    Set the number of OpenMP threads the packing library may use to pack or
+    unpack WGDOS fields, for every thread of the process (except those
+    inside a :func:`threads` block).
+
+    A large field is shared between the threads; smaller fields are each
+    packed or unpacked by a single thread, but a list of them (see
+    :func:`wgdos_pack_fields`) is shared out between the threads.  When
+    Mule is reading or writing fields from a pool of Python threads or
+    processes, each of those already uses a CPU, so they are limited to a
+    single OpenMP thread each (see :func:`single_threaded`).
+
+    Args:
+        * count (int):
+            the number of threads; None (or 0) restores the default, which
+            is the OpenMP default (given by the "OMP_NUM_THREADS"
+            environment variable, or otherwise the number of cores).
+
+    Returns:
+        The previous setting (0 for the default).
+
+    .. note::
+        This has no effect unless the "um_packing" implementation is being
+        used, and it supports the setting.
 
-def wgdos_unpack_field(data_bytes, mdi, rows, cols):
+    """
+    if count is None:
+        count = 0
+    if count < 0:
+        msg = "Number of threads must not be negative; got {0}"
+        raise ValueError(msg.format(count))
+    if _threads_module is None:
+        return 0
+    return _threads_module.set_threads(int(count))
+
+
+def get_threads():
+    """
+    Return the number of OpenMP threads the packing library will use when
+    called from the calling thread (see :func:`set_threads` and
+    :func:`threads`).
+
+    The other UM library extensions used with Mule (e.g. um_sstpert and
+    um_wafccb) take their default number of threads from this too, so that
+    a single setting controls all of them.
+
+    """
+    if _threads_module is None:
+        return 1
+    count = getattr(_thread_state, "threads", None)
+    if count is None:
+        count = _threads_module.get_threads()
+    return count
+
+
+@contextlib.contextmanager
+def threads(count):
+    """
+    A context manager which sets the number of OpenMP threads the packing
+    library may use, for calls from the calling thread only; other threads
+    keep their own setting (see :func:`set_threads`).
+
+    For example::
+
+        with mule.packing.threads(8):
+            data = field.get_data()
+
+    Args:
+        * count (int):
+            the number of threads.
+
+    """
+    if count < 1:
+        msg = "Number of threads must be at least 1; got {0}"
+        raise ValueError(msg.format(count))
+    previous = getattr(_thread_state, "threads", None)
+    _thread_state.threads = int(count)
+    try:
+        yield
+    finally:
+        _thread_state.threads = previous
+
+
+def single_threaded(function, *args):
+    """
+    Call a function, with the packing library limited to a single thread
+    for the duration of the call (see :func:`threads`); for use as the task
+    given to a pool of Python threads, so that the pool and OpenMP don't
+    both try to use every CPU.
+
+    Args:
+        * function:
+            the function to call.
+
+    Other arguments are passed to the function.
+
+    Returns:
+        The result of the function.
+
+    """
+    with threads(1):
+        return function(*args)
+
+
+def pipelined_map(function, items, workers=None):
+    """
+    Generate the result of calling a function for each of the given items,
+    in order.  If more than one worker is requested the calls for upcoming
+    items are made in a pool of threads (each limited to a single thread
+    for any packing, see :func:`single_threaded`) while earlier results are
+    being consumed.  Only a limited number of items (twice the number of
+    workers) are in flight at once, to bound the memory used by results
+    which haven't been consumed yet.
+
+    Args:
+        * function:
+            the function to call for each item.
+        * items (iterable):
+            the items; these are only taken from the iterable as they are
+            needed.
+
+    Kwargs:
+        * workers (int):
+            the number of threads to use (if not given, or 1, the calls are
+            made in turn by the calling thread).
+
+    """
+    if workers is None or workers <= 1:
+        for item in items:
+            yield function(item)
+        return
+
+    with ThreadPoolExecutor(max_workers=workers) as executor:
+        items = iter(items)
+        pending = deque(executor.submit(single_threaded, function, item)
+                        for item in itertools.islice(items, 2*workers))
+        while pending:
+            result = pending.popleft().result()
+            for item in itertools.islice(items, 1):
+                pending.append(
+                    executor.submit(single_threaded, function, item))
+            yield result
+
+
+def wgdos_unpack_field(data_bytes, mdi, rows, cols, dtype=None,
+                       row_range=None):
     """
     Unpack a WGDOS-packed field.
 
@@ -209,12 +501,32 @@ def wgdos_unpack_field(data_bytes, mdi, rows, cols):
                 these parameters are ignored by the "um_packing"
                 implementation.
 
+    Kwargs:
+        * dtype:
+            the data type of the unpacked field; either float64 (the default)
+            or float32.  Since WGDOS packed values are quantised, single
+            precision is often sufficient and halves the memory required.
+        * row_range (tuple):
+            if given, a (start, end) pair giving the range of rows of the
+            field to return.  Where the packing library supports it only
+            these rows are actually unpacked, which is much faster when
+            they are a small part of the field.
+
     Returns:
         data (array):
             the unpacked 2-dimensional data payload.
 
     """
-    return _wgdos_unpack_field(data_bytes, mdi, rows, cols)
+    if row_range is None:
+        return _wgdos_unpack_field(data_bytes, mdi, rows, cols, dtype=dtype)
+    row_start, row_end = row_range
+    if _wgdos_unpack_rows is not None:
+        return _wgdos_unpack_rows(data_bytes, mdi, row_start, row_end,
+                                  dtype=dtype)
+    # Otherwise unpack the whole field, and take a copy of the rows (so that
+    # the rest of the field needn't be kept)
+    data = _wgdos_unpack_field(data_bytes, mdi, rows, cols, dtype=dtype)
+    return data[row_start:row_end].copy()
 
 
 def wgdos_pack_field(data, mdi, acc):
@@ -243,3 +555,183 @@ def wgdos_pack_field(data, mdi, acc):
     """
     data_bytes = _wgdos_pack_field(data, mdi, acc)
     return data_bytes
+
+
+def wgdos_pack_fields(data_list, mdis, accs):
+    """
+    WGDOS-pack a list of fields.  Where the packing library supports it
+    (the "um_packing" implementation) the fields are packed in parallel.
+
+    Args:
+        * data_list (list of arrays):
+            the 2-dimensional arrays containing the field data.
+        * mdis (list of floats):
+            the value representing missing data in each field.
+        * accs (list of ints):
+           the accuracy to pack each field to (see :func:`wgdos_pack_field`).
+
+    Returns:
+        data_bytes_list (list of strings):
+            packed byte data for each field.
+
+    """
+    if not (len(data_list) == len(mdis) == len(accs)):
+        msg = ("Number of fields, missing data values and accuracies "
+               "must match; got {0}, {1} and {2}")
+        raise ValueError(msg.format(len(data_list), len(mdis), len(accs)))
+    return _wgdos_pack_fields(list(data_list), list(mdis), list(accs))
+
+
+def landsea_expand(packed, mask, fill):
+    """
+    Expand a land or sea packed field onto the full (flattened) grid.
+
+    Args:
+        * packed (array):
+            the values at each of the selected points.
+        * mask (array):
+            a boolean array giving the selected points of the grid.
+        * fill (float):
+            the value to set at the points which aren't selected (the
+            missing data value of the field).
+
+    Returns:
+        data (array):
+            a 1-dimensional array, of the same data type as the packed
+            values, covering the full grid.
+
+    """
+    packed = np.ascontiguousarray(packed).ravel()
+    mask = np.ascontiguousarray(mask, dtype=bool).ravel()
+    data = np.empty(mask.size, dtype=packed.dtype)
+    if _landsea_module is not None:
+        fill = np.array(fill, dtype=packed.dtype)
+        _landsea_module.landsea_expand(packed, mask, fill, data)
+    else:
+        data[:] = fill
+        data[mask] = packed
+    return data
+
+
+def landsea_compress(data, mask, n_points=None):
+    """
+    Extract the selected land or sea points from a field on the full grid.
+
+    Args:
+        * data (array):
+            the field data, covering the full grid.
+        * mask (array):
+            a boolean array giving the selected points of the grid.
+
+    Kwargs:
+        * n_points (int):
+            the number of points selected by the mask (calculated if not
+            provided).
+
+    Returns:
+        packed (array):
+            a 1-dimensional array, of the same data type as the field data,
+            containing the values at each of the selected points.
+
+    """
+    data = np.ascontiguousarray(data).ravel()
+    mask = np.ascontiguousarray(mask, dtype=bool).ravel()
+    if _landsea_module is None:
+        return data[mask]
+    if n_points is None:
+        n_points = np.count_nonzero(mask)
+    packed = np.empty(n_points, dtype=data.dtype)
+    _landsea_module.landsea_compress(data, mask, packed)
+    return packed
+
+
+def compare_arrays(data_1, data_2, stop_at_first=False):
+    """
+    Compare the values of two fields.
+
+    Points where both fields are NaN are treated as equal.
+
+    Args:
+        * data_1, data_2 (array):
+            the field data to compare (which must have the same number of
+            points).
+
+    Kwargs:
+        * stop_at_first (bool):
+            if True, the comparison may stop as soon as a difference is
+            found, in which case the returned values only describe the
+            points which were compared.
+
+    Returns:
+        n_differ, max_diff, rms_diff (int, float, float):
+            the number of points which differ, the maximum absolute
+            difference and the RMS difference.
+
+    """
+    if _compare_module is not None:
+        return _compare_module.compare_arrays(data_1, data_2,
+                                              stop_at_first=stop_at_first)
+    data_1 = np.asarray(data_1, dtype=np.float64).ravel()
+    data_2 = np.asarray(data_2, dtype=np.float64).ravel()
+    if data_1.size != data_2.size:
+        msg = "Arrays must have the same number of elements"
+        raise ValueError(msg)
+    differ = (data_1 != data_2) & ~(np.isnan(data_1) & np.isnan(data_2))
+    n_differ = int(np.count_nonzero(differ))
+    if n_differ == 0:
+        return 0, 0.0, 0.0
+    diff = np.where(differ, np.abs(data_1 - data_2), 0.0)
+    # (the maximum ignores any NaN differences, as the kernel does)
+    return (n_differ, float(np.fmax.reduce(diff, initial=0.0)),
+            float(np.sqrt(np.mean(np.square(diff)))))
+
+
+def cray32_unpack(data_bytes, count, dtype=np.float64):
+    """
+    Convert 32-bit big-endian (Cray32 packed) field data to native values.
+
+    Args:
+        * data_bytes (bytes):
+            the packed field data (which may be longer than needed).
+        * count (int):
+            the number of 32-bit words to convert.
+
+    Kwargs:
+        * dtype (numpy.dtype):
+            the data type of the returned values; one of float64 (the
+            default) or float32 if the words are reals, or int64 or int32
+            if they are integers.
+
+    Returns:
+        data (array):
+            a 1-dimensional array of the converted values.
+
+    """
+    dtype = np.dtype(dtype)
+    if _cray32_module is not None:
+        return _cray32_module.cray32_unpack(data_bytes, count, dtype=dtype)
+    word_dtype = ">i4" if dtype.kind == "i" else ">f4"
+    return np.frombuffer(data_bytes, word_dtype, count).astype(dtype)
+
+
+def cray32_pack(data, integer=False):
+    """
+    Convert field data to 32-bit big-endian (Cray32 packed) words.
+
+    Args:
+        * data (array):
+            the field data.
+
+    Kwargs:
+        * integer (bool):
+            if True the values are stored as 32-bit integers, otherwise as
+            32-bit reals.
+
+    Returns:
+        data_bytes (bytes):
+            the packed field data.
+
+    """
+    if _cray32_module is not None:
+        return _cray32_module.cray32_pack(data, integer=integer)
+    return np.asarray(data).astype(">i4" if integer else ">f4").tobytes()
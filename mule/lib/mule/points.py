@@ -0,0 +1,205 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+
+
+"""
+This module provides the extraction of the values at a set of points (for
+example the grid points nearest to a list of observing sites) from the
+fields of many UM files at once.
+
+For example, to extract the 1.5m temperature and surface pressure at three
+points from each of a series of forecast files:
+
+    >>> values = mule.points.extract_points(
+    ...     ["fc_t+003.ff", "fc_t+006.ff"], [3236, 409],
+    ...     rows=[10, 52, 300], cols=[4, 97, 811], workers=4)
+    >>> values.shape
+    (2, 2, 3)
+
+Only the parts of each file which are needed are read and decoded; the
+files are opened with their lookup read lazily and memory-mapped, only the
+matching fields are created, and where possible (for WGDOS packed fields)
+only the rows containing the points are unpacked.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import six
+import numpy as np
+from concurrent.futures import ThreadPoolExecutor
+
+import mule
+import mule.packing
+
+# Rows of points which are closer together than this are unpacked as a
+# single band of rows (rather than as separate bands, each of which has to
+# locate its rows in the packed field)
+_ROW_GAP = 16
+
+
+def extract_points(files, stash_codes, rows, cols, filter=None,
+                   workers=None, **kwargs):
+    """
+    Extract the values at a set of points from the fields of many files.
+
+    Args:
+        * files:
+            A list of either the paths to UM files or :class:`mule.UMFile`
+            objects.
+        * stash_codes:
+            The STASH codes (lbuser4) of the fields to extract points from.
+        * rows, cols:
+            Sequences giving the (0-based) row and column indices of each
+            of the points in the grid of the fields.
+
+    Kwargs:
+        * filter:
+            A dictionary of further lookup header names and values which
+            the fields must match (see :meth:`mule.UMFile.field_indices`),
+            e.g. {"lblev": [1, 2]}.
+        * workers:
+            The number of threads used to read and decode the fields of
+            each file.
+
+    Other Kwargs:
+        Any other keywords are passed to :func:`mule.load_umfile` when
+        given a path (by default the lookup is read lazily and the file is
+        memory-mapped).
+
+    Returns:
+        A 3-dimensional array (in double precision) of the value at each
+        point, for each of the matching fields, in each file.  The fields
+        are ordered by their STASH code (in the order given) and then by
+        their position in the file; each file must contain the same number
+        of matching fields.
+
+    """
+    rows = np.asarray(rows, dtype=np.int64).ravel()
+    cols = np.asarray(cols, dtype=np.int64).ravel()
+    if rows.shape != cols.shape:
+        msg = ("Row and column indices must have the same number of points; "
+               "got {0} and {1}")
+        raise ValueError(msg.format(rows.size, cols.size))
+    if rows.size > 0 and (rows.min() < 0 or cols.min() < 0):
+        msg = "Row and column indices must be non-negative"
+        raise ValueError(msg)
+
+    stash_codes = list(stash_codes)
+    stash_order = {}
+    for index, code in enumerate(stash_codes):
+        stash_order.setdefault(code, index)
+    criteria = dict(filter or {})
+    criteria["lbuser4"] = stash_codes
+    kwargs.setdefault("lazy", True)
+    kwargs.setdefault("mmap", True)
+
+    windows = _row_windows(rows)
+    files = list(files)
+    values = None
+
+    executor = None
+    if workers is not None and workers > 1:
+        executor = ThreadPoolExecutor(max_workers=workers)
+    try:
+        for ifile, umfile_or_path in enumerate(files):
+            if isinstance(umfile_or_path, six.string_types):
+                umf = mule.load_umfile(umfile_or_path, **kwargs)
+            else:
+                umf = umfile_or_path
+
+            fields = [umf.fields[index]
+                      for index in umf.field_indices(**criteria)]
+            fields.sort(key=lambda field: stash_order[field.lbuser4])
+
+            if values is None:
+                values = np.empty((len(files), len(fields), rows.size))
+            elif len(fields) != values.shape[1]:
+                msg = ("File {0} has {1} matching fields, but the first "
+                       "file has {2}")
+                raise ValueError(msg.format(ifile, len(fields),
+                                            values.shape[1]))
+
+            def field_points(field):
+                return _field_points(field, rows, cols, windows)
+
+            if executor is None:
+                results = map(field_points, fields)
+            else:
+                results = executor.map(
+                    lambda field: mule.packing.single_threaded(field_points,
+                                                               field),
+                    fields)
+            for ifield, result in enumerate(results):
+                values[ifile, ifield] = result
+    finally:
+        if executor is not None:
+            executor.shutdown()
+
+    if values is None:
+        values = np.empty((0, 0, rows.size))
+    return values
+
+
+def _row_windows(rows):
+    """
+    Group a set of points into bands of nearby rows.
+
+    Args:
+        * rows:
+            The row index of each point.
+
+    Returns:
+        A list of tuples (start, stop, points) giving the range of rows
+        of each band and the indices of the points within it.
+
+    """
+    if rows.size == 0:
+        return []
+    order = np.argsort(rows, kind="stable")
+    breaks = np.flatnonzero(np.diff(rows[order]) > _ROW_GAP) + 1
+    windows = []
+    for points in np.split(order, breaks):
+        windows.append((int(rows[points[0]]), int(rows[points[-1]]) + 1,
+                        points))
+    return windows
+
+
+def _field_points(field, rows, cols, windows):
+    """
+    Return the values of a field at the given points (see
+    :func:`extract_points`).
+
+    """
+    values = np.empty(rows.size)
+    if hasattr(field._data_provider, "_data_rows"):
+        for start, stop, points in windows:
+            data = field.get_data(rows=slice(start, stop))
+            values[points] = data[rows[points] - start, cols[points]]
+        return values
+
+    # Other fields have to be decoded in full, so this is only done once
+    # (rather than for each band of rows)
+    data = field.get_data()
+    if data is None:
+        msg = "Field with STASH code {0} has no data"
+        raise ValueError(msg.format(field.lbuser4))
+    values[:] = data[rows, cols]
+    return values
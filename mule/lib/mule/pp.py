@@ -24,8 +24,11 @@ This module provides tools for interacting with "pp" files.
 """
 from __future__ import (absolute_import, division, print_function)
 
+import os
 import six
+import mmap
 import mule
+from mule import instrument as _instrument
 import struct
 import numpy as np
 
@@ -101,139 +104,326 @@ def file_is_pp_file(file_path):
     return first_word == 256
 
 
-def fields_from_pp_file(pp_file_obj_or_path):
+def _pp_field(ints, reals, reclen, offset, pp_file, field_count):
     """
-    Reads in a PP file as a list of field objects.
+    Create a field object (along with its read provider) from the headers
+    and data record position of a field in a pp file.
 
-    Args:
-        * pp_file_obj_or_path:
-            Either an (opened) file object, or the path
-            to a file containing the pp data.
+    """
+    # Load into the basic field class
+    field_ref = PPField(ints, reals, None)
 
-    Returns:
-        * pp_fields
-            List of :class:`mule.pp.PPField` objects.
+    # Use the release number to select a better class if possible
+    fclass = FIELD_SELECT.get(field_ref.lbrel, None)
+    if fclass is not None:
+        field_ref = fclass(ints, reals, None)
+
+    # The data record length should be equivalent to lbnrec, but lbnrec can
+    # sometimes be set to zero... so to allow the existing provider to work
+    # add this value to the reference field's headers
+    field_ref.lbnrec = reclen // PP_WORD_SIZE
+
+    # Strip just the n1-n3 digits from the lbpack value
+    # and check for a suitable write operator
+    lbpack321 = "{0:03d}".format(
+        field_ref.lbpack - ((field_ref.lbpack // 1000) % 10) * 1000)
+
+    if lbpack321 not in _READ_PROVIDERS:
+        msg = "Field{0}; Cannot interpret unsupported packing code {1}"
+        raise ValueError(msg.format(field_count, lbpack321))
+
+    provider = _READ_PROVIDERS[lbpack321](field_ref, pp_file, offset)
+    field = type(field_ref)(ints, reals, provider)
 
+    # Change the DTYPE variables back to 64-bit - this is slightly hacky
+    # but *only* the UM File logic in the main part of Mule utilises this,
+    # and it will go wrong if it gets a PPField with it set to 32-bit
+    field.DTYPE_REAL = ">f8"
+    field.DTYPE_INT = ">i8"
+
+    return field
+
+
+def _read_pp_extra_data(pp_file, field):
     """
-    if isinstance(pp_file_obj_or_path, six.string_types):
-        pp_file = open(pp_file_obj_or_path, "rb")
-    else:
-        pp_file = pp_file_obj_or_path
+    Read the extra data vectors of a field from a pp file, which should be
+    positioned at the start of the extra data.
 
-    field_count = 0
+    """
+    # Save the current file position
+    start = pp_file.tell()
+
+    # Now load in the vectors as they are encountered until the
+    # end of the record is reached
+    vectors = {}
+    while pp_file.tell() - start < field.lbext * PP_WORD_SIZE:
+
+        # First read the code
+        vector_code = np.fromfile(pp_file, ">i4", 1)[0]
+
+        # Split the code into its parts
+        vector_points = vector_code // 1000
+        vector_type = vector_code % 1000
+
+        # Then read the vector into the dictionary
+        vectors[vector_type] = (
+            np.fromfile(pp_file, ">f4", vector_points))
+
+    return vectors
+
+
+def _fields_from_pp_records(pp_file, headers, reclens, offsets):
+    """
+    Create the field objects of a pp file from the raw headers, data record
+    lengths and data offsets of its records.
+
+    """
     fields = []
-    while True:
-        # Increment counter
-        field_count += 1
+    for ifield, (words, reclen, offset) in enumerate(
+            zip(headers, reclens, offsets)):
+        ints = words[:mule.Field.NUM_LOOKUP_INTS]
+        reals = words[mule.Field.NUM_LOOKUP_INTS:].view(">f4")
+        field = _pp_field(ints, reals, int(reclen), int(offset), pp_file,
+                          ifield + 1)
+
+        field.pp_extra_data = None
+        if field.lbext > 0:
+            # Skip to the extra data at the end of the field data
+            pp_file.seek(int(offset) +
+                         (field.lblrec - field.lbext) * PP_WORD_SIZE)
+            field.pp_extra_data = _read_pp_extra_data(pp_file, field)
 
-        # Read the record length
-        reclen = np.fromfile(pp_file, ">i4", 1)
+        fields.append(field)
+    return fields
 
-        # Check for end of file
-        if len(reclen) == 0:
-            break
-        else:
-            reclen = reclen[0]
 
-        if reclen != 256:
+def _scan_pp_records(buffer, base=0):
+    """
+    Find the position of every record in a buffer containing a pp file,
+    checking the record markers along the way.
+
+    Args:
+        * buffer:
+            An object supporting the buffer protocol holding the file
+            contents (e.g. a memory-map of the file).
+
+    Kwargs:
+        * base:
+            The position in the file of the start of the buffer.
+
+    Returns:
+        * headers - 2-dimensional array with the 64 raw lookup words
+                    of each field.
+        * reclens - array of the length in bytes of each data record.
+        * offsets - array of the position in the file of each data record.
+
+    """
+    size = len(buffer)
+    unpack_int = struct.Struct(">i").unpack_from
+    lookup_bytes = ((mule.Field.NUM_LOOKUP_INTS +
+                     mule.Field.NUM_LOOKUP_REALS) * PP_WORD_SIZE)
+
+    # Walking the records has to be done in turn (since each record's length
+    # gives the position of the next) but only the record markers are read
+    header_starts = []
+    reclens = []
+    offsets = []
+    position = 0
+    field_count = 0
+    while position + 4 <= size:
+        field_count += 1
+
+        # Read the record length of the header, and its check record
+        reclen = unpack_int(buffer, position)[0]
+        if reclen != lookup_bytes:
             msg = "Field {0}; Incorrectly sized lookup record: {1}"
             raise ValueError(msg.format(field_count, reclen))
 
-        # Read the record (the header)
-        ints = np.fromfile(pp_file, ">i4", mule.Field.NUM_LOOKUP_INTS)
-        reals = np.fromfile(pp_file, ">f4", mule.Field.NUM_LOOKUP_REALS)
+        if position + reclen + 12 > size:
+            msg = "Field {0}; File ends part way through record"
+            raise ValueError(msg.format(field_count))
 
-        # Read the check record
-        reclen_check = np.fromfile(pp_file, ">i4", 1)[0]
-
-        # They should match
+        reclen_check = unpack_int(buffer, position + 4 + reclen)[0]
         if reclen != reclen_check:
             msg = "Field {0}; Inconsistent header record lengths: {1} and {2}"
             raise ValueError(msg.format(field_count, reclen, reclen_check))
 
-        # Load into the basic field class
-        field_ref = PPField(ints, reals, None)
+        header_starts.append(position + 4)
+        position += reclen + 8
 
-        # Use the release number to select a better class if possible
-        fclass = FIELD_SELECT.get(field_ref.lbrel, None)
-        if fclass is not None:
-            field_ref = fclass(ints, reals, None)
+        # Now the same for the data record
+        reclen = unpack_int(buffer, position)[0]
+        offset = position + 4
+        if reclen < 0 or offset + reclen + 4 > size:
+            msg = "Field {0}; File ends part way through record"
+            raise ValueError(msg.format(field_count))
 
-        # Read the record length for the data
-        reclen = np.fromfile(pp_file, ">i4", 1)[0]
+        reclen_check = unpack_int(buffer, offset + reclen)[0]
+        if reclen != reclen_check:
+            msg = "Field {0}; Inconsistent data record lengths; {1} and {2}"
+            raise ValueError(msg.format(field_count, reclen, reclen_check))
 
-        # This should be equivalent to lbnrec, but can sometimes be set to
-        # zero... so to allow the existing provider to work add this value
-        # to the reference field's headers
-        field_ref.lbnrec = reclen // PP_WORD_SIZE
+        reclens.append(reclen)
+        offsets.append(base + offset)
+        position = offset + reclen + 4
 
-        # Associate the provider
-        offset = pp_file.tell()
+    reclens = np.array(reclens, dtype=np.int64)
+    offsets = np.array(offsets, dtype=np.int64)
+    if field_count == 0:
+        return np.empty((0, lookup_bytes // 4), dtype=">i4"), reclens, offsets
 
-        # Strip just the n1-n3 digits from the lbpack value
-        # and check for a suitable write operator
-        lbpack321 = "{0:03d}".format(
-            field_ref.lbpack - ((field_ref.lbpack // 1000) % 10) * 1000)
+    # Copy the headers into a single array (directly from the buffer, so
+    # that no larger temporary arrays are needed); the views onto the buffer
+    # are released as they go, so the buffer can be closed afterwards
+    num_words = lookup_bytes // 4
+    headers = np.empty((len(header_starts), num_words), dtype=">i4")
+    for ifield, start in enumerate(header_starts):
+        headers[ifield] = np.frombuffer(buffer, dtype=">i4", count=num_words,
+                                        offset=start)
 
-        if lbpack321 not in _READ_PROVIDERS:
-            msg = "Field{0}; Cannot interpret unsupported packing code {1}"
-            raise ValueError(msg.format(field_count, lbpack321))
+    return headers, reclens, offsets
 
-        provider = _READ_PROVIDERS[lbpack321](field_ref, pp_file, offset)
-        field = type(field_ref)(ints, reals, provider)
 
-        # Change the DTYPE variables back to 64-bit - this is slightly hacky
-        # but *only* the UM File logic in the main part of Mule utilises this,
-        # and it will go wrong if it gets a PPField with it set to 32-bit
-        field.DTYPE_REAL = ">f8"
-        field.DTYPE_INT = ">i8"
+def _scan_pp_stream(pp_file, base=0):
+    """
+    As :func:`_scan_pp_records`, but reading the records from a file object
+    (from its current position, at base bytes into the file); only the
+    headers and record markers are read, and each data record is skipped.
 
-        # Now check if the field contains extra data
-        if field.lbext > 0:
-            # Skip past the field data only (relative seek to avoid overflows)
-            pp_file.seek((field.lblrec - field.lbext) * PP_WORD_SIZE, 1)
+    """
+    unpack_int = struct.Struct(">i").unpack_from
+    lookup_bytes = ((mule.Field.NUM_LOOKUP_INTS +
+                     mule.Field.NUM_LOOKUP_REALS) * PP_WORD_SIZE)
+    num_words = lookup_bytes // 4
+
+    headers = []
+    reclens = []
+    offsets = []
+    position = base
+    field_count = 0
+    while True:
+        marker = pp_file.read(4)
+        if len(marker) < 4:
+            break
+        field_count += 1
 
-            # Save the current file position
-            start = pp_file.tell()
+        # Read the header record, its check record and the record length of
+        # the data which follows it
+        reclen = unpack_int(marker)[0]
+        if reclen != lookup_bytes:
+            msg = "Field {0}; Incorrectly sized lookup record: {1}"
+            raise ValueError(msg.format(field_count, reclen))
 
-            # Now load in the vectors as they are encountered until the
-            # end of the record is reached
-            vectors = {}
-            ext_consumed = 0
-            while pp_file.tell() - start < field.lbext * PP_WORD_SIZE:
+        record = pp_file.read(reclen + 8)
+        if len(record) < reclen + 8:
+            msg = "Field {0}; File ends part way through record"
+            raise ValueError(msg.format(field_count))
 
-                # First read the code
-                vector_code = np.fromfile(pp_file, ">i4", 1)[0]
+        reclen_check = unpack_int(record, reclen)[0]
+        if reclen != reclen_check:
+            msg = "Field {0}; Inconsistent header record lengths: {1} and {2}"
+            raise ValueError(msg.format(field_count, reclen, reclen_check))
 
-                # Split the code into its parts
-                vector_points = vector_code // 1000
-                vector_type = vector_code % 1000
+        headers.append(np.frombuffer(record, dtype=">i4", count=num_words))
+        offset = position + reclen + 12
+
+        # Skip over the data record to its check record
+        reclen = unpack_int(record, reclen + 4)[0]
+        if reclen < 0:
+            msg = "Field {0}; File ends part way through record"
+            raise ValueError(msg.format(field_count))
+        pp_file.seek(reclen, os.SEEK_CUR)
+        marker = pp_file.read(4)
+        if len(marker) < 4:
+            msg = "Field {0}; File ends part way through record"
+            raise ValueError(msg.format(field_count))
+
+        reclen_check = unpack_int(marker)[0]
+        if reclen != reclen_check:
+            msg = "Field {0}; Inconsistent data record lengths; {1} and {2}"
+            raise ValueError(msg.format(field_count, reclen, reclen_check))
 
-                # Then read the vector into the dictionary
-                vectors[vector_type] = (
-                    np.fromfile(pp_file, ">f4", vector_points))
+        reclens.append(reclen)
+        offsets.append(offset)
+        position = offset + reclen + 4
 
-                ext_consumed += vector_points
+    reclens = np.array(reclens, dtype=np.int64)
+    offsets = np.array(offsets, dtype=np.int64)
+    if field_count == 0:
+        return np.empty((0, num_words), dtype=">i4"), reclens, offsets
+    return np.array(headers, dtype=">i4"), reclens, offsets
 
-            # Having finished populating the vectors dict, attach it
-            # to the field object
-            field.pp_extra_data = vectors
 
-        else:
-            # If there isn't any extra data simply
-            # Skip the whole record (relative seek here to avoid overflows)
-            field.pp_extra_data = None
-            pp_file.seek(reclen, 1)
-
-        # Read the check record
-        reclen_check = np.fromfile(pp_file, ">i4", 1)[0]
-        # They should match
-        if reclen != reclen_check:
-            msg = "Field {0}; Inconsistent data record lengths; {1} and {2}"
-            raise ValueError(msg.format(field_count, reclen, reclen_check))
+def _scan_pp_file(pp_file):
+    """
+    Find the position of every record in an open pp file, from its current
+    position (see :func:`_scan_pp_records`).
 
-        fields.append(field)
+    """
+    base = pp_file.tell()
+    try:
+        file_map = mmap.mmap(pp_file.fileno(), 0, access=mmap.ACCESS_READ)
+    except (AttributeError, IOError, OSError, ValueError):
+        # Objects without a real file (and empty files) can't be mapped, so
+        # their records are read in turn instead
+        return _scan_pp_stream(pp_file, base)
+
+    records = _scan_pp_records(memoryview(file_map)[base:], base)
+    file_map.close()
+    return records
 
+
+def fields_from_pp_file(pp_file_obj_or_path, index=False):
+    """
+    Reads in a PP file as a list of field objects.
+
+    Args:
+        * pp_file_obj_or_path:
+            Either an (opened) file object, or the path
+            to a file containing the pp data.
+
+    Kwargs:
+        * index:
+            If set to True (and a file path is given), the positions of the
+            fields will be loaded from the file's sidecar index if it has a
+            valid one (see :mod:`mule.index`), instead of scanning through
+            every record in the file.  Otherwise the file is scanned as
+            usual, and an index is written for next time (if possible).
+
+    Returns:
+        * pp_fields
+            List of :class:`mule.pp.PPField` objects.
+
+    """
+    index_file = None
+    if isinstance(pp_file_obj_or_path, six.string_types):
+        pp_file = open(pp_file_obj_or_path, "rb")
+        if index:
+            index_file = pp_file_obj_or_path
+    else:
+        pp_file = pp_file_obj_or_path
+
+    arrays = None
+    if index_file is not None:
+        arrays = mule.index.read_index(index_file, "pp")
+
+    if arrays is not None:
+        headers = arrays["headers"]
+        reclens = arrays["reclens"]
+        offsets = arrays["offsets"]
+    else:
+        # The file is mapped (where possible) and walked through by its
+        # record markers, with the headers extracted all together at the
+        # end; the field data itself is left to be read by the providers
+        if index_file is not None:
+            stamp = mule.index.file_stamp(index_file)
+        headers, reclens, offsets = _scan_pp_file(pp_file)
+        if index_file is not None and len(headers) > 0:
+            mule.index.try_write_index(index_file, "pp", stamp,
+                                       headers=headers, reclens=reclens,
+                                       offsets=offsets)
+
+    fields = _fields_from_pp_records(pp_file, headers, reclens, offsets)
     pp_file.close()
     return fields
 
@@ -293,7 +483,13 @@ def fields_to_pp_file(pp_file_obj_or_path, field_or_fields,
                 msg = "Cannot write out packing code {0}"
                 raise ValueError(msg.format(lbpack321))
 
-            data_bytes, _ = _WRITE_OPERATORS[lbpack321].to_bytes(field)
+            write_operator = _WRITE_OPERATORS[lbpack321]
+            if _instrument.enabled:
+                data_bytes, _ = _instrument.timed(
+                    "encode lbpack={0}".format(field.lbpack),
+                    write_operator.to_bytes, field)
+            else:
+                data_bytes, _ = write_operator.to_bytes(field)
 
         # Calculate LBLREC
         field.lblrec = len(data_bytes) // PP_WORD_SIZE
@@ -426,7 +622,7 @@ def fields_to_pp_file(pp_file_obj_or_path, field_or_fields,
                      + [field.lbnpt] * 2 + [field.lbrow] * 2)
 
         pp_file.write(np.array(reclen).astype(">i4"))
-        pp_file.write(data_bytes)
+        _instrument.write(pp_file, data_bytes)
         if vector:
             for key, size in zip(keys, sizes):
                 pp_file.write(np.array(1000 * size + key).astype(">i4"))
@@ -0,0 +1,115 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Unit tests for :class:`mule.cache.DataCache`.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+from six.moves import (filter, input, map, range, zip)  # noqa
+
+import six
+import numpy as np
+
+import mule.tests as tests
+from mule.tests import COMMON_N48_TESTDATA_PATH
+
+from mule import FieldsFile, ArrayDataProvider
+from mule.cache import DataCache
+
+
+class Test_DataCache(tests.MuleTest):
+    def test_hit_and_miss(self):
+        cache = DataCache(1024)
+        array = np.arange(10.0)
+        self.assertIs(cache.get("a", lambda: array), array)
+        self.assertIs(cache.get("a", lambda: None), array)
+        self.assertEqual((cache.hits, cache.misses, cache.evictions),
+                         (1, 1, 0))
+        self.assertEqual(cache.nbytes, array.nbytes)
+        # Arrays held by the cache are shared, so can't be modified
+        self.assertFalse(array.flags.writeable)
+
+    def test_eviction(self):
+        cache = DataCache(200, max_field_bytes=100)
+        cache.get("a", lambda: np.zeros(10))
+        cache.get("b", lambda: np.zeros(10))
+        # Using "a" makes "b" the least recently used array, so it is the
+        # one discarded to make room for "c"
+        cache.get("a", lambda: None)
+        cache.get("c", lambda: np.zeros(10))
+        self.assertEqual(cache.stats(), {"hits": 1, "misses": 3,
+                                         "evictions": 1, "arrays": 2,
+                                         "nbytes": 160})
+        self.assertIsNotNone(cache.get("a", lambda: None))
+        self.assertIsNone(cache.get("b", lambda: None))
+
+    def test_large_field(self):
+        cache = DataCache(1000, max_field_bytes=80)
+        array = np.zeros(11)
+        cache.get("a", lambda: array)
+        self.assertEqual(len(cache), 0)
+        self.assertTrue(array.flags.writeable)
+
+    def test_negative_size__fail(self):
+        with six.assertRaisesRegex(self, ValueError, "non-negative"):
+            _ = DataCache(-1)
+
+
+class Test_DataCache__file(tests.MuleTest):
+    def test_fieldsfile(self):
+        cache = DataCache(64*1024**2)
+        ffv = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH, cache=cache)
+        field = ffv.fields[1]
+        hits, misses = cache.hits, cache.misses
+        data = field.get_data()
+        self.assertIs(field.get_data(), data)
+        # A copy of the field shares its provider, and so its cached data
+        self.assertIs(field.copy().get_data(), data)
+        self.assertEqual((cache.hits - hits, cache.misses - misses), (2, 1))
+
+        # Values taken from the cache should match those read directly
+        ffv_direct = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH)
+        for field, field_direct in zip(ffv.fields[:-1],
+                                       ffv_direct.fields[:-1]):
+            self.assertArrayEqual(field.get_data(),
+                                  field_direct.get_data())
+
+    def test_rewritten_file(self):
+        # A file re-written at the same path must not be given the data
+        # cached from its previous version
+        cache = DataCache(64*1024**2)
+        with self.temp_filename(suffix=".ff") as temp_path:
+            ffv = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH)
+            ffv.to_file(temp_path)
+            ffv = FieldsFile.from_file(temp_path, cache=cache)
+            ffv.fields[1].get_data()
+
+            ffv_new = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH)
+            new_data = ffv_new.fields[1].get_data() + 1.0
+            ffv_new.fields[1].set_data_provider(
+                ArrayDataProvider(new_data))
+            ffv_new.to_file(temp_path)
+            ffv_new = FieldsFile.from_file(temp_path, cache=cache)
+            self.assertArrayEqual(ffv_new.fields[1].get_data(), new_data)
+
+
+if __name__ == '__main__':
+    tests.main()
@@ -24,9 +24,14 @@ Unit tests for :class:`mule.ff.FieldsFile`.
 
 from __future__ import (absolute_import, division, print_function)
 
+import os
 import six
+import shutil
+import numpy as np
+import mule
 import mule.tests as tests
-from mule.tests import check_common_n48_testdata, COMMON_N48_TESTDATA_PATH
+from mule.tests import (check_common_n48_testdata, COMMON_N48_TESTDATA_PATH,
+                        testdata_filepath)
 
 from mule import FieldsFile, Field3
 from mule.ff import (FF_IntegerConstants, FF_RealConstants,
@@ -57,6 +62,126 @@ class Test_from_file(tests.MuleTest):
         self.assertEqual(type(ffv), FieldsFile)
         check_common_n48_testdata(self, ffv)
 
+    def test_read_fieldsfile_mmap(self):
+        ffv = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH, mmap=True)
+        self.assertEqual(type(ffv), FieldsFile)
+        check_common_n48_testdata(self, ffv)
+        ffv_read = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH)
+        for field, field_read in zip(ffv.fields, ffv_read.fields):
+            if field._data_provider is not None:
+                self.assertArrayEqual(field.get_data(),
+                                      field_read.get_data())
+
+    def test_read_fieldsfile_lazy(self):
+        ffv = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH, lazy=True)
+        self.assertEqual(type(ffv), FieldsFile)
+        # Finding fields shouldn't need any of them to be created
+        self.assertEqual(list(ffv.field_indices(lbvc=[6, 129])), [2, 3])
+        self.assertEqual(list(ffv.field_indices(lbvc=1, lbrel=3)), [0, 1])
+        self.assertEqual(ffv.fields.created(), [])
+        check_common_n48_testdata(self, ffv)
+        ffv_read = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH)
+        for field, field_read in zip(ffv.fields, ffv_read.fields):
+            self.assertArrayEqual(field.raw[1:], field_read.raw[1:])
+            if field._data_provider is not None:
+                self.assertArrayEqual(field.get_data(),
+                                      field_read.get_data())
+        self.assertEqual(list(ffv.field_indices(lbvc=[6, 129])),
+                         list(ffv_read.field_indices(lbvc=[6, 129])))
+
+    def test_read_fieldsfile_lazy_remove_empty(self):
+        ffv = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH, lazy=True,
+                                   remove_empty_lookups=True)
+        self.assertEqual(len(ffv.fields), 4)
+        self.assertEqual(len(ffv.fields.created()), 0)
+        self.assertEqual([fld.lbvc for fld in ffv.fields], [1, 1, 6, 129])
+
+    def test_validate_fieldsfile_lazy(self):
+        # All of the fields of a lazily read file should be checked, even
+        # those which haven't been created, without keeping them
+        ffv = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH, lazy=True)
+        ffv.fields.lookup[0, 21] = 99
+        with six.assertRaisesRegex(self, ValidateError,
+                                   "unrecognised release number 99"):
+            ffv.validate()
+        self.assertEqual(ffv.fields.created(), [])
+
+    def test_read_fieldsfile_index(self):
+        with self.temp_filename(suffix=".ff") as temp_path:
+            shutil.copyfile(COMMON_N48_TESTDATA_PATH, temp_path)
+            index_path = mule.index.index_path(temp_path)
+            try:
+                # The first read writes the index, the second uses it
+                for _ in range(2):
+                    ffv = FieldsFile.from_file(temp_path, index=True)
+                    arrays = mule.index.read_index(temp_path, "um")
+                    self.assertIsNotNone(arrays)
+                    check_common_n48_testdata(self, ffv)
+                    # The index holds the positions of the fields' data
+                    offsets = [field._data_provider.offset
+                               for field in ffv.fields]
+                    self.assertEqual(list(arrays["offsets"]), offsets)
+                    self.assertEqual(list(arrays["classes"]),
+                                     [field.lbrel for field in ffv.fields])
+                # The index can be read by anyone who can read the file
+                # (subject to the umask)
+                umask = os.umask(0)
+                os.umask(umask)
+                self.assertEqual(os.stat(index_path).st_mode & 0o777,
+                                 0o666 & ~umask)
+            finally:
+                if os.path.exists(index_path):
+                    os.remove(index_path)
+
+    def test_read_fieldsfile_unpack_dtype(self):
+        fname = testdata_filepath("n48_multi_field.ff")
+        ffv = FieldsFile.from_file(fname, unpack_dtype=np.float32)
+        ffv_read = FieldsFile.from_file(fname)
+        for field, field_read in zip(ffv.fields, ffv_read.fields):
+            if field.lbpack % 10 != 1:
+                continue
+            try:
+                data = field.get_data()
+            except NotImplementedError:
+                self.skipTest("WGDOS packing library unavailable")
+            self.assertEqual(data.dtype, np.float32)
+            self.assertArrayEqual(
+                data, field_read.get_data().astype(np.float32))
+
+    def test_read_fieldsfile_rows(self):
+        # Requesting some rows of a field should give the same values as
+        # slicing the full data (whether or not the field is WGDOS packed)
+        ffv = FieldsFile.from_file(testdata_filepath("n48_multi_field.ff"))
+        for field in ffv.fields:
+            try:
+                data = field.get_data()
+            except NotImplementedError:
+                self.skipTest("WGDOS packing library unavailable")
+            if data is None:
+                continue
+            for rows in (slice(10, 20), slice(0, 1), slice(-5, None),
+                         slice(None, None, 2)):
+                self.assertArrayEqual(field.get_data(rows=rows), data[rows])
+
+    def test_read_fieldsfile_rows_unpacked(self):
+        # Unpacked and Cray32 packed fields should read only the words of
+        # the requested rows (from a file or a mapping of it)
+        def unread():
+            raise AssertionError("Whole field should not have been read")
+
+        path = testdata_filepath("n48_eg_regular_sample.ff")
+        for mmap in (False, True):
+            ffv = FieldsFile.from_file(path, mmap=mmap)
+            fields = [field for field in ffv.fields
+                      if field.lbrel in (2, 3) and field.lbpack in (0, 2)]
+            self.assertTrue(fields)
+            for field in fields:
+                data = field.get_data()
+                field._data_provider._read_payload = unread
+                for rows in (slice(10, 20), slice(0, 1), slice(-5, None)):
+                    self.assertArrayEqual(field.get_data(rows=rows),
+                                          data[rows])
+
 
 class Test_from_template(tests.MuleTest):
     def test_fieldsfile_minimal_create(self):
@@ -146,6 +271,48 @@ class Test_from_template(tests.MuleTest):
                          (71, 9))
 
 
+class Test_to_file(tests.MuleTest):
+    def test_repack_workers(self):
+        # Changing the packing forces every field to be read and re-packed;
+        # doing this with a pool of workers should give an identical file
+        ffv = FieldsFile.from_file(testdata_filepath("n48_multi_field.ff"))
+        for field in ffv.fields:
+            if field.lbrel in (2, 3) and field.lbuser1 == 1:
+                field.lbpack = 1 if field.lbpack == 0 else 0
+                field.bacc = -10
+        try:
+            with self.temp_filename() as temp_path:
+                ffv.to_file(temp_path)
+                with open(temp_path, 'rb') as temp_file:
+                    expected_bytes = temp_file.read()
+        except NotImplementedError:
+            self.skipTest("WGDOS packing library unavailable")
+        with self.temp_filename() as temp_path:
+            ffv.to_file(temp_path, workers=3)
+            with open(temp_path, 'rb') as temp_file:
+                self.assertEqual(temp_file.read(), expected_bytes)
+
+    def test_repack_cray32(self):
+        # Cray32 packed fields should read back as native double precision
+        # (or single precision if requested) copies of the 32-bit values
+        ffv = FieldsFile.from_file(testdata_filepath("n48_multi_field.ff"))
+        expected = {}
+        for ifield, field in enumerate(ffv.fields):
+            if field.lbpack == 0 and field.lbuser1 == 1:
+                field.lbpack = 2
+                expected[ifield] = field.get_data().astype(np.float32)
+        self.assertNotEqual(len(expected), 0)
+        with self.temp_filename() as temp_path:
+            ffv.to_file(temp_path)
+            for dtype in (np.float64, np.float32):
+                ffv_read = FieldsFile.from_file(temp_path, unpack_dtype=dtype)
+                for ifield, data in expected.items():
+                    data_read = ffv_read.fields[ifield].get_data()
+                    self.assertEqual(data_read.dtype, dtype)
+                    self.assertTrue(data_read.dtype.isnative)
+                    self.assertArrayEqual(data_read, data)
+
+
 class Test_validate(tests.MuleTest):
     _dflt_nx = 4
     _dflt_ny = 3
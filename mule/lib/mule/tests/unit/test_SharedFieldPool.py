@@ -0,0 +1,80 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Unit tests for :class:`mule.cache.SharedFieldPool`.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+from six.moves import (filter, input, map, range, zip)  # noqa
+
+import pickle
+
+import mule
+import mule.tests as tests
+from mule.tests import COMMON_N48_TESTDATA_PATH
+
+from mule import FieldsFile
+from mule.cache import SharedFieldPool
+
+
+class Test_SharedFieldPool(tests.MuleTest):
+    def setUp(self):
+        self.ffv = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH)
+
+    def test_from_fields(self):
+        fields = list(mule.iter_fields(self.ffv))
+        with SharedFieldPool.from_fields(fields, workers=2) as pool:
+            self.assertEqual(len(pool), len(fields))
+            ffv = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH, cache=pool)
+            for field, field_direct in zip(mule.iter_fields(ffv), fields):
+                data = field.get_data()
+                # Pooled data is shared, so can't be modified
+                self.assertFalse(data.flags.writeable)
+                self.assertArrayEqual(data, field_direct.get_data())
+            self.assertGreaterEqual(pool.hits, len(fields))
+            self.assertEqual(pool.misses, 0)
+
+    def test_attach(self):
+        # The handle can be pickled, and another pool attached using it
+        # sees the same data
+        fields = list(mule.iter_fields(self.ffv))[:2]
+        with SharedFieldPool.from_fields(fields) as pool:
+            handle = pickle.loads(pickle.dumps(pool.handle))
+            with SharedFieldPool.attach(handle) as attached:
+                key = fields[1]._data_provider._cache_key()
+                self.assertArrayEqual(attached.get(key, lambda: None),
+                                      fields[1].get_data())
+                # Keys not in the pool fall back to the given function
+                self.assertIsNone(attached.get("missing", lambda: None))
+                self.assertEqual((attached.hits, attached.misses), (1, 1))
+
+    def test_closed(self):
+        # Once closed, the pool just loads the data as normal
+        fields = list(mule.iter_fields(self.ffv))[:1]
+        pool = SharedFieldPool.from_fields(fields)
+        key = fields[0]._data_provider._cache_key()
+        pool.unlink()
+        pool.close()
+        self.assertIsNone(pool.get(key, lambda: None))
+
+
+if __name__ == '__main__':
+    tests.main()
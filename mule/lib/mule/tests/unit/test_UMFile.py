@@ -31,6 +31,7 @@ import shutil
 import tempfile
 import warnings
 
+import mule
 import mule.tests as tests
 from mule.tests import check_common_n48_testdata, COMMON_N48_TESTDATA_PATH
 
@@ -103,6 +104,55 @@ class Test_to_file__targets(tests.MuleTest):
             ffv_rb = UMFile.from_file(temp_path)
             check_common_n48_testdata(self, ffv_rb)
 
+    def test_copy_workers(self):
+        # Writing with a pool of workers should give an identical file
+        ffv = UMFile.from_file(COMMON_N48_TESTDATA_PATH)
+        with self.temp_filename() as temp_path:
+            ffv.to_file(temp_path)
+            with open(temp_path, 'rb') as temp_file:
+                expected_bytes = temp_file.read()
+        with self.temp_filename() as temp_path:
+            ffv.to_file(temp_path, workers=4)
+            with open(temp_path, 'rb') as temp_file:
+                self.assertEqual(temp_file.read(), expected_bytes)
+            ffv_rb = UMFile.from_file(temp_path)
+            check_common_n48_testdata(self, ffv_rb)
+
+
+
+class Test_stream_to_file(tests.MuleTest):
+    def test_stream_copy(self):
+        # Streaming the fields should give the same file contents as a
+        # normal write (the unused lookup entry is left empty)
+        ffv = UMFile.from_file(COMMON_N48_TESTDATA_PATH)
+        with self.temp_filename() as temp_path:
+            n_fields = mule.stream_to_file(
+                mule.iter_fields(COMMON_N48_TESTDATA_PATH), ffv, temp_path)
+            self.assertEqual(n_fields, 4)
+            ffv_rb = UMFile.from_file(temp_path)
+            check_common_n48_testdata(self, ffv_rb)
+            for field, field_rb in zip(ffv.fields[:-1], ffv_rb.fields):
+                self.assertArrayEqual(field._get_raw_payload_bytes(),
+                                      field_rb._get_raw_payload_bytes())
+        # The template itself should be unchanged
+        self.assertEqual(len(ffv.fields), 5)
+
+    def test_iter_fields_filter(self):
+        ffv = UMFile.from_file(COMMON_N48_TESTDATA_PATH, lazy=True)
+        fields = list(mule.iter_fields(ffv, filter={"lbvc": 1}))
+        self.assertEqual([field.lbvc for field in fields], [1, 1])
+        fields = list(mule.iter_fields(
+            ffv, filter=lambda field: field.lbvc != 1))
+        self.assertEqual([field.lbvc for field in fields], [6, 129])
+        # None of the fields should have been kept by the lazy list
+        self.assertEqual(ffv.fields.created(), [])
+
+    def test_stream_too_many(self):
+        ffv = UMFile.from_file(COMMON_N48_TESTDATA_PATH)
+        with self.temp_filename() as temp_path:
+            with six.assertRaisesRegex(self, ValueError, "at most 2"):
+                mule.stream_to_file(ffv.fields, ffv, temp_path,
+                                    max_fields=2)
 
 class Test_to_file__minimal(tests.MuleTest):
     def test_copy_byfile(self):
@@ -0,0 +1,117 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Unit tests for :mod:`mule.instrument`.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+from six.moves import (filter, input, map, range, zip)  # noqa
+
+import six
+
+import mule
+import mule.tests as tests
+from mule.tests import COMMON_N48_TESTDATA_PATH
+
+from mule import FieldsFile, ArrayDataProvider
+from mule import instrument
+from mule import operators
+
+
+class Test_instrument(tests.MuleTest):
+    def setUp(self):
+        self.was_enabled = instrument.enabled
+        instrument.reset()
+        self.ffv = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH)
+        # Only the unpacked fields are used, so that the tests don't need
+        # a WGDOS packing library (and not the land-sea mask, which is read
+        # again when a file containing it is written)
+        self.fields = [field for field in self.ffv.fields
+                       if field.lbrel in (2, 3) and field.lbpack == 0 and
+                       field.lbuser4 != 30]
+
+    def tearDown(self):
+        if self.was_enabled:
+            instrument.enable()
+        else:
+            instrument.disable()
+        instrument.reset()
+
+    def test_disabled(self):
+        instrument.disable()
+        self.fields[0].get_data()
+        self.assertEqual(mule.stats(), {})
+
+    def test_read_and_decode(self):
+        instrument.enable()
+        for field in self.fields[:3]:
+            data = field.get_data()
+        stats = mule.stats()
+        self.assertEqual(stats["read"]["calls"], 3)
+        self.assertEqual(stats["decode lbpack=0"]["calls"], 3)
+        self.assertEqual(stats["decode lbpack=0"]["bytes"], 3*data.nbytes)
+        self.assertGreaterEqual(stats["decode lbpack=0"]["seconds"],
+                                stats["read"]["seconds"])
+
+        # Turning the counting off keeps the values until they are reset
+        instrument.disable()
+        self.fields[0].get_data()
+        self.assertEqual(mule.stats()["read"]["calls"], 3)
+        instrument.reset()
+        self.assertEqual(mule.stats(), {})
+
+    def test_write(self):
+        self.ffv.fields = self.fields[:2]
+        # The second field has to be encoded again to be written
+        field = self.ffv.fields[1]
+        field.set_data_provider(ArrayDataProvider(field.get_data()))
+        instrument.enable()
+        with self.temp_filename() as temp_path:
+            self.ffv.to_file(temp_path)
+        stats = mule.stats()
+        self.assertEqual(stats["write"]["calls"], 2)
+        self.assertEqual(stats["encode lbpack=0"]["calls"], 1)
+        self.assertEqual(stats["read"]["calls"], 1)
+
+    def test_operators(self):
+        # A chain of pointwise operators is evaluated in one pass, which is
+        # timed as the last operator of the chain
+        scaled = operators.ScaleFactorOperator(2.0)(self.fields[0])
+        added = operators.AddScalarOperator(1.0)(scaled)
+        instrument.enable()
+        added.get_data()
+        stats = mule.stats()
+        self.assertEqual(stats["operator AddScalarOperator"]["calls"], 1)
+        self.assertNotIn("operator ScaleFactorOperator", stats)
+
+    def test_summary(self):
+        instrument.enable()
+        self.fields[0].get_data()
+        stdout = six.StringIO()
+        instrument.summary(stdout)
+        lines = stdout.getvalue().splitlines()
+        self.assertTrue(lines[0].startswith("Phase"))
+        self.assertEqual(sorted(line.split()[0] for line in lines[1:]),
+                         ["decode", "read"])
+
+
+if __name__ == '__main__':
+    tests.main()
@@ -179,6 +179,66 @@ class Test_operators(tests.MuleTest):
         valid[2, 2] = 123.0
         self.run_operator_test(data, operator, valid)
 
+    # Test a chain of single field operators gives the same result as
+    # applying each operator separately
+    def test_chained_operators(self):
+        data = np.arange(12, dtype="float32").reshape(4, 3)
+        data[2, 2] = self.MDI
+        chain = [operators.ValueExchangeOperator(5.0, self.MDI),
+                 operators.AddScalarOperator(0.1),
+                 operators.ScaleFactorOperator(3.0),
+                 operators.HardLimitOperator(lower_limit=3.0,
+                                             upper_limit=25.0,
+                                             upper_fill=-5.0),
+                 operators.AddScalarOperator(-2.0)]
+        fld = self._field_from_data(data.copy())
+        valid = data.copy()
+        for operator in chain:
+            fld = operator(fld)
+            valid = operator.transform(self._field_from_data(valid), None)
+
+        # The operators should have been combined into a single provider
+        provider = fld._data_provider
+        self.assertIsInstance(provider, operators._PointwiseDataProvider)
+        self.assertEqual([stage[0] for stage in provider.stages], chain)
+
+        result = fld.get_data()
+        self.assertEqual(result.dtype, valid.dtype)
+        self.assertArrayEqual(result, valid)
+
+    # Test chained operators don't modify the source data in place
+    def test_chained_operators_source(self):
+        data = np.arange(12, dtype="float").reshape(4, 3)
+        fld = self._field_from_data(data)
+        scaled = operators.ScaleFactorOperator(2.0)(fld)
+        added = operators.AddScalarOperator(1.0)(scaled)
+        self.assertArrayEqual(added.get_data(), data*2.0 + 1.0)
+        self.assertArrayEqual(scaled.get_data(), data*2.0)
+        self.assertArrayEqual(fld.get_data(),
+                              np.arange(12, dtype="float").reshape(4, 3))
+
+    # Test replacing the data of a field part way along a chain
+    def test_chained_operators_replaced(self):
+        data = np.arange(12, dtype="float").reshape(4, 3)
+        fld = self._field_from_data(data)
+        scaled = operators.ScaleFactorOperator(2.0)(fld)
+        added = operators.AddScalarOperator(1.0)(scaled)
+        scaled.set_data_provider(ArrayDataProvider(data + 5.0))
+        self.assertArrayEqual(added.get_data(), data + 6.0)
+
+    # Test that arguments for new_field are passed through by the operators
+    def test_new_field_arguments(self):
+        class LabelOperator(operators.AddScalarOperator):
+            def new_field(self, source_field, lbproc=0):
+                new_field = source_field.copy()
+                new_field.lbproc = lbproc
+                return new_field
+
+        data = np.arange(12, dtype="float").reshape(4, 3)
+        new_field = LabelOperator(1.0)(self._field_from_data(data), 128)
+        self.assertEqual(new_field.lbproc, 128)
+        self.assertArrayEqual(new_field.get_data(), data + 1.0)
+
     # Test adding multiple fields together
     def test_AddFieldsOperator(self):
         data1 = np.arange(12, dtype="float").reshape(4, 3)
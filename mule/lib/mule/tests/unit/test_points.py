@@ -0,0 +1,81 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Unit tests for :func:`mule.points.extract_points`.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+from six.moves import (filter, input, map, range, zip)  # noqa
+
+import six
+import numpy as np
+
+import mule.tests as tests
+from mule.tests import COMMON_N48_TESTDATA_PATH
+
+from mule import FieldsFile
+from mule.points import extract_points
+
+
+class Test_extract_points(tests.MuleTest):
+    def setUp(self):
+        self.ffv = FieldsFile.from_file(COMMON_N48_TESTDATA_PATH)
+        self.fields = self.ffv.fields[:-1]
+        self.stash_codes = [field.lbuser4 for field in self.fields]
+        # Points spread over a few separate bands of rows
+        self.rows = np.array([0, 1, 40, 3, 71, 40])
+        self.cols = np.array([0, 95, 7, 50, 2, 8])
+
+    def test_extract(self):
+        try:
+            for workers in (None, 3):
+                values = extract_points(
+                    [COMMON_N48_TESTDATA_PATH, COMMON_N48_TESTDATA_PATH],
+                    self.stash_codes, self.rows, self.cols, workers=workers)
+                self.assertEqual(values.shape, (2, len(self.fields), 6))
+                for ifield, field in enumerate(self.fields):
+                    expected = field.get_data()[self.rows, self.cols]
+                    self.assertArrayEqual(values[0, ifield], expected)
+                    self.assertArrayEqual(values[1, ifield], expected)
+        except NotImplementedError:
+            self.skipTest("WGDOS packing library unavailable")
+
+    def test_stash_order(self):
+        # The fields are returned in the order of the requested codes, and
+        # UMFile objects may be given in place of paths
+        try:
+            values = extract_points([self.ffv], self.stash_codes[::-1][:1],
+                                    self.rows, self.cols)
+        except NotImplementedError:
+            self.skipTest("WGDOS packing library unavailable")
+        expected = [field.get_data()[self.rows, self.cols]
+                    for field in self.fields
+                    if field.lbuser4 == self.stash_codes[-1]]
+        self.assertArrayEqual(values[0], expected)
+
+    def test_mismatched_points__fail(self):
+        with six.assertRaisesRegex(self, ValueError, "same number"):
+            extract_points([COMMON_N48_TESTDATA_PATH], self.stash_codes,
+                           self.rows, self.cols[:-1])
+
+
+if __name__ == '__main__':
+    tests.main()
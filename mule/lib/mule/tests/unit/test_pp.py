@@ -24,6 +24,10 @@ Unit tests for :module:`mule.pp`.
 
 from __future__ import (absolute_import, division, print_function)
 
+import io
+import os
+import six
+import shutil
 import mule
 import mule.tests as tests
 from mule.tests import testdata_filepath
@@ -108,6 +112,44 @@ class Test_load_fields(tests.MuleTest):
         self.assertEqual(len(field.pp_extra_data[14]), field.lbrow)
         self.assertEqual(len(field.pp_extra_data[15]), field.lbrow)
 
+    def test_read_ppfile_truncated(self):
+        with open(testdata_filepath("n48_multi_field.pp"), "rb") as pp_file:
+            contents = pp_file.read()
+        with self.temp_filename(suffix=".pp") as temp_path:
+            # Cut the file off part way through the final data record
+            with open(temp_path, "wb") as pp_file:
+                pp_file.write(contents[:-8])
+            with six.assertRaisesRegex(self, ValueError,
+                                       "Field 4; File ends part way"):
+                fields_from_pp_file(temp_path)
+
+            # And with the final record's check marker corrupted
+            with open(temp_path, "wb") as pp_file:
+                pp_file.write(contents[:-4] + b"\x00\x00\x00\x01")
+            with six.assertRaisesRegex(self, ValueError,
+                                       "Inconsistent data record"):
+                fields_from_pp_file(temp_path)
+
+    def test_scan_ppfile_stream(self):
+        # A file object which can't be mapped should be scanned (record by
+        # record) to give the same positions as the mapped file, and report
+        # the same errors
+        path = testdata_filepath("ukv_eg_variable_sample.pp")
+        with open(path, "rb") as pp_file:
+            contents = pp_file.read()
+            pp_file.seek(0)
+            expected = mule.pp._scan_pp_file(pp_file)
+        result = mule.pp._scan_pp_file(io.BytesIO(contents))
+        for array, expected_array in zip(result, expected):
+            self.assertArrayEqual(array, expected_array)
+
+        for truncated, message in ((contents[:-8], "File ends part way"),
+                                   (contents[:100], "File ends part way"),
+                                   (contents[:-4] + b"\x00\x00\x00\x01",
+                                    "Inconsistent data record")):
+            with six.assertRaisesRegex(self, ValueError, message):
+                mule.pp._scan_pp_file(io.BytesIO(truncated))
+
     def test_ff_to_pp_fix_grid(self):
         ff = mule.FieldsFile.from_file(
             testdata_filepath("n48_multi_field.ff"))
@@ -127,5 +169,64 @@ class Test_load_fields(tests.MuleTest):
             self.test_read_ppfile_var_grid(temp_path)
 
 
+
+class Test_index(tests.MuleTest):
+    """Test the reading of pp files via a sidecar index"""
+    def _check_index(self, fname):
+        expected = fields_from_pp_file(testdata_filepath(fname))
+        with self.temp_filename(suffix=".pp") as temp_path:
+            shutil.copyfile(testdata_filepath(fname), temp_path)
+            index_path = mule.index.index_path(temp_path)
+            try:
+                # The first read scans the file and writes the index, the
+                # second should then be loaded from the index
+                for _ in range(2):
+                    pp = fields_from_pp_file(temp_path, index=True)
+                    self.assertTrue(os.path.exists(index_path))
+                    self.assertIsNotNone(
+                        mule.index.read_index(temp_path, "pp"))
+                    self.assertEqual(len(pp), len(expected))
+                    for field, field_exp in zip(pp, expected):
+                        self.assertArrayEqual(field.raw[1:],
+                                              field_exp.raw[1:])
+                        self.assertEqual(field._data_provider.offset,
+                                         field_exp._data_provider.offset)
+                        if field_exp.pp_extra_data is None:
+                            self.assertIsNone(field.pp_extra_data)
+                        else:
+                            self.assertEqual(
+                                sorted(field.pp_extra_data.keys()),
+                                sorted(field_exp.pp_extra_data.keys()))
+                            for key, vector in field.pp_extra_data.items():
+                                self.assertArrayEqual(
+                                    vector, field_exp.pp_extra_data[key])
+            finally:
+                if os.path.exists(index_path):
+                    os.remove(index_path)
+
+    def test_index_fix_grid(self):
+        self._check_index("n48_multi_field.pp")
+
+    def test_index_var_grid(self):
+        self._check_index("ukv_eg_variable_sample.pp")
+
+    def test_index_stale(self):
+        with self.temp_filename(suffix=".pp") as temp_path:
+            shutil.copyfile(testdata_filepath("n48_multi_field.pp"),
+                            temp_path)
+            index_path = mule.index.index_path(temp_path)
+            try:
+                fields_from_pp_file(temp_path, index=True)
+                self.assertIsNotNone(mule.index.read_index(temp_path, "pp"))
+                # Once the file has changed its index must not be used
+                stat = os.stat(temp_path)
+                os.utime(temp_path, ns=(stat.st_atime_ns,
+                                        stat.st_mtime_ns + 10**9))
+                self.assertIsNone(mule.index.read_index(temp_path, "pp"))
+                self.assertIsNone(mule.index.read_index(temp_path, "um"))
+            finally:
+                if os.path.exists(index_path):
+                    os.remove(index_path)
+
 if __name__ == '__main__':
     tests.main()
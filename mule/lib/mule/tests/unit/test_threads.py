@@ -0,0 +1,87 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Unit tests for the thread controls of :mod:`mule.packing`.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+from six.moves import (filter, input, map, range, zip)  # noqa
+
+import threading
+
+import mule.tests as tests
+
+from mule import packing
+
+
+class Test_threads(tests.MuleTest):
+    def setUp(self):
+        # Only check the counts when the library supports the setting
+        self.supported = packing._threads_module is not None
+
+    def test_context(self):
+        before = packing.get_threads()
+        with packing.threads(3):
+            if self.supported:
+                self.assertEqual(packing.get_threads(), 3)
+            with packing.threads(2):
+                if self.supported:
+                    self.assertEqual(packing.get_threads(), 2)
+            if self.supported:
+                self.assertEqual(packing.get_threads(), 3)
+        self.assertEqual(packing.get_threads(), before)
+
+    def test_other_threads(self):
+        # The setting only applies to the thread which made it
+        seen = []
+        with packing.threads(3):
+            thread = threading.Thread(
+                target=lambda: seen.append(packing.get_threads()))
+            thread.start()
+            thread.join()
+        self.assertEqual(seen, [packing.get_threads()])
+
+    def test_single_threaded(self):
+        self.assertEqual(
+            packing.single_threaded(lambda value: value + 1, 1), 2)
+        if self.supported:
+            self.assertEqual(
+                packing.single_threaded(packing.get_threads), 1)
+
+    def test_set_threads(self):
+        previous = packing.set_threads(2)
+        try:
+            if self.supported:
+                self.assertEqual(packing.get_threads(), 2)
+                self.assertEqual(packing.set_threads(None), 2)
+        finally:
+            packing.set_threads(previous)
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            with packing.threads(0):
+                pass
+        with self.assertRaises(ValueError):
+            packing.set_threads(-1)
+
+
+if __name__ == '__main__':
+    tests.main()
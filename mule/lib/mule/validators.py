@@ -133,8 +133,15 @@ def validate_umf(umf, filename=None, warn=False, GridArakawaA=False):
         # For the fields, a dictionary will be used to accumulate the
         # errors, where the keys are the error messages.  This will allow
         # us to only print each message once (with a list of fields).
+        # (If the lookup is being read lazily, fields which haven't been
+        # created yet are made only to be checked, and aren't kept)
         field_validation = defaultdict(list)
-        for ifield, field in enumerate(umf.fields):
+        if isinstance(umf.fields, mule._LazyFieldList):
+            fields = ((ifield, umf.fields.peek(ifield))
+                      for ifield in range(len(umf.fields)))
+        else:
+            fields = enumerate(umf.fields)
+        for ifield, field in fields:
             if (umf.fixed_length_header.dataset_type in (1, 2) and
                     field.lbrel == mule._INTEGER_MDI):
                 # In dumps, some headers are special mean fields
@@ -18,6 +18,10 @@
 # You should have received a copy of the Modified BSD License
 # along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
 
-from .um_packing import wgdos_pack, wgdos_unpack, get_shumlib_version
+from .um_packing import (wgdos_pack, wgdos_pack_many, wgdos_unpack,
+                         wgdos_unpack_many, landsea_expand, landsea_compress,
+                         compare_arrays, cray32_unpack, cray32_pack,
+                         get_shumlib_version, set_stats, get_stats,
+                         reset_stats, set_threads, get_threads)
 
 __version__ = "2025.10.1"
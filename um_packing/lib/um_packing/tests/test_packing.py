@@ -29,7 +29,11 @@ import sys
 import numpy as np
 
 import um_packing.tests as tests
-from um_packing import wgdos_unpack, wgdos_pack
+from um_packing import (wgdos_unpack, wgdos_pack, wgdos_unpack_many,
+                        wgdos_pack_many, landsea_expand, landsea_compress,
+                        compare_arrays, cray32_unpack, cray32_pack,
+                        set_stats, get_stats, reset_stats, set_threads,
+                        get_threads, wgdos_unpack_keywords)
 
 
 def get_random_data(mdi):
@@ -83,5 +87,399 @@ class Test_packing(tests.UMPackingTest):
 
         self.assertArrayEqual(np.abs(unpacked_array - reunpacked_array), 0.0)
 
+    def test_4_unpack_unmodified(self):
+        # Unpacking should not modify the packed bytes, so unpacking them
+        # for a second time should give exactly the same result
+        _, packed_bytes = self.test_1_pack()
+        original_bytes = bytes(bytearray(packed_bytes))
+
+        unpacked_array = wgdos_unpack(packed_bytes, self.MDI)
+        self.assertEqual(packed_bytes, original_bytes)
+
+        reunpacked_array = wgdos_unpack(packed_bytes, self.MDI)
+        self.assertArrayEqual(unpacked_array, reunpacked_array)
+
+    def test_5_unpack_buffers(self):
+        # The unpacking should accept any object supporting the buffer
+        # protocol, giving identical results for each
+        _, packed_bytes = self.test_1_pack()
+        unpacked_array = wgdos_unpack(packed_bytes, self.MDI)
+
+        for buffer_in in (memoryview(packed_bytes),
+                          np.frombuffer(packed_bytes, dtype=np.uint8),
+                          bytearray(packed_bytes)):
+            self.assertArrayEqual(wgdos_unpack(buffer_in, self.MDI),
+                                  unpacked_array)
+
+
+class Test_unpack_many(tests.UMPackingTest):
+    # Values of missing data and accuracy to use
+    MDI = -1.23456789
+    ACCURACY = -10
+
+    def _packed_fields(self, n_fields):
+        # Packs a few different fields, returning the packed bytes for each
+        # alongside the result of unpacking them individually
+        packed = [wgdos_pack(get_random_data(self.MDI), self.MDI,
+                             self.ACCURACY) for _ in range(n_fields)]
+        expected = [wgdos_unpack(packed_bytes, self.MDI)
+                    for packed_bytes in packed]
+        return packed, expected
+
+    def test_unpack_many_list(self):
+        # Unpacking a batch should give identical results to unpacking
+        # each field in turn
+        packed, expected = self._packed_fields(4)
+        unpacked = wgdos_unpack_many(packed, self.MDI)
+        self.assertEqual(len(unpacked), 4)
+        for array, expected_array in zip(unpacked, expected):
+            self.assertArrayEqual(array, expected_array)
+
+    def test_unpack_many_stack(self):
+        # When stacked, the fields should form the levels of a 3D array
+        packed, expected = self._packed_fields(3)
+        unpacked = wgdos_unpack_many(packed, [self.MDI]*3, stack=True)
+        self.assertEqual(unpacked.shape, (3, 500, 700))
+        self.assertArrayEqual(unpacked, np.array(expected))
+
+    def test_unpack_many_stack_mismatch(self):
+        # Fields of different sizes cannot be stacked
+        packed = [wgdos_pack(get_random_data(self.MDI), self.MDI,
+                             self.ACCURACY),
+                  wgdos_pack(get_random_data(self.MDI)[:200], self.MDI,
+                             self.ACCURACY)]
+        with self.assertRaisesRegex(ValueError, "same dimensions"):
+            wgdos_unpack_many(packed, self.MDI, stack=True)
+
+
+class Test_unpack_out(tests.UMPackingTest):
+    # Values of missing data and accuracy to use
+    MDI = -1.23456789
+    ACCURACY = -10
+
+    def test_unpack_into_out(self):
+        # Unpacking into the level of a preallocated 3D array should fill
+        # it with the same values as the normal unpacking
+        packed_bytes = wgdos_pack(get_random_data(self.MDI), self.MDI,
+                                  self.ACCURACY)
+        expected = wgdos_unpack(packed_bytes, self.MDI)
+
+        cube = np.zeros((2, 500, 700))
+        result = wgdos_unpack(packed_bytes, self.MDI, out=cube[1])
+        self.assertArrayEqual(cube[1], expected)
+        self.assertArrayEqual(cube[0], 0.0)
+        self.assertTrue(np.shares_memory(result, cube))
+
+    def test_unpack_into_bad_out(self):
+        # Only arrays which can be written to directly are accepted
+        packed_bytes = wgdos_pack(get_random_data(self.MDI), self.MDI,
+                                  self.ACCURACY)
+        bad_outs = (np.zeros((500, 699)),
+                    np.zeros((500, 700), dtype=np.float32),
+                    np.zeros((500, 700), dtype=">f8"),
+                    np.zeros((700, 500)).T)
+        for out in bad_outs:
+            with self.assertRaises(ValueError):
+                wgdos_unpack(packed_bytes, self.MDI, out=out)
+
+
+class Test_unpack_dtype(tests.UMPackingTest):
+    # Values of missing data and accuracy to use
+    MDI = -1.23456789
+    ACCURACY = -10
+
+    def test_unpack_float32(self):
+        # Unpacking to single precision should give the same values as
+        # unpacking to double precision and then converting
+        packed_bytes = wgdos_pack(get_random_data(self.MDI), self.MDI,
+                                  self.ACCURACY)
+        expected = wgdos_unpack(packed_bytes, self.MDI).astype(np.float32)
+
+        unpacked = wgdos_unpack(packed_bytes, self.MDI, dtype=np.float32)
+        self.assertEqual(unpacked.dtype, np.float32)
+        self.assertArrayEqual(unpacked, expected)
+
+        out = np.empty((500, 700), dtype=np.float32)
+        wgdos_unpack(packed_bytes, self.MDI, out=out, dtype="f4")
+        self.assertArrayEqual(out, expected)
+
+    def test_unpack_bad_dtype(self):
+        packed_bytes = wgdos_pack(get_random_data(self.MDI), self.MDI,
+                                  self.ACCURACY)
+        with self.assertRaisesRegex(ValueError, "float64 or float32"):
+            wgdos_unpack(packed_bytes, self.MDI, dtype=np.int32)
+
+
+class Test_unpack_rows(tests.UMPackingTest):
+    # Values of missing data and accuracy to use
+    MDI = -1.23456789
+    ACCURACY = -10
+
+    def setUp(self):
+        self.packed_bytes = wgdos_pack(get_random_data(self.MDI), self.MDI,
+                                       self.ACCURACY)
+        self.expected = wgdos_unpack(self.packed_bytes, self.MDI)
+
+    def test_unpack_rows(self):
+        # Unpacking a range of rows should give the same values as unpacking
+        # the whole field (including over the rows containing MDI)
+        for row_start, row_end in ((0, 1), (340, 410), (499, 500), (0, 500),
+                                   (200, 200)):
+            unpacked = wgdos_unpack(self.packed_bytes, self.MDI,
+                                    row_start=row_start, row_end=row_end)
+            self.assertArrayEqual(unpacked,
+                                  self.expected[row_start:row_end])
+
+    def test_unpack_rows_float32_out(self):
+        out = np.empty((50, 700), dtype=np.float32)
+        result = wgdos_unpack(self.packed_bytes, self.MDI, out=out,
+                              dtype=np.float32, row_start=100, row_end=150)
+        self.assertIs(result, out)
+        self.assertArrayEqual(out, self.expected[100:150].astype(np.float32))
+
+    def test_unpack_keywords(self):
+        # Every optional keyword the module lists should be accepted
+        kwargs = {"out": None, "dtype": np.float64, "row_start": 100,
+                  "row_end": 150, "threads": 1}
+        self.assertEqual(set(wgdos_unpack_keywords), set(kwargs))
+        unpacked = wgdos_unpack(self.packed_bytes, self.MDI, **kwargs)
+        self.assertArrayEqual(unpacked, self.expected[100:150])
+
+    def test_unpack_bad_rows(self):
+        for row_start, row_end in ((-1, 10), (10, 5), (0, 501)):
+            with self.assertRaisesRegex(ValueError, "Invalid range of rows"):
+                wgdos_unpack(self.packed_bytes, self.MDI,
+                             row_start=row_start, row_end=row_end)
+
+
+class Test_pack_many(tests.UMPackingTest):
+    # Values of missing data and accuracy to use
+    MDI = -1.23456789
+    ACCURACY = -10
+
+    def test_pack_many(self):
+        # Packing a batch should give identical results to packing each
+        # field in turn, including with per-field accuracies
+        arrays = [get_random_data(self.MDI) for _ in range(4)]
+        accuracies = [self.ACCURACY, -8, -6, self.ACCURACY]
+        packed = wgdos_pack_many(arrays, self.MDI, accuracies)
+        self.assertEqual(len(packed), 4)
+        for packed_bytes, array, accuracy in zip(packed, arrays, accuracies):
+            self.assertEqual(packed_bytes,
+                             wgdos_pack(array, self.MDI, accuracy))
+
+    def test_pack_many_non_contiguous(self):
+        # Arrays which aren't contiguous (or native double precision) are
+        # converted before packing
+        array = get_random_data(self.MDI)
+        expected = wgdos_pack(np.ascontiguousarray(array[:, ::2]),
+                              self.MDI, self.ACCURACY)
+        packed = wgdos_pack_many([array[:, ::2], array.astype(">f8")],
+                                 [self.MDI, self.MDI], self.ACCURACY)
+        self.assertEqual(packed[0], expected)
+        self.assertEqual(packed[1], wgdos_pack(array, self.MDI,
+                                               self.ACCURACY))
+
+    def test_pack_non_contiguous(self):
+        # A single field is converted in the same way
+        array = get_random_data(self.MDI)
+        self.assertEqual(wgdos_pack(array[:, ::2], self.MDI, self.ACCURACY),
+                         wgdos_pack(np.ascontiguousarray(array[:, ::2]),
+                                    self.MDI, self.ACCURACY))
+        self.assertEqual(wgdos_pack(array.astype(">f8"), self.MDI,
+                                    self.ACCURACY),
+                         wgdos_pack(array, self.MDI, self.ACCURACY))
+
+    def test_pack_bad_dimensions(self):
+        with self.assertRaisesRegex(ValueError, "must be 2 Dimensional"):
+            wgdos_pack(np.zeros(10), self.MDI, self.ACCURACY)
+
+
+class Test_landsea(tests.UMPackingTest):
+    # Value to set at the points which aren't selected
+    MDI = -1.23456789
+
+    def setUp(self):
+        grid = np.random.random(500*700)
+        self.mask = grid > 0.3
+        self.data = (grid*10**5).astype("int")/10.0**2
+
+    def test_expand(self):
+        # Expanding should fill the unselected points and scatter the
+        # selected values, for any size and byte order of data
+        for dtype in ("f8", ">f4", "i4"):
+            packed = self.data[self.mask].astype(dtype)
+            expected = np.empty(self.mask.size, dtype)
+            expected[:] = self.MDI
+            expected[self.mask] = packed
+            out = np.empty(self.mask.size, dtype)
+            result = landsea_expand(packed, self.mask,
+                                    np.array(self.MDI, dtype), out)
+            self.assertIs(result, out)
+            self.assertArrayEqual(out, expected)
+
+    def test_compress(self):
+        # Compressing should extract the selected values only
+        for dtype in ("f8", ">f4", "i4"):
+            data = self.data.astype(dtype)
+            out = np.empty(np.count_nonzero(self.mask), dtype)
+            result = landsea_compress(data, self.mask, out)
+            self.assertIs(result, out)
+            self.assertArrayEqual(out, data[self.mask])
+
+    def test_expand_mismatch(self):
+        # The number of packed values must match the number of selected
+        # points in the mask
+        packed = self.data[self.mask][:-1]
+        out = np.empty(self.mask.size)
+        with self.assertRaisesRegex(ValueError, "incompatible"):
+            landsea_expand(packed, self.mask, np.array(self.MDI), out)
+
+
+class Test_compare_arrays(tests.UMPackingTest):
+    def setUp(self):
+        self.a = np.random.random((500, 700))
+
+    def test_identical(self):
+        # NaNs in the same place in both arrays shouldn't count as different
+        self.a[10, 20] = np.nan
+        self.assertEqual(compare_arrays(self.a, self.a.copy()),
+                         (0, 0.0, 0.0))
+
+    def test_differences(self):
+        # The results should match those calculated from a difference array
+        # (and be unaffected by the byte order or precision of the inputs)
+        b = self.a + np.random.random(self.a.shape)*(self.a > 0.9)
+        diff = np.abs(self.a - b)
+        for a_in in (self.a, self.a.astype(">f8")):
+            n_differ, max_diff, rms_diff = compare_arrays(a_in, b)
+            self.assertEqual(n_differ, np.count_nonzero(diff))
+            self.assertEqual(max_diff, np.max(diff))
+            self.assertAlmostEqual(rms_diff, np.sqrt(np.mean(diff**2)))
+
+    def test_stop_at_first(self):
+        # Stopping early should still find a difference, but not all of them
+        b = self.a.copy()
+        b[0, 0] += 1.0
+        b[-1, -1] += 1.0
+        n_differ, max_diff, _ = compare_arrays(self.a, b, stop_at_first=True)
+        self.assertEqual(n_differ, 1)
+        self.assertEqual(compare_arrays(self.a, b)[0], 2)
+
+    def test_size_mismatch(self):
+        with self.assertRaisesRegex(ValueError, "same number of elements"):
+            compare_arrays(self.a, self.a[:-1])
+
+
+class Test_cray32(tests.UMPackingTest):
+    def setUp(self):
+        self.data = get_random_data(-99.0).astype("f4").astype("f8")
+        self.ints = np.arange(-5000, 5000, dtype="i8")
+
+    def test_unpack(self):
+        # The result should match a big-endian view of the words
+        for dtype in ("f8", "f4"):
+            data_bytes = self.data.astype(">f4").tobytes()
+            unpacked = cray32_unpack(data_bytes, self.data.size, dtype=dtype)
+            self.assertEqual(unpacked.dtype, np.dtype(dtype))
+            self.assertArrayEqual(unpacked, self.data.ravel())
+        for dtype in ("i8", "i4"):
+            data_bytes = self.ints.astype(">i4").tobytes()
+            unpacked = cray32_unpack(data_bytes, self.ints.size, dtype=dtype)
+            self.assertEqual(unpacked.dtype, np.dtype(dtype))
+            self.assertArrayEqual(unpacked, self.ints)
+
+    def test_unpack_into_out(self):
+        # Only the requested words should be used, and the output array
+        # may have any shape with the right number of elements
+        data_bytes = self.data.astype(">f4").tobytes() + b"\x00"*8
+        out = np.empty(self.data.shape)
+        result = cray32_unpack(data_bytes, self.data.size, out=out)
+        self.assertIs(result, out)
+        self.assertArrayEqual(out, self.data)
+
+    def test_unpack_bad_input(self):
+        data_bytes = self.data.astype(">f4").tobytes()
+        with self.assertRaisesRegex(ValueError, "too short"):
+            cray32_unpack(data_bytes, self.data.size + 1)
+        with self.assertRaisesRegex(ValueError, "wrong dtype"):
+            cray32_unpack(data_bytes, self.data.size,
+                          out=np.empty(self.data.size, dtype="f4"))
+        with self.assertRaisesRegex(ValueError, "data type"):
+            cray32_unpack(data_bytes, self.data.size, dtype="i2")
+
+    def test_pack(self):
+        # The words should match those numpy produces, whatever the type
+        # and byte order of the input
+        for data in (self.data, self.data.astype("f4"),
+                     self.data.astype(">f8"), self.data[:, ::2]):
+            self.assertEqual(cray32_pack(data), data.astype(">f4").tobytes())
+        for ints in (self.ints, self.ints.astype("i4")):
+            self.assertEqual(cray32_pack(ints, integer=True),
+                             ints.astype(">i4").tobytes())
+
+    def test_pack_reals_as_integers(self):
+        # Real data for an integer field (e.g. from an operator which has
+        # promoted it) should be truncated, as numpy's astype would do
+        for reals in (self.ints + 0.75, (self.ints - 0.5).astype("f4"),
+                      np.array([-1.0e9, -2.5, 0.0, 2.5, 1.0e9])):
+            self.assertEqual(cray32_pack(reals, integer=True),
+                             reals.astype(">i4").tobytes())
+
+
+class Test_stats(tests.UMPackingTest):
+    def test_counts(self):
+        data = np.arange(12.0).reshape(3, 4)
+        previous = set_stats(False)
+        try:
+            # Nothing is counted unless the counters are on
+            reset_stats()
+            cray32_pack(data)
+            self.assertEqual(get_stats()["cray32_pack"], (0, 0.0, 0))
+            set_stats(True)
+            packed = cray32_pack(data)
+            cray32_unpack(packed, data.size)
+            cray32_unpack(packed, data.size, dtype="f4")
+            stats = get_stats()
+            self.assertEqual(stats["cray32_pack"][0], 1)
+            self.assertEqual(stats["cray32_pack"][2], data.nbytes)
+            self.assertEqual(stats["cray32_unpack"][0], 2)
+            self.assertEqual(stats["cray32_unpack"][2], 1.5*data.nbytes)
+            self.assertGreaterEqual(stats["cray32_unpack"][1], 0.0)
+            self.assertEqual(stats["wgdos_unpack"], (0, 0.0, 0))
+            reset_stats()
+            self.assertEqual(get_stats()["cray32_unpack"], (0, 0.0, 0))
+        finally:
+            set_stats(previous)
+
+
+class Test_threads(tests.UMPackingTest):
+    MDI = -99.0
+    ACCURACY = -10
+
+    def test_threads(self):
+        previous = set_threads(2)
+        try:
+            self.assertGreaterEqual(get_threads(), 1)
+            self.assertEqual(set_threads(0), 2)
+            with self.assertRaises(ValueError):
+                set_threads(-1)
+            # The result doesn't depend on how the work is shared out
+            array = get_random_data(self.MDI)
+            packed = wgdos_pack(array, self.MDI, self.ACCURACY)
+            self.assertEqual(
+                wgdos_pack(array, self.MDI, self.ACCURACY, threads=3), packed)
+            self.assertEqual(
+                wgdos_pack_many([array]*3, self.MDI, self.ACCURACY,
+                                threads=2), [packed]*3)
+            unpacked = wgdos_unpack(packed, self.MDI)
+            self.assertArrayEqual(
+                wgdos_unpack(packed, self.MDI, threads=3), unpacked)
+            for result in wgdos_unpack_many([packed]*3, self.MDI, threads=4):
+                self.assertArrayEqual(result, unpacked)
+        finally:
+            set_threads(previous)
+
+
 if __name__ == "__main__":
     tests.main()
@@ -32,10 +32,18 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <numpy/arrayobject.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 #include "c_shum_wgdos_packing.h"
 #include "c_shum_byteswap.h"
 #include "c_shum_wgdos_packing_version.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #if PY_MAJOR_VERSION >= 3
 #define PyInt_FromLong PyLong_FromLong
 #define MOD_ERROR_VAL NULL
@@ -53,41 +61,273 @@
   ob = Py_InitModule3(name, methods, doc);
 #endif
 
+#if PY_MAJOR_VERSION >= 3
+#define BUFFER_FORMAT "y*"
+#else
+#define BUFFER_FORMAT "s*"
+#endif
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#elif defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 MOD_INIT(um_packing);
 
-static PyObject *wgdos_unpack_py(PyObject *self, PyObject *args);
-static PyObject *wgdos_pack_py(PyObject *self, PyObject *args);
+static PyObject *wgdos_unpack_py(PyObject *self, PyObject *args,
+                                 PyObject *kwds);
+static PyObject *wgdos_unpack_many_py(PyObject *self, PyObject *args,
+                                      PyObject *kwds);
+static PyObject *wgdos_pack_py(PyObject *self, PyObject *args,
+                               PyObject *kwds);
+static PyObject *wgdos_pack_many_py(PyObject *self, PyObject *args,
+                                    PyObject *kwds);
+static PyObject *landsea_expand_py(PyObject *self, PyObject *args);
+static PyObject *landsea_compress_py(PyObject *self, PyObject *args);
+static PyObject *compare_arrays_py(PyObject *self, PyObject *args,
+                                   PyObject *kwds);
+static PyObject *cray32_unpack_py(PyObject *self, PyObject *args,
+                                  PyObject *kwds);
+static PyObject *cray32_pack_py(PyObject *self, PyObject *args,
+                                PyObject *kwds);
 static PyObject *get_shumlib_version_py(PyObject *self, PyObject *args);
+static PyObject *set_stats_py(PyObject *self, PyObject *args);
+static PyObject *get_stats_py(PyObject *self, PyObject *args);
+static PyObject *reset_stats_py(PyObject *self, PyObject *args);
+static PyObject *set_threads_py(PyObject *self, PyObject *args);
+static PyObject *get_threads_py(PyObject *self, PyObject *args);
 
 MOD_INIT(um_packing)
 {
   PyDoc_STRVAR(um_packing__doc__,
-  "This extension module provides access to the SHUMlib packing library.\n"
+  "This extension module provides access to the SHUMlib packing library.\n\n"
+  "The tuple wgdos_unpack_keywords names the optional keyword arguments\n"
+  "accepted by wgdos_unpack, so that callers can tell which of them a\n"
+  "given build of the module supports.\n"
   );
 
   PyDoc_STRVAR(wgdos_unpack__doc__,
   "Unpack UM field data which has been packed using WGDOS packing.\n\n"
   "Usage:\n"
-  "   um_packing.wgdos_unpack(bytes_in, mdi)\n\n"
+  "   um_packing.wgdos_unpack(bytes_in, mdi, out=None, dtype=None,\n"
+  "                           row_start=0, row_end=None, threads=0)\n\n"
+  "Args:\n"
+  "* bytes_in  - Packed field byte-array; any object supporting the\n"
+  "              buffer protocol (bytes, memoryview, mmap, numpy.ndarray)\n"
+  "              may be given, and its contents will not be modified.\n"
+  "* mdi       - Missing data indicator.\n"
+  "* out       - If given, a C-contiguous, writeable, native byte-order\n"
+  "              numpy.ndarray of the requested dtype with the same shape\n"
+  "              as the field (or the requested rows of it); the field is\n"
+  "              unpacked directly into this array.\n"
+  "* dtype     - Data type of the unpacked field; either numpy.float64\n"
+  "              (the default) or numpy.float32.\n"
+  "* row_start - If given, the first row of the field to unpack.\n"
+  "* row_end   - If given, the row to stop unpacking at (this row is not\n"
+  "              unpacked); only the rows in this range are decoded.\n"
+  "* threads   - Number of threads the packing library may share a large\n"
+  "              field between (if not set, the default from set_threads\n"
+  "              is used); small fields always use a single thread.\n\n"
+  "Returns:\n"
+  "  2 Dimensional numpy.ndarray containing the unpacked field, or the\n"
+  "  requested rows of it (this is the out array, if it was given).\n"
+  );
+
+  PyDoc_STRVAR(wgdos_unpack_many__doc__,
+  "Unpack a batch of UM fields which have been packed using WGDOS packing.\n\n"
+  "The unpacking of the fields is shared between OpenMP threads, and is\n"
+  "done without holding the Python GIL.\n\n"
+  "Usage:\n"
+  "   um_packing.wgdos_unpack_many(list_of_bytes, mdi, stack=False,\n"
+  "                                threads=0)\n\n"
   "Args:\n"
-  "* bytes_in - Packed field byte-array.\n"
-  "* mdi      - Missing data indicator.\n\n"
+  "* list_of_bytes - Sequence of packed field byte-arrays.\n"
+  "* mdi           - Missing data indicator; either a single value or a\n"
+  "                  sequence giving a value for each field.\n"
+  "* stack         - If True, return a single 3 Dimensional array (the\n"
+  "                  fields must all have the same dimensions).\n"
+  "* threads       - Number of threads to use (if not set, the default\n"
+  "                  from set_threads is used).  Many or small fields are\n"
+  "                  shared out between the threads, but if there are\n"
+  "                  fewer large fields than threads they are unpacked\n"
+  "                  one at a time, with each shared between the threads.\n\n"
   "Returns:\n"
-  "  2 Dimensional numpy.ndarray containing the unpacked field.\n" 
+  "  List of 2 Dimensional numpy.ndarrays containing the unpacked fields\n"
+  "  (or a 3 Dimensional numpy.ndarray if stack is True).\n"
   );
 
   PyDoc_STRVAR(wgdos_pack__doc__,
   "Pack a UM field using WGDOS packing.\n\n"
   "Usage:\n"
-  "  um_packing.wgdos_pack(field_in, mdi, accuracy)\n\n"
+  "  um_packing.wgdos_pack(field_in, mdi, accuracy, threads=0)\n\n"
   "Args:\n"
-  "* field_in - 2 Dimensional numpy.ndarray containing the field.\n"
+  "* field_in - 2 Dimensional numpy.ndarray containing the field (a copy\n"
+  "             is packed if it isn't contiguous native double precision).\n"
   "* mdi      - Missing data indicator.\n"
-  "* accuracy - Packing accuracy (power of 2).\n\n"
+  "* accuracy - Packing accuracy (power of 2).\n"
+  "* threads  - Number of threads the packing library may share a large\n"
+  "             field between (if not set, the default from set_threads\n"
+  "             is used); small fields always use a single thread.\n\n"
   "Returns:\n"
   "  Byte-array/stream (suitable to write straight to file).\n"
   );
 
+  PyDoc_STRVAR(wgdos_pack_many__doc__,
+  "Pack a batch of UM fields using WGDOS packing.\n\n"
+  "The packing of the fields is shared between OpenMP threads, and is\n"
+  "done without holding the Python GIL.\n\n"
+  "Usage:\n"
+  "  um_packing.wgdos_pack_many(list_of_fields, mdi, accuracy, threads=0)\n\n"
+  "Args:\n"
+  "* list_of_fields - Sequence of 2 Dimensional numpy.ndarrays containing\n"
+  "                   the fields.\n"
+  "* mdi            - Missing data indicator; either a single value or a\n"
+  "                   sequence giving a value for each field.\n"
+  "* accuracy       - Packing accuracy (power of 2); either a single value\n"
+  "                   or a sequence giving a value for each field.\n"
+  "* threads        - Number of threads to use (if not set, the default\n"
+  "                   from set_threads is used); shared out as for\n"
+  "                   wgdos_unpack_many.\n\n"
+  "Returns:\n"
+  "  List of byte-arrays/streams (suitable to write straight to file).\n"
+  );
+
+  PyDoc_STRVAR(landsea_expand__doc__,
+  "Expand a land or sea packed field onto the full grid.\n\n"
+  "The values are copied unchanged (so any dtype and byte order may be\n"
+  "used), and the grid is filled and scattered in a single pass.\n\n"
+  "Usage:\n"
+  "  um_packing.landsea_expand(packed, mask, fill, out)\n\n"
+  "Args:\n"
+  "* packed - 1 Dimensional C-contiguous numpy.ndarray containing the\n"
+  "           values at the points selected by the mask.\n"
+  "* mask   - 1 Dimensional C-contiguous boolean numpy.ndarray giving the\n"
+  "           selected points of the full grid.\n"
+  "* fill   - numpy.ndarray containing a single value, of the same dtype\n"
+  "           as packed, to set at the points which aren't selected.\n"
+  "* out    - C-contiguous, writeable numpy.ndarray of the same dtype as\n"
+  "           packed, with the same number of elements as mask.\n\n"
+  "Returns:\n"
+  "  The out array.\n"
+  );
+
+  PyDoc_STRVAR(landsea_compress__doc__,
+  "Extract the land or sea points of a field on the full grid.\n\n"
+  "Usage:\n"
+  "  um_packing.landsea_compress(data, mask, out)\n\n"
+  "Args:\n"
+  "* data - C-contiguous numpy.ndarray containing the field, with the\n"
+  "         same number of elements as mask.\n"
+  "* mask - 1 Dimensional C-contiguous boolean numpy.ndarray giving the\n"
+  "         points of the grid to extract.\n"
+  "* out  - 1 Dimensional C-contiguous, writeable numpy.ndarray of the\n"
+  "         same dtype as data, with one element for each selected point.\n\n"
+  "Returns:\n"
+  "  The out array.\n"
+  );
+
+  PyDoc_STRVAR(compare_arrays__doc__,
+  "Compare the values of two fields, without creating a difference array.\n\n"
+  "Points are compared in double precision; points where both values are\n"
+  "NaN are treated as equal.\n\n"
+  "Usage:\n"
+  "  um_packing.compare_arrays(a, b, stop_at_first=False)\n\n"
+  "Args:\n"
+  "* a, b          - numpy.ndarrays (or objects which can be converted to\n"
+  "                  them) with the same number of elements.\n"
+  "* stop_at_first - If True, stop comparing shortly after the first\n"
+  "                  difference is found (the returned values then only\n"
+  "                  describe the points compared so far).\n\n"
+  "Returns:\n"
+  "  Tuple containing the number of points which differ, the maximum\n"
+  "  absolute difference and the RMS difference.\n"
+  );
+
+  PyDoc_STRVAR(cray32_unpack__doc__,
+  "Convert 32-bit big-endian (Cray32 packed or unpacked) field data to\n"
+  "native values, byte-swapping and widening them in a single pass.\n\n"
+  "Usage:\n"
+  "  um_packing.cray32_unpack(bytes_in, count, dtype=None, out=None)\n\n"
+  "Args:\n"
+  "* bytes_in - Object supporting the buffer protocol containing at\n"
+  "             least count 32-bit words.\n"
+  "* count    - The number of words to convert.\n"
+  "* dtype    - The type of the returned values; float64 (the default)\n"
+  "             or float32 to treat the words as reals, int64 or int32\n"
+  "             to treat them as integers.\n"
+  "* out      - (Optional) C-contiguous, writeable numpy.ndarray of the\n"
+  "             given dtype with count elements, to convert into.\n\n"
+  "Returns:\n"
+  "  1 Dimensional numpy.ndarray of count values (or the out array).\n"
+  );
+
+  PyDoc_STRVAR(cray32_pack__doc__,
+  "Convert native field data to 32-bit big-endian words (as used by\n"
+  "Cray32 packed and 32-bit unpacked fields) in a single pass.\n\n"
+  "Usage:\n"
+  "  um_packing.cray32_pack(data, integer=False)\n\n"
+  "Args:\n"
+  "* data    - numpy.ndarray (or object which can be converted to one)\n"
+  "            containing the field.\n"
+  "* integer - If True the values are stored as 32-bit integers (real\n"
+  "            values are truncated), otherwise as 32-bit reals.\n\n"
+  "Returns:\n"
+  "  Byte array containing one big-endian word for each element.\n"
+  );
+
+  PyDoc_STRVAR(set_stats__doc__,
+  "Turn the counting of the work done by the functions of this module on\n"
+  "or off (it is off by default).\n\n"
+  "Usage:\n"
+  "  um_packing.set_stats(enabled)\n\n"
+  "Args:\n"
+  "* enabled - True to count the work done, False to stop.\n\n"
+  "Returns:\n"
+  "  True if the counting was previously on.\n"
+  );
+
+  PyDoc_STRVAR(get_stats__doc__,
+  "Return the work counted since the counters were last reset.\n\n"
+  "Usage:\n"
+  "  um_packing.get_stats()\n\n"
+  "Returns:\n"
+  "  Dictionary giving a tuple (fields, seconds, bytes) for each function;\n"
+  "  the number of fields processed, the time spent processing them\n"
+  "  (without holding the GIL) and the size of the unpacked field data\n"
+  "  produced or consumed.\n"
+  );
+
+  PyDoc_STRVAR(reset_stats__doc__,
+  "Reset the counters returned by get_stats to zero.\n\n"
+  "Usage:\n"
+  "  um_packing.reset_stats()\n"
+  );
+
+  PyDoc_STRVAR(set_threads__doc__,
+  "Set the number of OpenMP threads used by the functions of this module\n"
+  "when their threads argument isn't given.\n\n"
+  "Usage:\n"
+  "  um_packing.set_threads(threads)\n\n"
+  "Args:\n"
+  "* threads - Number of threads, or 0 to use the OpenMP default (which\n"
+  "            is set by the environment variable OMP_NUM_THREADS, or\n"
+  "            is otherwise the number of cores).\n\n"
+  "Returns:\n"
+  "  The previous setting.\n"
+  );
+
+  PyDoc_STRVAR(get_threads__doc__,
+  "Return the number of OpenMP threads used by the functions of this\n"
+  "module when their threads argument isn't given.\n\n"
+  "Usage:\n"
+  "  um_packing.get_threads()\n\n"
+  "Returns:\n"
+  "  Number of threads (1 if the module was built without OpenMP).\n"
+  );
+
   PyDoc_STRVAR(get_shumlib_version__doc__,
   "Returns the SHUMlib version number used the compile the library.\n\n"
   "Returns:\n"
@@ -95,10 +335,33 @@ MOD_INIT(um_packing)
   );
 
   static PyMethodDef um_packingMethods[] = {
-    {"wgdos_unpack", wgdos_unpack_py, METH_VARARGS, wgdos_unpack__doc__},
-    {"wgdos_pack", wgdos_pack_py, METH_VARARGS, wgdos_pack__doc__},
+    {"wgdos_unpack", (PyCFunction)(void(*)(void))wgdos_unpack_py,
+                     METH_VARARGS | METH_KEYWORDS, wgdos_unpack__doc__},
+    {"wgdos_unpack_many", (PyCFunction)(void(*)(void))wgdos_unpack_many_py,
+                          METH_VARARGS | METH_KEYWORDS,
+                          wgdos_unpack_many__doc__},
+    {"wgdos_pack", (PyCFunction)(void(*)(void))wgdos_pack_py,
+                   METH_VARARGS | METH_KEYWORDS, wgdos_pack__doc__},
+    {"wgdos_pack_many", (PyCFunction)(void(*)(void))wgdos_pack_many_py,
+                        METH_VARARGS | METH_KEYWORDS,
+                        wgdos_pack_many__doc__},
+    {"landsea_expand", landsea_expand_py, METH_VARARGS,
+                       landsea_expand__doc__},
+    {"landsea_compress", landsea_compress_py, METH_VARARGS,
+                         landsea_compress__doc__},
+    {"compare_arrays", (PyCFunction)(void(*)(void))compare_arrays_py,
+                       METH_VARARGS | METH_KEYWORDS, compare_arrays__doc__},
+    {"cray32_unpack", (PyCFunction)(void(*)(void))cray32_unpack_py,
+                      METH_VARARGS | METH_KEYWORDS, cray32_unpack__doc__},
+    {"cray32_pack", (PyCFunction)(void(*)(void))cray32_pack_py,
+                    METH_VARARGS | METH_KEYWORDS, cray32_pack__doc__},
     {"get_shumlib_version", get_shumlib_version_py, 
                             METH_VARARGS, get_shumlib_version__doc__},
+    {"set_stats", set_stats_py, METH_VARARGS, set_stats__doc__},
+    {"get_stats", get_stats_py, METH_NOARGS, get_stats__doc__},
+    {"reset_stats", reset_stats_py, METH_NOARGS, reset_stats__doc__},
+    {"set_threads", set_threads_py, METH_VARARGS, set_threads__doc__},
+    {"get_threads", get_threads_py, METH_NOARGS, get_threads__doc__},
     {NULL, NULL, 0, NULL}
   };
 
@@ -108,197 +371,1868 @@ MOD_INIT(um_packing)
     return MOD_ERROR_VAL;
 
   import_array();
+
+  PyObject *keywords = Py_BuildValue("(sssss)", "out", "dtype", "row_start",
+                                     "row_end", "threads");
+  if (keywords == NULL ||
+      PyModule_AddObject(mod, "wgdos_unpack_keywords", keywords) < 0) {
+    Py_XDECREF(keywords);
+    Py_DECREF(mod);
+    return MOD_ERROR_VAL;
+  }
   return MOD_SUCCESS_VAL(mod);
 }
 
-static PyObject *wgdos_unpack_py(PyObject *self, PyObject *args)
+// Opt-in counters of the work done by the functions of the module (see
+// set_stats); they are only updated once the GIL has been re-acquired, so
+// need no further locking
+enum {
+  STATS_WGDOS_UNPACK,
+  STATS_WGDOS_PACK,
+  STATS_LANDSEA_EXPAND,
+  STATS_LANDSEA_COMPRESS,
+  STATS_CRAY32_UNPACK,
+  STATS_CRAY32_PACK,
+  STATS_COUNT
+};
+
+static const char *stats_names[STATS_COUNT] = {
+  "wgdos_unpack", "wgdos_pack", "landsea_expand", "landsea_compress",
+  "cray32_unpack", "cray32_pack"
+};
+
+static int stats_enabled = 0;
+static int64_t stats_fields[STATS_COUNT];
+static int64_t stats_bytes[STATS_COUNT];
+static double stats_seconds[STATS_COUNT];
+
+// Return the current time (in seconds) if the counters are on, otherwise 0;
+// when they are off this costs no more than the test of the flag
+static double stats_clock(void)
 {
-  // Setup and obtain inputs passed from python
-  char *bytes_in = NULL;
-  int64_t n_bytes = 0;
-  double mdi = 0.0;
-  // Note the argument descriptors "s#d":
-  //   - s#  a string followed by its size
-  //   - d   an integer
-  if (!PyArg_ParseTuple(args, "s#d", &bytes_in, &n_bytes, &mdi)) return NULL;
+  struct timespec now;
+  if (!stats_enabled) return 0.0;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + 1.0e-9*(double)now.tv_nsec;
+}
 
-  // Cast self to void to avoid unused parameter errors
-  (void) self;
+// Add some processed fields to a counter, given the times from stats_clock
+// at the start and end of the work (nothing is added if the counters were
+// turned on or off part way through)
+static void stats_record(int which, int64_t fields, int64_t bytes,
+                         double start, double end)
+{
+  if (!stats_enabled || start <= 0.0 || end <= 0.0) return;
+  stats_fields[which] += fields;
+  stats_bytes[which] += bytes;
+  stats_seconds[which] += end - start;
+}
 
-  // Status variable to store various error codes
-  int64_t status = 1;
+// The number of OpenMP threads used when a call doesn't give one (see
+// set_threads); 0 means the OpenMP default
+static int default_threads = 0;
 
-  // Setup output array object and dimensions
-  PyArrayObject *npy_array_out = NULL;
-  npy_intp dims[2];
+// Fields with at least this many points are worth sharing between threads
+// (the SHUMlib packing library parallelises over the rows of a field);
+// for smaller fields the cost of starting the threads outweighs the gain
+#define INTRA_FIELD_POINTS (256*1024)
 
-  // Error message string
-  int64_t msg_len = 512;
-  char err_msg[msg_len];
+// Return the number of threads to use for a call, given its threads
+// argument
+static int choose_threads(int threads)
+{
+  if (threads > 0) return threads;
+  if (default_threads > 0) return default_threads;
+  #ifdef _OPENMP
+  return omp_get_max_threads();
+  #else
+  return 1;
+  #endif
+}
+
+// Set the number of threads the packing library may use for a field within
+// the calling thread, returning the previous setting to be restored by
+// restore_field_threads afterwards; this only affects the calling thread
+// (so is safe while other threads are using the library)
+static int set_field_threads(int threads, int64_t points)
+{
+  #ifdef _OPENMP
+  int previous = omp_get_max_threads();
+  omp_set_num_threads(points < INTRA_FIELD_POINTS ? 1 : threads);
+  return previous;
+  #else
+  (void) threads;
+  (void) points;
+  return 1;
+  #endif
+}
+
+static void restore_field_threads(int previous)
+{
+  #ifdef _OPENMP
+  omp_set_num_threads(previous);
+  #else
+  (void) previous;
+  #endif
+}
+
+// Decide how to share a batch of fields between threads.  If there are too
+// few fields to keep the threads busy, and they are large, the fields are
+// processed one at a time with each shared between all of the threads;
+// otherwise the fields are shared out and each is processed by one thread.
+// Returns the size of the team of threads to share the fields between, and
+// sets the number of threads to use within each field
+static int batch_threads(int threads, Py_ssize_t n_fields,
+                         int64_t total_points, int *field_threads)
+{
+  if (threads > 1 && n_fields > 0 && n_fields < threads &&
+      total_points / (int64_t)n_fields >= INTRA_FIELD_POINTS) {
+    *field_threads = threads;
+    return 1;
+  }
+  *field_threads = 1;
+  return threads;
+}
+
+// Read the i-th big-endian 32-bit word of a byte array; composing the word
+// from its bytes like this is independent of the machine's byte order (and
+// of the alignment of the input), and compilers turn it into a single load
+// and byte swap
+static inline uint32_t read_word_be(const unsigned char *bytes, int64_t i)
+{
+  const unsigned char *word = bytes + 4*i;
+  return ((uint32_t)word[0] << 24) | ((uint32_t)word[1] << 16) |
+         ((uint32_t)word[2] << 8) | (uint32_t)word[3];
+}
+
+static inline void write_word_be(unsigned char *bytes, int64_t i,
+                                 uint32_t word)
+{
+  unsigned char *out = bytes + 4*i;
+  out[0] = (unsigned char)(word >> 24);
+  out[1] = (unsigned char)(word >> 16);
+  out[2] = (unsigned char)(word >> 8);
+  out[3] = (unsigned char)word;
+}
+
+// Read the WGDOS header from the first 3 words of a packed field; the header
+// words are byteswapped (if required) in a local copy, so that the original
+// bytes are left untouched
+static int64_t read_wgdos_header_copy(const char *bytes_in,
+                                      int64_t n_bytes,
+                                      int64_t *num_words,
+                                      int64_t *accuracy,
+                                      int64_t *cols,
+                                      int64_t *rows,
+                                      char *err_msg,
+                                      int64_t msg_len)
+{
+  char header[3*sizeof(int32_t)];
+  int64_t status;
+
+  if (n_bytes < (int64_t)sizeof(header)) {
+    snprintf(err_msg, (size_t)msg_len,
+             "Packed field too short to contain a WGDOS header");
+    return 1;
+  }
+
+  memcpy(header, bytes_in, sizeof(header));
 
-  // Perform a byte swap on the byte-array, if it looks like it is needed
   if (c_shum_get_machine_endianism() == littleEndian) {
-    status = c_shum_byteswap(bytes_in,
-                             n_bytes/(int64_t)sizeof(int32_t),
-                             sizeof(int32_t),
-                             &err_msg[0],
-                             msg_len
-                             );
-    if (status != 0) {
-      PyErr_SetString(PyExc_ValueError, &err_msg[0]);
-      return NULL;
-    }
+    status = c_shum_byteswap(header, 3, sizeof(int32_t), err_msg, msg_len);
+    if (status != 0) return status;
   }
 
-  // Now extract the word count, accuracy, number of rows and number of columns
-  int64_t num_words;
-  int64_t accuracy;
-  int64_t cols;
-  int64_t rows;
+  status = c_shum_read_wgdos_header(header, num_words, accuracy, cols, rows,
+                                    err_msg, &msg_len);
+  if (status != 0) return status;
 
-  status = c_shum_read_wgdos_header(bytes_in,
-                                    &num_words,
-                                    &accuracy,
-                                    &cols,
-                                    &rows,
-                                    &err_msg[0],
-                                    &msg_len
-                                    );
+  if (*num_words*(int64_t)sizeof(int32_t) > n_bytes) {
+    snprintf(err_msg, (size_t)msg_len,
+             "WGDOS header gives %" PRId64 " words, but only %" PRId64
+             " bytes were provided", *num_words, n_bytes);
+    return 1;
+  }
 
-  if (status != 0) {
-    PyErr_SetString(PyExc_ValueError, &err_msg[0]);
-    return NULL;
+  return 0;
+}
+
+// Return a scratch buffer of at least the given number of words; each thread
+// has its own buffer, which is kept and re-used (growing it when required) to
+// avoid repeatedly allocating memory when unpacking many fields
+static THREAD_LOCAL int32_t *scratch_buffer = NULL;
+static THREAD_LOCAL int64_t scratch_words = 0;
+
+static int32_t *get_scratch_buffer(int64_t num_words)
+{
+  if (num_words > scratch_words) {
+    int32_t *new_buffer =
+      (int32_t *)realloc(scratch_buffer, (size_t)num_words*sizeof(int32_t));
+    if (new_buffer == NULL) return NULL;
+    scratch_buffer = new_buffer;
+    scratch_words = num_words;
   }
+  return scratch_buffer;
+}
 
-  // Allocate space to hold the unpacked field
-  double *dataout = (double*)calloc((size_t)(rows*cols), sizeof(double));
-  if (dataout == NULL) {
-    PyErr_SetString(PyExc_ValueError, "Unable to allocate memory for unpacking");
-    return NULL;
+// As above, but a buffer of doubles; this is used to hold the unpacked values
+// when the required output type is not double precision
+static THREAD_LOCAL double *scratch_doubles = NULL;
+static THREAD_LOCAL int64_t scratch_doubles_len = 0;
+
+static double *get_scratch_doubles(int64_t length)
+{
+  if (length > scratch_doubles_len) {
+    double *new_buffer =
+      (double *)realloc(scratch_doubles, (size_t)length*sizeof(double));
+    if (new_buffer == NULL) return NULL;
+    scratch_doubles = new_buffer;
+    scratch_doubles_len = length;
+  }
+  return scratch_doubles;
+}
+
+// And a buffer to hold packed words when packing; this is separate to the
+// unpacking buffer since a field packed by a thread is kept in it until it
+// has been copied out.  The library has always been given a zeroed buffer,
+// so the buffer is kept zeroed apart from the first pack_dirty_words words
+// (those written by the last field packed into it); it is allocated with
+// calloc so that a new buffer's pages are zeroed only as they are used
+static THREAD_LOCAL int32_t *pack_buffer = NULL;
+static THREAD_LOCAL int64_t pack_words = 0;
+static THREAD_LOCAL int64_t pack_dirty_words = 0;
+
+static int32_t *get_pack_buffer(int64_t num_words)
+{
+  if (num_words > pack_words) {
+    free(pack_buffer);
+    pack_words = 0;
+    pack_dirty_words = 0;
+    pack_buffer = (int32_t *)calloc((size_t)num_words, sizeof(int32_t));
+    if (pack_buffer == NULL) return NULL;
+    pack_words = num_words;
+  } else if (pack_dirty_words > 0) {
+    memset(pack_buffer, 0, (size_t)pack_dirty_words*sizeof(int32_t));
+    pack_dirty_words = 0;
+  }
+  return pack_buffer;
+}
+
+// The scratch buffers are kept between calls only while they are smaller than
+// this; larger buffers (for very large fields, where the cost of allocating
+// them is small compared to the work done with them) are released once the
+// field has been processed, so that threads don't each keep a buffer sized
+// to the largest field they have seen
+#define SCRATCH_KEEP_BYTES (16*1024*1024)
+
+static void release_scratch(void)
+{
+  if (scratch_words*(int64_t)sizeof(int32_t) > SCRATCH_KEEP_BYTES) {
+    free(scratch_buffer);
+    scratch_buffer = NULL;
+    scratch_words = 0;
+  }
+  if (scratch_doubles_len*(int64_t)sizeof(double) > SCRATCH_KEEP_BYTES) {
+    free(scratch_doubles);
+    scratch_doubles = NULL;
+    scratch_doubles_len = 0;
+  }
+  if (pack_words*(int64_t)sizeof(int32_t) > SCRATCH_KEEP_BYTES) {
+    free(pack_buffer);
+    pack_buffer = NULL;
+    pack_words = 0;
+    pack_dirty_words = 0;
+  }
+}
+
+// Obtain a value for each field from an argument which may be either a single
+// number (shared by all fields) or a sequence giving a value for each field.
+// Returns 0 on success, otherwise sets a Python exception
+static int get_field_doubles(PyObject *values_in, Py_ssize_t n_fields,
+                             double *values, const char *name)
+{
+  Py_ssize_t i;
+
+  if (!PySequence_Check(values_in)) {
+    double value = PyFloat_AsDouble(values_in);
+    if (value == -1.0 && PyErr_Occurred()) return 1;
+    for (i = 0; i < n_fields; i++) values[i] = value;
+    return 0;
+  }
+
+  PyObject *seq = PySequence_Fast(values_in,
+                                  "Expected a number or sequence of numbers");
+  if (seq == NULL) return 1;
+  if (PySequence_Fast_GET_SIZE(seq) != n_fields) {
+    Py_DECREF(seq);
+    PyErr_Format(PyExc_ValueError,
+                 "Number of %s values does not match number of fields", name);
+    return 1;
+  }
+  for (i = 0; i < n_fields; i++) {
+    values[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+    if (values[i] == -1.0 && PyErr_Occurred()) {
+      Py_DECREF(seq);
+      return 1;
+    }
+  }
+  Py_DECREF(seq);
+  return 0;
+}
+
+// As above, for integer values
+static int get_field_ints(PyObject *values_in, Py_ssize_t n_fields,
+                          int64_t *values, const char *name)
+{
+  Py_ssize_t i;
+
+  if (!PySequence_Check(values_in)) {
+    long long value = PyLong_AsLongLong(values_in);
+    if (value == -1 && PyErr_Occurred()) return 1;
+    for (i = 0; i < n_fields; i++) values[i] = (int64_t)value;
+    return 0;
+  }
+
+  PyObject *seq = PySequence_Fast(
+      values_in, "Expected an integer or sequence of integers");
+  if (seq == NULL) return 1;
+  if (PySequence_Fast_GET_SIZE(seq) != n_fields) {
+    Py_DECREF(seq);
+    PyErr_Format(PyExc_ValueError,
+                 "Number of %s values does not match number of fields", name);
+    return 1;
+  }
+  for (i = 0; i < n_fields; i++) {
+    long long value = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(seq, i));
+    if (value == -1 && PyErr_Occurred()) {
+      Py_DECREF(seq);
+      return 1;
+    }
+    values[i] = (int64_t)value;
   }
+  Py_DECREF(seq);
+  return 0;
+}
 
-  // Call the WGDOS unpacking code
-  int32_t *ptr_32 = (int32_t *)bytes_in;
+// Unpack a single WGDOS packed field into a provided output array.  The input
+// bytes are never modified; on little-endian machines the packed words are
+// byteswapped into this thread's scratch buffer, otherwise they are passed
+// directly to the library.  This routine does not use the Python API and so
+// is safe to call without holding the GIL
+static int64_t wgdos_decode(const char *bytes_in,
+                            int64_t num_words,
+                            int64_t cols,
+                            int64_t rows,
+                            double mdi,
+                            double *dataout,
+                            char *err_msg,
+                            int64_t msg_len)
+{
+  int64_t status;
+  int32_t *packed = (int32_t *)bytes_in;
+
+  if (c_shum_get_machine_endianism() == littleEndian) {
+    packed = get_scratch_buffer(num_words);
+    if (packed == NULL) {
+      snprintf(err_msg, (size_t)msg_len,
+               "Unable to allocate memory for unpacking");
+      return 1;
+    }
+    memcpy(packed, bytes_in, (size_t)num_words*sizeof(int32_t));
+    status = c_shum_byteswap(packed, num_words, sizeof(int32_t),
+                             err_msg, msg_len);
+    if (status != 0) return status;
+  }
 
-  status = c_shum_wgdos_unpack(ptr_32,
+  status = c_shum_wgdos_unpack(packed,
                                &num_words,
                                &cols,
                                &rows,
                                &mdi,
                                dataout,
-                               &err_msg[0],
+                               err_msg,
                                &msg_len
                                );
+  return status;
+}
 
-  if (status != 0) {
-    free(dataout);
-    PyErr_SetString(PyExc_ValueError, &err_msg[0]);
-    return NULL;
+// Unpack a single WGDOS packed field into a provided single precision output
+// array.  The library only produces double precision values, so the field is
+// unpacked into this thread's scratch buffer and narrowed from there (this
+// avoids allocating a full double precision array for every field).  Like the
+// above, this routine is safe to call without holding the GIL
+static int64_t wgdos_decode_float(const char *bytes_in,
+                                  int64_t num_words,
+                                  int64_t cols,
+                                  int64_t rows,
+                                  double mdi,
+                                  float *dataout,
+                                  char *err_msg,
+                                  int64_t msg_len)
+{
+  int64_t status;
+  int64_t i;
+  double *unpacked = get_scratch_doubles(rows*cols);
+
+  if (unpacked == NULL) {
+    snprintf(err_msg, (size_t)msg_len,
+             "Unable to allocate memory for unpacking");
+    return 1;
   }
 
-  // Now form a numpy array object to return to python
-  dims[0] = rows;
-  dims[1] = cols;
-  npy_array_out=(PyArrayObject *) PyArray_SimpleNewFromData(2, dims,
-                                                            NPY_DOUBLE,
-                                                            dataout);
-  if (npy_array_out == NULL) {
-    free(dataout);
-    PyErr_SetString(PyExc_ValueError, "Failed to make numpy array");
-    return NULL;
+  status = wgdos_decode(bytes_in, num_words, cols, rows, mdi, unpacked,
+                        err_msg, msg_len);
+  if (status != 0) return status;
+
+  for (i = 0; i < rows*cols; i++) {
+    dataout[i] = (float)unpacked[i];
   }
+  return 0;
+}
 
-  // Give python/numpy ownership of the memory storing the return array
-  #if NPY_API_VERSION >= NPY_1_7_API_VERSION
-  PyArray_ENABLEFLAGS(npy_array_out, NPY_ARRAY_OWNDATA);
-  #else
-  npy_array_out->flags = npy_array_out->flags | NPY_OWNDATA;
-  #endif
+// Unpack a range of rows of a WGDOS packed field by unpacking the whole
+// field and copying the rows out of it (see below)
+static int64_t wgdos_decode_rows_full(const char *bytes_in,
+                                      int64_t num_words,
+                                      int64_t cols,
+                                      int64_t rows,
+                                      int64_t row_start,
+                                      int64_t row_end,
+                                      double mdi,
+                                      double *dataout,
+                                      char *err_msg,
+                                      int64_t msg_len)
+{
+  int64_t status;
+  double *unpacked = (double *)malloc((size_t)(rows*cols)*sizeof(double));
 
-  return (PyObject *)npy_array_out;
+  if (unpacked == NULL) {
+    snprintf(err_msg, (size_t)msg_len,
+             "Unable to allocate memory for unpacking");
+    return 1;
+  }
+
+  status = wgdos_decode(bytes_in, num_words, cols, rows, mdi, unpacked,
+                        err_msg, msg_len);
+  if (status == 0) {
+    memcpy(dataout, unpacked + row_start*cols,
+           (size_t)((row_end - row_start)*cols)*sizeof(double));
+  }
+  free(unpacked);
+  return status;
 }
 
-static PyObject *wgdos_pack_py(PyObject *self, PyObject *args)
+// Unpack only the rows from row_start up to (but not including) row_end of a
+// WGDOS packed field.  Each row of packed data starts with a 2 word header,
+// the second word of which gives (in its lower 16 bits) the number of packed
+// words which follow for that row; this makes it quick to walk through the
+// rows to locate the selected ones.  These are copied into this thread's
+// scratch buffer behind a field header which describes only those rows, and
+// unpacked from there.  If the packed data doesn't have the expected layout
+// the whole field is unpacked instead.  Like the above, this routine is safe
+// to call without holding the GIL
+static int64_t wgdos_decode_rows(const char *bytes_in,
+                                 int64_t num_words,
+                                 int64_t cols,
+                                 int64_t rows,
+                                 int64_t row_start,
+                                 int64_t row_end,
+                                 double mdi,
+                                 double *dataout,
+                                 char *err_msg,
+                                 int64_t msg_len)
 {
-  // Setup and obtain inputs passed from python
-  PyArrayObject *datain;
-  double mdi = 0.0;  
-  int64_t accuracy = 0;
-  // Note the argument descriptors "Odl":
-  //   - O  a python object (here a numpy.ndarray)
-  //   - d  an integer
-  //   - l  a long integer
-  if (!PyArg_ParseTuple(args, "Odl", 
-                        &datain, 
-                        &mdi, 
-                        &accuracy)) return NULL;
+  const unsigned char *words = (const unsigned char *)bytes_in;
+  int64_t n_rows = row_end - row_start;
+  int64_t offset = 3;
+  int64_t first = 0;
+  int64_t last = 0;
+  int64_t row;
+  int64_t status;
 
-  // Cast self to void to avoid unused paramter errors
-  (void) self;
+  // The third word of the field header holds the number of columns and
+  // the number of rows, as two 16-bit values
+  uint32_t size_word = read_word_be(words, 2);
+  uint32_t new_size_word;
+  if (size_word == (((uint32_t)cols << 16) | (uint32_t)rows)) {
+    new_size_word = ((uint32_t)cols << 16) | (uint32_t)n_rows;
+  } else if (size_word == (((uint32_t)rows << 16) | (uint32_t)cols)) {
+    new_size_word = ((uint32_t)n_rows << 16) | (uint32_t)cols;
+  } else {
+    return wgdos_decode_rows_full(bytes_in, num_words, cols, rows,
+                                  row_start, row_end, mdi, dataout,
+                                  err_msg, msg_len);
+  }
 
-  npy_intp *dims = PyArray_DIMS(datain);
-  int64_t rows = (int64_t) dims[0];
-  int64_t cols = (int64_t) dims[1];
-  double *field_ptr = (double *) PyArray_DATA(datain);
+  // Find the words spanned by the selected rows; the rows should exactly
+  // fill the packed field
+  for (row = 0; row < rows && offset + 2 <= num_words; row++) {
+    if (row == row_start) first = offset;
+    if (row == row_end) last = offset;
+    offset += 2 + (int64_t)(read_word_be(words, offset + 1) & 0xFFFF);
+  }
+  if (row_end == rows) last = offset;
+  if (row < rows || offset != num_words) {
+    return wgdos_decode_rows_full(bytes_in, num_words, cols, rows,
+                                  row_start, row_end, mdi, dataout,
+                                  err_msg, msg_len);
+  }
 
-  // Allocate space for return value
-  int64_t len_comp = rows*cols;
-  int32_t *comp_field_ptr = 
-    (int32_t*)calloc((size_t)(len_comp), sizeof(int32_t));
+  int64_t sub_words = 3 + last - first;
+  int32_t *packed = get_scratch_buffer(sub_words);
+  if (packed == NULL) {
+    snprintf(err_msg, (size_t)msg_len,
+             "Unable to allocate memory for unpacking");
+    return 1;
+  }
+  memcpy(packed, bytes_in, 3*sizeof(int32_t));
+  memcpy(packed + 3, bytes_in + first*(int64_t)sizeof(int32_t),
+         (size_t)(last - first)*sizeof(int32_t));
 
-  int64_t status = 1;
-  int64_t num_words;
+  // The first header word holds the length of the packed field, which is
+  // adjusted by the same amount as the length of the data (in case it is
+  // not exactly the number of packed words)
+  uint32_t length_word = read_word_be(words, 0);
+  if (c_shum_get_machine_endianism() == littleEndian) {
+    status = c_shum_byteswap(packed, sub_words, sizeof(int32_t),
+                             err_msg, msg_len);
+    if (status != 0) return status;
+  }
+  packed[0] = (int32_t)(length_word - (uint32_t)(num_words - sub_words));
+  packed[2] = (int32_t)new_size_word;
 
-  int64_t msg_len = 512;
-  char err_msg[msg_len];
+  status = c_shum_wgdos_unpack(packed,
+                               &sub_words,
+                               &cols,
+                               &n_rows,
+                               &mdi,
+                               dataout,
+                               err_msg,
+                               &msg_len
+                               );
+  return status;
+}
+
+// As above, but unpacking the rows into a single precision output array
+// (via this thread's double precision scratch buffer)
+static int64_t wgdos_decode_rows_float(const char *bytes_in,
+                                       int64_t num_words,
+                                       int64_t cols,
+                                       int64_t rows,
+                                       int64_t row_start,
+                                       int64_t row_end,
+                                       double mdi,
+                                       float *dataout,
+                                       char *err_msg,
+                                       int64_t msg_len)
+{
+  int64_t status;
+  int64_t i;
+  int64_t n_points = (row_end - row_start)*cols;
+  double *unpacked = get_scratch_doubles(n_points);
+
+  if (unpacked == NULL) {
+    snprintf(err_msg, (size_t)msg_len,
+             "Unable to allocate memory for unpacking");
+    return 1;
+  }
+
+  status = wgdos_decode_rows(bytes_in, num_words, cols, rows, row_start,
+                             row_end, mdi, unpacked, err_msg, msg_len);
+  if (status != 0) return status;
+
+  for (i = 0; i < n_points; i++) {
+    dataout[i] = (float)unpacked[i];
+  }
+  return 0;
+}
+
+// Pack a single field using WGDOS packing.  The library requires an output
+// buffer large enough for the worst case (the size of the unpacked field), so
+// rather than allocating one for every field this thread's packing scratch
+// buffer is used.  On success *packed points to the num_words packed words
+// (in native byte order), which remain valid until this thread next packs a
+// field (or calls release_scratch).  This routine does not use the Python
+// API and so is safe to call without holding the GIL
+static int64_t wgdos_encode(const double *field,
+                            int64_t cols,
+                            int64_t rows,
+                            int64_t accuracy,
+                            double mdi,
+                            int32_t **packed,
+                            int64_t *num_words,
+                            char *err_msg,
+                            int64_t msg_len)
+{
+  int64_t status;
+  int64_t len_comp = rows*cols;
+  int32_t *comp_field_ptr = get_pack_buffer(len_comp);
+
+  if (comp_field_ptr == NULL) {
+    snprintf(err_msg, (size_t)msg_len,
+             "Unable to allocate memory for packing");
+    return 1;
+  }
 
-  status = c_shum_wgdos_pack(field_ptr,
+  status = c_shum_wgdos_pack(field,
                              &cols,
                              &rows,
                              &accuracy,
                              &mdi,
                              comp_field_ptr,
                              &len_comp,
-                             &num_words,
-                             &err_msg[0],
+                             num_words,
+                             err_msg,
                              &msg_len
                              );
+  // Only the packed words are written on success (after a failure the state
+  // of the buffer isn't known, so all of it is zeroed before it is re-used)
+  pack_dirty_words = (status == 0) ? *num_words : len_comp;
+  if (status != 0) return status;
 
-  if (status != 0) {
-    free(comp_field_ptr);
-    PyErr_SetString(PyExc_ValueError, &err_msg[0]);
-    return NULL;
-  }
+  *packed = comp_field_ptr;
+  return 0;
+}
 
-  // Construct a char pointer array
-  char *ptr_char = (char *)comp_field_ptr;
-  Py_ssize_t out_len = (Py_ssize_t) (num_words * (int64_t)sizeof(int32_t));
+// Copy packed words into an output byte array, converting them to big-endian
+// order (as they are stored in files) in the same pass if required
+static void copy_packed_words(char *bytes_out,
+                              const int32_t *packed,
+                              int64_t num_words)
+{
+  int64_t i;
 
-  // Byteswap on the way out, if needed
-  if (c_shum_get_machine_endianism() == littleEndian) {
-    status = c_shum_byteswap(ptr_char, 
-                             num_words,
-                             sizeof(int32_t),
-                             &err_msg[0],
-                             msg_len
-                             );
-    if (status != 0) {
-      PyErr_SetString(PyExc_ValueError, &err_msg[0]);
-      return NULL;
-    }
+  if (c_shum_get_machine_endianism() != littleEndian) {
+    memcpy(bytes_out, packed, (size_t)num_words*sizeof(int32_t));
+    return;
   }
 
-  // Form a python string object to return to python
-  PyObject *bytes_out = NULL;
-  #if PY_MAJOR_VERSION >= 3
-    bytes_out = PyBytes_FromStringAndSize(ptr_char, out_len);
+  for (i = 0; i < num_words; i++) {
+    uint32_t word = (uint32_t)packed[i];
+    unsigned char *out = (unsigned char *)bytes_out + i*sizeof(int32_t);
+    out[0] = (unsigned char)(word >> 24);
+    out[1] = (unsigned char)(word >> 16);
+    out[2] = (unsigned char)(word >> 8);
+    out[3] = (unsigned char)word;
+  }
+}
+
+// Check that an array given as an "out" argument can be written to directly
+// by the library; it must be a C-contiguous, aligned, writeable array of the
+// given type (in native byte order) and with exactly the expected dimensions.
+// Returns 0 if the array is suitable, otherwise sets a Python exception
+static int check_out_array(PyObject *out, int type_num, int ndim,
+                           const npy_intp *dims)
+{
+  PyArrayObject *array;
+  int i;
+
+  if (!PyArray_Check(out)) {
+    PyErr_SetString(PyExc_ValueError, "Output must be a numpy.ndarray");
+    return 1;
+  }
+  array = (PyArrayObject *)out;
+
+  if (PyArray_TYPE(array) != type_num || !PyArray_ISNOTSWAPPED(array)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array has the wrong dtype or byte order");
+    return 1;
+  }
+
+  if (!PyArray_ISCARRAY(array)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array must be C-contiguous, aligned and writeable");
+    return 1;
+  }
+
+  if (PyArray_NDIM(array) != ndim) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array has the wrong number of dimensions");
+    return 1;
+  }
+  for (i = 0; i < ndim; i++) {
+    if (PyArray_DIMS(array)[i] != dims[i]) {
+      PyErr_SetString(PyExc_ValueError, "Output array has the wrong shape");
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static PyObject *wgdos_unpack_py(PyObject *self, PyObject *args,
+                                 PyObject *kwds)
+{
+  // Setup and obtain inputs passed from python
+  Py_buffer buffer_in;
+  double mdi = 0.0;
+  PyObject *out = NULL;
+  PyArray_Descr *dtype = NULL;
+  long long row_start_in = 0;
+  PyObject *row_end_in = NULL;
+  int threads = 0;
+  static char *kwlist[] = {"bytes_in", "mdi", "out", "dtype", "row_start",
+                           "row_end", "threads", NULL};
+  // Note the argument descriptors "y*d|OO&LO":
+  //   - y*  any (read-only) object supporting the buffer protocol
+  //   - d   a double
+  //   - O   a python object (optional, the output array)
+  //   - O&  a numpy dtype (optional, converted to a descriptor)
+  //   - L   a long long (optional, the first row to unpack)
+  //   - O   a python object (optional, the row to stop at, or None)
+  //   - i   an integer (optional, the number of threads)
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, BUFFER_FORMAT "d|OO&LOi",
+                                   kwlist, &buffer_in, &mdi, &out,
+                                   PyArray_DescrConverter2, &dtype,
+                                   &row_start_in, &row_end_in, &threads))
+    return NULL;
+  if (out == Py_None) out = NULL;
+  if (row_end_in == Py_None) row_end_in = NULL;
+
+  // The output may be either double or single precision
+  int type_num = NPY_DOUBLE;
+  if (dtype != NULL) {
+    type_num = dtype->type_num;
+    Py_DECREF(dtype);
+  }
+  if (type_num != NPY_DOUBLE && type_num != NPY_FLOAT) {
+    PyBuffer_Release(&buffer_in);
+    PyErr_SetString(PyExc_ValueError,
+                    "Unpacked data type must be float64 or float32");
+    return NULL;
+  }
+  size_t item_size = (type_num == NPY_DOUBLE) ? sizeof(double) : sizeof(float);
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  // Status variable to store various error codes
+  int64_t status = 1;
+
+  // Setup output array object and dimensions
+  PyArrayObject *npy_array_out = NULL;
+  npy_intp dims[2];
+
+  // Error message string
+  int64_t msg_len = 512;
+  char err_msg[msg_len];
+
+  // Now extract the word count, accuracy, number of rows and number of columns
+  // (note that unlike the unpacking itself this only needs the first few
+  // words of the field, and never modifies the input)
+  int64_t num_words;
+  int64_t accuracy;
+  int64_t cols;
+  int64_t rows;
+
+  status = read_wgdos_header_copy((const char *)buffer_in.buf,
+                                  (int64_t)buffer_in.len,
+                                  &num_words,
+                                  &accuracy,
+                                  &cols,
+                                  &rows,
+                                  &err_msg[0],
+                                  msg_len
+                                  );
+
+  if (status != 0) {
+    PyBuffer_Release(&buffer_in);
+    PyErr_SetString(PyExc_ValueError, &err_msg[0]);
+    return NULL;
+  }
+
+  // Work out the range of rows to unpack (by default the whole field)
+  int64_t row_start = (int64_t)row_start_in;
+  int64_t row_end = rows;
+  if (row_end_in != NULL) {
+    row_end = (int64_t)PyLong_AsLongLong(row_end_in);
+    if (row_end == -1 && PyErr_Occurred()) {
+      PyBuffer_Release(&buffer_in);
+      return NULL;
+    }
+  }
+  if (row_start < 0 || row_end < row_start || row_end > rows) {
+    PyBuffer_Release(&buffer_in);
+    PyErr_Format(PyExc_ValueError,
+                 "Invalid range of rows (%" PRId64 " to %" PRId64 ") for a "
+                 "field with %" PRId64 " rows", row_start, row_end, rows);
+    return NULL;
+  }
+  int all_rows = (row_start == 0 && row_end == rows);
+
+  dims[0] = row_end - row_start;
+  dims[1] = cols;
+
+  // Unpack straight into the output array if one was given, otherwise
+  // allocate space to hold the unpacked field
+  void *dataout = NULL;
+  if (out != NULL) {
+    if (check_out_array(out, type_num, 2, dims) != 0) {
+      PyBuffer_Release(&buffer_in);
+      return NULL;
+    }
+    dataout = PyArray_DATA((PyArrayObject *)out);
+  } else {
+    dataout = calloc((size_t)(dims[0]*cols), item_size);
+    if (dataout == NULL && dims[0]*cols > 0) {
+      PyBuffer_Release(&buffer_in);
+      PyErr_SetString(PyExc_ValueError,
+                      "Unable to allocate memory for unpacking");
+      return NULL;
+    }
+  }
+
+  // Call the WGDOS unpacking code; this doesn't touch any Python objects so
+  // other threads may run while it works
+  threads = choose_threads(threads);
+  double stats_start = stats_clock();
+  double stats_end = 0.0;
+  Py_BEGIN_ALLOW_THREADS
+  int previous_threads = set_field_threads(threads, dims[0]*cols);
+  if (dims[0] == 0) {
+    status = 0;
+  } else if (all_rows && type_num == NPY_DOUBLE) {
+    status = wgdos_decode((const char *)buffer_in.buf,
+                          num_words,
+                          cols,
+                          rows,
+                          mdi,
+                          (double *)dataout,
+                          &err_msg[0],
+                          msg_len
+                          );
+  } else if (all_rows) {
+    status = wgdos_decode_float((const char *)buffer_in.buf,
+                                num_words,
+                                cols,
+                                rows,
+                                mdi,
+                                (float *)dataout,
+                                &err_msg[0],
+                                msg_len
+                                );
+  } else if (type_num == NPY_DOUBLE) {
+    status = wgdos_decode_rows((const char *)buffer_in.buf,
+                               num_words, cols, rows, row_start, row_end,
+                               mdi, (double *)dataout,
+                               &err_msg[0], msg_len);
+  } else {
+    status = wgdos_decode_rows_float((const char *)buffer_in.buf,
+                                     num_words, cols, rows, row_start,
+                                     row_end, mdi, (float *)dataout,
+                                     &err_msg[0], msg_len);
+  }
+  release_scratch();
+  restore_field_threads(previous_threads);
+  stats_end = stats_clock();
+  Py_END_ALLOW_THREADS
+  stats_record(STATS_WGDOS_UNPACK, 1, (int64_t)(dims[0]*cols*item_size),
+               stats_start, stats_end);
+
+  PyBuffer_Release(&buffer_in);
+
+  if (status != 0) {
+    if (out == NULL) free(dataout);
+    PyErr_SetString(PyExc_ValueError, &err_msg[0]);
+    return NULL;
+  }
+
+  // If unpacking into the output array, simply return it
+  if (out != NULL) {
+    Py_INCREF(out);
+    return out;
+  }
+
+  // Now form a numpy array object to return to python
+  npy_array_out=(PyArrayObject *) PyArray_SimpleNewFromData(2, dims,
+                                                            type_num,
+                                                            dataout);
+  if (npy_array_out == NULL) {
+    free(dataout);
+    PyErr_SetString(PyExc_ValueError, "Failed to make numpy array");
+    return NULL;
+  }
+
+  // Give python/numpy ownership of the memory storing the return array
+  #if NPY_API_VERSION >= NPY_1_7_API_VERSION
+  PyArray_ENABLEFLAGS(npy_array_out, NPY_ARRAY_OWNDATA);
   #else
-    bytes_out = PyString_FromStringAndSize(ptr_char, out_len);
+  npy_array_out->flags = npy_array_out->flags | NPY_OWNDATA;
   #endif
 
-  // Free the memory used by the integer array
-  free(comp_field_ptr);
+  return (PyObject *)npy_array_out;
+}
+
+static PyObject *wgdos_unpack_many_py(PyObject *self, PyObject *args,
+                                      PyObject *kwds)
+{
+  // Setup and obtain inputs passed from python
+  PyObject *list_in = NULL;
+  PyObject *mdi_in = NULL;
+  int stack = 0;
+  int threads = 0;
+  static char *kwlist[] = {"list_of_bytes", "mdi", "stack", "threads", NULL};
+  // Note the argument descriptors "OO|pi":
+  //   - O  a python object (here a sequence of byte-arrays)
+  //   - O  a python object (either a float or a sequence of floats)
+  //   - p  a boolean (optional)
+  //   - i  an integer (optional)
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|pi", kwlist,
+                                   &list_in, &mdi_in, &stack, &threads))
+    return NULL;
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  PyObject *seq = PySequence_Fast(list_in, "Expected a sequence of bytes");
+  if (seq == NULL) return NULL;
+  Py_ssize_t n_fields = PySequence_Fast_GET_SIZE(seq);
+
+  // Error message string
+  int64_t msg_len = 512;
+  char err_msg[msg_len];
+
+  // Per-field information; the buffers are held until the end of the call so
+  // that the packed data remains valid while the GIL is released
+  Py_buffer *buffers = (Py_buffer *)calloc((size_t)(n_fields + 1),
+                                           sizeof(Py_buffer));
+  int64_t *info = (int64_t *)calloc((size_t)(4*n_fields + 1),
+                                    sizeof(int64_t));
+  double *mdis = (double *)calloc((size_t)(n_fields + 1), sizeof(double));
+  double **dataout = (double **)calloc((size_t)(n_fields + 1),
+                                       sizeof(double *));
+  PyObject *result = NULL;
+  Py_ssize_t n_buffers = 0;
+  Py_ssize_t i;
+
+  if (buffers == NULL || info == NULL || mdis == NULL || dataout == NULL) {
+    PyErr_SetString(PyExc_ValueError, "Unable to allocate memory for unpacking");
+    goto cleanup;
+  }
+
+  // The missing data indicator can be shared or given per-field
+  if (get_field_doubles(mdi_in, n_fields, mdis, "mdi") != 0) goto cleanup;
+
+  // Obtain the packed data and read the header of each field (this is cheap,
+  // and allows the output arrays to be created up front)
+  for (i = 0; i < n_fields; i++) {
+    if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, i),
+                           &buffers[i], PyBUF_SIMPLE) != 0) goto cleanup;
+    n_buffers++;
+
+    int64_t accuracy;
+    int64_t status = read_wgdos_header_copy((const char *)buffers[i].buf,
+                                            (int64_t)buffers[i].len,
+                                            &info[4*i],
+                                            &accuracy,
+                                            &info[4*i + 1],
+                                            &info[4*i + 2],
+                                            &err_msg[0],
+                                            msg_len);
+    if (status != 0) {
+      PyErr_Format(PyExc_ValueError, "Field %zd: %s", i, &err_msg[0]);
+      goto cleanup;
+    }
+  }
+
+  // Create the output array(s)
+  if (stack) {
+    npy_intp dims[3];
+    dims[0] = n_fields;
+    dims[1] = (n_fields > 0) ? info[2] : 0;
+    dims[2] = (n_fields > 0) ? info[1] : 0;
+    for (i = 1; i < n_fields; i++) {
+      if (info[4*i + 2] != dims[1] || info[4*i + 1] != dims[2]) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Fields must have the same dimensions to be stacked");
+        goto cleanup;
+      }
+    }
+    result = PyArray_SimpleNew(3, dims, NPY_DOUBLE);
+    if (result == NULL) goto cleanup;
+    double *base = (double *)PyArray_DATA((PyArrayObject *)result);
+    for (i = 0; i < n_fields; i++) {
+      dataout[i] = base + i*dims[1]*dims[2];
+    }
+  } else {
+    result = PyList_New(n_fields);
+    if (result == NULL) goto cleanup;
+    for (i = 0; i < n_fields; i++) {
+      npy_intp dims[2];
+      dims[0] = info[4*i + 2];
+      dims[1] = info[4*i + 1];
+      PyObject *array = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+      if (array == NULL) goto cleanup;
+      PyList_SET_ITEM(result, i, array);
+      dataout[i] = (double *)PyArray_DATA((PyArrayObject *)array);
+    }
+  }
+
+  // Now unpack the fields; the 4th info element of each field records its
+  // unpacking status, and the first failure's message is kept for reporting
+  Py_ssize_t failed = -1;
+
+  int64_t total_points = 0;
+  for (i = 0; i < n_fields; i++) total_points += info[4*i + 1]*info[4*i + 2];
+  int field_threads;
+  int team = batch_threads(choose_threads(threads), n_fields, total_points,
+                           &field_threads);
+
+  double stats_start = stats_clock();
+  double stats_end = 0.0;
+  Py_BEGIN_ALLOW_THREADS
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(team)
+  for (i = 0; i < n_fields; i++) {
+    char thread_msg[512];
+    #ifdef _OPENMP
+    omp_set_num_threads(field_threads);
+    #endif
+    info[4*i + 3] = wgdos_decode((const char *)buffers[i].buf,
+                                 info[4*i],
+                                 info[4*i + 1],
+                                 info[4*i + 2],
+                                 mdis[i],
+                                 dataout[i],
+                                 &thread_msg[0],
+                                 (int64_t)sizeof(thread_msg));
+    release_scratch();
+    if (info[4*i + 3] != 0) {
+      #pragma omp critical
+      {
+        if (failed < 0 || i < failed) {
+          failed = i;
+          memcpy(err_msg, thread_msg, sizeof(thread_msg));
+        }
+      }
+    }
+  }
+  stats_end = stats_clock();
+  Py_END_ALLOW_THREADS
+
+  stats_record(STATS_WGDOS_UNPACK, (int64_t)n_fields,
+               (int64_t)sizeof(double)*total_points, stats_start, stats_end);
+
+  if (failed >= 0) {
+    PyErr_Format(PyExc_ValueError, "Field %zd: %s", failed, &err_msg[0]);
+    Py_CLEAR(result);
+  }
+
+ cleanup:
+  if (PyErr_Occurred()) Py_CLEAR(result);
+  for (i = 0; i < n_buffers; i++) PyBuffer_Release(&buffers[i]);
+  free(buffers);
+  free(info);
+  free(mdis);
+  free(dataout);
+  Py_DECREF(seq);
+  return result;
+}
+
+static PyObject *wgdos_pack_py(PyObject *self, PyObject *args,
+                               PyObject *kwds)
+{
+  // Setup and obtain inputs passed from python
+  PyObject *field_in = NULL;
+  double mdi = 0.0;  
+  int64_t accuracy = 0;
+  int threads = 0;
+  static char *kwlist[] = {"field_in", "mdi", "accuracy", "threads", NULL};
+  // Note the argument descriptors "Odl|i":
+  //   - O  a python object (here a numpy.ndarray)
+  //   - d  an integer
+  //   - l  a long integer
+  //   - i  an integer (optional, the number of threads)
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "Odl|i", kwlist,
+                                   &field_in,
+                                   &mdi,
+                                   &accuracy,
+                                   &threads)) return NULL;
+
+  // Cast self to void to avoid unused paramter errors
+  (void) self;
+
+  // Obtain the field as a contiguous, native double precision array (this
+  // only makes a copy if the given array isn't already in that form)
+  PyArrayObject *datain = (PyArrayObject *)PyArray_FROM_OTF(
+                              field_in, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY);
+  if (datain == NULL) return NULL;
+  if (PyArray_NDIM(datain) != 2) {
+    PyErr_SetString(PyExc_ValueError, "Field must be 2 Dimensional");
+    Py_DECREF(datain);
+    return NULL;
+  }
+
+  npy_intp *dims = PyArray_DIMS(datain);
+  int64_t rows = (int64_t) dims[0];
+  int64_t cols = (int64_t) dims[1];
+  double *field_ptr = (double *) PyArray_DATA(datain);
+
+  int64_t status = 1;
+  int64_t num_words;
+  int32_t *comp_field_ptr = NULL;
+
+  int64_t msg_len = 512;
+  char err_msg[msg_len];
+
+  // Call the WGDOS packing code; this doesn't touch any Python objects so
+  // other threads may run while it works
+  threads = choose_threads(threads);
+  double stats_start = stats_clock();
+  double stats_end = 0.0;
+  Py_BEGIN_ALLOW_THREADS
+  int previous_threads = set_field_threads(threads, rows*cols);
+  status = wgdos_encode(field_ptr,
+                        cols,
+                        rows,
+                        accuracy,
+                        mdi,
+                        &comp_field_ptr,
+                        &num_words,
+                        &err_msg[0],
+                        msg_len
+                        );
+  restore_field_threads(previous_threads);
+  stats_end = stats_clock();
+  Py_END_ALLOW_THREADS
+  stats_record(STATS_WGDOS_PACK, 1, (int64_t)sizeof(double)*rows*cols,
+               stats_start, stats_end);
+  Py_DECREF(datain);
+
+  // The packed words are in the thread's scratch buffer, which is released
+  // on every path from here (once they have been copied, if they can be)
+  PyObject *bytes_out = NULL;
+  if (status != 0) {
+    PyErr_SetString(PyExc_ValueError, &err_msg[0]);
+  } else {
+    // Form a python string object of exactly the packed size to return to
+    // python, and copy (and byteswap, if needed) the packed words into it
+    Py_ssize_t out_len = (Py_ssize_t) (num_words*(int64_t)sizeof(int32_t));
+    #if PY_MAJOR_VERSION >= 3
+      bytes_out = PyBytes_FromStringAndSize(NULL, out_len);
+      if (bytes_out != NULL)
+        copy_packed_words(PyBytes_AS_STRING(bytes_out), comp_field_ptr,
+                          num_words);
+    #else
+      bytes_out = PyString_FromStringAndSize(NULL, out_len);
+      if (bytes_out != NULL)
+        copy_packed_words(PyString_AS_STRING(bytes_out), comp_field_ptr,
+                          num_words);
+    #endif
+  }
+  release_scratch();
+
+  return bytes_out;
+}
+
+static PyObject *wgdos_pack_many_py(PyObject *self, PyObject *args,
+                                    PyObject *kwds)
+{
+  // Setup and obtain inputs passed from python
+  PyObject *list_in = NULL;
+  PyObject *mdi_in = NULL;
+  PyObject *accuracy_in = NULL;
+  int threads = 0;
+  static char *kwlist[] = {"list_of_fields", "mdi", "accuracy", "threads",
+                           NULL};
+  // Note the argument descriptors "OOO|i":
+  //   - O  a python object (here a sequence of numpy.ndarrays)
+  //   - O  a python object (either a float or a sequence of floats)
+  //   - O  a python object (either an integer or a sequence of integers)
+  //   - i  an integer (optional)
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOO|i", kwlist,
+                                   &list_in, &mdi_in, &accuracy_in, &threads))
+    return NULL;
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  PyObject *seq = PySequence_Fast(list_in, "Expected a sequence of arrays");
+  if (seq == NULL) return NULL;
+  Py_ssize_t n_fields = PySequence_Fast_GET_SIZE(seq);
+
+  // Error message string
+  int64_t msg_len = 512;
+  char err_msg[msg_len];
+
+  // Per-field information; the (contiguous, double precision) input arrays
+  // are held until the end of the call so that they remain valid while the
+  // GIL is released.  Each field is copied from the thread's packing buffer
+  // straight into a python string object of exactly its packed size
+  PyArrayObject **arrays = (PyArrayObject **)calloc((size_t)(n_fields + 1),
+                                                    sizeof(PyArrayObject *));
+  double *mdis = (double *)calloc((size_t)(n_fields + 1), sizeof(double));
+  int64_t *accuracies = (int64_t *)calloc((size_t)(n_fields + 1),
+                                          sizeof(int64_t));
+  int64_t *num_words = (int64_t *)calloc((size_t)(n_fields + 1),
+                                         sizeof(int64_t));
+  PyObject **packed = (PyObject **)calloc((size_t)(n_fields + 1),
+                                          sizeof(PyObject *));
+  PyObject *result = NULL;
+  Py_ssize_t i;
+
+  if (arrays == NULL || mdis == NULL || accuracies == NULL ||
+      num_words == NULL || packed == NULL) {
+    PyErr_SetString(PyExc_ValueError, "Unable to allocate memory for packing");
+    goto cleanup;
+  }
+
+  // The missing data indicator and accuracy can be shared or given per-field
+  if (get_field_doubles(mdi_in, n_fields, mdis, "mdi") != 0) goto cleanup;
+  if (get_field_ints(accuracy_in, n_fields, accuracies, "accuracy") != 0)
+    goto cleanup;
+
+  // Obtain each field as a contiguous, native double precision array (this
+  // only makes a copy if the given array isn't already in that form)
+  for (i = 0; i < n_fields; i++) {
+    arrays[i] = (PyArrayObject *)PyArray_FROM_OTF(
+                                     PySequence_Fast_GET_ITEM(seq, i),
+                                     NPY_DOUBLE, NPY_ARRAY_IN_ARRAY);
+    if (arrays[i] == NULL) goto cleanup;
+    if (PyArray_NDIM(arrays[i]) != 2) {
+      PyErr_Format(PyExc_ValueError,
+                   "Field %zd: Field must be 2 Dimensional", i);
+      goto cleanup;
+    }
+  }
+
+  // Now pack the fields; a failure's status is recorded in place of its word
+  // count, and the first failure's message is kept for reporting
+  Py_ssize_t failed = -1;
+
+  int64_t total_points = 0;
+  for (i = 0; i < n_fields; i++) {
+    total_points += (int64_t)PyArray_SIZE(arrays[i]);
+  }
+  int field_threads;
+  int team = batch_threads(choose_threads(threads), n_fields, total_points,
+                           &field_threads);
+
+  double stats_start = stats_clock();
+  double stats_end = 0.0;
+  Py_BEGIN_ALLOW_THREADS
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(team)
+  for (i = 0; i < n_fields; i++) {
+    char thread_msg[512];
+    int32_t *comp_field_ptr = NULL;
+    #ifdef _OPENMP
+    omp_set_num_threads(field_threads);
+    #endif
+    npy_intp *dims = PyArray_DIMS(arrays[i]);
+    int64_t status = wgdos_encode((const double *)PyArray_DATA(arrays[i]),
+                                  (int64_t)dims[1],
+                                  (int64_t)dims[0],
+                                  accuracies[i],
+                                  mdis[i],
+                                  &comp_field_ptr,
+                                  &num_words[i],
+                                  &thread_msg[0],
+                                  (int64_t)sizeof(thread_msg));
+    if (status == 0) {
+      // Creating the string object needs the GIL, but only briefly; the
+      // words are then copied into it (which no other thread can see yet)
+      // without holding it
+      Py_ssize_t out_len =
+        (Py_ssize_t)(num_words[i]*(int64_t)sizeof(int32_t));
+      PyGILState_STATE gil_state = PyGILState_Ensure();
+      #if PY_MAJOR_VERSION >= 3
+        packed[i] = PyBytes_FromStringAndSize(NULL, out_len);
+      #else
+        packed[i] = PyString_FromStringAndSize(NULL, out_len);
+      #endif
+      if (packed[i] == NULL) PyErr_Clear();
+      PyGILState_Release(gil_state);
+      if (packed[i] == NULL) {
+        status = 1;
+        snprintf(thread_msg, sizeof(thread_msg),
+                 "Unable to allocate memory for packing");
+      } else {
+        #if PY_MAJOR_VERSION >= 3
+          copy_packed_words(PyBytes_AS_STRING(packed[i]), comp_field_ptr,
+                            num_words[i]);
+        #else
+          copy_packed_words(PyString_AS_STRING(packed[i]), comp_field_ptr,
+                            num_words[i]);
+        #endif
+      }
+    }
+    release_scratch();
+    if (status != 0) {
+      #pragma omp critical
+      {
+        if (failed < 0 || i < failed) {
+          failed = i;
+          memcpy(err_msg, thread_msg, sizeof(thread_msg));
+        }
+      }
+    }
+  }
+  stats_end = stats_clock();
+  Py_END_ALLOW_THREADS
+
+  stats_record(STATS_WGDOS_PACK, (int64_t)n_fields,
+               (int64_t)sizeof(double)*total_points, stats_start, stats_end);
 
+  if (failed >= 0) {
+    PyErr_Format(PyExc_ValueError, "Field %zd: %s", failed, &err_msg[0]);
+    goto cleanup;
+  }
+
+  // Return the python string objects to python (the list takes over the
+  // references to them)
+  result = PyList_New(n_fields);
+  if (result == NULL) goto cleanup;
+  for (i = 0; i < n_fields; i++) {
+    PyList_SET_ITEM(result, i, packed[i]);
+    packed[i] = NULL;
+  }
+
+ cleanup:
+  if (PyErr_Occurred()) Py_CLEAR(result);
+  for (i = 0; i < n_fields && arrays != NULL; i++) Py_XDECREF(arrays[i]);
+  for (i = 0; i < n_fields && packed != NULL; i++) Py_XDECREF(packed[i]);
+  free(arrays);
+  free(mdis);
+  free(accuracies);
+  free(num_words);
+  free(packed);
+  Py_DECREF(seq);
+  return result;
+}
+
+// Check that an argument to the land/sea routines is a C-contiguous numpy
+// array (and writeable, if it is an output).  Returns the array, or NULL
+// after setting a Python exception
+static PyArrayObject *landsea_array(PyObject *obj, const char *name,
+                                    int writeable)
+{
+  if (!PyArray_Check(obj)) {
+    PyErr_Format(PyExc_ValueError, "%s must be a numpy.ndarray", name);
+    return NULL;
+  }
+  PyArrayObject *array = (PyArrayObject *)obj;
+  if (!PyArray_IS_C_CONTIGUOUS(array) ||
+      (writeable && !PyArray_ISWRITEABLE(array))) {
+    PyErr_Format(PyExc_ValueError, "%s array must be C-contiguous%s", name,
+                 writeable ? " and writeable" : "");
+    return NULL;
+  }
+  return array;
+}
+
+// Copy the values of the selected points between a packed array and the full
+// grid; when expanding, the unselected points are set to the fill value in
+// the same pass.  Values are copied as raw items of the given size, so this
+// works for any type or byte order.  Returns the number of packed values
+// used, or -1 if there were fewer packed values than selected points
+static int64_t landsea_copy(char *packed,
+                            int64_t n_packed,
+                            const npy_bool *mask,
+                            char *grid,
+                            int64_t n_points,
+                            const char *fill,
+                            size_t itemsize,
+                            int expand)
+{
+  int64_t i;
+  int64_t k = 0;
+
+  for (i = 0; i < n_points; i++) {
+    if (mask[i]) {
+      if (k >= n_packed) return -1;
+      if (expand) {
+        memcpy(grid + i*itemsize, packed + k*itemsize, itemsize);
+      } else {
+        memcpy(packed + k*itemsize, grid + i*itemsize, itemsize);
+      }
+      k++;
+    } else if (expand) {
+      memcpy(grid + i*itemsize, fill, itemsize);
+    }
+  }
+  return k;
+}
+
+// As above, but with the item size fixed so that the copies can be inlined
+// for the common cases of 32 and 64-bit items
+static int64_t landsea_copy_items(char *packed,
+                                  int64_t n_packed,
+                                  const npy_bool *mask,
+                                  char *grid,
+                                  int64_t n_points,
+                                  const char *fill,
+                                  size_t itemsize,
+                                  int expand)
+{
+  switch (itemsize) {
+    case 8:
+      return landsea_copy(packed, n_packed, mask, grid, n_points, fill,
+                          8, expand);
+    case 4:
+      return landsea_copy(packed, n_packed, mask, grid, n_points, fill,
+                          4, expand);
+    default:
+      return landsea_copy(packed, n_packed, mask, grid, n_points, fill,
+                          itemsize, expand);
+  }
+}
+
+static PyObject *landsea_expand_py(PyObject *self, PyObject *args)
+{
+  // Setup and obtain inputs passed from python
+  PyObject *packed_in;
+  PyObject *mask_in;
+  PyObject *fill_in;
+  PyObject *out_in;
+  if (!PyArg_ParseTuple(args, "OOOO", &packed_in, &mask_in, &fill_in,
+                        &out_in)) return NULL;
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  PyArrayObject *packed = landsea_array(packed_in, "Packed", 0);
+  PyArrayObject *mask = landsea_array(mask_in, "Mask", 0);
+  PyArrayObject *fill = landsea_array(fill_in, "Fill", 0);
+  PyArrayObject *out = landsea_array(out_in, "Output", 1);
+  if (packed == NULL || mask == NULL || fill == NULL || out == NULL)
+    return NULL;
+
+  size_t itemsize = (size_t)PyArray_ITEMSIZE(packed);
+  if (PyArray_TYPE(mask) != NPY_BOOL) {
+    PyErr_SetString(PyExc_ValueError, "Mask array must be boolean");
+    return NULL;
+  }
+  if ((size_t)PyArray_ITEMSIZE(out) != itemsize ||
+      (size_t)PyArray_ITEMSIZE(fill) != itemsize ||
+      PyArray_SIZE(fill) != 1) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Fill and output must have the same type as packed data");
+    return NULL;
+  }
+  if (PyArray_SIZE(out) != PyArray_SIZE(mask)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array must be the same size as the mask");
+    return NULL;
+  }
+
+  int64_t n_packed = (int64_t)PyArray_SIZE(packed);
+  int64_t n_used;
+
+  double stats_start = stats_clock();
+  double stats_end = 0.0;
+  Py_BEGIN_ALLOW_THREADS
+  n_used = landsea_copy_items((char *)PyArray_DATA(packed),
+                              n_packed,
+                              (const npy_bool *)PyArray_DATA(mask),
+                              (char *)PyArray_DATA(out),
+                              (int64_t)PyArray_SIZE(mask),
+                              (const char *)PyArray_DATA(fill),
+                              itemsize,
+                              1);
+  stats_end = stats_clock();
+  Py_END_ALLOW_THREADS
+  stats_record(STATS_LANDSEA_EXPAND, 1, (int64_t)(PyArray_SIZE(mask)*itemsize),
+               stats_start, stats_end);
+
+  if (n_used != n_packed) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Number of points in mask is incompatible with the "
+                    "packed data");
+    return NULL;
+  }
+
+  Py_INCREF(out_in);
+  return out_in;
+}
+
+static PyObject *landsea_compress_py(PyObject *self, PyObject *args)
+{
+  // Setup and obtain inputs passed from python
+  PyObject *data_in;
+  PyObject *mask_in;
+  PyObject *out_in;
+  if (!PyArg_ParseTuple(args, "OOO", &data_in, &mask_in, &out_in))
+    return NULL;
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  PyArrayObject *data = landsea_array(data_in, "Data", 0);
+  PyArrayObject *mask = landsea_array(mask_in, "Mask", 0);
+  PyArrayObject *out = landsea_array(out_in, "Output", 1);
+  if (data == NULL || mask == NULL || out == NULL) return NULL;
+
+  size_t itemsize = (size_t)PyArray_ITEMSIZE(data);
+  if (PyArray_TYPE(mask) != NPY_BOOL) {
+    PyErr_SetString(PyExc_ValueError, "Mask array must be boolean");
+    return NULL;
+  }
+  if ((size_t)PyArray_ITEMSIZE(out) != itemsize) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output must have the same type as the data");
+    return NULL;
+  }
+  if (PyArray_SIZE(data) != PyArray_SIZE(mask)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Data array must be the same size as the mask");
+    return NULL;
+  }
+
+  int64_t n_packed = (int64_t)PyArray_SIZE(out);
+  int64_t n_used;
+
+  double stats_start = stats_clock();
+  double stats_end = 0.0;
+  Py_BEGIN_ALLOW_THREADS
+  n_used = landsea_copy_items((char *)PyArray_DATA(out),
+                              n_packed,
+                              (const npy_bool *)PyArray_DATA(mask),
+                              (char *)PyArray_DATA(data),
+                              (int64_t)PyArray_SIZE(mask),
+                              NULL,
+                              itemsize,
+                              0);
+  stats_end = stats_clock();
+  Py_END_ALLOW_THREADS
+  stats_record(STATS_LANDSEA_COMPRESS, 1, (int64_t)(PyArray_SIZE(mask)*itemsize),
+               stats_start, stats_end);
+
+  if (n_used != n_packed) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Number of points in mask is incompatible with the "
+                    "packed data");
+    return NULL;
+  }
+
+  Py_INCREF(out_in);
+  return out_in;
+}
+
+// Number of points compared between checks of whether to stop comparing
+#define COMPARE_BLOCK 4096
+
+// Compare two arrays of doubles, counting the points which differ and
+// accumulating the largest absolute difference and the sum of the squared
+// differences.  The arrays are compared in blocks with no branches in the
+// inner loop (so that it can be vectorised); if stop_at_first is set, the
+// comparison ends after the first block containing a difference.  Returns
+// the number of points compared
+static int64_t compare_doubles(const double *a,
+                               const double *b,
+                               int64_t n_points,
+                               int stop_at_first,
+                               int64_t *n_differ,
+                               double *max_diff,
+                               double *sum_sq)
+{
+  int64_t start;
+  int64_t i;
+  int64_t count = 0;
+  double max_abs = 0.0;
+  double sum = 0.0;
+
+  for (start = 0; start < n_points; start += COMPARE_BLOCK) {
+    int64_t end = start + COMPARE_BLOCK;
+    if (end > n_points) end = n_points;
+    for (i = start; i < end; i++) {
+      // Points differ if they aren't equal, unless they are both NaN
+      int differ = (a[i] != b[i]) & !((a[i] != a[i]) & (b[i] != b[i]));
+      double diff = differ ? fabs(a[i] - b[i]) : 0.0;
+      count += differ;
+      max_abs = diff > max_abs ? diff : max_abs;
+      sum += diff*diff;
+    }
+    if (stop_at_first && count > 0) {
+      n_points = end;
+      break;
+    }
+  }
+
+  *n_differ = count;
+  *max_diff = max_abs;
+  *sum_sq = sum;
+  return n_points;
+}
+
+static PyObject *compare_arrays_py(PyObject *self, PyObject *args,
+                                   PyObject *kwds)
+{
+  // Setup and obtain inputs passed from python
+  PyObject *a_in;
+  PyObject *b_in;
+  int stop_at_first = 0;
+  static char *kwlist[] = {"a", "b", "stop_at_first", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|p", kwlist,
+                                   &a_in, &b_in, &stop_at_first))
+    return NULL;
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  // Convert the inputs to aligned, native double arrays (this only copies
+  // them if they aren't already suitable)
+  PyArrayObject *a = (PyArrayObject *)PyArray_FROM_OTF(
+      a_in, NPY_FLOAT64, NPY_ARRAY_IN_ARRAY);
+  if (a == NULL) return NULL;
+  PyArrayObject *b = (PyArrayObject *)PyArray_FROM_OTF(
+      b_in, NPY_FLOAT64, NPY_ARRAY_IN_ARRAY);
+  if (b == NULL) {
+    Py_DECREF(a);
+    return NULL;
+  }
+
+  if (PyArray_SIZE(a) != PyArray_SIZE(b)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Arrays must have the same number of elements");
+    Py_DECREF(a);
+    Py_DECREF(b);
+    return NULL;
+  }
+
+  int64_t n_compared;
+  int64_t n_differ;
+  double max_diff;
+  double sum_sq;
+
+  Py_BEGIN_ALLOW_THREADS
+  n_compared = compare_doubles((const double *)PyArray_DATA(a),
+                               (const double *)PyArray_DATA(b),
+                               (int64_t)PyArray_SIZE(a),
+                               stop_at_first,
+                               &n_differ,
+                               &max_diff,
+                               &sum_sq);
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(a);
+  Py_DECREF(b);
+
+  double rms_diff = 0.0;
+  if (n_compared > 0) rms_diff = sqrt(sum_sq / (double)n_compared);
+
+  return Py_BuildValue("Ldd", (long long)n_differ, max_diff, rms_diff);
+}
+
+// Convert count big-endian 32-bit words to native values of the given type,
+// in a single pass over the data.  This routine does not use the Python API
+// and so is safe to call without holding the GIL
+static void cray32_decode(const unsigned char *bytes_in,
+                          int64_t count,
+                          int type_num,
+                          void *dataout)
+{
+  int64_t i;
+  uint32_t word;
+  float value;
+
+  switch (type_num) {
+    case NPY_FLOAT64:
+      for (i = 0; i < count; i++) {
+        word = read_word_be(bytes_in, i);
+        memcpy(&value, &word, sizeof(float));
+        ((double *)dataout)[i] = (double)value;
+      }
+      break;
+    case NPY_FLOAT32:
+      for (i = 0; i < count; i++) {
+        word = read_word_be(bytes_in, i);
+        memcpy(&((float *)dataout)[i], &word, sizeof(float));
+      }
+      break;
+    case NPY_INT64:
+      for (i = 0; i < count; i++) {
+        ((int64_t *)dataout)[i] = (int64_t)(int32_t)read_word_be(bytes_in, i);
+      }
+      break;
+    default:
+      for (i = 0; i < count; i++) {
+        ((int32_t *)dataout)[i] = (int32_t)read_word_be(bytes_in, i);
+      }
+      break;
+  }
+}
+
+// The reverse of the above; narrow count native values of the given type to
+// big-endian 32-bit words (again safe to call without holding the GIL)
+static void cray32_encode(const void *data,
+                          int64_t count,
+                          int type_num,
+                          unsigned char *bytes_out)
+{
+  int64_t i;
+  uint32_t word;
+  float value;
+
+  switch (type_num) {
+    case NPY_FLOAT64:
+      for (i = 0; i < count; i++) {
+        value = (float)((const double *)data)[i];
+        memcpy(&word, &value, sizeof(float));
+        write_word_be(bytes_out, i, word);
+      }
+      break;
+    case NPY_FLOAT32:
+      for (i = 0; i < count; i++) {
+        memcpy(&word, &((const float *)data)[i], sizeof(float));
+        write_word_be(bytes_out, i, word);
+      }
+      break;
+    case NPY_INT64:
+      for (i = 0; i < count; i++) {
+        word = (uint32_t)((const int64_t *)data)[i];
+        write_word_be(bytes_out, i, word);
+      }
+      break;
+    default:
+      for (i = 0; i < count; i++) {
+        word = (uint32_t)((const int32_t *)data)[i];
+        write_word_be(bytes_out, i, word);
+      }
+      break;
+  }
+}
+
+static PyObject *cray32_unpack_py(PyObject *self, PyObject *args,
+                                  PyObject *kwds)
+{
+  // Setup and obtain inputs passed from python
+  Py_buffer buffer_in;
+  long long count_in;
+  PyArray_Descr *dtype = NULL;
+  PyObject *out = NULL;
+  static char *kwlist[] = {"bytes_in", "count", "dtype", "out", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, BUFFER_FORMAT "L|O&O", kwlist,
+                                   &buffer_in, &count_in,
+                                   PyArray_DescrConverter2, &dtype, &out))
+    return NULL;
+  if (out == Py_None) out = NULL;
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  int type_num = NPY_FLOAT64;
+  if (dtype != NULL) {
+    type_num = dtype->type_num;
+    Py_DECREF(dtype);
+  }
+  if (type_num != NPY_FLOAT64 && type_num != NPY_FLOAT32 &&
+      type_num != NPY_INT64 && type_num != NPY_INT32) {
+    PyBuffer_Release(&buffer_in);
+    PyErr_SetString(PyExc_ValueError,
+                    "Unpacked data type must be float64, float32, int64 "
+                    "or int32");
+    return NULL;
+  }
+
+  int64_t count = (int64_t)count_in;
+  if (count < 0 || (int64_t)buffer_in.len < 4*count) {
+    PyBuffer_Release(&buffer_in);
+    PyErr_SetString(PyExc_ValueError,
+                    "Input is too short to contain the requested number "
+                    "of words");
+    return NULL;
+  }
+
+  // Convert straight into the output array if one was given, otherwise
+  // create a new one
+  npy_intp dims[1] = {(npy_intp)count};
+  PyArrayObject *npy_array_out = NULL;
+  if (out != NULL) {
+    if (!PyArray_Check(out) ||
+        PyArray_SIZE((PyArrayObject *)out) != (npy_intp)count) {
+      PyBuffer_Release(&buffer_in);
+      PyErr_SetString(PyExc_ValueError,
+                      "Output must be a numpy.ndarray with count elements");
+      return NULL;
+    }
+    npy_array_out = (PyArrayObject *)out;
+    if (check_out_array(out, type_num, PyArray_NDIM(npy_array_out),
+                        PyArray_DIMS(npy_array_out)) != 0) {
+      PyBuffer_Release(&buffer_in);
+      return NULL;
+    }
+    Py_INCREF(out);
+  } else {
+    npy_array_out = (PyArrayObject *)PyArray_SimpleNew(1, dims, type_num);
+    if (npy_array_out == NULL) {
+      PyBuffer_Release(&buffer_in);
+      return NULL;
+    }
+  }
+
+  double stats_start = stats_clock();
+  double stats_end = 0.0;
+  Py_BEGIN_ALLOW_THREADS
+  cray32_decode((const unsigned char *)buffer_in.buf, count, type_num,
+                PyArray_DATA(npy_array_out));
+  stats_end = stats_clock();
+  Py_END_ALLOW_THREADS
+  stats_record(STATS_CRAY32_UNPACK, 1,
+               count*(int64_t)PyArray_ITEMSIZE(npy_array_out),
+               stats_start, stats_end);
+
+  PyBuffer_Release(&buffer_in);
+  return (PyObject *)npy_array_out;
+}
+
+static PyObject *cray32_pack_py(PyObject *self, PyObject *args,
+                                PyObject *kwds)
+{
+  // Setup and obtain inputs passed from python
+  PyObject *data_in;
+  int integer = 0;
+  static char *kwlist[] = {"data", "integer", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p", kwlist,
+                                   &data_in, &integer))
+    return NULL;
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  // Single precision (or 32-bit integer) input is used as it is, anything
+  // else is converted to double precision (or 64-bit integers); either way
+  // this only copies the input if it isn't already aligned and contiguous.
+  // The conversion is forced, so that (as with numpy's astype) real values
+  // given for an integer field are truncated rather than rejected
+  int type_num = integer ? NPY_INT64 : NPY_FLOAT64;
+  if (PyArray_Check(data_in)) {
+    int in_type = PyArray_TYPE((PyArrayObject *)data_in);
+    if ((integer && in_type == NPY_INT32) ||
+        (!integer && in_type == NPY_FLOAT32)) {
+      type_num = in_type;
+    }
+  }
+  PyArrayObject *data = (PyArrayObject *)PyArray_FROM_OTF(
+      data_in, type_num, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+  if (data == NULL) return NULL;
+
+  int64_t count = (int64_t)PyArray_SIZE(data);
+  PyObject *bytes_out = NULL;
+#if PY_MAJOR_VERSION >= 3
+  bytes_out = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)(4*count));
+#else
+  bytes_out = PyString_FromStringAndSize(NULL, (Py_ssize_t)(4*count));
+#endif
+  if (bytes_out == NULL) {
+    Py_DECREF(data);
+    return NULL;
+  }
+
+#if PY_MAJOR_VERSION >= 3
+  unsigned char *words = (unsigned char *)PyBytes_AS_STRING(bytes_out);
+#else
+  unsigned char *words = (unsigned char *)PyString_AS_STRING(bytes_out);
+#endif
+
+  double stats_start = stats_clock();
+  double stats_end = 0.0;
+  Py_BEGIN_ALLOW_THREADS
+  cray32_encode(PyArray_DATA(data), count, type_num, words);
+  stats_end = stats_clock();
+  Py_END_ALLOW_THREADS
+  stats_record(STATS_CRAY32_PACK, 1, count*(int64_t)PyArray_ITEMSIZE(data),
+               stats_start, stats_end);
+
+  Py_DECREF(data);
   return bytes_out;
 }
 
@@ -313,3 +2247,76 @@ static PyObject *get_shumlib_version_py(PyObject *self, PyObject *args)
   version_out = PyInt_FromLong(version);
   return version_out;
 }
+
+static PyObject *set_stats_py(PyObject *self, PyObject *args)
+{
+  int enabled;
+  if (!PyArg_ParseTuple(args, "p", &enabled)) return NULL;
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  int previous = stats_enabled;
+  stats_enabled = enabled;
+  return PyBool_FromLong(previous);
+}
+
+static PyObject *get_stats_py(PyObject *self, PyObject *args)
+{
+  (void) self;
+  (void) args;
+
+  PyObject *stats = PyDict_New();
+  if (stats == NULL) return NULL;
+  for (int i = 0; i < STATS_COUNT; i++) {
+    PyObject *entry = Py_BuildValue("(LdL)", (long long)stats_fields[i],
+                                    stats_seconds[i],
+                                    (long long)stats_bytes[i]);
+    if (entry == NULL ||
+        PyDict_SetItemString(stats, stats_names[i], entry) != 0) {
+      Py_XDECREF(entry);
+      Py_DECREF(stats);
+      return NULL;
+    }
+    Py_DECREF(entry);
+  }
+  return stats;
+}
+
+static PyObject *reset_stats_py(PyObject *self, PyObject *args)
+{
+  (void) self;
+  (void) args;
+
+  for (int i = 0; i < STATS_COUNT; i++) {
+    stats_fields[i] = 0;
+    stats_bytes[i] = 0;
+    stats_seconds[i] = 0.0;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *set_threads_py(PyObject *self, PyObject *args)
+{
+  int threads;
+  if (!PyArg_ParseTuple(args, "i", &threads)) return NULL;
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  if (threads < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Number of threads must not be negative");
+    return NULL;
+  }
+  int previous = default_threads;
+  default_threads = threads;
+  return PyInt_FromLong((long)previous);
+}
+
+static PyObject *get_threads_py(PyObject *self, PyObject *args)
+{
+  (void) self;
+  (void) args;
+  return PyInt_FromLong((long)choose_threads(0));
+}
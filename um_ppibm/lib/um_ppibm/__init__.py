@@ -28,6 +28,7 @@ likely of little real use outside of that case.
 """
 from __future__ import (absolute_import, division, print_function)
 
+import io
 import six
 import mule
 import mule.pp
@@ -48,15 +49,52 @@ __version__ = "2025.10.1"
 class _WriteIBMOperatorUnpacked(object):
     def to_bytes(self, field):
         data = field.get_data()
-        data_ibm = ieee2ibm32(data.astype("f8"))
+        data_ibm = ieee2ibm32(data.astype("f8", copy=False))
         return data_ibm, len(data_ibm)
 
+    def to_array(self, field):
+        # The array to convert as it is written (see _write_ibm32)
+        return field.get_data().astype("f8", copy=False)
+
 
 # Replace the write operator in the usual pp.py list with the one above
 _WRITE_OPERATORS = mule.pp._WRITE_OPERATORS.copy()
 _WRITE_OPERATORS["000"] = _WriteIBMOperatorUnpacked()
 
 
+# The types of file object whose descriptor can be written to directly (the
+# output of others, e.g. compressed files, isn't what goes to the descriptor)
+_FD_FILE_TYPES = (io.FileIO, io.BufferedWriter, io.BufferedRandom)
+
+
+def _write_ibm32(pp_file, data):
+    """
+    Write the IBM format conversion of an array to a file.  For an ordinary
+    file the conversion is written straight to its descriptor, in blocks
+    (after flushing anything the file object has buffered); otherwise it is
+    converted in full and then written.
+
+    """
+    if isinstance(pp_file, _FD_FILE_TYPES):
+        pp_file.flush()
+        ieee2ibm32(data, fd=pp_file.fileno())
+    else:
+        pp_file.write(ieee2ibm32(data))
+
+
+def _write_data(pp_file, data_bytes, data_array, padding):
+    """
+    Write the data of a field to a file, either as the given bytes or as
+    the conversion of the given array, followed by any padding.
+
+    """
+    if data_array is not None:
+        _write_ibm32(pp_file, data_array)
+    else:
+        pp_file.write(data_bytes)
+    pp_file.write(padding)
+
+
 def fields_to_pp_file_ibm32(
         pp_file_obj_or_path, field_or_fields,
         umfile=None, keep_addressing=False):
@@ -91,6 +129,11 @@ def fields_to_pp_file_ibm32(
         if field.lbrel not in (2, 3):
             continue
 
+        # The data is either given as the bytes to write, or (for unpacked
+        # fields) as an array which is converted as it is written
+        data_bytes = None
+        data_array = None
+
         # Skip unpacking if possible (but only for WGDOS fields, since all
         # unpacked fields need their number format converting)
         if (field.lbpack == 1 and field._can_copy_deferred_data(
@@ -112,16 +155,25 @@ def fields_to_pp_file_ibm32(
                 msg = "Cannot write out packing code {0}"
                 raise ValueError(msg.format(lbpack321))
 
-            data_bytes, _ = _WRITE_OPERATORS[lbpack321].to_bytes(field)
+            operator = _WRITE_OPERATORS[lbpack321]
+            if hasattr(operator, "to_array"):
+                data_array = operator.to_array(field)
+            else:
+                data_bytes, _ = operator.to_bytes(field)
 
         # Calculate LBLREC
-        field.lblrec = len(data_bytes) // mule.pp.PP_WORD_SIZE
+        if data_array is not None:
+            data_len = data_array.size * mule.pp.PP_WORD_SIZE
+        else:
+            data_len = len(data_bytes)
+        field.lblrec = data_len // mule.pp.PP_WORD_SIZE
 
-        # The return from the ieee2ibm32 needs to be padded in some cases
-        # (to ensure whole 64-bit words only)
+        # The converted data needs to be padded in some cases (to ensure
+        # whole 64-bit words only)
+        padding = b""
         if field.lblrec % 2 != 0:
             field.lblrec += 1
-            data_bytes += b"\x00\x00\x00\x00"
+            padding = b"\x00\x00\x00\x00"
 
         # If the field appears to be variable resolution, attach the
         # relevant extra data (requires that a UM file object was given)
@@ -238,7 +290,7 @@ def fields_to_pp_file_ibm32(
         pp_file.write(lookup_reclen)
 
         # Similarly echo the record length before and after the data
-        reclen = len(data_bytes)
+        reclen = data_len + len(padding)
 
         if vector:
             reclen += extra_len * mule.pp.PP_WORD_SIZE
@@ -248,7 +300,7 @@ def fields_to_pp_file_ibm32(
 
         reclen = np.array(reclen).astype(">i4")
         pp_file.write(reclen)
-        pp_file.write(data_bytes)
+        _write_data(pp_file, data_bytes, data_array, padding)
 
         if vector:
             for key, size in zip(keys, sizes):
@@ -266,7 +318,7 @@ def fields_to_pp_file_ibm32(
     pp_file.write(ieee2ibm32(reals.astype("f8")))
     pp_file.write(lookup_reclen)
     pp_file.write(reclen)
-    pp_file.write(data_bytes)
+    _write_data(pp_file, data_bytes, data_array, padding)
     pp_file.write(reclen)
 
     pp_file.close()
@@ -0,0 +1,194 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of the UM ppibm extension module for Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Unit tests for the IBM32 conversion of :mod:`um_ppibm` module.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import io
+import sys
+import tempfile
+import numpy as np
+import mule
+import um_ppibm.tests as tests
+from um_ppibm import ieee2ibm32, fields_to_pp_file_ibm32
+
+
+def ibm_words(values):
+    """
+    Return the 32-bit IBM words for a sequence of whole numbers (which the
+    IBM format can represent exactly, so there is no rounding to consider).
+
+    """
+    words = []
+    for value in values:
+        if value == 0:
+            words.append(0)
+            continue
+        sign = 1 if value < 0 else 0
+        fraction = abs(float(value))
+        exponent = 0
+        while fraction >= 1.0:
+            fraction /= 16.0
+            exponent += 1
+        words.append((sign << 31) | ((exponent + 64) << 24) |
+                     int(fraction*2**24))
+    return words
+
+
+def expected_bytes(words):
+    """
+    Return the output expected for a sequence of 32-bit words; following the
+    original utility the words are byteswapped in 64-bit pairs, so on a
+    little-endian machine each pair is reversed (and an odd final word is
+    swapped with the padding, leaving zeros in its place).
+
+    """
+    words = np.array(words, dtype=">u4")
+    if sys.byteorder == "little":
+        padded = np.zeros(words.size + words.size % 2, dtype=">u4")
+        padded[:words.size] = words
+        words = padded.reshape(-1, 2)[:, ::-1].ravel()[:words.size]
+    return words.tobytes()
+
+
+class Test_ieee2ibm32(tests.UMPPIBMTest):
+    def setUp(self):
+        # More values than are converted in a single block, with an odd
+        # number so that the final value shares its word with the padding
+        self.values = np.arange(-10000, 10001, dtype="f8")
+        self.words = ibm_words(self.values)
+
+    def test_convert(self):
+        for length in (0, 1, 2, 7, 8192, 8193, self.values.size):
+            for dtype in ("f8", "f4"):
+                data = self.values[:length].astype(dtype)
+                self.assertEqual(ieee2ibm32(data),
+                                 expected_bytes(self.words[:length]))
+            # Integers are simply narrowed to 32 bits
+            ints = np.arange(-length, length, dtype="i8")[:length]
+            expected = expected_bytes(ints.astype("i4").view("u4"))
+            for dtype in ("i8", "i4"):
+                self.assertEqual(ieee2ibm32(ints.astype(dtype)), expected)
+
+    def test_non_native_input(self):
+        # Big-endian, non-contiguous and multi-dimensional arrays give the
+        # same result as the equivalent native, contiguous array
+        expected = ieee2ibm32(self.values[::3])
+        self.assertEqual(ieee2ibm32(self.values.astype(">f8")[::3]),
+                         expected)
+        data = self.values[:20000].reshape(100, 200)
+        self.assertEqual(ieee2ibm32(data), ieee2ibm32(data.ravel()))
+
+    def test_offset_stride(self):
+        # The values selected by offset and stride (counting through the
+        # flattened array) are converted as if they had been sliced out
+        data = self.values[:20000].reshape(200, 100)
+        for offset, stride in ((0, 1), (1, 1), (3, 2), (5, 3), (8191, 1),
+                               (0, 7), (19999, 4), (20000, 1), (25000, 2)):
+            selected = data.ravel()[offset::stride]
+            self.assertEqual(ieee2ibm32(data, offset=offset, stride=stride),
+                             ieee2ibm32(selected))
+            self.assertEqual(
+                ieee2ibm32(data, offset=offset, stride=stride),
+                expected_bytes(ibm_words(selected)))
+
+        for offset, stride in ((-1, 1), (0, 0)):
+            with self.assertRaisesRegex(ValueError, "Offset"):
+                ieee2ibm32(data, offset=offset, stride=stride)
+
+    def test_out(self):
+        # The output is written into the start of the buffer, leaving the
+        # rest of it alone
+        expected = ieee2ibm32(self.values)
+        out = bytearray(b"\xff"*(len(expected) + 8))
+        self.assertEqual(ieee2ibm32(self.values, out=out), len(expected))
+        self.assertEqual(bytes(out[:len(expected)]), expected)
+        self.assertEqual(bytes(out[len(expected):]), b"\xff"*8)
+
+        out = bytearray(4*5)
+        self.assertEqual(ieee2ibm32(self.values, offset=100, stride=2001,
+                                    out=out), len(out))
+        self.assertEqual(bytes(out), ieee2ibm32(self.values[100::2001]))
+
+        with self.assertRaisesRegex(ValueError, "too small"):
+            ieee2ibm32(self.values, out=bytearray(len(expected) - 4))
+        with self.assertRaises(ValueError):
+            ieee2ibm32(self.values, out=bytearray(len(expected)), fd=1)
+
+    def test_fd(self):
+        # Writing to a file gives the same bytes, following anything which
+        # was already written to it
+        expected = ieee2ibm32(self.values, offset=1, stride=2)
+        with tempfile.TemporaryFile() as output:
+            output.write(b"header")
+            output.flush()
+            size = ieee2ibm32(self.values, offset=1, stride=2,
+                              fd=output.fileno())
+            self.assertEqual(size, len(expected))
+            output.seek(0)
+            self.assertEqual(output.read(), b"header" + expected)
+
+            # A file object isn't accepted (its buffered output could end
+            # up after the converted values)
+            with self.assertRaisesRegex(TypeError, "integer file descriptor"):
+                ieee2ibm32(self.values, fd=output)
+
+
+
+class _Output(io.BytesIO):
+    # An in-memory file which keeps what was written to it once it is closed
+    def close(self):
+        self.written = self.getvalue()
+        io.BytesIO.close(self)
+
+
+class Test_fields_to_pp_file_ibm32(tests.UMPPIBMTest):
+    def make_field(self, rows, cols):
+        field = mule.Field3.empty()
+        field.lbrel = 3
+        field.lbpack = 0
+        field.lbuser1 = 1
+        field.lbrow = rows
+        field.lbnpt = cols
+        field.bmdi = -1.0e30
+        data = np.arange(rows*cols, dtype=np.float64).reshape(rows, cols)
+        field.set_data_provider(mule.ArrayDataProvider(data))
+        return field
+
+    def test_streamed(self):
+        # Writing to a file (which unpacked data is converted straight to)
+        # should give the same bytes as writing to any other file object,
+        # including the padding of fields with an odd number of points
+        fields = [self.make_field(3, 5), self.make_field(4, 5)]
+        output = _Output()
+        fields_to_pp_file_ibm32(output, fields)
+        with tempfile.NamedTemporaryFile() as temp_file:
+            fields_to_pp_file_ibm32(temp_file.name, fields)
+            with open(temp_file.name, "rb") as pp_file:
+                self.assertEqual(pp_file.read(), output.written)
+        self.assertIn(ieee2ibm32(fields[0].get_data()) + b"\x00"*4,
+                      output.written)
+
+
+if __name__ == "__main__":
+    tests.main()
@@ -32,6 +32,10 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <numpy/arrayobject.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
 #include "c_shum_data_conv.h"
 #include "c_shum_byteswap.h"
 #include "c_shum_data_conv_version.h"
@@ -55,7 +59,8 @@
 
 MOD_INIT(um_packing);
 
-static PyObject *ieee2ibm32_py(PyObject *self, PyObject *args);
+static PyObject *ieee2ibm32_py(PyObject *self, PyObject *args,
+                               PyObject *kwds);
 static PyObject *get_shumlib_version_py(PyObject *self, PyObject *args);
 
 MOD_INIT(um_ieee2ibm32)
@@ -69,11 +74,25 @@ MOD_INIT(um_ieee2ibm32)
   "Converts a numpy array to a byte-string containing 32-bit byte-swapped \n"
   "words in IBM number format \n\n."
   "Usage:\n"
-  "   um_ieee2ibm32.ieee2ibm32(array) \n\n"
+  "   um_ieee2ibm32.ieee2ibm32(array, offset=0, stride=1, out=None, \n"
+  "                            fd=None) \n\n"
   "Args:\n"
-  "* array - A numpy.ndarray.\n"
+  "* array  - A numpy.ndarray.\n"
+  "* offset - Index (in the flattened array) of the first value to\n"
+  "           convert.\n"
+  "* stride - Convert every stride-th value from offset onwards.\n"
+  "* out    - If given, a writeable, C-contiguous buffer (e.g. a\n"
+  "           bytearray) of at least 4 bytes per converted value, which\n"
+  "           the output is written into directly.\n"
+  "* fd     - If given, an (open) integer file descriptor which the\n"
+  "           output is written to directly, in blocks (so no buffer for\n"
+  "           the whole output is needed).  File objects aren't accepted;\n"
+  "           if one is writing to the same file it must be flushed first\n"
+  "           (and its fileno() given), so that its own buffered output\n"
+  "           comes before this.\n"
   "Returns:\n"
-  "  Byte-array/stream (suitable to write straight to file).\n"
+  "  Byte-array/stream (suitable to write straight to file), or if out or\n"
+  "  fd was given the number of bytes written.\n"
   );
 
   PyDoc_STRVAR(get_shumlib_version__doc__,
@@ -83,7 +102,8 @@ MOD_INIT(um_ieee2ibm32)
   );
 
   static PyMethodDef um_ieee2ibm32Methods[] = {
-    {"ieee2ibm32", ieee2ibm32_py, METH_VARARGS, ieee2ibm32__doc__},
+    {"ieee2ibm32", (PyCFunction)(void(*)(void))ieee2ibm32_py,
+                   METH_VARARGS | METH_KEYWORDS, ieee2ibm32__doc__},
     {"get_shumlib_version", get_shumlib_version_py, 
                             METH_VARARGS, get_shumlib_version__doc__},
     {NULL, NULL, 0, NULL}
@@ -100,28 +120,134 @@ MOD_INIT(um_ieee2ibm32)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static PyObject *ieee2ibm32_py(PyObject *self, PyObject *args)
+// The number of values converted at a time; the converted block is
+// byteswapped while it is still in cache, on its way to the destination
+// (this must be even, since the byteswap works on pairs of values)
+#define CONVERT_BLOCK 8192
+
+// Where the converted (and byteswapped) values are written
+typedef struct {
+  char *buffer;   // a buffer for the whole output (or NULL)
+  int fd;         // otherwise a file descriptor
+} convert_dest;
+
+// Write bytes to a file descriptor, retrying after partial writes; returns
+// 0 on success or the errno value of the failure
+static int write_all(int fd, const char *bytes, size_t len)
+{
+  while (len > 0) {
+    ssize_t written = write(fd, bytes, len);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    bytes += written;
+    len -= (size_t) written;
+  }
+  return 0;
+}
+
+// Convert the values a block at a time, byteswapping each block in 64-bit
+// words (following the original utility) as it is copied to the output.
+// Returns 0 on success, otherwise an error status with err_msg set.  Does
+// not need the GIL
+static int64_t convert_blocks(c_shum_datatypes data_type, char *datain,
+                              int64_t data_length, int64_t stride,
+                              int64_t size_in, convert_dest dest,
+                              char *err_msg, int64_t msg_len)
+{
+  uint64_t block[CONVERT_BLOCK/2];
+  int64_t size_out = 32;
+  int64_t offset = 0;
+  int64_t in_bytes = size_in/8;
+  bool swap = (c_shum_get_machine_endianism() == littleEndian);
+  int64_t start;
+
+  for (start = 0; start < data_length; start += CONVERT_BLOCK) {
+    int64_t count = data_length - start;
+    if (count > CONVERT_BLOCK) count = CONVERT_BLOCK;
+
+    // An odd final value shares its 64-bit word with zero padding
+    int64_t words = (count + 1)/2;
+    block[words - 1] = 0;
+
+    int64_t status = c_shum_ieee2ibm(&data_type,
+                                     &count,
+                                     block,
+                                     &offset,
+                                     datain + start*stride*in_bytes,
+                                     &stride,
+                                     &size_in,
+                                     &size_out,
+                                     err_msg,
+                                     msg_len
+                                     );
+    if (status != 0) return status;
+
+    if (swap) {
+      status = c_shum_byteswap(block, words, sizeof(int64_t), err_msg,
+                               msg_len);
+      if (status != 0) return status;
+    }
+
+    // (the padding isn't part of the output)
+    size_t len = (size_t) count*sizeof(int32_t);
+    if (dest.buffer != NULL) {
+      memcpy(dest.buffer + start*(int64_t)sizeof(int32_t), block, len);
+    } else {
+      int err = write_all(dest.fd, (const char *) block, len);
+      if (err != 0) {
+        snprintf(err_msg, (size_t) msg_len, "Failed to write output: %s",
+                 strerror(err));
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static PyObject *ieee2ibm32_py(PyObject *self, PyObject *args,
+                               PyObject *kwds)
 {
   // Setup and obtain inputs passed from python
-  PyArrayObject *datain_obj;
-  // Note the argument descriptor "O":
+  PyObject *datain_in;
+  Py_ssize_t offset = 0;
+  Py_ssize_t stride = 1;
+  PyObject *out = NULL;
+  PyObject *fd_in = NULL;
+  static char *kwlist[] = {"array", "offset", "stride", "out", "fd", NULL};
+  // Note the argument descriptor "O|nnOO":
   //   - O  a python object (here a numpy.ndarray)
-  if (!PyArg_ParseTuple(args, "O",
-                        &datain_obj )) return NULL;
+  //   - n  the offset and stride
+  //   - O  the optional output buffer and file descriptor
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nnOO", kwlist,
+                                   &datain_in, &offset, &stride,
+                                   &out, &fd_in)) return NULL;
+  if (out == Py_None) out = NULL;
+  if (fd_in == Py_None) fd_in = NULL;
 
   // Cast self to void to avoid unused paramter errors
   (void) self;
 
+  if (!PyArray_Check(datain_in)) {
+    PyErr_SetString(PyExc_ValueError, "Input must be a numpy.ndarray");
+    return NULL;
+  }
+  if (out != NULL && fd_in != NULL) {
+    PyErr_SetString(PyExc_ValueError, "Only one of out and fd may be given");
+    return NULL;
+  }
+  if (offset < 0 || stride < 1) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Offset must be non-negative and stride positive");
+    return NULL;
+  }
+
   // Find out the datatype of the array to setup the arguments
   // to the conversion
-  int datain_type = PyArray_TYPE(datain_obj);
+  int datain_type = PyArray_TYPE((PyArrayObject *) datain_in);
 
   c_shum_datatypes data_type;
-
-  // Someday we may want to be able to control these, but for
-  // now they will be disabled
-  int64_t offset = 0;
-  int64_t stride = 1;
   int64_t size_in;
 
   // Size in depends on the object passed in
@@ -147,80 +273,96 @@ static PyObject *ieee2ibm32_py(PyObject *self, PyObject *args)
     return NULL;
   }
 
-  // Size out is 32-bit
-  int64_t size_out = 32;
-
-  // Also need the length of the array
-  int64_t data_length = (int64_t) PyArray_SIZE(datain_obj);
-
-  // And a reference to the data
-  void *datain = PyArray_DATA(datain_obj);
-
-  // The output array is 32-bit, but since the byte-swapping is going to be
-  // (incorrectly, following the original utility) to be applied as 64-bit 
-  // words we have to keep enough space in the array through this routine
-  int64_t pad = data_length % 2;
-
-  // Array to store the output
-  void *dataout = calloc((size_t)(data_length + pad), sizeof(int32_t));
-  if (dataout == NULL) {
-    PyErr_SetString(PyExc_ValueError, "Unable to allocate memory");
-    return NULL;
+  // The data must be contiguous and in native byte order for the library
+  // (this only makes a copy if it isn't already)
+  PyArrayObject *datain_obj = (PyArrayObject *) PyArray_FROM_OTF(
+      datain_in, datain_type, NPY_ARRAY_IN_ARRAY);
+  if (datain_obj == NULL) return NULL;
+
+  // The number of values to convert
+  int64_t size = (int64_t) PyArray_SIZE(datain_obj);
+  int64_t data_length = 0;
+  if (size > offset) {
+    data_length = (size - offset + stride - 1)/stride;
   }
+  char *datain = (char *) PyArray_DATA(datain_obj) + offset*(size_in/8);
+  Py_ssize_t out_len = (Py_ssize_t) (data_length * sizeof(int32_t));
 
   // Error message string
   int64_t msg_len = 512;
-  char err_msg[msg_len];
+  char err_msg[512];
+
+  // Set up the destination
+  PyObject *result = NULL;
+  Py_buffer view;
+  bool have_view = false;
+  convert_dest dest = {NULL, -1};
+
+  if (out != NULL) {
+    if (PyObject_GetBuffer(out, &view,
+                           PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS) != 0) {
+      goto cleanup;
+    }
+    have_view = true;
+    if (view.len < out_len) {
+      PyErr_SetString(PyExc_ValueError, "Output buffer is too small");
+      goto cleanup;
+    }
+    dest.buffer = (char *) view.buf;
+  } else if (fd_in != NULL) {
+    // Only an integer is accepted; a Python file object may still hold
+    // buffered output, which would end up after this output if it were
+    // written to the descriptor underneath it
+    #if PY_MAJOR_VERSION >= 3
+      int fd_is_int = PyLong_Check(fd_in);
+    #else
+      int fd_is_int = PyInt_Check(fd_in) || PyLong_Check(fd_in);
+    #endif
+    if (!fd_is_int) {
+      PyErr_SetString(PyExc_TypeError,
+                      "fd must be an integer file descriptor");
+      goto cleanup;
+    }
+    dest.fd = PyObject_AsFileDescriptor(fd_in);
+    if (dest.fd < 0) goto cleanup;
+  } else {
+    #if PY_MAJOR_VERSION >= 3
+      result = PyBytes_FromStringAndSize(NULL, out_len);
+    #else
+      result = PyString_FromStringAndSize(NULL, out_len);
+    #endif
+    if (result == NULL) goto cleanup;
+    #if PY_MAJOR_VERSION >= 3
+      dest.buffer = PyBytes_AS_STRING(result);
+    #else
+      dest.buffer = PyString_AS_STRING(result);
+    #endif
+  }
+
   int64_t status;
 
-  // Now construct the call
-  status = c_shum_ieee2ibm(&data_type,
-                           &data_length,
-                           dataout,
-                           &offset,
-                           datain,
-                           &stride,
-                           &size_in,
-                           &size_out,
-                           &err_msg[0],
-                           msg_len
-                           );
+  // Now do the conversion (the arrays are kept alive by the references
+  // held above, so this doesn't need the GIL)
+  Py_BEGIN_ALLOW_THREADS
+  status = convert_blocks(data_type, datain, data_length, (int64_t) stride,
+                          size_in, dest, &err_msg[0], msg_len);
+  Py_END_ALLOW_THREADS
 
   if (status != 0) {
+    Py_CLEAR(result);
     PyErr_SetString(PyExc_ValueError, &err_msg[0]);
-    return NULL;
-  }  
-
-  // Create a byte array to store the output
-  char *ptr_char = (char *)dataout;
-  Py_ssize_t out_len = (Py_ssize_t) (data_length * sizeof(int32_t));
+    goto cleanup;
+  }
 
-  // Byteswap on the way out, if needed
-  if (c_shum_get_machine_endianism() == littleEndian) {
-    status = c_shum_byteswap(ptr_char, 
-                             (data_length + pad)/2,
-                             sizeof(int64_t),
-                             &err_msg[0],
-                             msg_len
-                             );
-    if (status != 0) {
-      PyErr_SetString(PyExc_ValueError, &err_msg[0]);
-      return NULL;
-    }
+  // When writing to a buffer or file, return the number of bytes written
+  if (result == NULL) {
+    result = PyLong_FromSsize_t(out_len);
   }
 
-  // Now create the output object
-  PyObject *bytes_out = NULL;
-  #if PY_MAJOR_VERSION >= 3
-    bytes_out = PyBytes_FromStringAndSize(ptr_char, out_len);
-  #else
-    bytes_out = PyString_FromStringAndSize(ptr_char, out_len);
-  #endif
-
-  // Free the memory used by the original array
-  free(dataout);
-                  
-  return bytes_out;
+cleanup:
+  if (have_view) PyBuffer_Release(&view);
+  Py_DECREF(datain_obj);
+  return result;
 
 }
 
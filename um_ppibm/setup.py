@@ -60,6 +60,7 @@ setuptools.setup(
     package_dir={"": "lib"},
     packages=[
         "um_ppibm",
+        "um_ppibm.tests",
     ],
     ext_modules=[
         setuptools.Extension(
@@ -19,6 +19,6 @@
 # You should have received a copy of the Modified BSD License
 # along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
 
-from .um_spiral_search import spiral_search
+from .um_spiral_search import spiral_search, spiral_search_many
 
 __version__ = "2025.10.1"
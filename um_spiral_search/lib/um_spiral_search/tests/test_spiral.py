@@ -28,7 +28,7 @@ from __future__ import (absolute_import, division, print_function)
 import warnings
 import numpy as np
 import um_spiral_search.tests as tests
-from um_spiral_search import spiral_search
+from um_spiral_search import spiral_search, spiral_search_many
 
 
 class Test_spiral_search(tests.UMSpiralTest):
@@ -105,6 +105,44 @@ class Test_spiral_search(tests.UMSpiralTest):
 
         self.assertArrayEqual(indices, expected_indices)
 
+    def test_spiral_search_out_test(self):
+        # The same setup as the basic land test, but writing the indices
+        # into a slice of a larger preallocated array
+        unres_mask = np.repeat(True, 25)
+        unres_mask[20:] = False
+        lsm = np.repeat(False, 25)
+        lsm[20:] = True
+        lsm[6] = lsm[13] = True
+        index_unres = np.array([6, 13])
+        lats = np.linspace(3, 4, num=5)
+        lons = np.linspace(3, 4, num=5)
+
+        out = np.zeros((2, 2), dtype=np.int64)
+        indices = spiral_search(lsm,
+                                index_unres,
+                                unres_mask,
+                                lats,
+                                lons,
+                                self.PLANET_RADIUS,
+                                False,
+                                True,
+                                False,
+                                self.CONSTRAINED_MAX_DIST,
+                                self.DIST_STEP,
+                                out=out[1])
+
+        self.assertArrayEqual(out[1], np.array([21, 23]))
+        self.assertArrayEqual(out[0], np.array([0, 0]))
+        self.assertTrue(np.shares_memory(indices, out))
+
+        # An output of the wrong type or length is rejected
+        for bad_out in (np.zeros(3, dtype=np.int64), np.zeros(2)):
+            with self.assertRaises(ValueError):
+                spiral_search(lsm, index_unres, unres_mask, lats, lons,
+                              self.PLANET_RADIUS, False, True, False,
+                              self.CONSTRAINED_MAX_DIST, self.DIST_STEP,
+                              out=bad_out)
+
     def test_spiral_search_basic_sea_test(self):
         # Our upscaled original mask contains a resolved block of sea along
         # the top 2 rows (note that "T" means unresolved)
@@ -588,6 +626,184 @@ class Test_spiral_search(tests.UMSpiralTest):
         #  .  .  .  .  .  .  .
         self.assertArrayEqual(indices_constrained, expected_indices)
 
+    def test_spiral_search_tree_test(self):
+        # The setup from the cyclic land test, resolved using the tree; the
+        # points are the same distance from the land either side of them
+        # when wrapping, so this also checks the ties are broken in the same
+        # way as the spiral search
+        unres_mask = np.repeat(True, 25)
+        lsm = np.repeat(False, 25)
+        for row in range(5):
+            unres_mask[row*5:row*5 + 3] = False
+            lsm[row*5:row*5 + 3] = True
+        lsm[9] = lsm[19] = True
+        index_unres = np.array([9, 19])
+        lats = np.linspace(3, 4, num=5)
+        lons = np.array([1.0, 2.0, 357.0, 358.0, 359.0])
+
+        for cyclic, expected_indices in ((False, [7, 17]), (True, [5, 15])):
+            indices = spiral_search(lsm,
+                                    index_unres,
+                                    unres_mask,
+                                    lats,
+                                    lons,
+                                    self.PLANET_RADIUS,
+                                    cyclic,
+                                    True,
+                                    False,
+                                    self.CONSTRAINED_MAX_DIST,
+                                    self.DIST_STEP,
+                                    use_tree=True)
+            self.assertArrayEqual(indices, np.array(expected_indices))
+
+        # The setup from the constrained land test; the tree should issue
+        # the same warning and give the same result
+        unres_mask = np.repeat(True, 25)
+        unres_mask[20:] = False
+        lsm = np.repeat(False, 25)
+        lsm[20:] = True
+        lsm[2] = True
+        lats = np.array([3.0, 4.0, 5.0, 6.0, 89.0])
+        lons = np.linspace(3, 4, num=5)
+        with warnings.catch_warnings(record=True) as warning_msgs:
+            warnings.simplefilter("always")
+            indices = spiral_search(lsm,
+                                    np.array([2]),
+                                    unres_mask,
+                                    lats,
+                                    lons,
+                                    self.PLANET_RADIUS,
+                                    False,
+                                    True,
+                                    True,
+                                    self.CONSTRAINED_MAX_DIST,
+                                    self.DIST_STEP,
+                                    use_tree=True)
+            self.assertEqual(len(warning_msgs), 1)
+            self.assertRegex(
+                warning_msgs[0].message.args[0],
+                "Despite being constrained there were no resolved points "
+                "of any type within the limit")
+        self.assertArrayEqual(indices, np.array([22]))
+
+    def test_spiral_search_tree_random_test(self):
+        # A larger cyclic grid with random masks; the tree always finds the
+        # nearest resolved point of the same type, while the spiral search
+        # (which stops at a radius set by the dist_step) may find one a
+        # little further away - but never a nearer one, and where both are
+        # the same distance away they should pick the same point
+        rng = np.random.RandomState(1234)
+        lats = np.linspace(-87.5, 87.5, num=36)
+        lons = np.linspace(0.0, 355.0, num=72)
+        n_points = lats.size*lons.size
+        lsm = rng.rand(n_points) < 0.3
+        unres_mask = rng.rand(n_points) < 0.6
+        index_unres = np.where(unres_mask & lsm)[0]
+
+        lat_rad = np.radians(np.repeat(lats, lons.size))
+        lon_rad = np.radians(np.tile(lons, lats.size))
+        xyz = np.column_stack((np.cos(lat_rad)*np.cos(lon_rad),
+                               np.cos(lat_rad)*np.sin(lon_rad),
+                               np.sin(lat_rad)))
+
+        def chord(indices):
+            return np.sum((xyz[indices] - xyz[index_unres])**2, axis=1)
+
+        tree = spiral_search(lsm, index_unres, unres_mask, lats, lons,
+                             self.PLANET_RADIUS, True, True, False,
+                             self.CONSTRAINED_MAX_DIST, self.DIST_STEP,
+                             use_tree=True)
+        spiral = spiral_search(lsm, index_unres, unres_mask, lats, lons,
+                               self.PLANET_RADIUS, True, True, False,
+                               self.CONSTRAINED_MAX_DIST, self.DIST_STEP)
+
+        # The tree's points are resolved land points, at the smallest
+        # distance from each unresolved point
+        self.assertTrue(np.all(lsm[tree] & ~unres_mask[tree]))
+        resolved = np.where(lsm & ~unres_mask)[0]
+        nearest = np.array(
+            [np.min(np.sum((xyz[resolved] - xyz[index])**2, axis=1))
+             for index in index_unres])
+        tree_dist = chord(tree)
+        np.testing.assert_allclose(tree_dist, nearest, rtol=1.0e-9)
+
+        spiral_dist = chord(spiral)
+        self.assertTrue(np.all(tree_dist <= spiral_dist*(1.0 + 1.0e-9)))
+        same = np.isclose(tree_dist, spiral_dist, rtol=1.0e-9, atol=0.0)
+        self.assertArrayEqual(tree[same], spiral[same])
+
+        # The batched search gives the same points, whether the threads
+        # are shared over the fields or used by a single field's search
+        for n_fields in (1, 3):
+            indices = spiral_search_many(lsm, [index_unres]*n_fields,
+                                         [unres_mask]*n_fields, lats, lons,
+                                         self.PLANET_RADIUS, True, True,
+                                         False, self.CONSTRAINED_MAX_DIST,
+                                         self.DIST_STEP, threads=2,
+                                         use_tree=True)
+            for field_indices in indices:
+                self.assertArrayEqual(field_indices, tree)
+
+    def test_spiral_search_many_test(self):
+        # The setups from the basic land and sea tests, run together
+        land_unres_mask = np.repeat(True, 25)
+        land_unres_mask[20:] = False
+        land_lsm = np.repeat(False, 25)
+        land_lsm[20:] = True
+        land_lsm[6] = land_lsm[13] = True
+        land_index_unres = np.array([6, 13])
+
+        sea_unres_mask = np.repeat(True, 25)
+        sea_unres_mask[:10] = False
+        sea_lsm = np.repeat(True, 25)
+        sea_lsm[:10] = False
+        sea_lsm[11:14] = False
+        sea_lsm[17:19] = False
+        sea_lsm[23] = False
+        sea_index_unres = np.array([11, 12, 13, 17, 18, 23])
+
+        lats = np.linspace(3, 4, num=5)
+        lons = np.linspace(3, 4, num=5)
+
+        for threads, use_tree in ((1, False), (2, False), (2, True)):
+            indices = spiral_search_many([land_lsm, sea_lsm],
+                                         [land_index_unres, sea_index_unres],
+                                         [land_unres_mask, sea_unres_mask],
+                                         lats,
+                                         lons,
+                                         self.PLANET_RADIUS,
+                                         False,
+                                         [True, False],
+                                         False,
+                                         self.CONSTRAINED_MAX_DIST,
+                                         self.DIST_STEP,
+                                         threads=threads,
+                                         use_tree=use_tree)
+
+            self.assertEqual(len(indices), 2)
+            self.assertArrayEqual(indices[0], np.array([21, 23]))
+            self.assertArrayEqual(indices[1],
+                                  np.array([6, 7, 8, 7, 8, 8]))
+
+        # A single land sea mask may be shared by all of the fields
+        indices = spiral_search_many(land_lsm,
+                                     [land_index_unres, land_index_unres],
+                                     [land_unres_mask, land_unres_mask],
+                                     lats, lons, self.PLANET_RADIUS,
+                                     False, True, False,
+                                     self.CONSTRAINED_MAX_DIST,
+                                     self.DIST_STEP)
+        for field_indices in indices:
+            self.assertArrayEqual(field_indices, np.array([21, 23]))
+
+        # The number of masks must match the number of index arrays
+        with self.assertRaises(ValueError):
+            spiral_search_many(land_lsm, [land_index_unres],
+                               [land_unres_mask, land_unres_mask],
+                               lats, lons, self.PLANET_RADIUS,
+                               False, True, False,
+                               self.CONSTRAINED_MAX_DIST, self.DIST_STEP)
+
 
 if __name__ == "__main__":
     tests.main()
@@ -34,8 +34,16 @@
 #include <numpy/arrayobject.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "c_shum_spiral_search.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #if PY_MAJOR_VERSION >= 3
 #define PyInt_FromLong PyLong_FromLong
 #define MOD_ERROR_VAL NULL
@@ -55,7 +63,20 @@
 
 MOD_INIT(um_spiral_search);
 
-static PyObject *spiral_search_py(PyObject *self, PyObject *args);
+static PyObject *spiral_search_py(PyObject *self, PyObject *args,
+                                  PyObject *kwds);
+static PyObject *spiral_search_many_py(PyObject *self, PyObject *args,
+                                       PyObject *kwds);
+
+// Length of the buffer for error messages returned by the library
+#define ERR_MSG_LEN 512
+
+// The signature shared by the two search engines (the last argument is the
+// number of threads the engine may use itself, or 0 for the OpenMP default)
+typedef int64_t (*search_engine)(bool *, const int64_t *, int64_t, int64_t,
+                                 int64_t, double *, double *, bool, bool,
+                                 double, double, bool, bool *, int64_t *,
+                                 double, char *, int);
 
 MOD_INIT(um_spiral_search)
 {
@@ -68,7 +89,7 @@ MOD_INIT(um_spiral_search)
   "  um_spiral_search.spiral_search( \n"
   "      lsm, index_unres, unres_mask, lats, lons, planet_radius, \n"
   "      cyclic, is_land_field, constrained, constrained_max_dist, \n"
-  "      dist_step) \n\n"
+  "      dist_step, out=None, use_tree=False) \n\n"
   "Args:\n"
   "* lsm                  - land sea mask array (1d, must be \n"
   "                         len(lats)*len(lons))\n"
@@ -82,14 +103,64 @@ MOD_INIT(um_spiral_search)
   "* is_land_field        - True if field is a land field\n"
   "* constrained          - True if a distance constraint is applied\n"
   "* constrained_max_dist - distance constraint (in metres)\n"
-  "* dist_step            - step coefficient for distance search\n\n"             
+  "* dist_step            - step coefficient for distance search\n"
+  "* out                  - if given, a C-contiguous, writeable, native\n"
+  "                         byte-order int64 array of len(index_unres)\n"
+  "                         which the indices are written into directly\n"
+  "* use_tree             - if True, find the nearest points using a k-d\n"
+  "                         tree of the resolved points instead of the\n"
+  "                         spiral search; this is much faster for large\n"
+  "                         grids with few resolved points near the\n"
+  "                         unresolved ones.  The tree always finds the\n"
+  "                         nearest point (dist_step is ignored), while\n"
+  "                         the spiral search stops at a radius set by\n"
+  "                         dist_step and so may pick a slightly further\n"
+  "                         point where the grid spacing varies; points\n"
+  "                         at the same distance are chosen in the same\n"
+  "                         way by both\n\n"
   "Returns:\n"
   "  1 Dimensional numpy.ndarray givng the indices which each of the\n"
-  "  points in index_unres resolves to.\n"
+  "  points in index_unres resolves to (this is the out array, if it\n"
+  "  was given).\n"
+  );
+
+  PyDoc_STRVAR(spiral_search_many__doc__,
+  "Run the spiral search for a batch of fields at once.\n\n"
+  "The searches are shared between OpenMP threads, and are done without\n"
+  "holding the Python GIL.\n\n"
+  "Usage:\n"
+  "  um_spiral_search.spiral_search_many( \n"
+  "      lsm, list_of_index_unres, list_of_unres_mask, lats, lons, \n"
+  "      planet_radius, cyclic, is_land_field, constrained, \n"
+  "      constrained_max_dist, dist_step, threads=0, use_tree=False) \n\n"
+  "Args:\n"
+  "* lsm                  - land sea mask array (as for spiral_search), or\n"
+  "                         a sequence giving a mask for each field\n"
+  "* list_of_index_unres  - sequence of unresolved point indices (1d) for\n"
+  "                         each field\n"
+  "* list_of_unres_mask   - sequence of masks showing the unresolved\n"
+  "                         points of each field\n"
+  "* lats, lons, planet_radius, cyclic\n"
+  "                       - as for spiral_search\n"
+  "* is_land_field        - True if the fields are land fields; either a\n"
+  "                         single value or a sequence giving a value for\n"
+  "                         each field\n"
+  "* constrained, constrained_max_dist, dist_step\n"
+  "                       - as for spiral_search\n"
+  "* threads              - Number of threads to use (if not set, the\n"
+  "                         OpenMP default is used).\n"
+  "* use_tree             - as for spiral_search\n\n"
+  "Returns:\n"
+  "  List of 1 Dimensional numpy.ndarrays giving the indices which the\n"
+  "  unresolved points of each field resolve to.\n"
   );
 
   static PyMethodDef um_spiral_searchMethods[] = {
-    {"spiral_search", spiral_search_py, METH_VARARGS, spiral_search__doc__},
+    {"spiral_search", (PyCFunction)(void(*)(void))spiral_search_py,
+                      METH_VARARGS | METH_KEYWORDS, spiral_search__doc__},
+    {"spiral_search_many", (PyCFunction)(void(*)(void))spiral_search_many_py,
+                           METH_VARARGS | METH_KEYWORDS,
+                           spiral_search_many__doc__},
     {NULL, NULL, 0, NULL}
   };
 
@@ -103,7 +174,457 @@ MOD_INIT(um_spiral_search)
   return MOD_SUCCESS_VAL(mod);
 }
 
-static PyObject *spiral_search_py(PyObject *self, PyObject *args)
+// Check that an array given as an "out" argument can be written to directly
+// by the library; it must be a C-contiguous, aligned, writeable array of the
+// given type (in native byte order) and with exactly the expected dimensions.
+// Returns 0 if the array is suitable, otherwise sets a Python exception
+static int check_out_array(PyObject *out, int type_num, int ndim,
+                           const npy_intp *dims)
+{
+  PyArrayObject *array;
+  int i;
+
+  if (!PyArray_Check(out)) {
+    PyErr_SetString(PyExc_ValueError, "Output must be a numpy.ndarray");
+    return 1;
+  }
+  array = (PyArrayObject *)out;
+
+  if (PyArray_TYPE(array) != type_num || !PyArray_ISNOTSWAPPED(array)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array has the wrong dtype or byte order");
+    return 1;
+  }
+
+  if (!PyArray_ISCARRAY(array)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array must be C-contiguous, aligned and writeable");
+    return 1;
+  }
+
+  if (PyArray_NDIM(array) != ndim) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array has the wrong number of dimensions");
+    return 1;
+  }
+  for (i = 0; i < ndim; i++) {
+    if (PyArray_DIMS(array)[i] != dims[i]) {
+      PyErr_SetString(PyExc_ValueError, "Output array has the wrong shape");
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Run the search for a single field, converting between the 0-based (C)
+// indices used by the Python interface and the 1-based (Fortran) indices
+// used by the library.  The unresolved indices are copied to the heap (this
+// avoids modifying them in place, and unlike a stack array is safe for any
+// number of points).  Returns the status from the library, or 1 if the copy
+// couldn't be allocated; does not need the GIL
+static int64_t run_spiral_search(bool *lsm,
+                                 const int64_t *index_unres,
+                                 int64_t no_point_unres,
+                                 int64_t points_phi,
+                                 int64_t points_lambda,
+                                 double *lats,
+                                 double *lons,
+                                 bool is_land_field,
+                                 bool constrained,
+                                 double constrained_max_dist,
+                                 double dist_step,
+                                 bool cyclic,
+                                 bool *unres_mask,
+                                 int64_t *indices,
+                                 double planet_radius,
+                                 char *err_msg,
+                                 int threads)
+{
+  int64_t i;
+  int64_t msg_len = ERR_MSG_LEN;
+  int64_t status;
+
+  (void) threads;
+
+  // (allocate at least one element, so that no points isn't a failure)
+  int64_t *index_unres_data =
+      (int64_t *)malloc((size_t)(no_point_unres + 1)*sizeof(int64_t));
+  if (index_unres_data == NULL) {
+    snprintf(err_msg, ERR_MSG_LEN,
+             "Unable to allocate memory for unresolved indices");
+    return 1;
+  }
+  for (i = 0; i < no_point_unres; i++) {
+    index_unres_data[i] = index_unres[i] + 1;
+  }
+
+  status = c_shum_spiral_search_algorithm(lsm,
+                                          index_unres_data,
+                                          &no_point_unres,
+                                          &points_phi,
+                                          &points_lambda,
+                                          lats,
+                                          lons,
+                                          &is_land_field,
+                                          &constrained,
+                                          &constrained_max_dist,
+                                          &dist_step,
+                                          &cyclic,
+                                          unres_mask,
+                                          indices,
+                                          &planet_radius,
+                                          err_msg,
+                                          &msg_len);
+  free(index_unres_data);
+
+  if (status <= 0) {
+    for (i = 0; i < no_point_unres; i++) {
+      indices[i] = indices[i] - 1;
+    }
+  }
+  return status;
+}
+
+// The nearest neighbour engine: instead of searching outwards over the grid
+// from each unresolved point, the resolved points are put into a k-d tree
+// which is queried for every unresolved point.  The points are held as unit
+// vectors, since the straight-line (chord) distance between two points on
+// the sphere orders them in the same way as the great-circle distance (and
+// so also handles points either side of the date line)
+typedef struct {
+  int64_t n;
+  double *xyz;          // 3 coordinates for each point, in tree order
+  int64_t *index;       // grid index of each point, in tree order
+  unsigned char *dim;   // dimension split by the node at each position
+} point_tree;
+
+// Distances which agree to within this (relative) tolerance are treated as
+// ties; these are broken in the same way as the spiral search, which finds
+// the points in the nearest ring of grid boxes first, and then the lowest
+// index within a ring
+#define TREE_TIE_TOL 1.0e-10
+
+typedef struct {
+  const double *xyz;    // unit vector of the point being resolved
+  int64_t row;          // grid position of the point being resolved
+  int64_t col;
+  int64_t points_lambda;
+  bool cyclic;
+  int64_t found;        // grid index of the best point so far (or -1)
+  double best;          // squared chord distance to the best point
+  int64_t ring;         // grid ring containing the best point
+} tree_query;
+
+static void grid_xyz(int64_t index, int64_t points_lambda, const double *trig,
+                     int64_t points_phi, double *xyz)
+{
+  // The table holds sin and cos of the latitudes, then of the longitudes
+  int64_t row = index / points_lambda;
+  int64_t col = index % points_lambda;
+  double sin_lat = trig[row];
+  double cos_lat = trig[points_phi + row];
+  double sin_lon = trig[2*points_phi + col];
+  double cos_lon = trig[2*points_phi + points_lambda + col];
+  xyz[0] = cos_lat*cos_lon;
+  xyz[1] = cos_lat*sin_lon;
+  xyz[2] = sin_lat;
+}
+
+static void swap_tree_points(point_tree *tree, int64_t a, int64_t b)
+{
+  int k;
+  int64_t index = tree->index[a];
+  tree->index[a] = tree->index[b];
+  tree->index[b] = index;
+  for (k = 0; k < 3; k++) {
+    double tmp = tree->xyz[3*a + k];
+    tree->xyz[3*a + k] = tree->xyz[3*b + k];
+    tree->xyz[3*b + k] = tmp;
+  }
+}
+
+// Arrange the points between lo and hi into a (balanced) tree; the node of
+// each range is the point at its middle, split on the dimension with the
+// largest spread, with the points either side of it forming the sub-trees
+static void build_tree(point_tree *tree, int64_t lo, int64_t hi)
+{
+  while (hi - lo > 1) {
+    double min[3] = {2.0, 2.0, 2.0};
+    double max[3] = {-2.0, -2.0, -2.0};
+    int64_t i;
+    int k;
+    int dim = 0;
+    for (i = lo; i < hi; i++) {
+      for (k = 0; k < 3; k++) {
+        double x = tree->xyz[3*i + k];
+        if (x < min[k]) min[k] = x;
+        if (x > max[k]) max[k] = x;
+      }
+    }
+    for (k = 1; k < 3; k++) {
+      if (max[k] - min[k] > max[dim] - min[dim]) dim = k;
+    }
+
+    // Partially sort the points so that the middle one is in place
+    int64_t mid = lo + (hi - lo)/2;
+    int64_t left = lo;
+    int64_t right = hi - 1;
+    while (left < right) {
+      double pivot = tree->xyz[3*(left + (right - left)/2) + dim];
+      int64_t a = left;
+      int64_t b = right;
+      while (a <= b) {
+        while (tree->xyz[3*a + dim] < pivot) a++;
+        while (tree->xyz[3*b + dim] > pivot) b--;
+        if (a <= b) {
+          swap_tree_points(tree, a, b);
+          a++;
+          b--;
+        }
+      }
+      if (mid <= b) {
+        right = b;
+      } else if (mid >= a) {
+        left = a;
+      } else {
+        break;
+      }
+    }
+    tree->dim[mid] = (unsigned char) dim;
+
+    build_tree(tree, lo, mid);
+    lo = mid + 1;
+  }
+}
+
+static void consider_point(tree_query *query, const double *xyz,
+                           int64_t index)
+{
+  double d0 = xyz[0] - query->xyz[0];
+  double d1 = xyz[1] - query->xyz[1];
+  double d2 = xyz[2] - query->xyz[2];
+  double dist = d0*d0 + d1*d1 + d2*d2;
+
+  if (query->found >= 0 && dist > query->best*(1.0 + TREE_TIE_TOL)) return;
+
+  int64_t row = index / query->points_lambda;
+  int64_t col = index % query->points_lambda;
+  int64_t drow = llabs(row - query->row);
+  int64_t dcol = llabs(col - query->col);
+  if (query->cyclic && query->points_lambda - dcol < dcol) {
+    dcol = query->points_lambda - dcol;
+  }
+  int64_t ring = drow > dcol ? drow : dcol;
+
+  if (query->found < 0 || dist < query->best*(1.0 - TREE_TIE_TOL) ||
+      ring < query->ring || (ring == query->ring && index < query->found)) {
+    query->found = index;
+    query->best = dist;
+    query->ring = ring;
+  }
+}
+
+static void search_tree(const point_tree *tree, int64_t lo, int64_t hi,
+                        tree_query *query)
+{
+  while (hi > lo) {
+    int64_t mid = lo + (hi - lo)/2;
+    const double *xyz = &tree->xyz[3*mid];
+    consider_point(query, xyz, tree->index[mid]);
+    if (hi - lo == 1) return;
+
+    // Search the side of the split containing the point first, then the
+    // other side only if it could hold a point as close as the best so far
+    int dim = tree->dim[mid];
+    double diff = query->xyz[dim] - xyz[dim];
+    if (diff < 0.0) {
+      search_tree(tree, lo, mid, query);
+      lo = mid + 1;
+    } else {
+      search_tree(tree, mid + 1, hi, query);
+      hi = mid;
+    }
+    if (diff*diff > query->best*(1.0 + TREE_TIE_TOL)) return;
+  }
+}
+
+// Fill a tree with the resolved points (either all of them, or only those
+// of the given type); returns 1 if it couldn't be allocated
+static int fill_tree(point_tree *tree, const bool *lsm,
+                     const bool *unres_mask, bool any_type,
+                     bool is_land_field, int64_t points_phi,
+                     int64_t points_lambda, const double *trig)
+{
+  int64_t n_points = points_phi*points_lambda;
+  int64_t i;
+  int64_t n = 0;
+
+  for (i = 0; i < n_points; i++) {
+    if (!unres_mask[i] && (any_type || lsm[i] == is_land_field)) n++;
+  }
+
+  tree->n = n;
+  tree->xyz = (double *)malloc((size_t)(3*n + 1)*sizeof(double));
+  tree->index = (int64_t *)malloc((size_t)(n + 1)*sizeof(int64_t));
+  tree->dim = (unsigned char *)malloc((size_t)(n + 1));
+  if (tree->xyz == NULL || tree->index == NULL || tree->dim == NULL) {
+    return 1;
+  }
+
+  n = 0;
+  for (i = 0; i < n_points; i++) {
+    if (!unres_mask[i] && (any_type || lsm[i] == is_land_field)) {
+      tree->index[n] = i;
+      grid_xyz(i, points_lambda, trig, points_phi, &tree->xyz[3*n]);
+      n++;
+    }
+  }
+  build_tree(tree, 0, n);
+  return 0;
+}
+
+static void free_tree(point_tree *tree)
+{
+  free(tree->xyz);
+  free(tree->index);
+  free(tree->dim);
+}
+
+// Run the nearest neighbour search for a single field; takes the same
+// arguments and returns the same status as run_spiral_search.  The dist_step
+// isn't needed, since the tree always finds the nearest point; the spiral
+// search only looks as far as a radius set by dist_step, so where the grid
+// spacing varies it may return a point slightly further away than this.
+// The unresolved points are shared between the given number of threads.
+// Does not need the GIL
+static int64_t run_tree_search(bool *lsm,
+                               const int64_t *index_unres,
+                               int64_t no_point_unres,
+                               int64_t points_phi,
+                               int64_t points_lambda,
+                               double *lats,
+                               double *lons,
+                               bool is_land_field,
+                               bool constrained,
+                               double constrained_max_dist,
+                               double dist_step,
+                               bool cyclic,
+                               bool *unres_mask,
+                               int64_t *indices,
+                               double planet_radius,
+                               char *err_msg,
+                               int threads)
+{
+  int64_t n_points = points_phi*points_lambda;
+  int64_t i;
+  int64_t status = 0;
+  int64_t warned = 0;
+  point_tree same_type = {0, NULL, NULL, NULL};
+  point_tree any_type = {0, NULL, NULL, NULL};
+  const double deg_to_rad = M_PI/180.0;
+
+  (void) dist_step;
+
+  #ifdef _OPENMP
+  if (threads <= 0) threads = omp_get_max_threads();
+  #endif
+
+  for (i = 0; i < no_point_unres; i++) {
+    if (index_unres[i] < 0 || index_unres[i] >= n_points) {
+      snprintf(err_msg, ERR_MSG_LEN,
+               "Unresolved point index %" PRId64 " is outside the grid",
+               index_unres[i]);
+      return 1;
+    }
+  }
+
+  double *trig = (double *)malloc(
+      (size_t)(2*(points_phi + points_lambda))*sizeof(double));
+  if (trig == NULL) {
+    snprintf(err_msg, ERR_MSG_LEN,
+             "Unable to allocate memory for the search tree");
+    return 1;
+  }
+  for (i = 0; i < points_phi; i++) {
+    trig[i] = sin(lats[i]*deg_to_rad);
+    trig[points_phi + i] = cos(lats[i]*deg_to_rad);
+  }
+  for (i = 0; i < points_lambda; i++) {
+    trig[2*points_phi + i] = sin(lons[i]*deg_to_rad);
+    trig[2*points_phi + points_lambda + i] = cos(lons[i]*deg_to_rad);
+  }
+
+  if (fill_tree(&same_type, lsm, unres_mask, false, is_land_field,
+                points_phi, points_lambda, trig) != 0 ||
+      (constrained &&
+       fill_tree(&any_type, lsm, unres_mask, true, is_land_field,
+                 points_phi, points_lambda, trig) != 0)) {
+    snprintf(err_msg, ERR_MSG_LEN,
+             "Unable to allocate memory for the search tree");
+    status = 1;
+    goto cleanup;
+  }
+  if (same_type.n == 0 && no_point_unres > 0) {
+    snprintf(err_msg, ERR_MSG_LEN,
+             "There are no resolved points of the same type as the field");
+    status = 1;
+    goto cleanup;
+  }
+
+  // The constraint as a squared chord distance
+  double max_angle = constrained_max_dist/planet_radius;
+  double max_chord = max_angle < M_PI ? 2.0*sin(0.5*max_angle) : 2.0;
+  double max_dist = max_chord*max_chord;
+
+  #pragma omp parallel for schedule(static) reduction(|:warned) \
+      num_threads(threads)
+  for (i = 0; i < no_point_unres; i++) {
+    double xyz[3];
+    tree_query query;
+    grid_xyz(index_unres[i], points_lambda, trig, points_phi, xyz);
+    query.xyz = xyz;
+    query.row = index_unres[i] / points_lambda;
+    query.col = index_unres[i] % points_lambda;
+    query.points_lambda = points_lambda;
+    query.cyclic = cyclic;
+    query.found = -1;
+    query.best = 0.0;
+    query.ring = 0;
+    search_tree(&same_type, 0, same_type.n, &query);
+    int64_t found = query.found;
+
+    // If the nearest point of the same type is too far away, use the
+    // nearest resolved point of either type (if that is close enough)
+    if (constrained && query.best > max_dist) {
+      query.found = -1;
+      search_tree(&any_type, 0, any_type.n, &query);
+      if (query.found >= 0 && query.best <= max_dist) {
+        found = query.found;
+      } else {
+        warned = 1;
+      }
+    }
+    indices[i] = found;
+  }
+
+  if (warned) {
+    snprintf(err_msg, ERR_MSG_LEN,
+             "Despite being constrained there were no resolved points "
+             "of any type within the limit; using the nearest point of the "
+             "same type instead");
+    status = -1;
+  }
+
+cleanup:
+  free(trig);
+  free_tree(&same_type);
+  free_tree(&any_type);
+  return status;
+}
+
+static PyObject *spiral_search_py(PyObject *self, PyObject *args,
+                                  PyObject *kwds)
 {
 
   // Setup and obtain inputs passed from python
@@ -119,12 +640,20 @@ static PyObject *spiral_search_py(PyObject *self, PyObject *args)
   PyObject *constrained;
   double constrained_max_dist;
   double dist_step;
+  PyObject *out = NULL;
+  PyObject *use_tree = NULL;
+  static char *kwlist[] = {"lsm", "index_unres", "unres_mask", "lats", "lons",
+                           "planet_radius", "cyclic", "is_land_field",
+                           "constrained", "constrained_max_dist", "dist_step",
+                           "out", "use_tree", NULL};
 
   // Note the argument descriptors:
-  if (!PyArg_ParseTuple(args, "OOOOOdOOOdd",
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOOOOdOOOdd|OO", kwlist,
                         &lsm, &index_unres, &unres_mask, 
                         &lats, &lons, &planet_radius, &cyclic, &is_land_field, 
-                        &constrained, &constrained_max_dist, &dist_step)) return NULL;
+                        &constrained, &constrained_max_dist, &dist_step,
+                        &out, &use_tree)) return NULL;
+  if (out == Py_None) out = NULL;
 
   // Cast self to void to avoid unused paramter errors
   (void) self;
@@ -162,54 +691,46 @@ static PyObject *spiral_search_py(PyObject *self, PyObject *args)
   bool *unres_mask_ptr = (bool *) PyArray_DATA(unres_mask);
   double *lats_ptr = (double *) PyArray_DATA(lats);
   double *lons_ptr = (double *) PyArray_DATA(lons);
-
-  // Create a copy of the unresolved indices (to avoid updating them in place!)
-  int64_t index_unres_data[no_point_unres];
   int64_t *index_unres_ptr = (int64_t *) PyArray_DATA(index_unres);
-  // The indices passed in will be using 0-based (C) indexing...
-  int i;
-  for (i = 0; i < no_point_unres; i++)
-    {
-      index_unres_data[i] = index_unres_ptr[i] + 1;
-    }  
 
   // Setup output array object and dimensions
   PyArrayObject *npy_array_out = NULL;
   npy_intp dims_out[1];
 
-  // Allocate space for return value
-  int64_t *indices =
-    (int64_t*)calloc((size_t)(no_point_unres), sizeof(int64_t));
-  if (indices == NULL) {
-    PyErr_SetString(PyExc_ValueError, "Unable to allocate memory for output indices");
-    return NULL;
+  dims_out[0] = no_point_unres;
+
+  // Write straight into the output array if one was given, otherwise
+  // allocate space for return value
+  int64_t *indices = NULL;
+  if (out != NULL) {
+    if (check_out_array(out, NPY_INT64, 1, dims_out) != 0) return NULL;
+    indices = (int64_t *) PyArray_DATA((PyArrayObject *) out);
+  } else {
+    indices = (int64_t*)calloc((size_t)(no_point_unres), sizeof(int64_t));
+    if (indices == NULL) {
+      PyErr_SetString(PyExc_ValueError,
+                      "Unable to allocate memory for output indices");
+      return NULL;
+    }
   }
- 
-  int64_t msg_len = 512;
-  char err_msg[msg_len];
 
+  char err_msg[ERR_MSG_LEN];
   int64_t status;
-
-  status = c_shum_spiral_search_algorithm(lsm_ptr,
-                                          index_unres_data,
-                                          &no_point_unres,
-                                          &points_phi,
-                                          &points_lambda,
-                                          lats_ptr,
-                                          lons_ptr,
-                                          &is_land_field_bool,
-                                          &constrained_bool,
-                                          &constrained_max_dist,
-                                          &dist_step,
-                                          &cyclic_bool,
-                                          unres_mask_ptr,
-                                          indices,
-                                          &planet_radius,
-                                          &err_msg[0],
-                                          &msg_len);
+  search_engine engine = (use_tree != NULL && PyObject_IsTrue(use_tree)) ?
+      run_tree_search : run_spiral_search;
+
+  // The search doesn't need the GIL (the arrays are kept alive by the
+  // references held in the arguments)
+  Py_BEGIN_ALLOW_THREADS
+  status = engine(lsm_ptr, index_unres_ptr, no_point_unres,
+                  points_phi, points_lambda, lats_ptr, lons_ptr,
+                  is_land_field_bool, constrained_bool,
+                  constrained_max_dist, dist_step, cyclic_bool,
+                  unres_mask_ptr, indices, planet_radius, err_msg, 0);
+  Py_END_ALLOW_THREADS
 
   if (status > 0) {
-    free(indices);
+    if (out == NULL) free(indices);
     PyErr_SetString(PyExc_ValueError, err_msg);
     return NULL;
   }
@@ -217,14 +738,13 @@ static PyObject *spiral_search_py(PyObject *self, PyObject *args)
     PyErr_WarnEx(PyExc_RuntimeWarning, err_msg, 1);
   }
 
-  // The indices returned will be using 1-based (Fortran) indexing...
-  for (i = 0; i < no_point_unres; i++)
-    {
-      indices[i] = indices[i] - 1;
-    }
+  // If writing into the output array, simply return it
+  if (out != NULL) {
+    Py_INCREF(out);
+    return out;
+  }
 
   // Now form a numpy array object to return to python
-  dims_out[0] = no_point_unres;
   npy_array_out=(PyArrayObject *) PyArray_SimpleNewFromData(1, dims_out,
                                                             NPY_INT64,
                                                             indices);
@@ -243,3 +763,232 @@ static PyObject *spiral_search_py(PyObject *self, PyObject *args)
 
   return (PyObject *)npy_array_out;
 }
+
+// Fetch one array from an argument which may either be a single array
+// (shared by every field) or a sequence with an array for each field
+static PyArrayObject *field_array(PyObject *arg, Py_ssize_t i)
+{
+  if (PyArray_Check(arg)) return (PyArrayObject *)arg;
+  return (PyArrayObject *)PySequence_Fast_GET_ITEM(arg, i);
+}
+
+static PyObject *spiral_search_many_py(PyObject *self, PyObject *args,
+                                       PyObject *kwds)
+{
+  // Setup and obtain inputs passed from python
+  PyObject *lsm_in;
+  PyObject *index_unres_in;
+  PyObject *unres_mask_in;
+  PyArrayObject *lats;
+  PyArrayObject *lons;
+
+  double planet_radius;
+  PyObject *cyclic;
+  PyObject *is_land_field_in;
+  PyObject *constrained;
+  double constrained_max_dist;
+  double dist_step;
+  int threads = 0;
+  PyObject *use_tree = NULL;
+  static char *kwlist[] = {"lsm", "list_of_index_unres",
+                           "list_of_unres_mask", "lats", "lons",
+                           "planet_radius", "cyclic", "is_land_field",
+                           "constrained", "constrained_max_dist", "dist_step",
+                           "threads", "use_tree", NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOOOOdOOOdd|iO", kwlist,
+                        &lsm_in, &index_unres_in, &unres_mask_in,
+                        &lats, &lons, &planet_radius, &cyclic,
+                        &is_land_field_in, &constrained,
+                        &constrained_max_dist, &dist_step,
+                        &threads, &use_tree)) return NULL;
+
+  // Cast self to void to avoid unused paramter errors
+  (void) self;
+
+  bool cyclic_bool = (bool) PyObject_IsTrue(cyclic);
+  bool constrained_bool = (bool) PyObject_IsTrue(constrained);
+
+  int64_t points_phi = (int64_t) PyArray_DIMS(lats)[0];
+  int64_t points_lambda = (int64_t) PyArray_DIMS(lons)[0];
+  int64_t n_points = points_phi*points_lambda;
+
+  // Turn each of the per-field arguments into a fast sequence (unless it
+  // was given as a single value)
+  PyObject *index_unres_seq = NULL;
+  PyObject *unres_mask_seq = NULL;
+  PyObject *lsm_seq = NULL;
+  PyObject *is_land_seq = NULL;
+  PyObject *result = NULL;
+  bool *is_land = NULL;
+  int64_t **indices = NULL;
+  int64_t *status = NULL;
+  char err_msg[ERR_MSG_LEN];
+  Py_ssize_t i;
+
+  index_unres_seq = PySequence_Fast(index_unres_in,
+                                    "Unresolved indices must be a sequence");
+  if (index_unres_seq == NULL) goto cleanup;
+  unres_mask_seq = PySequence_Fast(unres_mask_in,
+                                   "Unresolved masks must be a sequence");
+  if (unres_mask_seq == NULL) goto cleanup;
+  Py_ssize_t n_fields = PySequence_Fast_GET_SIZE(index_unres_seq);
+
+  if (PySequence_Fast_GET_SIZE(unres_mask_seq) != n_fields) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Number of unresolved masks must match the number of "
+                    "unresolved index arrays");
+    goto cleanup;
+  }
+
+  if (PyArray_Check(lsm_in)) {
+    lsm_seq = lsm_in;
+    Py_INCREF(lsm_seq);
+  } else {
+    lsm_seq = PySequence_Fast(lsm_in, "Land/Sea mask must be an array or "
+                              "a sequence of arrays");
+    if (lsm_seq == NULL) goto cleanup;
+    if (PySequence_Fast_GET_SIZE(lsm_seq) != n_fields) {
+      PyErr_SetString(PyExc_ValueError,
+                      "Number of land/sea masks must match the number of "
+                      "unresolved index arrays");
+      goto cleanup;
+    }
+  }
+
+  is_land = (bool *)malloc((size_t)(n_fields + 1)*sizeof(bool));
+  indices = (int64_t **)calloc((size_t)(n_fields + 1), sizeof(int64_t *));
+  status = (int64_t *)calloc((size_t)(n_fields + 1), sizeof(int64_t));
+  if (is_land == NULL || indices == NULL || status == NULL) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Unable to allocate memory for field information");
+    goto cleanup;
+  }
+
+  if (PySequence_Check(is_land_field_in)) {
+    is_land_seq = PySequence_Fast(is_land_field_in, "");
+    if (is_land_seq == NULL) goto cleanup;
+    if (PySequence_Fast_GET_SIZE(is_land_seq) != n_fields) {
+      PyErr_SetString(PyExc_ValueError,
+                      "Number of land field flags must match the number of "
+                      "unresolved index arrays");
+      goto cleanup;
+    }
+  }
+
+  // Check the arrays for each field, and create the output arrays
+  result = PyList_New(n_fields);
+  if (result == NULL) goto cleanup;
+  for (i = 0; i < n_fields; i++) {
+    PyArrayObject *index_unres = field_array(index_unres_seq, i);
+    PyArrayObject *unres_mask = field_array(unres_mask_seq, i);
+    PyArrayObject *lsm = field_array(lsm_seq, i);
+    if (!PyArray_Check((PyObject *)index_unres) ||
+        !PyArray_Check((PyObject *)unres_mask) ||
+        !PyArray_Check((PyObject *)lsm)) {
+      PyErr_SetString(PyExc_ValueError,
+                      "Masks and unresolved indices must be numpy.ndarrays");
+      goto cleanup;
+    }
+    if ((int64_t) PyArray_DIMS(unres_mask)[0] != n_points) {
+      PyErr_SetString(PyExc_ValueError,
+                      "Mask length not equal to product of lat + lon lengths");
+      goto cleanup;
+    }
+    if ((int64_t) PyArray_DIMS(lsm)[0] != n_points) {
+      PyErr_SetString(PyExc_ValueError,
+                      "Land/Sea mask length not equal to product of lat + "
+                      "lon lengths");
+      goto cleanup;
+    }
+
+    if (is_land_seq != NULL) {
+      is_land[i] = (bool) PyObject_IsTrue(
+          PySequence_Fast_GET_ITEM(is_land_seq, i));
+    } else {
+      is_land[i] = (bool) PyObject_IsTrue(is_land_field_in);
+    }
+
+    npy_intp dims_out[1];
+    dims_out[0] = PyArray_DIMS(index_unres)[0];
+    PyObject *array = PyArray_ZEROS(1, dims_out, NPY_INT64, 0);
+    if (array == NULL) goto cleanup;
+    PyList_SET_ITEM(result, i, array);
+    indices[i] = (int64_t *)PyArray_DATA((PyArrayObject *)array);
+  }
+
+  // Now run the searches; the first failure's message is kept for
+  // reporting (and the first warning, if there are no failures)
+  Py_ssize_t failed = -1;
+  Py_ssize_t warned = -1;
+  char warn_msg[ERR_MSG_LEN];
+  search_engine engine = (use_tree != NULL && PyObject_IsTrue(use_tree)) ?
+      run_tree_search : run_spiral_search;
+
+  #ifdef _OPENMP
+  if (threads <= 0) threads = omp_get_max_threads();
+  #endif
+
+  // The threads are shared out over the fields; only a single field may
+  // use them within its own search (this avoids nesting parallel regions)
+  int team = n_fields > 1 ? threads : 1;
+  int field_threads = n_fields > 1 ? 1 : threads;
+
+  Py_BEGIN_ALLOW_THREADS
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(team)
+  for (i = 0; i < n_fields; i++) {
+    char thread_msg[ERR_MSG_LEN];
+    PyArrayObject *index_unres = field_array(index_unres_seq, i);
+    status[i] = engine(
+        (bool *) PyArray_DATA(field_array(lsm_seq, i)),
+        (const int64_t *) PyArray_DATA(index_unres),
+        (int64_t) PyArray_DIMS(index_unres)[0],
+        points_phi, points_lambda,
+        (double *) PyArray_DATA(lats), (double *) PyArray_DATA(lons),
+        is_land[i], constrained_bool, constrained_max_dist, dist_step,
+        cyclic_bool,
+        (bool *) PyArray_DATA(field_array(unres_mask_seq, i)),
+        indices[i], planet_radius, &thread_msg[0], field_threads);
+    if (status[i] != 0) {
+      #pragma omp critical
+      {
+        if (status[i] > 0 && (failed < 0 || i < failed)) {
+          failed = i;
+          memcpy(err_msg, thread_msg, sizeof(thread_msg));
+        } else if (status[i] < 0 && (warned < 0 || i < warned)) {
+          warned = i;
+          memcpy(warn_msg, thread_msg, sizeof(thread_msg));
+        }
+      }
+    }
+  }
+  Py_END_ALLOW_THREADS
+
+  if (failed >= 0) {
+    PyErr_SetString(PyExc_ValueError, err_msg);
+    goto cleanup;
+  }
+  if (warned >= 0) {
+    if (PyErr_WarnEx(PyExc_RuntimeWarning, warn_msg, 1) != 0) goto cleanup;
+  }
+
+  free(is_land);
+  free(indices);
+  free(status);
+  Py_DECREF(index_unres_seq);
+  Py_DECREF(unres_mask_seq);
+  Py_DECREF(lsm_seq);
+  Py_XDECREF(is_land_seq);
+  return result;
+
+cleanup:
+  free(is_land);
+  free(indices);
+  free(status);
+  Py_XDECREF(index_unres_seq);
+  Py_XDECREF(unres_mask_seq);
+  Py_XDECREF(lsm_seq);
+  Py_XDECREF(is_land_seq);
+  Py_XDECREF(result);
+  return NULL;
+}
@@ -19,11 +19,18 @@
 # along with this UM Spiral Search module.
 # If not, see <http://opensource.org/licenses/BSD-3-Clause>.
 import os
+import sys
 import shutil
 import setuptools
 import numpy as np
 from glob import glob
 
+# The build_ext command which enables OpenMP is shared by the extensions, so
+# is taken from the admin directory of the working copy
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                os.pardir, "admin"))
+from openmp_build import BuildExtCommand  # noqa: E402
+
 
 class CleanCommand(setuptools.Command):
     """
@@ -56,7 +63,7 @@ setuptools.setup(
     description="Unified Model Spiral Search extension",
     author="UM Systems Team",
     url="https://github.com/metoffice/mule",
-    cmdclass={"clean": CleanCommand},
+    cmdclass={"clean": CleanCommand, "build_ext": BuildExtCommand},
     package_dir={"": "lib"},
     packages=["um_spiral_search", "um_spiral_search.tests"],
     ext_modules=[
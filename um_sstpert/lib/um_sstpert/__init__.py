@@ -34,6 +34,12 @@ Usage:
     >>> pert_fil = mule_sstpert.gen_pert_file(
                                          clim_file, alpha, ens_member, date)
 
+ * Produce the perturbation fields for several ensemble members at once
+   (sharing the climatology between them):
+
+    >>> pert_fields = mule_sstpert.gen_pert_fields(
+                                        clim_fields, alpha, ens_members, date)
+
 """
 import os
 import sys
@@ -44,34 +50,17 @@ import numpy as np
 from datetime import datetime
 
 import mule
-from .um_sstpert import sstpert, sstpertseed
+from .um_sstpert import sstpert, sstpert_many, sstpertseed
 from um_utils.version import report_modules
 from um_utils.pumf import _banner
 
 __version__ = "2025.10.1"
 
 
-def gen_pert_field(clim_fields, alpha, ens_member, date):
+def _clim_array(clim_fields):
     """
-    Generate an SST perturbation field from a set of climatological
-    fields and some values to setup a random number generator.
-
-    Args:
-        * clim_fields:
-            Array of 12 field objects giving the SST (lbuser4=24)
-            for each month of the year.
-        * alpha:
-            Factor used by algorithm (higher values lead to more extreme
-            perturbations).
-        * ens_member:
-            Ensemble member number - used in random generator.
-        * date:
-            Datetime object giving the desired date for the perturbed field.
-
-    Returns:
-        * pert_field:
-            A new field object based on the first climatology field but with
-            its data replaced by the new perturbed SST field.
+    Check a set of climatology fields and return their data as the array
+    required by the SST pert library, along with the fields in month order.
 
     """
     # Climatology should be a list of 12 field object giving the SSTs
@@ -102,23 +91,34 @@ def gen_pert_field(clim_fields, alpha, ens_member, date):
     for ifield, field in enumerate(clim_fields):
         clim_array[:, :, ifield] = field.get_data()
 
-    # The library also requires some of the other arguments be packed into an
-    # array similar to the UM's "dt" array:
-    dt = np.array([date.year,
-                   date.month,
-                   date.day,
-                   0,              # This element is a UTC offset and always 0
-                   date.hour + 1,  # Add 1 here because fieldcalc did it
-                   date.minute,
-                   ens_member,
-                   ens_member + 100],
-                   dtype=np.int64)
+    return clim_array, clim_fields
 
-    # Call the library
-    pert_data = sstpert(alpha, dt, clim_array)
 
+def _dt_array(ens_member, date):
+    """
+    Return the array of date and ensemble member information (similar to
+    the UM's "dt" array) required by the SST pert library.
+
+    """
+    return np.array([date.year,
+                     date.month,
+                     date.day,
+                     0,              # This element is a UTC offset; always 0
+                     date.hour + 1,  # Add 1 here because fieldcalc did it
+                     date.minute,
+                     ens_member,
+                     ens_member + 100],
+                    dtype=np.int64)
+
+
+def _pert_field(template, pert_data, date):
+    """
+    Return a copy of a climatology field with its data replaced by a
+    perturbation field, and headers set from the given date.
+
+    """
     # Create a copy of the first field to store the new output
-    pert_field = clim_fields[0].copy()
+    pert_field = template.copy()
     pert_field.set_data_provider(mule.ArrayDataProvider(pert_data))
 
     # Set the field headers from the given date
@@ -135,6 +135,80 @@ def gen_pert_field(clim_fields, alpha, ens_member, date):
     return pert_field
 
 
+def gen_pert_field(clim_fields, alpha, ens_member, date):
+    """
+    Generate an SST perturbation field from a set of climatological
+    fields and some values to setup a random number generator.
+
+    Args:
+        * clim_fields:
+            Array of 12 field objects giving the SST (lbuser4=24)
+            for each month of the year.
+        * alpha:
+            Factor used by algorithm (higher values lead to more extreme
+            perturbations).
+        * ens_member:
+            Ensemble member number - used in random generator.
+        * date:
+            Datetime object giving the desired date for the perturbed field.
+
+    Returns:
+        * pert_field:
+            A new field object based on the first climatology field but with
+            its data replaced by the new perturbed SST field.
+
+    """
+    clim_array, clim_fields = _clim_array(clim_fields)
+
+    # Call the library
+    pert_data = sstpert(alpha, _dt_array(ens_member, date), clim_array)
+
+    return _pert_field(clim_fields[0], pert_data, date)
+
+
+def gen_pert_fields(clim_fields, alpha, ens_members, date, threads=1):
+    """
+    Generate the SST perturbation fields for several ensemble members from
+    a set of climatological fields.  This gives the same fields as calling
+    :func:`gen_pert_field` for each member, but the climatology is only
+    prepared once and the fields are generated in a single library call.
+
+    Args:
+        * clim_fields:
+            Array of 12 field objects giving the SST (lbuser4=24)
+            for each month of the year.
+        * alpha:
+            Factor used by algorithm (higher values lead to more extreme
+            perturbations).
+        * ens_members:
+            List of ensemble member numbers - used in random generator.
+        * date:
+            Datetime object giving the desired date for the perturbed fields.
+
+    Kwargs:
+        * threads:
+            Number of threads to generate the fields with (default 1; 0
+            uses the OpenMP default).  Only use more than 1 if the SST pert
+            library was built to be thread-safe.
+
+    Returns:
+        * pert_fields:
+            A list of new field objects (one for each ensemble member) based
+            on the first climatology field.
+
+    """
+    clim_array, clim_fields = _clim_array(clim_fields)
+
+    dt = np.array([_dt_array(ens_member, date)
+                   for ens_member in ens_members], dtype=np.int64)
+    dt = dt.reshape(-1, 8)
+
+    # Call the library
+    pert_data = sstpert_many(alpha, dt, clim_array, threads=threads)
+
+    return [_pert_field(clim_fields[0], data, date) for data in pert_data]
+
+
 def gen_seed(ens_member, date):
     """
     Generate a seed
@@ -149,20 +223,8 @@ def gen_seed(ens_member, date):
 
     """
 
-    # The library also requires some of the other arguments be packed into an
-    # array similar to the UM's "dt" array:
-    dt = np.array([date.year,
-                   date.month,
-                   date.day,
-                   0,              # This element is a UTC offset and always 0
-                   date.hour + 1,  # Add 1 here because fieldcalc did it
-                   date.minute,
-                   ens_member,
-                   ens_member + 100],
-                   dtype=np.int64)
-
     # Call the library
-    seed = sstpertseed(dt)
+    seed = sstpertseed(_dt_array(ens_member, date))
     return seed
 
 
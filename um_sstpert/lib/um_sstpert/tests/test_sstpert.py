@@ -0,0 +1,101 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of the UM sstpert library extension module for Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Unit tests for :mod:`um_sstpert` module.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import numpy as np
+import um_sstpert.tests as tests
+from datetime import datetime
+
+import mule
+from um_sstpert import (sstpert, sstpert_many, gen_pert_field,
+                        gen_pert_fields)
+
+
+class Test_sstpert_many(tests.UMSstpertTest):
+    ALPHA = 0.5
+    ROWS = 18
+    COLS = 24
+
+    def setUp(self):
+        # A climatology which varies with latitude and month
+        rng = np.random.RandomState(2468)
+        lats = np.linspace(-85.0, 85.0, self.ROWS)
+        months = np.arange(12)
+        base = 273.0 + 30.0*np.cos(np.radians(lats))
+        seasonal = 2.0*np.sin(2.0*np.pi*months/12.0)
+        self.clim = (base[:, None, None] + seasonal[None, None, :] +
+                     0.5*rng.rand(self.ROWS, self.COLS, 12))
+        self.date = datetime(2025, 6, 15, 12, 30)
+        self.dt = np.array([[2025, 6, 15, 0, 13, 30, member, member + 100]
+                            for member in range(1, 6)], dtype=np.int64)
+
+    def test_matches_sstpert(self):
+        # Each field should be the same as a separate call for its dt
+        # (using a single thread, since the library needn't be thread-safe)
+        expected = [sstpert(self.ALPHA, dt, self.clim) for dt in self.dt]
+        result = sstpert_many(self.ALPHA, self.dt, self.clim, threads=1)
+        self.assertEqual(result.shape, (len(self.dt), self.ROWS, self.COLS))
+        for data, expected_data in zip(result, expected):
+            self.assertArrayEqual(data, expected_data)
+
+        # A float32 climatology is converted in the same way as sstpert
+        clim32 = self.clim.astype(np.float32)
+        result = sstpert_many(self.ALPHA, self.dt, clim32, threads=1)
+        for data, dt in zip(result, self.dt):
+            self.assertArrayEqual(data, sstpert(self.ALPHA, dt, clim32))
+
+    def test_bad_dt(self):
+        with self.assertRaisesRegex(ValueError, "shape"):
+            sstpert_many(self.ALPHA, self.dt[:, :7], self.clim)
+
+    def test_gen_pert_fields(self):
+        # The fields for several members should match those generated one
+        # at a time (with the climatology fields in any order)
+        clim_fields = []
+        for month in range(12):
+            field = mule.Field3.empty()
+            field.lbrel = 3
+            field.lbuser4 = 24
+            field.lbmon = month + 1
+            field.lbrow, field.lbnpt = self.ROWS, self.COLS
+            field.set_data_provider(
+                mule.ArrayDataProvider(self.clim[:, :, month]))
+            clim_fields.append(field)
+        clim_fields = clim_fields[6:] + clim_fields[:6]
+
+        members = [3, 1, 4]
+        fields = gen_pert_fields(clim_fields, self.ALPHA, members, self.date,
+                                 threads=1)
+        self.assertEqual(len(fields), len(members))
+        for field, member in zip(fields, members):
+            expected = gen_pert_field(clim_fields, self.ALPHA, member,
+                                      self.date)
+            self.assertArrayEqual(field.get_data(), expected.get_data())
+            self.assertEqual(field.lbmon, 6)
+            self.assertEqual(field.lbmin, 30)
+
+
+if __name__ == "__main__":
+    tests.main()
@@ -32,9 +32,14 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <numpy/arrayobject.h>
+#include <string.h>
 
 #include "sstpert.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #if PY_MAJOR_VERSION >= 3
 #define PyInt_FromLong PyLong_FromLong
 #define MOD_ERROR_VAL NULL
@@ -54,7 +59,9 @@
 
 MOD_INIT(um_sstpert);
 
-static PyObject *sstpert_py(PyObject *self, PyObject *args);
+static PyObject *sstpert_py(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *sstpert_many_py(PyObject *self, PyObject *args,
+                                 PyObject *kwds);
 static PyObject *sstpertseed_py(PyObject *self, PyObject *args);
 
 MOD_INIT(um_sstpert)
@@ -66,15 +73,42 @@ MOD_INIT(um_sstpert)
   PyDoc_STRVAR(sstpert__doc__,
   "Generate a SST perturbation field from a climatology and target date.\n\n"
   "Usage:\n"
-  "  um_sstpert.sstpert(factor, dt, climatology)\n\n"
+  "  um_sstpert.sstpert(factor, dt, climatology, out=None)\n\n"
   "Args:\n"
   "* factor      - alpha factor for perturbation generation.\n"
   "* dt          - 8 element array giving year, month, day, hour, offset,\n"
   "                minutes, ensemble member number and ensemble member + 100.\n"
   "* climatology - 3 Dimensional numpy.ndarray giving climatologies; the \n"
-  "                dimensions are rows, columns, and 12 (months).\n\n"
+  "                dimensions are rows, columns, and 12 (months).\n"
+  "* out         - If given, a C-contiguous, writeable, native byte-order\n"
+  "                float64 numpy.ndarray of shape (rows, columns), which\n"
+  "                the field data is written into directly.\n\n"
+  "Returns:\n"
+  "  2 Dimensional numpy.ndarray containing SST pert field data (this is\n"
+  "  the out array, if it was given).\n\n"
+  "The climatology and dt arrays are used directly if they are C-contiguous,\n"
+  "native byte-order float64 and int64 arrays respectively; otherwise (e.g.\n"
+  "for a float32 climatology) they are converted to that form first.\n"
+  );
+
+  PyDoc_STRVAR(sstpert_many__doc__,
+  "Generate a SST perturbation field for each of several target dates or\n"
+  "ensemble members from the same climatology.\n\n"
+  "Usage:\n"
+  "  um_sstpert.sstpert_many(factor, dt, climatology, threads=1)\n\n"
+  "Args:\n"
+  "* factor      - alpha factor for perturbation generation.\n"
+  "* dt          - 2 Dimensional array of shape (N, 8); each row is a dt\n"
+  "                array as for sstpert.\n"
+  "* climatology - 3 Dimensional numpy.ndarray giving climatologies; the \n"
+  "                dimensions are rows, columns, and 12 (months).\n"
+  "* threads     - Number of OpenMP threads to generate the fields with\n"
+  "                (by default 1; 0 uses the OpenMP default).  Only\n"
+  "                use more than 1 if the perturbation library was\n"
+  "                built to be thread-safe.\n\n"
   "Returns:\n"
-  "  2 Dimensional numpy.ndarray containing SST pert field data.\n"
+  "  3 Dimensional numpy.ndarray of shape (N, rows, columns) containing\n"
+  "  the SST pert field data for each row of dt.\n"
   );
 
   PyDoc_STRVAR(sstpertseed__doc__,
@@ -90,7 +124,10 @@ MOD_INIT(um_sstpert)
 
 
   static PyMethodDef um_sstpertMethods[] = {
-    {"sstpert", sstpert_py, METH_VARARGS, sstpert__doc__},
+    {"sstpert", (PyCFunction)(void(*)(void))sstpert_py,
+                METH_VARARGS | METH_KEYWORDS, sstpert__doc__},
+    {"sstpert_many", (PyCFunction)(void(*)(void))sstpert_many_py,
+                     METH_VARARGS | METH_KEYWORDS, sstpert_many__doc__},
     {"sstpertseed", sstpertseed_py, METH_VARARGS, sstpertseed__doc__},
     {NULL, NULL, 0, NULL}
   };
@@ -104,15 +141,109 @@ MOD_INIT(um_sstpert)
   return MOD_SUCCESS_VAL(mod);
 }
 
-static PyObject *sstpert_py(PyObject *self, PyObject *args)
+// Check that an array given as an "out" argument can be written to directly
+// by the library; it must be a C-contiguous, aligned, writeable array of the
+// given type (in native byte order) and with exactly the expected dimensions.
+// Returns 0 if the array is suitable, otherwise sets a Python exception
+static int check_out_array(PyObject *out, int type_num, int ndim,
+                           const npy_intp *dims)
+{
+  PyArrayObject *array;
+  int i;
+
+  if (!PyArray_Check(out)) {
+    PyErr_SetString(PyExc_ValueError, "Output must be a numpy.ndarray");
+    return 1;
+  }
+  array = (PyArrayObject *)out;
+
+  if (PyArray_TYPE(array) != type_num || !PyArray_ISNOTSWAPPED(array)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array has the wrong dtype or byte order");
+    return 1;
+  }
+
+  if (!PyArray_ISCARRAY(array)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array must be C-contiguous, aligned and writeable");
+    return 1;
+  }
+
+  if (PyArray_NDIM(array) != ndim) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array has the wrong number of dimensions");
+    return 1;
+  }
+  for (i = 0; i < ndim; i++) {
+    if (PyArray_DIMS(array)[i] != dims[i]) {
+      PyErr_SetString(PyExc_ValueError, "Output array has the wrong shape");
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Obtain an input argument as an aligned, C-contiguous, native byte-order
+// array of the given type and number of dimensions.  The argument is used
+// directly if it is already in that form, otherwise it is converted (this
+// means e.g. float32 inputs are accepted without a copy being made in
+// Python first).  Returns a new reference, or NULL with a Python exception
+static PyArrayObject *input_array(PyObject *obj, int type_num, int ndim,
+                                  const char *name)
+{
+  PyArrayObject *array =
+      (PyArrayObject *) PyArray_FROM_OTF(obj, type_num, NPY_ARRAY_IN_ARRAY);
+  if (array == NULL) return NULL;
+  if (PyArray_NDIM(array) != ndim) {
+    PyErr_Format(PyExc_ValueError, "%s must be %d Dimensional", name, ndim);
+    Py_DECREF(array);
+    return NULL;
+  }
+  return array;
+}
+
+// Obtain the climatology and check that it holds 12 months
+static PyArrayObject *climatology_array(PyObject *obj)
+{
+  PyArrayObject *fieldclim = input_array(obj, NPY_DOUBLE, 3, "Climatology");
+  if (fieldclim == NULL) return NULL;
+  if (PyArray_DIMS(fieldclim)[2] != 12) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Climatology must have a final dimension of 12");
+    Py_DECREF(fieldclim);
+    return NULL;
+  }
+  return fieldclim;
+}
+
+// Obtain a single 8 element dt array
+static PyArrayObject *dt_array(PyObject *obj)
+{
+  PyArrayObject *dt = input_array(obj, NPY_INT64, 1, "Date array");
+  if (dt == NULL) return NULL;
+  if (PyArray_DIMS(dt)[0] != 8) {
+    PyErr_SetString(PyExc_ValueError, "Date array must have 8 elements");
+    Py_DECREF(dt);
+    return NULL;
+  }
+  return dt;
+}
+
+static PyObject *sstpert_py(PyObject *self, PyObject *args, PyObject *kwds)
 {
   // Setup and obtain inputs passed from python
   double factor = 0.0;
-  PyArrayObject *dt;
-  PyArrayObject *fieldclim;
-
-  // Note the argument descriptors "s#d":
-  if (!PyArg_ParseTuple(args, "dOO", &factor, &dt, &fieldclim )) return NULL;
+  PyObject *dt_in;
+  PyObject *fieldclim_in;
+  PyObject *out = NULL;
+  static char *kwlist[] = {"factor", "dt", "climatology", "out", NULL};
+
+  // Note the argument descriptors "dOO|O":
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "dOO|O", kwlist,
+                                   &factor, &dt_in, &fieldclim_in, &out))
+    return NULL;
+  if (out == Py_None) out = NULL;
 
   // Cast self to void to avoid unused paramter errors
   (void) self;
@@ -122,46 +253,65 @@ static PyObject *sstpert_py(PyObject *self, PyObject *args)
   npy_intp dims_out[2];
 
   // Get dimensions of input fieldclim array
+  PyArrayObject *fieldclim = climatology_array(fieldclim_in);
+  if (fieldclim == NULL) return NULL;
   npy_intp *dims_clim = PyArray_DIMS(fieldclim);
   int64_t rows = (int64_t) dims_clim[0];
   int64_t cols = (int64_t) dims_clim[1];
-  int64_t months = (int64_t) dims_clim[2];
   double *field_ptr = (double *) PyArray_DATA(fieldclim);
 
-  if (months != 12) {
-    PyErr_SetString(PyExc_ValueError, 
-                     "Climatology must have a final dimension of 12");
-    return NULL;
-  } 
-
   // Attach to the dt array
-  npy_intp *dims_dt = PyArray_DIMS(dt);
-  int64_t len_dt = dims_dt[0];
-  int64_t *dt_ptr = (int64_t *) PyArray_DATA(dt);
-  if (len_dt != 8) {
-    PyErr_SetString(PyExc_ValueError, "Date array must have 8 elements");
-    return NULL;
-  } 
-
-  // Allocate space for return value
-  int64_t len_comp = rows*cols;
-  double *dataout = 
-    (double*)calloc((size_t)(len_comp), sizeof(double));
-  if (dataout == NULL) {
-    PyErr_SetString(PyExc_ValueError, "Unable to allocate memory for sstpert");
+  PyArrayObject *dt = dt_array(dt_in);
+  if (dt == NULL) {
+    Py_DECREF(fieldclim);
     return NULL;
-  } 
+  }
+  int64_t *dt_ptr = (int64_t *) PyArray_DATA(dt);
 
+  dims_out[0] = rows;
+  dims_out[1] = cols;
+
+  // Write straight into the output array if one was given, otherwise
+  // allocate space for return value
+  double *dataout = NULL;
+  if (out != NULL) {
+    if (check_out_array(out, NPY_DOUBLE, 2, dims_out) != 0) {
+      Py_DECREF(fieldclim);
+      Py_DECREF(dt);
+      return NULL;
+    }
+    dataout = (double *) PyArray_DATA((PyArrayObject *) out);
+  } else {
+    int64_t len_comp = rows*cols;
+    dataout = (double*)calloc((size_t)(len_comp), sizeof(double));
+    if (dataout == NULL) {
+      Py_DECREF(fieldclim);
+      Py_DECREF(dt);
+      PyErr_SetString(PyExc_ValueError,
+                      "Unable to allocate memory for sstpert");
+      return NULL;
+    }
+  }
+
+  Py_BEGIN_ALLOW_THREADS
   sstpert(&factor,
           dt_ptr,
           &rows,
           &cols,
           field_ptr,
           dataout);
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(fieldclim);
+  Py_DECREF(dt);
+
+  // If writing into the output array, simply return it
+  if (out != NULL) {
+    Py_INCREF(out);
+    return out;
+  }
 
   // Now form a numpy array object to return to python
-  dims_out[0] = rows;
-  dims_out[1] = cols;
   npy_array_out=(PyArrayObject *) PyArray_SimpleNewFromData(2, dims_out,
                                                             NPY_DOUBLE,
                                                             dataout);
@@ -181,28 +331,113 @@ static PyObject *sstpert_py(PyObject *self, PyObject *args)
   return (PyObject *)npy_array_out;
 }
 
-static PyObject *sstpertseed_py(PyObject *self, PyObject *args)
+static PyObject *sstpert_many_py(PyObject *self, PyObject *args,
+                                 PyObject *kwds)
 {
   // Setup and obtain inputs passed from python
-  PyArrayObject *dt;
+  double factor = 0.0;
+  PyObject *dt_in;
+  PyObject *fieldclim_in;
+  int threads = 1;
+  static char *kwlist[] = {"factor", "dt", "climatology", "threads", NULL};
 
-  if (!PyArg_ParseTuple(args, "O", &dt )) return NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "dOO|i", kwlist,
+                                   &factor, &dt_in, &fieldclim_in, &threads))
+    return NULL;
 
-  // Cast self to void to avoid unused parameter errors
+  // Cast self to void to avoid unused paramter errors
   (void) self;
 
+  // Get dimensions of input fieldclim array
+  PyArrayObject *fieldclim = climatology_array(fieldclim_in);
+  if (fieldclim == NULL) return NULL;
+  npy_intp *dims_clim = PyArray_DIMS(fieldclim);
+  int64_t rows = (int64_t) dims_clim[0];
+  int64_t cols = (int64_t) dims_clim[1];
+  double *field_ptr = (double *) PyArray_DATA(fieldclim);
+
   // Attach to the dt array
-  npy_intp *dims_dt = PyArray_DIMS(dt);
-  int64_t len_dt = dims_dt[0];
+  PyArrayObject *dt = input_array(dt_in, NPY_INT64, 2, "Date array");
+  if (dt == NULL) {
+    Py_DECREF(fieldclim);
+    return NULL;
+  }
+  if (PyArray_DIMS(dt)[1] != 8) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Date array must have shape (N, 8)");
+    Py_DECREF(fieldclim);
+    Py_DECREF(dt);
+    return NULL;
+  }
+  int64_t n_fields = (int64_t) PyArray_DIMS(dt)[0];
   int64_t *dt_ptr = (int64_t *) PyArray_DATA(dt);
-  if (len_dt != 8) {
-    PyErr_SetString(PyExc_ValueError, "Date array must have 8 elements");
+
+  // Every field is written into its own part of a single output array
+  npy_intp dims_out[3];
+  dims_out[0] = (npy_intp) n_fields;
+  dims_out[1] = (npy_intp) rows;
+  dims_out[2] = (npy_intp) cols;
+  PyArrayObject *npy_array_out =
+      (PyArrayObject *) PyArray_ZEROS(3, dims_out, NPY_DOUBLE, 0);
+  if (npy_array_out == NULL) {
+    Py_DECREF(fieldclim);
+    Py_DECREF(dt);
+    PyErr_SetString(PyExc_ValueError,
+                    "Unable to allocate memory for sstpert");
     return NULL;
   }
+  double *dataout = (double *) PyArray_DATA(npy_array_out);
+
+  #ifdef _OPENMP
+  if (threads <= 0) threads = omp_get_max_threads();
+  #endif
+
+  // The climatology is shared (read-only) by all of the fields; the
+  // library is given a copy of each dt row, since it takes a non-const
+  // pointer
+  int64_t i;
+  Py_BEGIN_ALLOW_THREADS
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+  for (i = 0; i < n_fields; i++) {
+    int64_t dt_field[8];
+    int64_t field_rows = rows;
+    int64_t field_cols = cols;
+    double field_factor = factor;
+    memcpy(dt_field, &dt_ptr[8*i], sizeof(dt_field));
+    sstpert(&field_factor,
+            dt_field,
+            &field_rows,
+            &field_cols,
+            field_ptr,
+            &dataout[i*rows*cols]);
+  }
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(fieldclim);
+  Py_DECREF(dt);
+
+  return (PyObject *)npy_array_out;
+}
+
+static PyObject *sstpertseed_py(PyObject *self, PyObject *args)
+{
+  // Setup and obtain inputs passed from python
+  PyObject *dt_in;
+
+  if (!PyArg_ParseTuple(args, "O", &dt_in )) return NULL;
+
+  // Cast self to void to avoid unused parameter errors
+  (void) self;
+
+  // Attach to the dt array
+  PyArrayObject *dt = dt_array(dt_in);
+  if (dt == NULL) return NULL;
+  int64_t *dt_ptr = (int64_t *) PyArray_DATA(dt);
 
   int64_t seed;
 
   sstpertseed(dt_ptr, &seed);
+  Py_DECREF(dt);
 
   PyObject *seedval = NULL;
   seedval = PyInt_FromLong((long) seed);
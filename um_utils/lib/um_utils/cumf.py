@@ -82,11 +82,25 @@ Global comparison settings:
         Maximum number of missing fields to display. Set to -1 to indicate no
         maximum. (default: -1)
 
+    * workers:
+        The number of threads to use to compare the data of the fields; if
+        greater than 1 the pairs of fields are compared in parallel (the
+        results are the same as when comparing them one at a time).
+        (default: 1)
+
+    * identical_only:
+        Flag which indicates that the comparison only needs to find whether
+        the data of each pair of fields is identical; the comparison of each
+        field stops at the first difference, so the statistics describing
+        the differences (and so the full report) are not available.  Use
+        the summary report to obtain a pass/fail summary.  (default: False)
+
 """
 import re
 import sys
 import mule
 import mule.pp
+import mule.packing
 import errno
 import argparse
 import textwrap
@@ -94,6 +108,7 @@ import numpy as np
 import warnings
 from six import StringIO
 from collections import defaultdict
+from concurrent.futures import ThreadPoolExecutor
 from um_utils.stashmaster import STASHmaster
 from um_utils.pumf import pprint, _banner
 from um_utils.version import report_modules
@@ -135,6 +150,8 @@ COMPARISON_SETTINGS = {
     "lookup_print_func": _print_lookup,
     "show_missing": False,
     "show_missing_max": -1,
+    "workers": 1,
+    "identical_only": False,
     }
 
 # Lookup indices which should be ignored when the user indicates
@@ -166,6 +183,48 @@ _INDEX_IGNORED_LOOKUP = [
     40   # lbuser(2) (for same reason as lbegin)
     ]
 
+# Lookup indices which only describe where a field's data is stored, and
+# so may differ between fields whose packed payloads can be compared directly
+_INDEX_POSITIONAL_LOOKUP = [
+    29,  # lbegin
+    40,  # lbuser(2)
+    ]
+
+
+def _payloads_match(field_1, field_2):
+    """
+    Return True if two fields must have the same data because they are read
+    and unpacked in the same way from identical raw payloads.  This allows
+    the fields to be compared without unpacking either of them; note that
+    if this returns False the data may still be the same.
+
+    """
+    provider_1 = field_1._data_provider
+    provider_2 = field_2._data_provider
+    if (type(provider_1) is not type(provider_2) or
+            not hasattr(provider_1, "_read_bytes")):
+        return False
+    if (getattr(provider_1, "unpack_dtype", None) !=
+            getattr(provider_2, "unpack_dtype", None)):
+        return False
+    # Land/sea packed fields are expanded using the land-sea mask from their
+    # file, so identical payloads don't imply identical data
+    if hasattr(provider_1, "_lsm_source"):
+        return False
+
+    # The providers decode the data using the headers they were created
+    # with, so these must also agree (apart from the positional headers)
+    raw_1 = provider_1.source.raw
+    raw_2 = provider_2.source.raw
+    if len(raw_1) != len(raw_2):
+        return False
+    for index in range(1, len(raw_1)):
+        if (index not in _INDEX_POSITIONAL_LOOKUP and
+                raw_1[index] != raw_2[index]):
+            return False
+
+    return provider_1._read_bytes() == provider_2._read_bytes()
+
 
 class DifferenceField(mule.Field):
     """
@@ -185,11 +244,35 @@ class DifferenceField(mule.Field):
     data_shape_match = None
     """Data shape matching flag: True if fields are the same shape."""
 
-    compared = None
-    """
-    Tuple containing the number of points which are different and the total
-    number of points in the field.
-    """
+    _compared = None
+
+    # A field whose size gives the total number of points (if the data was
+    # matched without unpacking it, this is taken from its data provider
+    # when it is needed, so that it agrees with the size of its data)
+    _compared_source = None
+
+    @property
+    def compared(self):
+        """
+        Tuple containing the number of points which are different and the
+        total number of points in the field.
+        """
+        if self._compared is None and self._compared_source is not None:
+            source = self._compared_source
+            points = None
+            provider = source._data_provider
+            if hasattr(provider, "_data_points"):
+                points = provider._data_points()
+            if points is None:
+                # A field whose headers don't give the size of its data has
+                # to be read to find it
+                points = source.get_data().size
+            self._compared = (0, points)
+        return self._compared
+
+    @compared.setter
+    def compared(self, value):
+        self._compared = value
 
     rms_diff = None
     """Root-Mean-Squared difference between the two fields."""
@@ -248,9 +331,17 @@ class DifferenceOperator(mule.DataOperator):
     the data in two fields.
 
     """
-    def __init__(self):
-        """Initialise the object."""
-        pass
+    def __init__(self, identical_only=False):
+        """
+        Initialise the object.
+
+        Kwargs:
+            * identical_only:
+                If True, only find whether the data of the fields is
+                identical (the difference statistics are not calculated).
+
+        """
+        self.identical_only = identical_only
 
     def new_field(self, fields):
         """
@@ -285,6 +376,18 @@ class DifferenceOperator(mule.DataOperator):
         # Copy the STASH entry (if it exists)
         new_field.stash = fields[0].stash
 
+        # If the raw payloads are identical the data must match, so it
+        # doesn't need to be unpacked
+        if _payloads_match(fields[0], fields[1]):
+            new_field.data_match = True
+            new_field.data_shape_match = True
+            new_field.max_diff = 0.0
+            new_field.rms_diff = 0.0
+            new_field.rms_norm_diff_1 = 0.0
+            new_field.rms_norm_diff_2 = 0.0
+            new_field._compared_source = fields[0]
+            return self._difference_headers(new_field)
+
         # Get the data from the fields and check if it matches
         # Note: this is an abnormal use of the operator; usually
         # get_data should not be called in this method, however in
@@ -293,6 +396,9 @@ class DifferenceOperator(mule.DataOperator):
         data1 = fields[0].get_data()
         data2 = fields[1].get_data()
 
+        if self.identical_only:
+            return self._identical_field(new_field, data1, data2)
+
         # A quick helper function which calculates the RMS of the arrays
         def rms(array, mdi_val=None):
             if mdi_val is not None:
@@ -345,6 +451,31 @@ class DifferenceOperator(mule.DataOperator):
             new_field.rms_norm_diff_2 = 0.0
             new_field.compared = (0, data1.size)
 
+        return self._difference_headers(new_field)
+
+    def _identical_field(self, new_field, data1, data2):
+        """
+        Set the matching flags of a new field, stopping the comparison at
+        the first difference.
+
+        """
+        new_field.data_shape_match = data1.shape == data2.shape
+        if not new_field.data_shape_match:
+            new_field.data_match = False
+            return new_field
+
+        if data1.dtype.kind == "f" and data2.dtype.kind == "f":
+            # The comparison kernel doesn't create any temporary arrays
+            n_differ, _, _ = mule.packing.compare_arrays(
+                data1, data2, stop_at_first=True)
+            new_field.data_match = n_differ == 0
+        else:
+            new_field.data_match = np.array_equal(data1, data2)
+
+        return self._difference_headers(new_field)
+
+    def _difference_headers(self, new_field):
+        """Update the headers of a new field to describe a difference."""
         # Add 1 to lbproc - to indicate it is a different between fields
         # (note the default "Field" objects do not know this property)
         if new_field.lbrel in (2, 3):
@@ -663,7 +794,9 @@ class UMFileComparison(object):
 
         # For the fields we will need the difference operator defined above,
         # but it needs to be initialised first
-        difference_op = DifferenceOperator()
+        difference_op = DifferenceOperator(
+            identical_only=comp_settings["identical_only"])
+        workers = comp_settings["workers"]
 
         # Get the (user) list of lookup elements to ignore
         lookup_ignores = (
@@ -709,24 +842,36 @@ class UMFileComparison(object):
                 not comp_settings["ignore_missing"]):
             self.match = False
 
-        # Now iterate through the fields whose lookups appear to match
-        for ifield_1, ifield_2 in index:
+        # Create a field difference object for each pair of fields whose
+        # lookups appear to match, which stores information about the
+        # differences and the means to obtain a difference map.
+        # Note: technically this operator is reading both fields at this
+        # point, since it must do this to determine if the fields are
+        # different - this is intentional and differs from how operators
+        # are commonly used)
+        field_pairs = [[um_file1.fields[ifield_1], um_file2.fields[ifield_2]]
+                       for ifield_1, ifield_2 in index]
+        if workers > 1:
+            # Reading and comparing the data is the most expensive part of
+            # the comparison, and can be done for several pairs of fields
+            # at once (the unpacking and array operations release the GIL;
+            # each uses a single thread for the unpacking)
+            with ThreadPoolExecutor(max_workers=workers) as executor:
+                diff_fields = list(executor.map(
+                    lambda pair: mule.packing.single_threaded(difference_op,
+                                                              pair),
+                    field_pairs))
+        else:
+            diff_fields = map(difference_op, field_pairs)
 
-            field_1 = um_file1.fields[ifield_1]
-            field_2 = um_file2.fields[ifield_2]
+        # Now iterate through the fields
+        for (ifield_1, ifield_2), (field_1, field_2), diff_field in zip(
+                index, field_pairs, diff_fields):
 
             # Compare the lookups themselves with a comparison object
             lookup_comparison = ComponentComparison(field_1, field_2,
                                                     lookup_ignores)
 
-            # Create a field difference object, which stores information about
-            # the differences and the means to obtain a difference map.
-            # Note: technically this operator is reading both fields at this
-            # point, since it must do this to determine if the fields are
-            # different - this is intentional and differs from how operators
-            # are commonly used)
-            diff_field = difference_op([field_1, field_2])
-
             diff_field.file_1_index = ifield_1
             diff_field.file_2_index = ifield_2
             diff_field.lookup_comparison = lookup_comparison
@@ -1325,6 +1470,18 @@ def _main():
         metavar='[=N]',
         help="display missing fields from either file. If given, N is the\n"
         " maximum number of fields to display.\n")
+    parser.add_argument(
+        '--identical', action='store_true',
+        help="only check whether the files are identical, stopping the \n"
+        "comparison of each field at its first difference, and print a \n"
+        "summary report\n ")
+    parser.add_argument(
+        "--workers",
+        type=int,
+        default=1,
+        metavar="N",
+        help="compare the data of up to N pairs of fields at once, using \n"
+        "multiple threads (default: 1)\n ")
     parser.add_argument(
         "--fail-if-differ",
         help="if set, then exit with a return code of 1 if two files differ.\n",
@@ -1368,6 +1525,8 @@ def _main():
 
     # Process the ignore missing flag
     COMPARISON_SETTINGS["ignore_missing"] = args.ignore_missing
+    COMPARISON_SETTINGS["workers"] = args.workers
+    COMPARISON_SETTINGS["identical_only"] = args.identical
     COMPARISON_SETTINGS["show_missing"] = args.show_missing[0]
     if args.show_missing[0]:
         COMPARISON_SETTINGS["show_missing_max"] = args.show_missing[1]
@@ -1409,7 +1568,7 @@ def _main():
     # Now print a report to stdout, if a SIGPIPE is received handle
     # it appropriately
     try:
-        if args.summary:
+        if args.summary or args.identical:
             files_differ = summary_report(comparison)
         else:
             files_differ = full_report(comparison)
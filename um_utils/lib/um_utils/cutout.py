@@ -48,16 +48,27 @@ Usage:
        :mod:`um_utils.trim` module for working with variable resolution
        files.
 
+ * Extract several regions from the same file, using 4 processes (the
+   fields of the file are only decoded once, see :func:`cutout_files`)
+
+    >>> cutout.cutout_files(path, [(5, 10, 20, 30, "region_1.ff"),
+    ...                            (50, 60, 15, 15, "region_2.ff")],
+    ...                     processes=4)
+
 """
 import os
 import re
 import sys
 import mule
 import mule.pp
+import mule.cache
+import mule.packing
 import argparse
 import textwrap
 import warnings
 import numpy as np
+from six import StringIO
+from concurrent.futures import ProcessPoolExecutor
 from um_utils.stashmaster import STASHmaster
 from um_utils.version import report_modules
 from um_utils.pumf import _banner
@@ -128,8 +139,10 @@ class CutoutDataOperator(mule.DataOperator):
 
     def transform(self, source_field, result_field):
         """Extract the sub-region data from the original field data."""
-        # Get the existing data
-        data = source_field.get_data()
+        # Get the existing data; only the rows of the sub-region are needed
+        # (which for some fields means only these rows are decoded)
+        data = source_field.get_data(
+            rows=slice(self.zy - 1, self.zy - 1 + self.ny))
 
         # Create a new data array with the desired output sizes
         cut_data = np.empty((self.ny, self.nx))
@@ -142,18 +155,15 @@ class CutoutDataOperator(mule.DataOperator):
             # The left-most part of the target array is filled using
             # values from right-most part of the source array
             cut_data[:, :source_field.lbnpt - self.zx + 1] = (
-                data[self.zy-1:self.zy - 1 + self.ny,
-                     self.zx - 1:])
+                data[:, self.zx - 1:])
             # And the remainder of the target array is filled using
             # values from the left-most part of the source array
             cut_data[:, source_field.lbnpt - self.zx + 1:] = (
-                data[self.zy-1:self.zy-1+self.ny,
-                     :self.nx + self.zx - source_field.lbnpt - 1])
+                data[:, :self.nx + self.zx - source_field.lbnpt - 1])
         else:
             # If the domain is contained entirely within the domain
             # it can be extracted directly
-            cut_data[:, :] = data[self.zy-1:self.zy-1+self.ny,
-                                  self.zx-1:self.zx-1+self.nx]
+            cut_data[:, :] = data[:, self.zx-1:self.zx-1+self.nx]
         return cut_data
 
 
@@ -275,7 +285,7 @@ class CoordRotator(object):
 
 
 def cutout_coords(ff_src, sw_lon, sw_lat, ne_lon, ne_lat,
-                  native_grid=False, stdout=None):
+                  native_grid=False, stdout=None, stream=False):
     """
     Cutout a sub-region from a :class:`mule.FieldsFile` object, based on
     the lat-lon co-ordinates of the region.
@@ -300,6 +310,9 @@ def cutout_coords(ff_src, sw_lon, sw_lat, ne_lon, ne_lat,
         * stdout:
             The open file-like object to write informational output to,
             default is to use sys.stdout.
+        * stream:
+            If set to True, the cutout fields are created one at a time as
+            they are needed (see :func:`cutout`).
 
     .. Warning::
         The input :class:`mule.FieldsFile` must be on a fixed
@@ -425,10 +438,20 @@ def cutout_coords(ff_src, sw_lon, sw_lat, ne_lon, ne_lat,
 
     stdout.write("\n")
 
-    return cutout(ff_src, x_start, y_start, x_points, y_points, stdout)
+    return cutout(ff_src, x_start, y_start, x_points, y_points, stdout,
+                  stream=stream)
+
+
+def _check_regular_grid(dx, dy, fail_context, mdi=0.0):
+    # Raise error if dx or dy values indicate an 'irregular' grid.
+    invalid_values = [0.0, mdi]
+    if dx in invalid_values or dy in invalid_values:
+        msg = "Source grid in {0} is not regular."
+        raise ValueError(msg.format(fail_context))
 
 
-def cutout(ff_src, x_start, y_start, x_points, y_points, stdout=None):
+def cutout(ff_src, x_start, y_start, x_points, y_points, stdout=None,
+           fields=None, stream=False):
     """
     Cutout a sub-region from a :class:`mule.FieldsFile` object, based on
     a set of indices describing the region's location in the original file.
@@ -449,6 +472,17 @@ def cutout(ff_src, x_start, y_start, x_points, y_points, stdout=None):
         * stdout:
             The open file-like object to write informational output to,
             default is to use sys.stdout.
+        * fields:
+            An iterable of the source fields to cutout, if these should be
+            taken from somewhere other than the field list of ff_src.
+        * stream:
+            If set to True, the returned object has an empty field list
+            and is returned along with a generator of the cutout fields;
+            these are then only created as they are needed (e.g. by
+            :func:`mule.stream_to_file`), so that they needn't all be
+            held in memory at once.  The headers of the fields are
+            still all checked before returning, so that a field which
+            can't be cutout doesn't leave a partly written output.
 
     .. Warning::
         The input :class:`mule.FieldsFile` must be on a fixed
@@ -460,13 +494,6 @@ def cutout(ff_src, x_start, y_start, x_points, y_points, stdout=None):
     if stdout is None:
         stdout = sys.stdout
 
-    def check_regular_grid(dx, dy, fail_context, mdi=0.0):
-        # Raise error if dx or dy values indicate an 'irregular' grid.
-        invalid_values = [0.0, mdi]
-        if dx in invalid_values or dy in invalid_values:
-            msg = "Source grid in {0} is not regular."
-            raise ValueError(msg.format(fail_context))
-
     # Determine the grid staggering
     if ff_src.fixed_length_header.grid_staggering not in GRID_STAGGER:
         msg = "Grid staggering {0} not supported"
@@ -499,7 +526,7 @@ def cutout(ff_src, x_start, y_start, x_points, y_points, stdout=None):
     # Grid-spacing in degrees, ensure this is a regular grid
     dx = ff_src.real_constants.col_spacing
     dy = ff_src.real_constants.row_spacing
-    check_regular_grid(dx, dy, fail_context='header', mdi=rmdi)
+    _check_regular_grid(dx, dy, fail_context='header', mdi=rmdi)
 
     # Want to extract the co-ords of the first P point in the file
     if (stagger == "new_dynamics" or (stagger == "endgame" and
@@ -559,8 +586,71 @@ def cutout(ff_src, x_start, y_start, x_points, y_points, stdout=None):
 
     stdout.write("Performing cutout...\n")
 
-    # Ready to begin processing of each field
-    for i_field, field_src in enumerate(ff_src.fields):
+    # When streaming, the headers of all of the fields are checked first so
+    # that a field which can't be cutout is reported before any output has
+    # been written (this doesn't need any of their data)
+    if stream:
+        if fields is None:
+            _check_fields(mule.iter_fields(ff_src))
+        else:
+            fields = list(fields)
+            _check_fields(fields)
+
+    # Ready to begin processing of each field; the fields are created as
+    # they are requested, so that they needn't all be held at once
+    if fields is None:
+        fields = mule.iter_fields(ff_src)
+    cutout_fields = _cutout_fields(fields, x_start, y_start,
+                                   x_points, y_points, stagger)
+
+    if stream:
+        return ff_dest, cutout_fields
+
+    ff_dest.fields = list(cutout_fields)
+    return ff_dest
+
+
+def _check_field(i_field, field_src):
+    """
+    Check that a field's headers describe a grid which cutout can work with,
+    raising a ValueError if not.
+
+    """
+    # Ensure this field is on a regular grid
+    _check_regular_grid(field_src.bdx, field_src.bdy,
+                        fail_context='Field {0}'.format(i_field),
+                        mdi=field_src.bmdi)
+
+    # In case the field has extra data, abort
+    if field_src.lbext != 0:
+        msg = ('Field {0} has extra data, which cutout '
+               'does not support')
+        raise ValueError(msg.format(i_field))
+
+    # If the grid is not a regular lat-lon grid, abort
+    if field_src.lbcode % 10 != 1:
+        msg = ('Field {0} is not on a regular lat/lon grid')
+        raise ValueError(msg.format(i_field))
+
+
+def _check_fields(fields):
+    """
+    Check the headers of all of the given fields (see :func:`_check_field`),
+    other than those which :func:`_cutout_fields` will skip.
+
+    """
+    for i_field, field_src in enumerate(fields):
+        if field_src.lbrel in (2, 3):
+            _check_field(i_field, field_src)
+
+
+def _cutout_fields(fields, x_start, y_start, x_points, y_points, stagger):
+    """
+    Generate the cutout version of each of the given fields (see
+    :func:`cutout`), skipping any which can't be cutout.
+
+    """
+    for i_field, field_src in enumerate(fields):
 
         # Discard any fields which aren't from a valid release header, since
         # we need to be able to assume certain attributes are present later
@@ -570,21 +660,8 @@ def cutout(ff_src, x_start, y_start, x_points, y_points, stdout=None):
             warnings.warn(msg.format(i_field, field_src.lbrel))
             continue
 
-        # Ensure this field is on a regular grid
-        check_regular_grid(field_src.bdx, field_src.bdy,
-                           fail_context='Field {0}'.format(i_field),
-                           mdi=field_src.bmdi)
-
-        # In case the field has extra data, abort
-        if field_src.lbext != 0:
-            msg = ('Field {0} has extra data, which cutout '
-                   'does not support')
-            raise ValueError(msg.format(i_field))
-
-        # If the grid is not a regular lat-lon grid, abort
-        if field_src.lbcode % 10 != 1:
-            msg = ('Field {0} is not on a regular lat/lon grid')
-            raise ValueError(msg.format(i_field))
+        # Abort for fields on grids which cutout can't work with
+        _check_field(i_field, field_src)
 
         # Retrieve the grid-type for this field from the STASHmaster and
         # use it to adjust the indices to extract for the non-P grids
@@ -638,9 +715,102 @@ def cutout(ff_src, x_start, y_start, x_points, y_points, stdout=None):
         cutout_operator = CutoutDataOperator(x_start, y_start, cut_x, cut_y)
         field = cutout_operator(field_src)
 
-        ff_dest.fields.append(field)
+        yield field
 
-    return ff_dest
+
+def cutout_files(input_file, regions, stashmaster=None, processes=None,
+                 workers=None, stdout=None):
+    """
+    Cutout several sub-regions from the same file, writing each of them to
+    a new file.
+
+    The fields of the input file are decoded only once, into a
+    :class:`mule.cache.SharedFieldPool`, and each cutout then extracts its
+    region from views of the decoded data; this is much faster than
+    calling :func:`cutout` for each region when there are many of them.
+
+    Args:
+        * input_file:
+            The path to the input file.
+        * regions:
+            An iterable of tuples (x_start, y_start, x_points, y_points,
+            output_file), giving the indices of each sub-region (as for
+            :func:`cutout`) and the path to write it to.
+
+    Kwargs:
+        * stashmaster:
+            A :class:`mule.stashmaster.STASHmaster` to use in place of
+            the one given by the version in the input file.
+        * processes:
+            The number of processes to perform the cutouts in; if not set
+            they are performed one at a time in this process.
+        * workers:
+            The number of threads used to decode the input fields.
+        * stdout:
+            The open file-like object to write informational output to,
+            default is to use sys.stdout.
+
+    """
+    _run_pooled(input_file, _cutout_job, regions, stashmaster=stashmaster,
+                processes=processes, workers=workers, stdout=stdout)
+
+
+def _cutout_job(input_file, stashmaster, x_start, y_start, x_points,
+                y_points, output_file):
+    # Perform one of the cutouts of :func:`cutout_files`, returning its
+    # informational output
+    stdout = StringIO()
+    ff = mule.load_umfile(input_file, stashmaster=stashmaster, lazy=True)
+    ff_out, fields = cutout(ff, x_start, y_start, x_points, y_points,
+                            stdout, stream=True)
+    mule.stream_to_file(fields, ff_out, output_file)
+    return stdout.getvalue()
+
+
+def _attach_pool(handle):
+    # Initialise a process running pooled jobs; the shared pool becomes the
+    # default cache, so that the input fields take their data from it (and
+    # each process uses a single thread for any packing, since the jobs
+    # already run in parallel)
+    mule.cache.set_default_cache(mule.cache.SharedFieldPool.attach(handle))
+    mule.packing.set_threads(1)
+
+
+def _run_pooled(input_file, job, job_args, stashmaster=None, processes=None,
+                workers=None, stdout=None):
+    """
+    Decode the fields of a file into a shared pool, then run a job for
+    each of a list of arguments using the pooled data, writing the output
+    of each job (in order) to stdout.
+
+    The job is called with the path to the input file, the STASHmaster and
+    then each of its arguments, and returns its informational output.
+
+    """
+    if stdout is None:
+        stdout = sys.stdout
+
+    umf = mule.load_umfile(input_file, stashmaster=stashmaster, lazy=True)
+    fields = mule.iter_fields(umf)
+    with mule.cache.SharedFieldPool.from_fields(fields,
+                                                workers=workers) as pool:
+        if processes is None or processes <= 1:
+            previous_cache = mule.cache.get_default_cache()
+            mule.cache.set_default_cache(pool)
+            try:
+                for args in job_args:
+                    stdout.write(job(input_file, stashmaster, *args))
+            finally:
+                mule.cache.set_default_cache(previous_cache)
+        else:
+            with ProcessPoolExecutor(max_workers=processes,
+                                     initializer=_attach_pool,
+                                     initargs=(pool.handle,)) as executor:
+                results = [executor.submit(job, input_file, stashmaster,
+                                           *args)
+                           for args in job_args]
+                for result in results:
+                    stdout.write(result.result())
 
 
 def _main():
@@ -794,8 +964,9 @@ def _main():
             raise ValueError(msg.format(filename))
 
         # Load the file using Mule - filter it according to the file types
-        # which cutout can handle
-        ff = mule.load_umfile(filename, stashmaster=stashm)
+        # which cutout can handle (the fields are only created as they are
+        # processed, so that large files needn't be held in memory at once)
+        ff = mule.load_umfile(filename, stashmaster=stashm, lazy=True)
         if ff.fixed_length_header.dataset_type not in (1, 2, 3, 4):
             msg = (
                 "Invalid dataset type ({0}) for file: {1}\nCutout is only "
@@ -805,16 +976,17 @@ def _main():
 
         # Perform the cutout
         if hasattr(args, "zx"):
-            ff_out = cutout(ff, args.zx, args.zy, args.nx, args.ny)
+            ff_out, fields = cutout(ff, args.zx, args.zy, args.nx, args.ny,
+                                    stream=True)
 
         else:
-            ff_out = cutout_coords(ff,
-                                   args.SW_lon, args.SW_lat,
-                                   args.NE_lon, args.NE_lat,
-                                   args.native_grid)
+            ff_out, fields = cutout_coords(ff,
+                                           args.SW_lon, args.SW_lat,
+                                           args.NE_lon, args.NE_lat,
+                                           args.native_grid, stream=True)
 
         # Write the result out to the new file
-        ff_out.to_file(args.output_file)
+        mule.stream_to_file(fields, ff_out, args.output_file)
 
     else:
         msg = "File not found: {0}".format(filename)
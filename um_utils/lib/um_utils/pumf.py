@@ -424,12 +424,17 @@ def _print_um_file(umf, stdout=sys.stdout, print_settings=PRINT_SETTINGS):
     # Moving onto the fields
     if "lookup" in component_filter:
 
+        # Only visit the fields in the index filtering (if given), so that
+        # fields which aren't required needn't be created
         total_fields = len(umf.fields)
-        for ifield, field in enumerate(umf.fields):
+        if field_index != []:
+            field_indices = sorted(set(
+                [ind - 1 for ind in field_index if 0 < ind <= total_fields]))
+        else:
+            field_indices = range(total_fields)
 
-            # Skip the field if it isn't in the index filtering
-            if field_index != [] and ifield + 1 not in field_index:
-                continue
+        for ifield in field_indices:
+            field = umf.fields[ifield]
 
             if field.lbrel != -99:
                 # Skip the field if it doesn't match the property filtering
@@ -690,7 +695,8 @@ def _main():
             # available in a pp file
             PRINT_SETTINGS["component_filter"] = ["lookup"]
         else:
-            um_file = mule.load_umfile(filename, stashmaster=stashm)
+            um_file = mule.load_umfile(filename, stashmaster=stashm,
+                                       lazy=True)
         # Now print the object to stdout, if a SIGPIPE is received handle
         # it appropriately
         try:
@@ -76,30 +76,24 @@ def select(umf, include=None, exclude=None):
             Mule, values are lists of the values to exclude.
 
     """
-    fields_out = [f for f in umf.fields]
+    # The matching is done on the lookup headers as a whole (this avoids
+    # creating the field objects at all if the file's lookup is being read
+    # lazily); process includes first... the field has to meet all of the
+    # criteria not to be removed
     if include is not None:
-        for field in list(fields_out):
-            # Process includes first... the field has to meet all of the
-            # criteria not to be removed, so as soon as it fails one criteria
-            # remove it
-            for header, vals in include.items():
-                if getattr(field, header, None) not in vals:
-                    fields_out.remove(field)
-                    break
-
-    if exclude is not None:
-        for field in list(fields_out):
-            # After processing includes, process excludes on the result,
-            # since the two are to be "and"ed together anyway.  This time
-            # however a field must fail to satisfy all of the conditions
-            check = []
-            for header, vals in exclude.items():
-                if getattr(field, header, None) in vals:
-                    check.append(True)
-            if len(check) > 0 and all(check):
-                fields_out.remove(field)
-
-    return fields_out
+        indices = umf.field_indices(**include)
+    else:
+        indices = range(len(umf.fields))
+
+    if exclude:
+        # After processing includes, process excludes on the result,
+        # since the two are to be "and"ed together anyway
+        excluded = set()
+        for header, vals in exclude.items():
+            excluded.update(umf.field_indices(**{header: vals}))
+        indices = [index for index in indices if index not in excluded]
+
+    return [umf.fields[index] for index in indices]
 
 
 def _main():
@@ -258,7 +252,7 @@ def _main():
             umf.fields = mule.pp.fields_from_pp_file(input_file)
             umf._source_path = input_file
         elif not pp_mode:
-            umf = mule.load_umfile(input_file)
+            umf = mule.load_umfile(input_file, lazy=True)
         else:
             msg = "Cannot mix and match UM files and pp files"
             raise ValueError(msg)
@@ -142,6 +142,12 @@ def field_summary(umf, stdout=None, **kwargs):
     fields = umf.fields
     if field_index != []:
         fields = [fields[ind] for ind in field_index]
+    elif field_property != {}:
+        # Without an index filter the property filter can be applied to
+        # the lookup as a whole (so that only the matching fields need to
+        # be created if the lookup is being read lazily)
+        fields = [fields[ind]
+                  for ind in umf.field_indices(**field_property)]
 
     # And filter by property
     if field_property != {}:
@@ -447,7 +453,8 @@ def _main():
             # available in a pp file
             PRINT_SETTINGS["component_filter"] = ["lookup"]
         else:
-            um_file = mule.load_umfile(filename, stashmaster=stashm)
+            um_file = mule.load_umfile(filename, stashmaster=stashm,
+                                       lazy=True)
 
         # Now print the object to stdout, if a SIGPIPE is received handle
         # it appropriately
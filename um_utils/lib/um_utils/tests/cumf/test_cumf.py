@@ -29,6 +29,7 @@ import mule
 
 from six import StringIO
 from um_utils import cumf
+from mule.tests import COMMON_N48_TESTDATA_PATH, testdata_filepath
 
 
 # Manually change this flag to "True" if you are trying to add a new test -
@@ -306,5 +307,80 @@ class TestCumf(tests.UMUtilsNDTest):
         self.run_comparison(ff1, ff2, "difference_full_with_nans",
                             expected_difference=True)
 
+    def test_workers(self):
+        # Test the report is the same when comparing in parallel
+        ff1, ff2 = self.create_2_different_files()
+        self.run_comparison(ff1, ff2, "default", expected_difference=True,
+                            workers=3)
+
+    def test_identical_only(self):
+        # Test only checking for identical data finds the same differences
+        ff1, ff2 = self.create_2_different_files()
+        comp = cumf.UMFileComparison(ff1, ff2)
+        ff1, ff2 = self.create_2_different_files()
+        comp_identical = cumf.UMFileComparison(ff1, ff2, identical_only=True)
+        self.assertEqual(comp.match, comp_identical.match)
+        self.assertEqual(
+            [field.data_match for field in comp.field_comparisons],
+            [field.data_match for field in comp_identical.field_comparisons])
+        for field in comp_identical.field_comparisons:
+            if not field.data_match:
+                self.assertIsNone(field.rms_diff)
+
+        # The summary report should still be available
+        files_differ = cumf.summary_report(comp_identical, stdout=StringIO())
+        self.assertTrue(files_differ)
+
+
+def _unreadable(*args, **kwargs):
+    # Replaces the method which decodes the data of fields whose data
+    # must not be read
+    raise AssertionError("Field data should not have been read")
+
+
+class TestCumfPayloads(tests.UMUtilsNDTest):
+
+    def _check_unread(self, path):
+        # The number of points compared in fields matched by their payloads
+        # should be found without unpacking them
+        ff1 = mule.load_umfile(path)
+        ff2 = mule.load_umfile(path)
+        comp = cumf.UMFileComparison(ff1, ff2)
+        expected = [(0, field.get_data().size) for field in ff1.fields]
+        for field in ff1.fields:
+            field._data_provider._data_array = _unreadable
+        self.assertEqual([diff_field.compared
+                          for diff_field in comp.field_comparisons],
+                         expected)
+
+    def test_identical_files_unread(self):
+        self._check_unread(COMMON_N48_TESTDATA_PATH)
+
+    def test_identical_lbc_files_unread(self):
+        # The data of LBC fields isn't the size given by lbrow and lbnpt
+        self._check_unread(testdata_filepath("eg_boundary_sample.lbc"))
+
+    def test_identical_files(self):
+        # Fields read from identical files should be matched by comparing
+        # their packed payloads, without unpacking them
+        ff1 = mule.load_umfile(COMMON_N48_TESTDATA_PATH)
+        ff2 = mule.load_umfile(COMMON_N48_TESTDATA_PATH)
+        comp = cumf.UMFileComparison(ff1, ff2)
+        self.assertTrue(comp.match)
+        for diff_field, field in zip(comp.field_comparisons, ff1.fields):
+            self.assertTrue(diff_field.data_match)
+            self.assertIsNotNone(diff_field._compared_source)
+            self.assertEqual(diff_field.compared,
+                             (0, field.get_data().size))
+
+        # And the parallel comparison should give the same report
+        comp_workers = cumf.UMFileComparison(ff1, ff2, workers=2)
+        reports = []
+        for comparison in (comp, comp_workers):
+            strbuffer = StringIO()
+            cumf.full_report(comparison, stdout=strbuffer)
+            reports.append(strbuffer.getvalue())
+        self.assertEqual(reports[0], reports[1])
+
 if __name__ == "__main__":
     tests.main()
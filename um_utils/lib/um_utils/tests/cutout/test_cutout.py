@@ -69,6 +69,30 @@ class _TestCutoutBase(object):
         self.assertEqual(field.bzx, VALID_HEADS[2])
         self.assertEqual(field.bzy, VALID_HEADS[3])
 
+    def test_stream_unsupported_field(self):
+        # A field which can't be cutout should be reported when the cutout
+        # is requested, rather than part way through writing its output
+        ff = self._minimal_valid_ff(self.DOMAIN_XY_DIMS[0],
+                                    self.DOMAIN_XY_DIMS[1],
+                                    self.N_LEVELS,
+                                    self.DOMAIN_XY_START[0],
+                                    self.DOMAIN_XY_START[1],
+                                    self.DOMAIN_XY_SPACING[0],
+                                    self.DOMAIN_XY_SPACING[1], self.STAGGERING)
+        ff.real_constants.north_pole_lon = self.DOMAIN_XY_POLE[0]
+        ff.real_constants.north_pole_lat = self.DOMAIN_XY_POLE[1]
+        ff.fixed_length_header.horiz_grid_type = 0
+        self.new_p_field(ff)
+        self.new_p_field(ff)
+        ff.fields[1].lbext = 10
+        ff.attach_stashmaster_info(
+            STASHmaster.from_file(tests.SAMPLE_STASHMASTER))
+
+        cutout_method = getattr(cutout, self.CUTOUT_METHOD)
+        with self.assertRaisesRegex(ValueError, "Field 1 has extra data"):
+            cutout_method(ff, *self.CUTOUT_PARAMS, stdout=StringIO(),
+                          stream=True)
+
     def test_p_field(self):
         self.run_test(
             self.P_VALID_DATA, self.P_VALID_HEADS, self.new_p_field)
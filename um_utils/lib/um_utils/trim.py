@@ -35,6 +35,12 @@ Usage:
        field object's data provider will be setup to return the data
        for the target region.
 
+ * Extract several regions, decoding the fields of the file only once
+   (see :func:`trim_files`)
+
+    >>> trim.trim_files(path, [(1, 2, "west.ff"), (3, 2, "east.ff")],
+    ...                 processes=2)
+
 """
 import os
 import re
@@ -45,7 +51,8 @@ import argparse
 import textwrap
 import numpy as np
 from um_utils.stashmaster import STASHmaster
-from um_utils.cutout import cutout
+from six import StringIO
+from um_utils.cutout import cutout, _run_pooled
 from um_utils.version import report_modules
 from um_utils.pumf import _banner
 
@@ -115,7 +122,8 @@ def _get_fixed_indices(array, tolerance=1.0e-9):
     return region_indices
 
 
-def trim_fixed_region(ff_src, region_x, region_y, stdout=None):
+def trim_fixed_region(ff_src, region_x, region_y, stdout=None,
+                      stream=False):
     """
     Extract a fixed resolution sub-region from a variable resolution
     :class:`mule.FieldsFile` object.
@@ -132,6 +140,9 @@ def trim_fixed_region(ff_src, region_x, region_y, stdout=None):
         * stdout:
             The open file-like object to write informational output to,
             default is to use sys.stdout.
+        * stream:
+            If set to True, the trimmed fields are created one at a time
+            as they are needed (see :func:`um_utils.cutout.cutout`).
 
     .. Warning::
 
@@ -152,8 +163,9 @@ def trim_fixed_region(ff_src, region_x, region_y, stdout=None):
     # We are going to use CUTOUT to do the final cutout operation, but
     # in order to have it extract the correct points we must first create
     # a modified version of the original input object.  To avoid making
-    # any changes to the user's input object, take a copy of it here
-    ff = ff_src.copy(include_fields=True)
+    # any changes to the user's input object, take a copy of it here (the
+    # fields are copied as they are passed on to cutout, below)
+    ff = ff_src.copy()
 
     # We need the arrays giving the latitudes and longitudes of the P grid
     # (note the phi_p array has an extra missing point at the end)
@@ -263,10 +275,27 @@ def trim_fixed_region(ff_src, region_x, region_y, stdout=None):
     ff.row_dependent_constants = None
     ff.column_dependent_constants = None
 
-    # Now we must repeat these steps for each of the field objects
-    for field in ff.fields:
+    # Should now be able to hand things off to cutout - note that since
+    # normally cutout expects the start indices to be 1-based we have to adjust
+    # the inputs slightly here to end up with the correct output
+    fields = _trim_fields(mule.iter_fields(ff_src), stagger,
+                          new_dx, new_dy, new_zx, new_zy)
+    return cutout(ff, x_start + 1, y_start + 1, x_size, y_size, stdout,
+                  fields=fields, stream=stream)
+
+
+def _trim_fields(fields, stagger, new_dx, new_dy, new_zx, new_zy):
+    """
+    Generate a copy of each of the given fields with the grid headers set
+    to describe the fixed resolution grid (see :func:`trim_fixed_region`).
+
+    """
+    # Now we must repeat the steps for the file header for each field
+    for field in fields:
+        field = field.copy()
         # Skip fields which won't have the required headers
         if field.lbrel not in (2, 3):
+            yield field
             continue
 
         # The grid spacing is just the same as in the file header
@@ -278,6 +307,7 @@ def trim_fixed_region(ff_src, region_x, region_y, stdout=None):
             grid_type = field.stash.grid
         else:
             # Skip this field (it won't be output by cutout in the end anyway)
+            yield field
             continue
 
         if grid_type == 19:  # V Points
@@ -309,12 +339,53 @@ def trim_fixed_region(ff_src, region_x, region_y, stdout=None):
                 field.bzx = new_zx - 0.5 * new_dx
                 field.bzy = new_zy - 0.5 * new_dy
 
-    # Should now be able to hand things off to cutout - note that since
-    # normally cutout expects the start indices to be 1-based we have to adjust
-    # the inputs slightly here to end up with the correct output
-    ff_out = cutout(ff, x_start + 1, y_start + 1, x_size, y_size, stdout)
+        yield field
+
+
+def trim_files(input_file, regions, stashmaster=None, processes=None,
+               workers=None, stdout=None):
+    """
+    Extract several fixed resolution sub-regions from the same variable
+    resolution file, writing each of them to a new file.
+
+    As for :func:`um_utils.cutout.cutout_files`, the fields of the input
+    file are decoded only once, into a shared pool.
+
+    Args:
+        * input_file:
+            The path to the input file.
+        * regions:
+            An iterable of tuples (region_x, region_y, output_file),
+            giving the indices of each sub-region (as for
+            :func:`trim_fixed_region`) and the path to write it to.
+
+    Kwargs:
+        * stashmaster:
+            A :class:`mule.stashmaster.STASHmaster` to use in place of
+            the one given by the version in the input file.
+        * processes:
+            The number of processes to perform the trims in; if not set
+            they are performed one at a time in this process.
+        * workers:
+            The number of threads used to decode the input fields.
+        * stdout:
+            The open file-like object to write informational output to,
+            default is to use sys.stdout.
+
+    """
+    _run_pooled(input_file, _trim_job, regions, stashmaster=stashmaster,
+                processes=processes, workers=workers, stdout=stdout)
+
 
-    return ff_out
+def _trim_job(input_file, stashmaster, region_x, region_y, output_file):
+    # Perform one of the trims of :func:`trim_files`, returning its
+    # informational output
+    stdout = StringIO()
+    ff = mule.load_umfile(input_file, stashmaster=stashmaster, lazy=True)
+    ff_out, fields = trim_fixed_region(ff, region_x, region_y, stdout,
+                                       stream=True)
+    mule.stream_to_file(fields, ff_out, output_file)
+    return stdout.getvalue()
 
 
 def _main():
@@ -398,7 +469,7 @@ def _main():
 
         # Load the file using Mule - filter it according to the file types
         # which cutout can handle
-        ff = mule.load_umfile(filename, stashmaster=stashm)
+        ff = mule.load_umfile(filename, stashmaster=stashm, lazy=True)
         if ff.fixed_length_header.dataset_type not in (1, 2, 3, 4):
             msg = (
                 "Invalid dataset type ({0}) for file: {1}\nTrim is only "
@@ -407,10 +478,11 @@ def _main():
             raise ValueError(msg)
 
         # Perform the trim operation
-        ff_out = trim_fixed_region(ff, args.region_x, args.region_y)
+        ff_out, fields = trim_fixed_region(ff, args.region_x, args.region_y,
+                                           stream=True)
 
         # Write the result out to the new file
-        ff_out.to_file(args.output_file)
+        mule.stream_to_file(fields, ff_out, args.output_file)
 
     else:
         msg = "File not found: {0}".format(filename)
@@ -18,6 +18,166 @@
 # You should have received a copy of the Modified BSD License
 # along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
 
+"""
+This module provides the WAFC CB diagnostics, from the UM WAFCCB library.
+
+As well as :func:`wafccb` (which works on the full 3d cubes of data) the
+diagnostics can be computed band by band, with :func:`wafccb_bands`; only
+one band of rows of the 3d data needs to be held at once.  The bands can
+be read from a set of fields (e.g. from a :class:`mule.UMFile`) with
+:func:`field_bands`:
+
+    >>> bands = field_bands(cpnrt_field, blkcld_fields, concld_fields,
+                            ptheta_fields, band_rows=64)
+    >>> p_cbb, p_cbt, cbhore = wafccb_bands(
+                                   bands, cpnrt_field.lbrow, cpnrt_field.lbnpt,
+                                   rmdi, icao_out)
+
+"""
+import numpy as np
+
 from .um_wafccb import wafccb
 
 __version__ = "2025.10.1"
+
+
+def _default_threads():
+    """
+    Return the number of threads set for Mule's packing (so that one setting
+    controls all of the UM library extensions), or 0 (meaning the OpenMP
+    default) if Mule isn't available.
+
+    """
+    try:
+        from mule import packing
+    except ImportError:
+        return 0
+    return packing.get_threads()
+
+
+def wafccb_bands(bands, rows, cols, rmdi, icao_out, out=None,
+                 threads=None):
+    """
+    Compute the WAFC CB diagnostics band by band.  Each band of rows is
+    passed to :func:`wafccb` (in its level-major layout) and the results
+    are written straight into the corresponding rows of the outputs, so
+    the full 3d cubes are never needed.
+
+    Args:
+        * bands:
+            An iterable yielding a tuple (row_start, cpnrt, blkcld, concld,
+            ptheta) for each band of rows; cpnrt has dimensions (band rows,
+            columns) and the others (levels, band rows, columns).  Between
+            them the bands should cover all of the rows.
+        * rows:
+            The number of rows in the (full) domain.
+        * cols:
+            The number of columns in the domain.
+        * rmdi:
+            Missing Data Indicator.
+        * icao_out:
+            Return ICAO heights instead of pressures if True.
+
+    Kwargs:
+        * out:
+            If given, a tuple of 3 C-contiguous, writeable, float64 arrays
+            of dimensions (rows, columns) to write the outputs into.
+        * threads:
+            Number of threads to use for each band; if not given, the
+            number set for Mule's packing is used (see
+            :func:`mule.packing.get_threads`), or without Mule the OpenMP
+            default.
+
+    Returns:
+        A tuple of 3 arrays (p_cbb, p_cbt, cbhore) of dimensions (rows,
+        columns); this is the out tuple, if it was given.
+
+    """
+    if threads is None:
+        threads = _default_threads()
+    if out is None:
+        out = tuple(np.zeros((rows, cols)) for _ in range(3))
+    elif len(out) != 3:
+        msg = "Output must be a tuple of 3 arrays; got {0}"
+        raise ValueError(msg.format(len(out)))
+
+    for row_start, cpnrt, blkcld, concld, ptheta in bands:
+        row_end = row_start + np.shape(cpnrt)[0]
+        if row_start < 0 or row_end > rows:
+            msg = "Band of rows {0}-{1} is outside the domain ({2} rows)"
+            raise ValueError(msg.format(row_start, row_end, rows))
+        # Rows of a C-contiguous array are themselves contiguous, so the
+        # band's outputs can be written directly into the full outputs
+        wafccb(cpnrt, blkcld, concld, ptheta, rmdi, icao_out,
+               out=tuple(array[row_start:row_end] for array in out),
+               level_major=True, threads=threads)
+
+    return out
+
+
+def field_bands(cpnrt, blkcld, concld, ptheta, band_rows=64):
+    """
+    Generate the bands of rows needed by :func:`wafccb_bands` from a set of
+    fields.
+
+    Only the band's rows of each field are requested (see
+    :meth:`mule.Field.get_data`), so where the fields can read a range of
+    rows directly (unpacked, Cray32 and WGDOS packed fields read from a
+    file) just one band of the 3d data is held at once, and the rest of each
+    field isn't decoded.  Other fields are decoded once, in full.
+
+    Args:
+        * cpnrt:
+            The Convective Precipitation Rate field.
+        * blkcld:
+            List of the Bulk Cloud Fraction fields, in level order.
+        * concld:
+            List of the Convective Cloud Amount fields, in level order.
+        * ptheta:
+            List of the Theta Level Pressure fields, in level order.
+
+    Kwargs:
+        * band_rows:
+            The number of rows in each band.
+
+    Returns:
+        A generator yielding a tuple (row_start, cpnrt, blkcld, concld,
+        ptheta) for each band.
+
+    """
+    if not len(blkcld) == len(concld) == len(ptheta):
+        msg = ("Must have the same number of blkcld, concld and ptheta "
+               "fields; got {0}, {1} and {2}")
+        raise ValueError(msg.format(len(blkcld), len(concld), len(ptheta)))
+    if band_rows < 1:
+        msg = "Number of rows in each band must be positive; got {0}"
+        raise ValueError(msg.format(band_rows))
+
+    def band_source(field):
+        # Return a function giving a band of rows of the field; a field
+        # which can't read just those rows is decoded once (rather than for
+        # every band)
+        if hasattr(field._data_provider, "_data_rows"):
+            return lambda band_slice: field.get_data(rows=band_slice)
+        data = field.get_data()
+        if data is None:
+            msg = "Field with STASH code {0} has no data"
+            raise ValueError(msg.format(field.lbuser4))
+        return lambda band_slice: data[band_slice]
+
+    cpnrt_source = band_source(cpnrt)
+    sources = [[band_source(field) for field in fields]
+               for fields in (blkcld, concld, ptheta)]
+
+    rows = cpnrt.lbrow
+    for row_start in range(0, rows, band_rows):
+        band_slice = slice(row_start, min(row_start + band_rows, rows))
+
+        def band(level_sources):
+            return np.array([source(band_slice) for source in level_sources],
+                            dtype=np.float64)
+
+        yield (row_start,
+               np.ascontiguousarray(cpnrt_source(band_slice),
+                                    dtype=np.float64),
+               band(sources[0]), band(sources[1]), band(sources[2]))
@@ -0,0 +1,68 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of the UM WAFCCB library extension module for Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""Tests for the :mod:`um_wafccb` module."""
+
+from __future__ import (absolute_import, division, print_function)
+
+import numpy as np
+import unittest as tests
+
+# Mule itself is only needed to read the bands of fields (see field_bands)
+try:
+    import mule
+except ImportError:
+    MULE_AVAILABLE = False
+else:
+    MULE_AVAILABLE = True
+
+
+def skip_mule(fn):
+    """
+    Decorator which can be used to skip a test if Mule isn't available.
+    This will completely disable the definition of a method or class if it
+    is decorated like this:
+
+    @skip_mule
+    def test_which_uses_mule(*args):
+        etc
+
+    """
+    skip = tests.skipIf(
+        condition=not MULE_AVAILABLE,
+        reason="Test required 'mule'")
+    return skip(fn)
+
+
+class UMWafccbTest(tests.TestCase):
+    """An extension of unittest.TestCase with extra test methods."""
+
+    def assertArrayEqual(self, a, b, err_msg=''):
+        """Check that numpy arrays have identical contents."""
+        np.testing.assert_array_equal(a, b, err_msg=err_msg)
+
+
+def main():
+    """
+    A wrapper that just calls unittest.main().
+
+    Allows um_wafccb.tests to be imported in place of unittest
+
+    """
+    tests.main()
@@ -0,0 +1,150 @@
+# *****************************COPYRIGHT******************************
+# (C) Crown copyright Met Office. All rights reserved.
+# For further details please refer to the file LICENCE.txt
+# which you should have received as part of this distribution.
+# *****************************COPYRIGHT******************************
+#
+# This file is part of the UM WAFCCB library extension module for Mule.
+#
+# Mule is free software: you can redistribute it and/or modify it under
+# the terms of the Modified BSD License, as published by the
+# Open Source Initiative.
+#
+# Mule is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Modified BSD License for more details.
+#
+# You should have received a copy of the Modified BSD License
+# along with Mule.  If not, see <http://opensource.org/licenses/BSD-3-Clause>.
+"""
+Unit tests for :mod:`um_wafccb` module.
+
+"""
+
+from __future__ import (absolute_import, division, print_function)
+
+import numpy as np
+import um_wafccb.tests as tests
+from um_wafccb import wafccb, wafccb_bands, field_bands
+
+
+class Test_wafccb(tests.UMWafccbTest):
+    # A small domain, with a number of columns which doesn't divide evenly
+    # into the blocks shared between the threads
+    ROWS = 9
+    COLS = 37
+    LEVELS = 12
+    RMDI = -1073741824.0
+
+    def setUp(self):
+        # Convective precipitation over some of the domain, with cloud
+        # fractions peaking in the mid troposphere beneath it (in the
+        # level-major layout)
+        rng = np.random.RandomState(4321)
+        rain = rng.rand(self.ROWS, self.COLS)
+        self.cpnrt = np.where(rain > 0.5, 2.0e-3*rain, 0.0)
+        profile = np.sin(np.linspace(0.0, np.pi, self.LEVELS))
+        cloud = rng.rand(self.ROWS, self.COLS)
+        self.blkcld = profile[:, None, None]*cloud[None, :, :]
+        self.concld = 0.5*self.blkcld
+        heights = np.linspace(20.0, 18000.0, self.LEVELS)
+        pressures = 100000.0*np.exp(-heights/7000.0)
+        self.ptheta = np.repeat(pressures, self.ROWS*self.COLS).reshape(
+            self.LEVELS, self.ROWS, self.COLS)
+
+    def column_major(self):
+        # The same inputs in the library's own layout
+        return (np.ascontiguousarray(self.cpnrt.T),
+                np.ascontiguousarray(self.blkcld.transpose(2, 1, 0)),
+                np.ascontiguousarray(self.concld.transpose(2, 1, 0)),
+                np.ascontiguousarray(self.ptheta.transpose(2, 1, 0)))
+
+    def assertResultsEqual(self, result, expected):
+        self.assertEqual(len(result), 3)
+        for array, expected_array in zip(result, expected):
+            self.assertArrayEqual(array, expected_array)
+
+    def test_threads(self):
+        # The columns are independent, so splitting them into blocks for
+        # the threads should give exactly the result of a single call
+        for icao_out in (False, True):
+            expected = wafccb(*self.column_major() +
+                              (self.RMDI, icao_out), threads=1)
+            for threads in (2, 3, 0):
+                result = wafccb(*self.column_major() +
+                                (self.RMDI, icao_out), threads=threads)
+                self.assertResultsEqual(result, expected)
+
+    def test_level_major(self):
+        # The level-major inputs should give the same result as passing the
+        # transposed inputs, for a single thread or several
+        expected = wafccb(*self.column_major() + (self.RMDI, False),
+                          threads=1)
+        for threads in (1, 3):
+            result = wafccb(self.cpnrt, self.blkcld, self.concld,
+                            self.ptheta, self.RMDI, False,
+                            level_major=True, threads=threads)
+            self.assertResultsEqual(result, expected)
+
+    def test_out(self):
+        # The outputs should be written into the given arrays in place
+        expected = wafccb(self.cpnrt, self.blkcld, self.concld, self.ptheta,
+                          self.RMDI, False, level_major=True)
+        out = tuple(np.full((self.ROWS, self.COLS), -1.0) for _ in range(3))
+        result = wafccb(self.cpnrt, self.blkcld, self.concld, self.ptheta,
+                        self.RMDI, False, out=out, level_major=True,
+                        threads=2)
+        self.assertIs(result, out)
+        self.assertResultsEqual(out, expected)
+
+    def test_bands(self):
+        # Computing the diagnostics band by band (with a last band which
+        # is smaller than the others) should match the full domain
+        expected = wafccb(self.cpnrt, self.blkcld, self.concld, self.ptheta,
+                          self.RMDI, True, level_major=True)
+        band_rows = 4
+        bands = [(row_start,
+                  self.cpnrt[row_start:row_start + band_rows],
+                  self.blkcld[:, row_start:row_start + band_rows],
+                  self.concld[:, row_start:row_start + band_rows],
+                  self.ptheta[:, row_start:row_start + band_rows])
+                 for row_start in range(0, self.ROWS, band_rows)]
+        result = wafccb_bands(bands, self.ROWS, self.COLS, self.RMDI, True)
+        self.assertResultsEqual(result, expected)
+
+        # A band outside of the domain is rejected
+        with self.assertRaisesRegex(ValueError, "outside the domain"):
+            wafccb_bands(bands[-1:], self.ROWS - 1, self.COLS, self.RMDI,
+                         True)
+
+    @tests.skip_mule
+    def test_field_bands(self):
+        # The bands read from a set of fields should give the same result
+        # as the full domain, whatever the size of the bands
+        def make_field(data):
+            field = tests.mule.Field3.empty()
+            field.lbrow, field.lbnpt = data.shape
+            field.set_data_provider(tests.mule.ArrayDataProvider(data))
+            return field
+
+        cpnrt = make_field(self.cpnrt)
+        blkcld = [make_field(data) for data in self.blkcld]
+        concld = [make_field(data) for data in self.concld]
+        ptheta = [make_field(data) for data in self.ptheta]
+
+        expected = wafccb(self.cpnrt, self.blkcld, self.concld, self.ptheta,
+                          self.RMDI, False, level_major=True)
+        for band_rows in (1, 4, self.ROWS, 64):
+            bands = field_bands(cpnrt, blkcld, concld, ptheta,
+                                band_rows=band_rows)
+            result = wafccb_bands(bands, self.ROWS, self.COLS, self.RMDI,
+                                  False, threads=2)
+            self.assertResultsEqual(result, expected)
+
+        with self.assertRaisesRegex(ValueError, "same number"):
+            next(field_bands(cpnrt, blkcld[1:], concld, ptheta))
+
+
+if __name__ == "__main__":
+    tests.main()
@@ -30,12 +30,23 @@
 #endif
 
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <numpy/arrayobject.h>
 
 #include "wafccb.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// The (approximate) amount of working memory each thread uses for a block
+// of columns; the domain is split into blocks of at most this size (and
+// into enough blocks to share between the threads)
+#define WAFCCB_BLOCK_BYTES (16*1024*1024)
+
 #if PY_MAJOR_VERSION >= 3
 #define MOD_ERROR_VAL NULL
 #define MOD_SUCCESS_VAL(val) val
@@ -54,30 +65,47 @@
 
 MOD_INIT(um_wafccb);
 
-static PyObject *wafccb_py(PyObject *self, PyObject *args);
+static PyObject *wafccb_py(PyObject *self, PyObject *args, PyObject *kwds);
 
 MOD_INIT(um_wafccb)
 {
   PyDoc_STRVAR(um_wafccb__doc__,
   "Generate WAFC CB diagnostics.\n\n"
   "Usage:\n"
-  "  um_wafccb.um_wafccb(cpnrt, blkcld, concld, ptheta, rmdi, icao_out)\n\n"
+  "  um_wafccb.um_wafccb(cpnrt, blkcld, concld, ptheta, rmdi, icao_out,\n"
+  "                      out=None, level_major=False, threads=0)\n\n"
   "Args:\n"
   "* cpnrt    - Convective Precipitation Rate (2d array).\n"
   "* blkcld   - Bulk Cloud Fraction (3d array).\n"
   "* concld   - Convective Cloud Amount (3d array).\n"
   "* ptheta   - Theta Level Pressure (3d array).\n"
   "* rmdi     - Missing Data Indicator.\n"
-  "* icao_out - Return ICAO heights instaed of pressures if True.\n\n"
+  "* icao_out - Return ICAO heights instaed of pressures if True.\n"
+  "* out      - If given, a tuple of 3 C-contiguous, writeable, native\n"
+  "             byte-order float64 2d numpy.ndarrays (rows, columns) which\n"
+  "             the outputs are written into directly.\n"
+  "* level_major\n"
+  "           - If False the 3d arrays have dimensions (columns, rows,\n"
+  "             levels) and cpnrt (columns, rows).  If True they have\n"
+  "             dimensions (levels, rows, columns) and cpnrt (rows,\n"
+  "             columns), i.e. the layout given by stacking the data of\n"
+  "             a set of fields.\n"
+  "* threads  - Number of OpenMP threads to share the columns between\n"
+  "             (if not set, the OpenMP default is used).\n\n"
   "Returns:\n"
-  "A tuple containing 3 2d numpy.ndarrays, as follows:\n"
+  "A tuple containing 3 2d numpy.ndarrays (this is the out tuple, if it\n"
+  "was given), as follows:\n"
   "* p_cbb  - Cb Base Pressure / ICAO Height (if icao_out is True).\n"
   "* p_cbt  - Cb Top Pressure / ICAO Height (if icao_out is True).\n"
-  "* cbhore - Cb Horizontal Extent.\n"
+  "* cbhore - Cb Horizontal Extent.\n\n"
+  "The input arrays are used directly if they are C-contiguous, native\n"
+  "byte-order float64 arrays; otherwise (e.g. for float32 inputs) they\n"
+  "are converted to that form first.\n"
   );
 
   static PyMethodDef um_wafccbMethods[] = {
-    {"wafccb", wafccb_py, METH_VARARGS, um_wafccb__doc__},
+    {"wafccb", (PyCFunction)(void(*)(void))wafccb_py,
+               METH_VARARGS | METH_KEYWORDS, um_wafccb__doc__},
     {NULL, NULL, 0, NULL}
   };
 
@@ -90,123 +118,326 @@ MOD_INIT(um_wafccb)
   return MOD_SUCCESS_VAL(mod);
 }
 
-static PyObject *wafccb_py(PyObject *self, PyObject *args)
+// Check that an array given as an "out" argument can be written to directly
+// by the library; it must be a C-contiguous, aligned, writeable array of the
+// given type (in native byte order) and with exactly the expected dimensions.
+// Returns 0 if the array is suitable, otherwise sets a Python exception
+static int check_out_array(PyObject *out, int type_num, int ndim,
+                           const npy_intp *dims)
+{
+  PyArrayObject *array;
+  int i;
+
+  if (!PyArray_Check(out)) {
+    PyErr_SetString(PyExc_ValueError, "Output must be a numpy.ndarray");
+    return 1;
+  }
+  array = (PyArrayObject *)out;
+
+  if (PyArray_TYPE(array) != type_num || !PyArray_ISNOTSWAPPED(array)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array has the wrong dtype or byte order");
+    return 1;
+  }
+
+  if (!PyArray_ISCARRAY(array)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array must be C-contiguous, aligned and writeable");
+    return 1;
+  }
+
+  if (PyArray_NDIM(array) != ndim) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output array has the wrong number of dimensions");
+    return 1;
+  }
+  for (i = 0; i < ndim; i++) {
+    if (PyArray_DIMS(array)[i] != dims[i]) {
+      PyErr_SetString(PyExc_ValueError, "Output array has the wrong shape");
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Obtain an input argument as an aligned, C-contiguous, native byte-order
+// float64 array with the given number of dimensions.  The argument is used
+// directly if it is already in that form, otherwise it is converted.
+// Returns a new reference, or NULL with a Python exception
+static PyArrayObject *input_array(PyObject *obj, int ndim, const char *name)
+{
+  PyArrayObject *array =
+      (PyArrayObject *) PyArray_FROM_OTF(obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY);
+  if (array == NULL) return NULL;
+  if (PyArray_NDIM(array) != ndim) {
+    PyErr_Format(PyExc_ValueError, "%s must be %d Dimensional", name, ndim);
+    Py_DECREF(array);
+    return NULL;
+  }
+  return array;
+}
+
+// Gather a block of columns from an array with dimensions (levels, rows,
+// cols) into an array with dimensions (block cols, rows, levels)
+static void gather_columns(const double *in, int64_t cols, int64_t rows,
+                           int64_t levels, int64_t col_start,
+                           int64_t block_cols, double *block)
+{
+  int64_t k, r, j;
+  for (k = 0; k < levels; k++) {
+    for (r = 0; r < rows; r++) {
+      const double *row = &in[(k*rows + r)*cols + col_start];
+      for (j = 0; j < block_cols; j++) {
+        block[(j*rows + r)*levels + k] = row[j];
+      }
+    }
+  }
+}
+
+// Run the diagnostic, split into blocks of columns which are shared between
+// threads; the columns are independent so this gives the same result as a
+// single call for the whole domain.  Returns 1 if the working memory
+// couldn't be allocated.  Does not need the GIL
+static int run_convact(int64_t cols, int64_t rows, int64_t levels,
+                       double *cpnrt, double *blkcld, double *concld,
+                       double *ptheta, double rmdi, bool icao_bool,
+                       bool level_major, int threads,
+                       double *p_cbb, double *p_cbt, double *cbhore)
+{
+  // A single thread can pass the arrays straight to the library
+  if (threads == 1 && !level_major) {
+    convact(&cols, &rows, &levels, cpnrt, blkcld, concld, ptheta, &rmdi,
+            &icao_bool, p_cbb, p_cbt, cbhore);
+    return 0;
+  }
+
+  // Each block needs space for its outputs (and for level-major inputs a
+  // copy of its inputs in the library's column-major layout)
+  int64_t col_doubles = rows*(3 + (level_major ? 1 + 3*levels : 0));
+  int64_t block = WAFCCB_BLOCK_BYTES/(col_doubles*(int64_t)sizeof(double));
+  int64_t share = (cols + 4*threads - 1)/(4*(int64_t)threads);
+  if (block > share) block = share;
+  if (block < 1) block = 1;
+  int64_t n_blocks = (cols + block - 1)/block;
+
+  int failed = 0;
+  #pragma omp parallel num_threads(threads) reduction(|:failed)
+  {
+    double *work =
+        (double *)malloc((size_t)(block*col_doubles)*sizeof(double));
+    int64_t ib;
+
+    #pragma omp for schedule(dynamic, 1)
+    for (ib = 0; ib < n_blocks; ib++) {
+      if (work == NULL) {
+        failed = 1;
+        continue;
+      }
+      int64_t col_start = ib*block;
+      int64_t block_cols = cols - col_start < block ? cols - col_start : block;
+      int64_t plane = rows*block_cols;
+      double *cbb_block = work;
+      double *cbt_block = &work[plane];
+      double *hore_block = &work[2*plane];
+      double *cp_block, *blk_block, *con_block, *pth_block;
+
+      if (level_major) {
+        int64_t r, j;
+        cp_block = &work[3*plane];
+        blk_block = &work[4*plane];
+        con_block = &blk_block[plane*levels];
+        pth_block = &con_block[plane*levels];
+        for (r = 0; r < rows; r++) {
+          for (j = 0; j < block_cols; j++) {
+            cp_block[j*rows + r] = cpnrt[r*cols + col_start + j];
+          }
+        }
+        gather_columns(blkcld, cols, rows, levels, col_start, block_cols,
+                       blk_block);
+        gather_columns(concld, cols, rows, levels, col_start, block_cols,
+                       con_block);
+        gather_columns(ptheta, cols, rows, levels, col_start, block_cols,
+                       pth_block);
+      } else {
+        // The block's columns are contiguous in the inputs
+        cp_block = &cpnrt[col_start*rows];
+        blk_block = &blkcld[col_start*rows*levels];
+        con_block = &concld[col_start*rows*levels];
+        pth_block = &ptheta[col_start*rows*levels];
+      }
+
+      int64_t block_rows = rows;
+      int64_t block_levels = levels;
+      double block_rmdi = rmdi;
+      bool block_icao = icao_bool;
+      convact(&block_cols, &block_rows, &block_levels,
+              cp_block, blk_block, con_block, pth_block,
+              &block_rmdi, &block_icao, cbb_block, cbt_block, hore_block);
+
+      // Copy the block's outputs into place (the outputs have dimensions
+      // (rows, cols), so the block's columns are not contiguous in them)
+      int64_t r;
+      for (r = 0; r < rows; r++) {
+        memcpy(&p_cbb[r*cols + col_start], &cbb_block[r*block_cols],
+               (size_t)block_cols*sizeof(double));
+        memcpy(&p_cbt[r*cols + col_start], &cbt_block[r*block_cols],
+               (size_t)block_cols*sizeof(double));
+        memcpy(&cbhore[r*cols + col_start], &hore_block[r*block_cols],
+               (size_t)block_cols*sizeof(double));
+      }
+    }
+    free(work);
+  }
+  return failed;
+}
+
+static PyObject *wafccb_py(PyObject *self, PyObject *args, PyObject *kwds)
 {
   // Setup and obtain inputs passed from python
   double rmdi = 0.0;
-  PyArrayObject *cpnrt;
-  PyArrayObject *blkcld;
-  PyArrayObject *concld;
-  PyArrayObject *ptheta;
+  PyObject *cpnrt_in;
+  PyObject *blkcld_in;
+  PyObject *concld_in;
+  PyObject *ptheta_in;
   PyObject *icao_out;
+  PyObject *out = NULL;
+  PyObject *level_major_in = NULL;
+  int threads = 0;
+  static char *kwlist[] = {"cpnrt", "blkcld", "concld", "ptheta", "rmdi",
+                           "icao_out", "out", "level_major", "threads",
+                           NULL};
 
-  // Note the argument descriptors "s#d":
-  if (!PyArg_ParseTuple(args, "OOOOdO", 
-                        &cpnrt, &blkcld, &concld, &ptheta, &rmdi, &icao_out
-                        )) return NULL;
+  // Note the argument descriptors "OOOOdO|OOi":
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOOOdO|OOi", kwlist,
+                                   &cpnrt_in, &blkcld_in, &concld_in,
+                                   &ptheta_in, &rmdi,
+                                   &icao_out, &out, &level_major_in,
+                                   &threads
+                                   )) return NULL;
+  if (out == Py_None) out = NULL;
 
   // Cast self to void to avoid unused paramter errors
   (void) self;
 
+  // Get value of output and layout flags
+  bool icao_bool = (bool) PyObject_IsTrue(icao_out);
+  bool level_major = (level_major_in != NULL &&
+                      PyObject_IsTrue(level_major_in));
+
+  // Obtain the inputs in the form required by the library (this only
+  // copies them if they aren't already suitable)
+  PyObject *result = NULL;
+  PyObject *outputs[3] = {NULL, NULL, NULL};
+  PyArrayObject *cpnrt = input_array(cpnrt_in, 2, "cpnrt");
+  PyArrayObject *blkcld = NULL;
+  PyArrayObject *concld = NULL;
+  PyArrayObject *ptheta = NULL;
+  if (cpnrt == NULL) goto cleanup;
+  blkcld = input_array(blkcld_in, 3, "blkcld");
+  if (blkcld == NULL) goto cleanup;
+  concld = input_array(concld_in, 3, "concld");
+  if (concld == NULL) goto cleanup;
+  ptheta = input_array(ptheta_in, 3, "ptheta");
+  if (ptheta == NULL) goto cleanup;
+
   // Get dimensions of input fieldclim array
   npy_intp *dims_in = PyArray_DIMS(ptheta);
-  int64_t cols   = (int64_t) dims_in[0];
+  int64_t cols   = (int64_t) dims_in[level_major ? 2 : 0];
   int64_t rows   = (int64_t) dims_in[1];
-  int64_t levels = (int64_t) dims_in[2];
+  int64_t levels = (int64_t) dims_in[level_major ? 0 : 2];
 
-  double *cpnrt_ptr = (double *) PyArray_DATA(cpnrt);
-  double *blkcld_ptr = (double *) PyArray_DATA(blkcld);
-  double *concld_ptr = (double *) PyArray_DATA(concld);
-  double *ptheta_ptr = (double *) PyArray_DATA(ptheta);
-
-  // Get value of output flag
-  bool icao_bool = (bool) PyObject_IsTrue(icao_out);
+  // The other inputs must match the pressure array
+  int idim;
+  for (idim = 0; idim < 3; idim++) {
+    if (PyArray_DIMS(blkcld)[idim] != dims_in[idim] ||
+        PyArray_DIMS(concld)[idim] != dims_in[idim]) {
+      PyErr_SetString(PyExc_ValueError,
+                      "blkcld, concld and ptheta must have the same shape");
+      goto cleanup;
+    }
+  }
+  if ((int64_t) PyArray_DIMS(cpnrt)[0] != (level_major ? rows : cols) ||
+      (int64_t) PyArray_DIMS(cpnrt)[1] != (level_major ? cols : rows)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "cpnrt must have the same shape as the horizontal "
+                    "dimensions of ptheta");
+    goto cleanup;
+  }
 
-  // Allocate space for return value
-  int64_t len_out = rows*cols;
-  double *dataout_p_cbb = 
-    (double*)calloc((size_t)(len_out), sizeof(double));
-  if (dataout_p_cbb == NULL) {
-    PyErr_SetString(PyExc_ValueError, "Unable to allocate memory for WAFC CB p_cbb");
-    return NULL;
-  } 
-  double *dataout_p_cbt = 
-    (double*)calloc((size_t)(len_out), sizeof(double));
-  if (dataout_p_cbt == NULL) {
-    PyErr_SetString(PyExc_ValueError, "Unable to allocate memory for WAFC CB p_cbt");
-    return NULL;
-  } 
-  double *dataout_cbhore = 
-    (double*)calloc((size_t)(len_out), sizeof(double));
-  if (dataout_cbhore == NULL) {
-    PyErr_SetString(PyExc_ValueError, "Unable to allocate memory for WAFC CB cbhore");
-    return NULL;
-  } 
-
-  convact(&cols,
-          &rows,
-          &levels,
-          cpnrt_ptr,
-          blkcld_ptr,
-          concld_ptr,
-          ptheta_ptr,
-          &rmdi,
-          &icao_bool,
-          dataout_p_cbb,
-          dataout_p_cbt,
-          dataout_cbhore);
-          
-  // Now form numpy array objects to return to python
   npy_intp dims_out[2];
   dims_out[0] = rows;
   dims_out[1] = cols;
 
-  // Setup output array objects and dimensions
-  PyArrayObject *npy_array_out_p_cbb = NULL;
-  PyArrayObject *npy_array_out_p_cbt = NULL;
-  PyArrayObject *npy_array_out_cbhore = NULL;
-
-  npy_array_out_p_cbb=(PyArrayObject *) PyArray_SimpleNewFromData(2, dims_out,
-                                                                  NPY_DOUBLE,
-                                                                  dataout_p_cbb);
-  if (npy_array_out_p_cbb == NULL) {
-    free(dataout_p_cbb);
-    PyErr_SetString(PyExc_ValueError, "Failed to make numpy array (p_cbb)");
-    return NULL;
-  }
-  npy_array_out_p_cbt=(PyArrayObject *) PyArray_SimpleNewFromData(2, dims_out,
-                                                                  NPY_DOUBLE,
-                                                                  dataout_p_cbt);
-  if (npy_array_out_p_cbt == NULL) {
-    free(dataout_p_cbt);
-    PyErr_SetString(PyExc_ValueError, "Failed to make numpy array (p_cbt)");
-    return NULL;
-  }
-  npy_array_out_cbhore=(PyArrayObject *) PyArray_SimpleNewFromData(2, dims_out,
-                                                                   NPY_DOUBLE,
-                                                                   dataout_cbhore);
-  if (npy_array_out_cbhore == NULL) {
-    free(dataout_cbhore);
-    PyErr_SetString(PyExc_ValueError, "Failed to make numpy array (cbhore)");
-    return NULL;
+  // If output arrays were given, write straight into them, otherwise
+  // allocate space for return value
+  Py_ssize_t iout;
+  if (out != NULL) {
+    if (!PyTuple_Check(out) || PyTuple_GET_SIZE(out) != 3) {
+      PyErr_SetString(PyExc_ValueError,
+                      "Output must be a tuple of 3 numpy.ndarrays");
+      goto cleanup;
+    }
+    for (iout = 0; iout < 3; iout++) {
+      if (check_out_array(PyTuple_GET_ITEM(out, iout),
+                          NPY_DOUBLE, 2, dims_out) != 0) goto cleanup;
+    }
+    for (iout = 0; iout < 3; iout++) {
+      outputs[iout] = PyTuple_GET_ITEM(out, iout);
+      Py_INCREF(outputs[iout]);
+    }
+  } else {
+    for (iout = 0; iout < 3; iout++) {
+      outputs[iout] = PyArray_ZEROS(2, dims_out, NPY_DOUBLE, 0);
+      if (outputs[iout] == NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Unable to allocate memory for WAFC CB outputs");
+        goto cleanup;
+      }
+    }
   }
 
-  // Give python/numpy ownership of the memory storing the return arrays
-  #if NPY_API_VERSION >= NPY_1_7_API_VERSION
-  PyArray_ENABLEFLAGS(npy_array_out_p_cbb, NPY_ARRAY_OWNDATA);
-  PyArray_ENABLEFLAGS(npy_array_out_p_cbt, NPY_ARRAY_OWNDATA);
-  PyArray_ENABLEFLAGS(npy_array_out_cbhore, NPY_ARRAY_OWNDATA);
+  #ifdef _OPENMP
+  if (threads <= 0) threads = omp_get_max_threads();
   #else
-  npy_array_out_p_cbb->flags = npy_array_out_p_cbb->flags | NPY_OWNDATA;
-  npy_array_out_p_cbt->flags = npy_array_out_p_cbt->flags | NPY_OWNDATA;
-  npy_array_out_cbhore->flags = npy_array_out_cbhore->flags | NPY_OWNDATA;
+  threads = 1;
   #endif
 
-  // Need to pack the items into a tuple to return them all
-  PyObject *tuple_out = PyTuple_New(3);
-  PyTuple_SetItem(tuple_out, 0, (PyObject *) npy_array_out_p_cbb);
-  PyTuple_SetItem(tuple_out, 1, (PyObject *) npy_array_out_p_cbt);
-  PyTuple_SetItem(tuple_out, 2, (PyObject *) npy_array_out_cbhore);
+  int failed;
+  Py_BEGIN_ALLOW_THREADS
+  failed = run_convact(
+      cols, rows, levels,
+      (double *) PyArray_DATA(cpnrt),
+      (double *) PyArray_DATA(blkcld),
+      (double *) PyArray_DATA(concld),
+      (double *) PyArray_DATA(ptheta),
+      rmdi, icao_bool, level_major, threads,
+      (double *) PyArray_DATA((PyArrayObject *) outputs[0]),
+      (double *) PyArray_DATA((PyArrayObject *) outputs[1]),
+      (double *) PyArray_DATA((PyArrayObject *) outputs[2]));
+  Py_END_ALLOW_THREADS
+
+  if (failed) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Unable to allocate working memory for WAFC CB");
+    goto cleanup;
+  }
 
-  return tuple_out;
+  if (out != NULL) {
+    Py_INCREF(out);
+    result = out;
+  } else {
+    // Need to pack the items into a tuple to return them all
+    result = PyTuple_Pack(3, outputs[0], outputs[1], outputs[2]);
+  }
+
+cleanup:
+  Py_XDECREF(cpnrt);
+  Py_XDECREF(blkcld);
+  Py_XDECREF(concld);
+  Py_XDECREF(ptheta);
+  for (iout = 0; iout < 3; iout++) {
+    Py_XDECREF(outputs[iout]);
+  }
+  return result;
 }